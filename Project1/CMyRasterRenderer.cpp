@@ -0,0 +1,562 @@
+//
+// Name :         CMyRasterRenderer.cpp
+// Description :  Implementation of CMyRasterRenderer. The scene graph is
+//                collected into set up triangles and tile bins while it
+//                is rendered. RendererEnd() rasterizes the tiles on a pool
+//                of threads. Edge functions and depth tests run four
+//                pixels at a time with SSE.
+//
+
+#include "pch.h"
+#include "CMyRasterRenderer.h"
+#include "graphics/GrProfiler.h"
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include <emmintrin.h>
+
+using namespace std;
+
+CMyRasterRenderer::CMyRasterRenderer()
+{
+    m_image = NULL;
+    m_imagewidth = 0;
+    m_imageheight = 0;
+    m_threads = 0;
+    m_normalvalid = false;
+    m_material = NULL;
+    m_projx = m_projy = 1;
+    m_projz = -1;
+    m_projzw = 0;
+    m_tilecols = 0;
+    m_tilerows = 0;
+    m_nexttile = 0;
+}
+
+void CMyRasterRenderer::SetImage(unsigned char* p_pixels, int w, int h, int p_stride)
+{
+    m_rows.resize(h);
+    for (int i = 0; i < h; i++)
+        m_rows[i] = p_pixels + size_t(i) * p_stride;
+
+    SetImage(h > 0 ? &m_rows[0] : NULL, w, h);
+}
+
+//
+// Name : CMyRasterRenderer::RendererStart()
+// Description : Set up the camera, the projection and the lights
+// in eye coordinates.
+//
+
+bool CMyRasterRenderer::RendererStart()
+{
+    m_mstack.clear();
+    m_mstack.push_back(CGrTransform());
+    m_mstack.back().SetLookAt(Eye().X(), Eye().Y(), Eye().Z(),
+        Center().X(), Center().Y(), Center().Z(),
+        Up().X(), Up().Y(), Up().Z());
+    m_normalvalid = false;
+    m_material = NULL;
+
+    // The matrix gluPerspective() makes
+    double f = 1. / tan(ProjectionAngle() / 2 * GR_DTOR);
+    m_projy = f;
+    m_projx = f / ProjectionAspect();
+    m_projz = (FarClip() + NearClip()) / (NearClip() - FarClip());
+    m_projzw = 2 * FarClip() * NearClip() / (NearClip() - FarClip());
+
+    // Lights are placed with the LookAt on the modelview
+    // stack, as COpenGLRenderer does
+    m_eyelights.clear();
+    for (int i = 0; i < LightCnt(); i++)
+    {
+        const Light& light = GetLight(i);
+
+        EyeLight e;
+        e.pos = m_mstack.back() * light.m_pos;
+        e.directional = light.m_pos.W() == 0;
+        if (e.directional)
+            e.pos.Normalize3();
+
+        for (int c = 0; c < 3; c++)
+        {
+            e.ambient[c] = light.m_ambient[c];
+            e.diffuse[c] = light.m_diffuse[c];
+            e.specular[c] = light.m_specular[c];
+        }
+
+        m_eyelights.push_back(e);
+    }
+
+    m_triangles.clear();
+    m_tilecols = (m_imagewidth + TileSize - 1) / TileSize;
+    m_tilerows = (m_imageheight + TileSize - 1) / TileSize;
+    m_bins.assign(m_tilecols * m_tilerows, vector<int>());
+
+    return true;
+}
+
+//
+// Name : CMyRasterRenderer::RendererEnd()
+// Description : Rasterize all of the tiles. Each thread takes
+// the next tile until there are none left.
+//
+
+bool CMyRasterRenderer::RendererEnd()
+{
+    GR_PROFILE_ZONE("CMyRasterRenderer::RendererEnd");
+
+    if (m_image == NULL || m_bins.empty())
+        return true;
+
+    int threads = m_threads;
+    if (threads <= 0)
+        threads = max(1, int(thread::hardware_concurrency()));
+    threads = min(threads, int(m_bins.size()));
+
+    m_nexttile = 0;
+
+    vector<thread> workers;
+    for (int i = 1; i < threads; i++)
+        workers.push_back(thread([this]() {
+            GR_PROFILE_THREAD("Raster worker");
+            Worker();
+        }));
+
+    Worker();
+
+    for (size_t i = 0; i < workers.size(); i++)
+        workers[i].join();
+
+    return true;
+}
+
+void CMyRasterRenderer::Worker()
+{
+    vector<float> depth(TileSize * TileSize);
+
+    for (;;)
+    {
+        int tile = m_nexttile++;
+        if (tile >= int(m_bins.size()))
+            break;
+
+        RasterTile(tile, depth);
+    }
+}
+
+void CMyRasterRenderer::RendererMaterial(CGrMaterial* p_material)
+{
+    m_material = p_material;
+}
+
+void CMyRasterRenderer::RendererPushMatrix()
+{
+    m_mstack.push_back(m_mstack.back());
+}
+
+void CMyRasterRenderer::RendererPopMatrix()
+{
+    m_mstack.pop_back();
+    m_normalvalid = false;
+}
+
+void CMyRasterRenderer::RendererRotate(double a, double x, double y, double z)
+{
+    CGrTransform r;
+    r.SetRotate(a, CGrPoint(x, y, z));
+    m_mstack.back() *= r;
+    m_normalvalid = false;
+}
+
+void CMyRasterRenderer::RendererTranslate(double x, double y, double z)
+{
+    CGrTransform t;
+    t.SetTranslate(x, y, z);
+    m_mstack.back() *= t;
+}
+
+void CMyRasterRenderer::RendererTransform(const CGrTransform* p_transform)
+{
+    m_mstack.back() *= *p_transform;
+    m_normalvalid = false;
+}
+
+const CGrTransform& CMyRasterRenderer::NormalMatrix()
+{
+    if (!m_normalvalid)
+    {
+        m_normalmatrix.SetAffineInverse(m_mstack.back());
+        m_normalmatrix.Transpose();
+        m_normalvalid = true;
+    }
+
+    return m_normalmatrix;
+}
+
+//
+// Name : CMyRasterRenderer::Shade()
+// Description : OpenGL fixed function lighting of a vertex in eye
+// coordinates: emission, the default 0.2 scene ambient, and for each
+// light ambient, diffuse and Blinn-Phong specular with an infinite
+// viewer. Without a material the OpenGL default material is used.
+//
+
+void CMyRasterRenderer::Shade(const CGrPoint& p, const CGrPoint& n, float* color) const
+{
+    static const float defambient[4] = { 0.2f, 0.2f, 0.2f, 1.f };
+    static const float defdiffuse[4] = { 0.8f, 0.8f, 0.8f, 1.f };
+    static const float defblack[4] = { 0.f, 0.f, 0.f, 1.f };
+
+    const float* ambient = m_material ? m_material->Ambient() : defambient;
+    const float* diffuse = m_material ? m_material->Diffuse() : defdiffuse;
+    const float* specular = m_material ? m_material->Specular() : defblack;
+    const float* emission = m_material ? m_material->Emission() : defblack;
+    double shininess = m_material ? m_material->Shininess() : 0;
+
+    for (int c = 0; c < 3; c++)
+        color[c] = emission[c] + 0.2f * ambient[c];
+
+    for (size_t i = 0; i < m_eyelights.size(); i++)
+    {
+        const EyeLight& light = m_eyelights[i];
+
+        CGrPoint L = light.directional ? light.pos : Normalize3(light.pos - p);
+        double ndotl = Dot3(n, L);
+
+        CGrPoint H = Normalize3(L + CGrPoint(0, 0, 1, 0));
+        double ndoth = max(0., Dot3(n, H));
+        double spec = ndotl > 0 ? pow(ndoth, shininess) : 0;
+
+        for (int c = 0; c < 3; c++)
+        {
+            color[c] += light.ambient[c] * ambient[c];
+            if (ndotl > 0)
+                color[c] += float(ndotl) * light.diffuse[c] * diffuse[c] + float(spec) * light.specular[c] * specular[c];
+        }
+    }
+
+    for (int c = 0; c < 3; c++)
+        color[c] = min(1.f, max(0.f, color[c]));
+}
+
+//
+// Name : CMyRasterRenderer::RendererEndPolygon()
+// Description : Light the vertices and take them to clip coordinates.
+// Like OpenGL, a vertex without its own normal or texture coordinate
+// uses the last one given. A polygon with no normals gets its face
+// normal.
+//
+
+void CMyRasterRenderer::RendererEndPolygon()
+{
+    const std::list<CGrPoint>& vertices = PolyVertices();
+    const std::list<CGrPoint>& normals = PolyNormals();
+    const std::list<CGrPoint>& tvertices = PolyTexVertices();
+
+    if (vertices.size() < 3)
+        return;
+
+    const CGrTransform& modelview = m_mstack.back();
+
+    // Face normal by Newell's method
+    CGrPoint normal(0, 0, 1, 0);
+    if (normals.empty())
+    {
+        CGrPoint face(0, 0, 0, 0);
+        std::list<CGrPoint>::const_iterator a = vertices.begin();
+        for (std::list<CGrPoint>::const_iterator i = vertices.begin(); i != vertices.end(); i++)
+        {
+            std::list<CGrPoint>::const_iterator b = i;
+            if (++b == vertices.end())
+                b = vertices.begin();
+
+            face.X() += (i->Y() - b->Y()) * (i->Z() + b->Z());
+            face.Y() += (i->Z() - b->Z()) * (i->X() + b->X());
+            face.Z() += (i->X() - b->X()) * (i->Y() + b->Y());
+        }
+
+        if (face.LengthSquared3() > 0)
+            normal = face;
+    }
+
+    CGrPoint texcoord(0, 0, 0);
+    std::list<CGrPoint>::const_iterator n = normals.begin();
+    std::list<CGrPoint>::const_iterator t = tvertices.begin();
+
+    m_polygon.clear();
+    for (std::list<CGrPoint>::const_iterator i = vertices.begin(); i != vertices.end(); i++)
+    {
+        if (n != normals.end())
+            normal = *n++;
+        if (t != tvertices.end())
+            texcoord = *t++;
+
+        CGrPoint eye = modelview * *i;
+        CGrPoint N = NormalMatrix() * CGrPoint(normal.X(), normal.Y(), normal.Z(), 0);
+        N.Normalize3();
+
+        float color[3];
+        Shade(eye, N, color);
+
+        Vertex v;
+        v.x = float(m_projx * eye.X());
+        v.y = float(m_projy * eye.Y());
+        v.z = float(m_projz * eye.Z() + m_projzw * eye.W());
+        v.w = float(-eye.Z());
+        v.r = color[0];
+        v.g = color[1];
+        v.b = color[2];
+        v.s = float(texcoord.X());
+        v.t = float(texcoord.Y());
+        m_polygon.push_back(v);
+    }
+
+    CGrTexture* texture = PolyTexture();
+    if (texture != NULL && texture->Empty())
+        texture = NULL;
+
+    AddPolygon(m_polygon, texture);
+}
+
+//
+// Name : CMyRasterRenderer::AddPolygon()
+// Description : Clip a polygon to the near plane (z >= -w) and
+// add it as a fan of triangles. The other planes are handled by
+// the screen bounds and the depth test.
+//
+
+void CMyRasterRenderer::AddPolygon(vector<Vertex>& poly, CGrTexture* texture)
+{
+    m_clipped.clear();
+
+    int cnt = int(poly.size());
+    for (int i = 0; i < cnt; i++)
+    {
+        const Vertex& a = poly[i];
+        const Vertex& b = poly[(i + 1) % cnt];
+        float da = a.z + a.w;
+        float db = b.z + b.w;
+
+        if (da >= 0)
+            m_clipped.push_back(a);
+
+        if ((da >= 0) != (db >= 0))
+        {
+            float f = da / (da - db);
+            Vertex v;
+            v.x = a.x + f * (b.x - a.x);
+            v.y = a.y + f * (b.y - a.y);
+            v.z = a.z + f * (b.z - a.z);
+            v.w = a.w + f * (b.w - a.w);
+            v.r = a.r + f * (b.r - a.r);
+            v.g = a.g + f * (b.g - a.g);
+            v.b = a.b + f * (b.b - a.b);
+            v.s = a.s + f * (b.s - a.s);
+            v.t = a.t + f * (b.t - a.t);
+            m_clipped.push_back(v);
+        }
+    }
+
+    for (int i = 1; i + 1 < int(m_clipped.size()); i++)
+        AddTriangle(m_clipped[0], m_clipped[i], m_clipped[i + 1], texture);
+}
+
+//
+// Name : CMyRasterRenderer::AddTriangle()
+// Description : Set up a triangle in window coordinates and add
+// it to the bins of the tiles it touches. Clockwise triangles are
+// back facing and culled, as with glCullFace(GL_BACK).
+//
+
+void CMyRasterRenderer::AddTriangle(const Vertex& a, const Vertex& b, const Vertex& c, CGrTexture* texture)
+{
+    const Vertex* v[3] = { &a, &b, &c };
+
+    Triangle tri;
+    float wx[3], wy[3];
+    for (int i = 0; i < 3; i++)
+    {
+        float invw = 1.f / v[i]->w;
+        wx[i] = (v[i]->x * invw + 1.f) * 0.5f * m_imagewidth;
+        wy[i] = (v[i]->y * invw + 1.f) * 0.5f * m_imageheight;
+        tri.z[i] = (v[i]->z * invw + 1.f) * 0.5f;
+        tri.invw[i] = invw;
+        tri.r[i] = v[i]->r * invw;
+        tri.g[i] = v[i]->g * invw;
+        tri.b[i] = v[i]->b * invw;
+        tri.s[i] = v[i]->s * invw;
+        tri.t[i] = v[i]->t * invw;
+    }
+
+    float area = (wx[1] - wx[0]) * (wy[2] - wy[0]) - (wx[2] - wx[0]) * (wy[1] - wy[0]);
+    if (!(area > 0))
+        return;
+
+    tri.minx = max(0, int(floor(min(wx[0], min(wx[1], wx[2])))));
+    tri.miny = max(0, int(floor(min(wy[0], min(wy[1], wy[2])))));
+    tri.maxx = min(m_imagewidth - 1, int(ceil(max(wx[0], max(wx[1], wx[2])))));
+    tri.maxy = min(m_imageheight - 1, int(ceil(max(wy[0], max(wy[1], wy[2])))));
+    if (tri.minx > tri.maxx || tri.miny > tri.maxy)
+        return;
+
+    // Edge i is opposite vertex i and is positive inside
+    for (int i = 0; i < 3; i++)
+    {
+        int j = (i + 1) % 3;
+        int k = (i + 2) % 3;
+        tri.ea[i] = wy[j] - wy[k];
+        tri.eb[i] = wx[k] - wx[j];
+        tri.ec[i] = wx[j] * wy[k] - wx[k] * wy[j];
+
+        float dx = wx[k] - wx[j];
+        float dy = wy[k] - wy[j];
+        tri.topleft[i] = dy < 0 || (dy == 0 && dx < 0);
+    }
+
+    tri.invarea = 1.f / area;
+    tri.texture = texture;
+
+    int index = int(m_triangles.size());
+    m_triangles.push_back(tri);
+
+    for (int ty = tri.miny / TileSize; ty <= tri.maxy / TileSize; ty++)
+    {
+        for (int tx = tri.minx / TileSize; tx <= tri.maxx / TileSize; tx++)
+        {
+            m_bins[ty * m_tilecols + tx].push_back(index);
+        }
+    }
+}
+
+//
+// Name : CMyRasterRenderer::RasterTile()
+// Description : Rasterize the triangles binned to one tile. The
+// edge functions and the depth test are evaluated for four pixels
+// of a row at once. Only the pixels that pass are shaded.
+//
+
+void CMyRasterRenderer::RasterTile(int tile, vector<float>& depth)
+{
+    GR_PROFILE_ZONE("RasterTile");
+
+    int x0 = (tile % m_tilecols) * TileSize;
+    int y0 = (tile / m_tilecols) * TileSize;
+    int x1 = min(x0 + TileSize, m_imagewidth);
+    int y1 = min(y0 + TileSize, m_imageheight);
+
+    fill(depth.begin(), depth.end(), 1.f);
+    for (int y = y0; y < y1; y++)
+        memset(m_image[y] + x0 * 3, 0, (x1 - x0) * 3);
+
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.f);
+    const __m128 lanes = _mm_set_ps(3.f, 2.f, 1.f, 0.f);
+
+    const vector<int>& bin = m_bins[tile];
+    for (size_t b = 0; b < bin.size(); b++)
+    {
+        const Triangle& tri = m_triangles[bin[b]];
+
+        int minx = max(tri.minx, x0);
+        int maxx = min(tri.maxx, x1 - 1);
+        int miny = max(tri.miny, y0);
+        int maxy = min(tri.maxy, y1 - 1);
+
+        // Start on a multiple of four within the tile
+        int sx = x0 + ((minx - x0) & ~3);
+        __m128 lastx = _mm_set1_ps(float(maxx));
+
+        __m128 ea[3], ec[3], ea4[3];
+        for (int i = 0; i < 3; i++)
+        {
+            ea[i] = _mm_set1_ps(tri.ea[i]);
+            ea4[i] = _mm_set1_ps(tri.ea[i] * 4);
+        }
+
+        __m128 invarea = _mm_set1_ps(tri.invarea);
+        __m128 z0 = _mm_set1_ps(tri.z[0]);
+        __m128 z1 = _mm_set1_ps(tri.z[1]);
+        __m128 z2 = _mm_set1_ps(tri.z[2]);
+
+        for (int y = miny; y <= maxy; y++)
+        {
+            float py = y + 0.5f;
+            __m128 px = _mm_add_ps(_mm_set1_ps(sx + 0.5f), lanes);
+            __m128 e[3];
+            for (int i = 0; i < 3; i++)
+            {
+                ec[i] = _mm_set1_ps(tri.eb[i] * py + tri.ec[i]);
+                e[i] = _mm_add_ps(_mm_mul_ps(ea[i], px), ec[i]);
+            }
+
+            float* drow = &depth[(y - y0) * TileSize];
+            unsigned char* irow = m_image[y];
+
+            for (int x = sx; x <= maxx; x += 4)
+            {
+                __m128 xs = _mm_add_ps(_mm_set1_ps(float(x)), lanes);
+                __m128 inside = _mm_cmple_ps(xs, lastx);
+                for (int i = 0; i < 3; i++)
+                {
+                    inside = _mm_and_ps(inside, tri.topleft[i] ? _mm_cmpge_ps(e[i], zero) : _mm_cmpgt_ps(e[i], zero));
+                }
+
+                if (_mm_movemask_ps(inside))
+                {
+                    __m128 l0 = _mm_mul_ps(e[0], invarea);
+                    __m128 l1 = _mm_mul_ps(e[1], invarea);
+                    __m128 l2 = _mm_mul_ps(e[2], invarea);
+                    __m128 z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(l0, z0), _mm_mul_ps(l1, z1)), _mm_mul_ps(l2, z2));
+
+                    float* dp = drow + (x - x0);
+                    __m128 d = _mm_loadu_ps(dp);
+                    __m128 pass = _mm_and_ps(inside, _mm_and_ps(_mm_cmplt_ps(z, d), _mm_cmple_ps(z, one)));
+                    int bits = _mm_movemask_ps(pass);
+
+                    if (bits)
+                    {
+                        _mm_storeu_ps(dp, _mm_or_ps(_mm_and_ps(pass, z), _mm_andnot_ps(pass, d)));
+
+                        float bl[3][4];
+                        _mm_storeu_ps(bl[0], l0);
+                        _mm_storeu_ps(bl[1], l1);
+                        _mm_storeu_ps(bl[2], l2);
+
+                        for (int lane = 0; lane < 4; lane++)
+                        {
+                            if (!(bits & (1 << lane)))
+                                continue;
+
+                            float w0 = bl[0][lane], w1 = bl[1][lane], w2 = bl[2][lane];
+                            float w = 1.f / (w0 * tri.invw[0] + w1 * tri.invw[1] + w2 * tri.invw[2]);
+
+                            float r = (w0 * tri.r[0] + w1 * tri.r[1] + w2 * tri.r[2]) * w;
+                            float g = (w0 * tri.g[0] + w1 * tri.g[1] + w2 * tri.g[2]) * w;
+                            float bb = (w0 * tri.b[0] + w1 * tri.b[1] + w2 * tri.b[2]) * w;
+
+                            // GL_MODULATE with GL_REPEAT
+                            if (tri.texture)
+                            {
+                                float s = (w0 * tri.s[0] + w1 * tri.s[1] + w2 * tri.s[2]) * w;
+                                float t = (w0 * tri.t[0] + w1 * tri.t[1] + w2 * tri.t[2]) * w;
+                                CGrPoint texel = tri.texture->Sample(s - floor(s), t - floor(t));
+                                r *= float(texel.X());
+                                g *= float(texel.Y());
+                                bb *= float(texel.Z());
+                            }
+
+                            unsigned char* pixel = irow + (x + lane) * 3;
+                            pixel[0] = (unsigned char)(min(1.f, max(0.f, r)) * 255.f + 0.5f);
+                            pixel[1] = (unsigned char)(min(1.f, max(0.f, g)) * 255.f + 0.5f);
+                            pixel[2] = (unsigned char)(min(1.f, max(0.f, bb)) * 255.f + 0.5f);
+                        }
+                    }
+                }
+
+                for (int i = 0; i < 3; i++)
+                    e[i] = _mm_add_ps(e[i], ea4[i]);
+            }
+        }
+    }
+}
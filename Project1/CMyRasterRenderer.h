@@ -0,0 +1,122 @@
+#pragma once
+#include "graphics/GrRenderer.h"
+#include "graphics/GrTexture.h"
+#include <atomic>
+#include <list>
+#include <vector>
+
+//
+// Name :         CMyRasterRenderer
+// Description :  Software rasterizer. Polygons are lit per vertex the
+//                same way as the OpenGL fixed function pipeline that
+//                COpenGLRenderer sets up, split into triangles, clipped
+//                to the near plane and binned into screen tiles. The
+//                tiles are rasterized in parallel, each with its own
+//                depth buffer. No window or GL context is needed.
+//
+//                Nothing here uses MFC, so a program without a window
+//                can SetImage(), set the camera and lights and Render().
+//                The graphics classes it is built on still include the
+//                Windows GL headers, and CGrTexture reports load errors
+//                with AfxMessageBox.
+//
+
+class CMyRasterRenderer :
+	public CGrRenderer
+{
+public:
+    CMyRasterRenderer();
+
+    // The image has the same layout as the ray tracer image: RGB bytes,
+    // row 0 at the bottom.
+    void SetImage(unsigned char** image, int w, int h) { m_image = image; m_imagewidth = w;  m_imageheight = h; }
+
+    // Or one block of memory with rows p_stride bytes apart
+    void SetImage(unsigned char* p_pixels, int w, int h, int p_stride);
+
+    // Worker threads for the tiles, 0 for one for each processor
+    void SetThreads(int n) { m_threads = n; }
+
+    static const int TileSize = 64;
+
+    int TriangleCnt() const { return int(m_triangles.size()); }
+
+    bool RendererStart();
+    bool RendererEnd();
+    void RendererMaterial(CGrMaterial* p_material);
+    void RendererEndPolygon();
+
+    virtual void RendererPushMatrix();
+    virtual void RendererPopMatrix();
+    virtual void RendererRotate(double a, double x, double y, double z);
+    virtual void RendererTranslate(double x, double y, double z);
+    virtual void RendererTransform(const CGrTransform* p_transform);
+
+private:
+    // A lit vertex in clip coordinates
+    struct Vertex
+    {
+        float x, y, z, w;
+        float r, g, b;
+        float s, t;
+    };
+
+    // A triangle set up for rasterization. Window coordinates, edge
+    // functions, and the attributes divided by w for perspective
+    // correct interpolation.
+    struct Triangle
+    {
+        float ea[3], eb[3], ec[3];  // Edge i is ea * x + eb * y + ec
+        bool  topleft[3];           // Pixels exactly on the edge are in
+        float invarea;
+        float z[3];                 // Window depth
+        float invw[3];
+        float r[3], g[3], b[3];     // Divided by w
+        float s[3], t[3];           // Divided by w
+        CGrTexture* texture;
+        int minx, miny, maxx, maxy;
+    };
+
+    // A light in eye coordinates
+    struct EyeLight
+    {
+        CGrPoint pos;               // Direction to the light if directional
+        bool directional;
+        float ambient[3];
+        float diffuse[3];
+        float specular[3];
+    };
+
+    const CGrTransform& NormalMatrix();
+    void Shade(const CGrPoint& p, const CGrPoint& n, float* color) const;
+    void AddPolygon(std::vector<Vertex>& poly, CGrTexture* texture);
+    void AddTriangle(const Vertex& a, const Vertex& b, const Vertex& c, CGrTexture* texture);
+    void Worker();
+    void RasterTile(int tile, std::vector<float>& depth);
+
+    unsigned char** m_image;
+    std::vector<unsigned char*> m_rows;     // For a single block image
+    int     m_imagewidth;
+    int     m_imageheight;
+    int     m_threads;
+
+    std::list<CGrTransform> m_mstack;   // Modelview, starts with the LookAt
+    CGrTransform m_normalmatrix;        // Inverse transpose of m_mstack.back()
+    bool    m_normalvalid;
+    CGrMaterial* m_material;
+
+    double  m_projx, m_projy;           // Projection scale factors
+    double  m_projz, m_projzw;          // Depth row of the projection
+
+    std::vector<EyeLight> m_eyelights;
+
+    // Reused for each polygon
+    std::vector<Vertex> m_polygon;
+    std::vector<Vertex> m_clipped;
+
+    std::vector<Triangle> m_triangles;
+    std::vector<std::vector<int> > m_bins;  // Triangles touching each tile
+    int     m_tilecols;
+    int     m_tilerows;
+    std::atomic<int> m_nexttile;
+};
@@ -1,8 +1,51 @@
 #include "pch.h"
 #include "CMyRaytraceRenderer.h"
 #include "graphics/GrTexture.h"
+#include "graphics/GrProfiler.h"
+#include "graphics/jitter.h"
 #include <algorithm>
 #include <cmath>
+#include <intrin.h>
+
+CMyRaytraceRenderer::CMyRaytraceRenderer() : m_wavefront(this)
+{
+    m_window = NULL;
+    m_rayimage = NULL;
+    m_rayimagewidth = 0;
+    m_rayimageheight = 0;
+    m_material = NULL;
+
+    m_progressive = false;
+    m_progressivesamples = 8;
+    m_framebudget = 33;
+    m_abort = NULL;
+
+    m_termination = FIXED_DEPTH;
+    m_maxdepth = 2;
+    m_throughputthreshold = 0.01;
+    m_roulettedepth = 1;
+    m_raybudget = 0;
+    m_raycount = 0;
+    m_raypersample = 0;
+    m_rayallowance = 0;
+    m_randomstate = 2463534242u;
+
+    m_engine = DEPTH_FIRST;
+    m_reservoirs = NULL;
+    m_geometry = &m_owngeometry;
+    m_features = &m_ownfeatures;
+    m_links = &m_ownlinks;
+    m_link = 0;
+    m_scenecache = NULL;
+    m_cache = NULL;
+    m_accelerator = &m_kdtree;
+    m_validator = NULL;
+    m_recorder = NULL;
+    m_hybrid = false;
+    m_costs = NULL;
+    m_raystraced = 0;
+    m_kdtuner = NULL;
+}
 
 void CMyRaytraceRenderer::SetWindow(CWnd* p_window)
 {
@@ -11,8 +54,41 @@ void CMyRaytraceRenderer::SetWindow(CWnd* p_window)
 
 bool CMyRaytraceRenderer::RendererStart()
 {
-	m_intersection.Initialize();
+	if (m_scenecache != NULL)
+	{
+		// The polygons are replaced or kept by RendererReplay()
+		m_geometry = &m_scenecache->Geometry();
+		m_features = &m_scenecache->Features();
+		m_links = &m_scenecache->Links();
+
+		// The kept polygons are in the groups of the old links
+		if (!m_links->Begin(*this))
+			m_scenecache->Clear();
+	}
+	else
+	{
+		m_geometry = &m_owngeometry;
+		m_features = &m_ownfeatures;
+		m_links = &m_ownlinks;
+		m_geometry->Clear();
+		m_features->clear();
+		m_links->Begin(*this);
+	}
+
+	m_lights.Build(*this, m_links);
+	StartScene();
+	return true;
+}
+
+//
+// Name : CMyRaytraceRenderer::StartScene()
+// Description : Reset what is collected while the scene graph is
+// rendered.
+//
 
+void CMyRaytraceRenderer::StartScene()
+{
+	m_scene = CRaySceneCache::Summary();
 	m_mstack.clear();
 
 	// We have to do all of the matrix work ourselves.
@@ -25,10 +101,84 @@ bool CMyRaytraceRenderer::RendererStart()
 	m_mstack.push_back(t);
 
 	m_material = NULL;
+	m_link = 0;
+}
+
+//
+// Name : CMyRaytraceRenderer::RendererReplay()
+// Description : With a scene cache, the scene graph is rendered here
+// so we know whether it lined up with the cache. If it did not, it is
+// rendered again into an empty cache.
+//
+
+bool CMyRaytraceRenderer::RendererReplay(CGrObject* p_object)
+{
+	if (m_scenecache == NULL)
+		return false;
+
+	GR_PROFILE_ZONE("CMyRaytraceRenderer::RendererReplay");
+
+	m_scenecache->Begin();
+	p_object->Render(this);
+	if (!m_scenecache->End())
+	{
+		m_scenecache->Clear();
+		StartScene();
+		m_scenecache->Begin();
+		p_object->Render(this);
+		m_scenecache->End();
+	}
 
 	return true;
 }
 
+//
+// Name : CMyRaytraceRenderer::RendererVisible()
+// Description : With a scene cache, a child of a composite that did not
+// change since the last render is skipped and keeps its polygons. Any
+// other child is rendered right here instead of by the composite, so
+// the cache can tell which polygons are its. A child a light is linked
+// to is also rendered here, in its light linking group.
+//
+
+bool CMyRaytraceRenderer::RendererVisible(CGrObject* p_object)
+{
+	bool linked = m_links->Linked(p_object);
+	if (m_scenecache == NULL && !linked)
+		return true;
+
+	int outerlink = m_link;
+	if (linked)
+		m_link = m_links->Enter(m_link, p_object);
+
+	const CRaySceneCache::Summary* reused = NULL;
+	if (m_scenecache == NULL)
+	{
+		p_object->Render(this);
+	}
+	else if ((reused = m_scenecache->Reuse(p_object, m_mstack.back(), m_material, m_link)) != NULL)
+	{
+		m_scene.Add(*reused);
+	}
+	else
+	{
+		// The child is summarized on its own, then added to
+		// the scene the same way a skipped one would be
+		CRaySceneCache::Summary outer = m_scene;
+		m_scene = CRaySceneCache::Summary();
+
+		int entry = m_scenecache->Open(p_object, m_mstack.back(), m_material, m_link);
+		p_object->Render(this);
+		m_scenecache->Close(entry, m_scene, m_material);
+
+		outer.Add(m_scene);
+		m_scene = outer;
+	}
+
+	m_link = outerlink;
+	return false;
+}
+
 void CMyRaytraceRenderer::RendererMaterial(CGrMaterial* p_material)
 {
 	m_material = p_material;
@@ -68,36 +218,63 @@ void CMyRaytraceRenderer::RendererEndPolygon()
     const std::list<CGrPoint>& normals = PolyNormals();
     const std::list<CGrPoint>& tvertices = PolyTexVertices();
 
-    // Allocate a new polygon in the ray intersection system
-    m_intersection.PolygonBegin();
-    m_intersection.Material(m_material);
+    m_polyvertices.clear();
+    m_polynormals.clear();
+    m_polytexcoords.clear();
 
-    if (PolyTexture())
+    for (std::list<CGrPoint>::const_iterator i = vertices.begin(); i != vertices.end(); i++)
     {
-        m_intersection.Texture(PolyTexture());
+        CGrPoint vertex = m_mstack.back() * *i;
+        m_scene.min.Minimize(vertex);
+        m_scene.max.Maximize(vertex);
+        m_polyvertices.push_back(vertex);
     }
 
-    std::list<CGrPoint>::const_iterator normal = normals.begin();
-    std::list<CGrPoint>::const_iterator tvertex = tvertices.begin();
+    for (std::list<CGrPoint>::const_iterator i = normals.begin(); i != normals.end() && m_polynormals.size() < m_polyvertices.size(); i++)
+    {
+        m_polynormals.push_back(m_mstack.back() * *i);
+    }
 
-    for (std::list<CGrPoint>::const_iterator i = vertices.begin(); i != vertices.end(); i++)
+    for (std::list<CGrPoint>::const_iterator i = tvertices.begin(); i != tvertices.end() && m_polytexcoords.size() < m_polyvertices.size(); i++)
     {
-        if (normal != normals.end())
-        {
-            m_intersection.Normal(m_mstack.back() * *normal);
-            normal++;
-        }
+        m_polytexcoords.push_back(*i);
+    }
+
+    // The accelerator is built over our own copy of the polygon,
+    // which also supplies the hit attributes
+    unsigned char features = (unsigned char)RayShadeFeatures(m_material, PolyTexture());
+    if (m_scenecache != NULL)
+    {
+        m_scenecache->AddPolygon(m_material, PolyTexture(), m_polyvertices, m_polynormals, m_polytexcoords, features, m_link);
+    }
+    else
+    {
+        m_geometry->AddPolygon(m_material, PolyTexture(), m_polyvertices, m_polynormals, m_polytexcoords, m_link);
+        m_features->push_back(features);
+    }
+
+    if (m_material != NULL && !m_material->CastShadows())
+        m_scene.shadowless = true;
 
-        if (tvertex != tvertices.end())
+    if (m_cache != NULL)
+    {
+        // Anything that changes the primary hits or what casts shadows
+        bool casts = m_material == NULL || m_material->CastShadows();
+        m_scene.scenehash = CRayVisibilityCache::Hash(m_scene.scenehash, &casts, sizeof(casts));
+        for (size_t i = 0; i < m_polyvertices.size(); i++)
         {
-            m_intersection.TexVertex(*tvertex);
-            tvertex++;
+            double xyz[3] = {m_polyvertices[i].X(), m_polyvertices[i].Y(), m_polyvertices[i].Z()};
+            m_scene.scenehash = CRayVisibilityCache::Hash(m_scene.scenehash, xyz, sizeof(xyz));
         }
-
-        m_intersection.Vertex(m_mstack.back() * *i);
     }
 
-    m_intersection.PolygonEnd();
+    if (m_kdtuner != NULL)
+    {
+        // The structure of the scene, which does not change as the
+        // camera moves. The tuned parameters are kept by this.
+        const void* polygon[3] = {m_material, PolyTexture(), (const void*)m_polyvertices.size()};
+        m_scene.kdhash = CRayVisibilityCache::Hash(m_scene.kdhash, polygon, sizeof(polygon));
+    }
 }
 
 CGrPoint CMyRaytraceRenderer::Reflect(const CGrPoint& incident, const CGrPoint& normal) const
@@ -107,129 +284,899 @@ CGrPoint CMyRaytraceRenderer::Reflect(const CGrPoint& incident, const CGrPoint&
     return reflected;
 }
 
-void CMyRaytraceRenderer::RayColor(const CRay& ray, CGrPoint& color, int recurse, const CRayIntersection::Object* ignore)
+//
+// Name : CMyRaytraceRenderer::RayColor()
+// Description : Compute the color seen along a ray. throughput is the
+// product of the reflectances along the path from the eye to this ray.
+// It decides when reflection paths are terminated (see SetTermination).
+//
+
+void CMyRaytraceRenderer::RayColor(const CRay& ray, CGrPoint& color, int recurse, int ignore, const CGrPoint& throughput)
 {
     double t; // Distance to intersection
     CGrPoint intersect; // x,y,z location of intersection
-    const CRayIntersection::Object* nearest; // Pointer to intersecting object
+    int primitive; // The polygon hit
+
+    if (Intersect(ray, 1e20, ignore, primitive, t, intersect, recurse == 0 ? CRayRecorder::PRIMARY : CRayRecorder::REFLECTION))
+    {
+        // We hit something. The attributes are computed as they are needed.
+        CRayHit hit;
+        hit.Set(m_geometry, primitive, t, intersect);
+
+        // Shade with the kernel for this material
+        Immediate visibility(this, primitive, recurse, throughput);
+        CRayShade shade;
+        m_kernels[(*m_features)[hit.Primitive()]](m_lights, hit, ray, visibility, shade);
+        color = shade.Color();
+    }
+    else
+    {
+        // No intersection: return background color
+        color = CGrPoint(0, 0, 0); 
+    }
+}
+
+//
+// Name : CMyRaytraceRenderer::Immediate::Reflect()
+// Description : Trace the reflection of a mirror right away. The base
+// color is the reflected color scaled by the reflectance, or black if
+// the path is terminated.
+//
+
+bool CMyRaytraceRenderer::Immediate::Reflect(CRayHit& hit, const CRay& ray, CGrPoint& base)
+{
+    if (!m_renderer->ReflectionAllowed(m_recurse))
+        return false;
+
+    // The reflectance of a mirror is its specular color
+    CGrMaterial* material = hit.Material();
+    CGrPoint reflectance(material->Specular(0), material->Specular(1), material->Specular(2));
+    CGrPoint reflectionThroughput = m_throughput;
+    reflectionThroughput.MemberMultiply3(reflectance);
 
-    if (m_intersection.Intersect(ray, 1e20, ignore, nearest, t, intersect))
+    double weight;
+    if (m_renderer->ContinuePath(reflectionThroughput, m_recurse, weight) && m_renderer->SpendRay())
     {
-        // We hit something...
-        CGrPoint N; // Normal at the intersection
-        CGrMaterial* material; // Material at the intersection
-        CGrTexture* texture; // Texture at the intersection (if any)
-        CGrPoint texcoord; // Texture coordinates at the intersection (if any)
-        m_intersection.IntersectInfo(ray, nearest, t, N, material, texture, texcoord);
+        const CGrPoint& N = hit.Normal();
+        CGrPoint reflectionDir = m_renderer->Reflect(ray.Direction(), N);
+        CRay reflectionRay(hit.Point() + N * 0.001, reflectionDir); // Offset to avoid self-intersection
 
-        //
-        // Color computation
-        //
+        // Recursively trace the reflection ray
+        CGrPoint reflectionColor;
+        m_renderer->RayColor(reflectionRay, reflectionColor, m_recurse + 1, m_primitive, reflectionThroughput * weight);
+        base = reflectionColor.MemberMultiply3(reflectance) * weight;
+    }
+    else
+    {
+        // Terminated, the reflection contributes nothing
+        base = CGrPoint(0, 0, 0);
+    }
+
+    return true;
+}
+
+//
+// Name : CMyRaytraceRenderer::Immediate::Light()
+// Description : Trace the shadow ray for a light and apply the light
+// if nothing blocks it. Once the ray budget is spent, lights are
+// assumed unoccluded.
+//
+
+template <bool Multiply> void CMyRaytraceRenderer::Immediate::Light(CRayShade& shade, const CRay& shadow, double maxt, const CGrPoint& term, int light, bool cast)
+{
+    if (cast && m_renderer->SpendRay())
+    {
+        if (m_renderer->Occluded(shadow, maxt, m_primitive))
+            return;
+    }
+
+    RayShadeApply<Multiply>(shade, term);
+}
+
+// The shading tables are also filled in other files, which only see the
+// declaration
+template void CMyRaytraceRenderer::Immediate::Light<true>(CRayShade&, const CRay&, double, const CGrPoint&, int, bool);
+template void CMyRaytraceRenderer::Immediate::Light<false>(CRayShade&, const CRay&, double, const CGrPoint&, int, bool);
+
+//
+// Name : CMyRaytraceRenderer::Cached::Light()
+// Description : Apply a light to a cached primary hit. The shadow
+// result comes from the cache, or is traced and stored there.
+//
+
+template <bool Multiply> void CMyRaytraceRenderer::Cached::Light(CRayShade& shade, const CRay& shadow, double maxt, const CGrPoint& term, int light, bool cast)
+{
+    if (cast)
+    {
+        unsigned char* state = m_renderer->m_cache->Shadow(m_s, m_r, m_c, light);
+        if (state == NULL || *state == CRayVisibilityCache::SHADOW_UNKNOWN)
+        {
+            if (!m_renderer->SpendRay())
+            {
+                // Out of budget, assumed unoccluded but not cached
+                RayShadeApply<Multiply>(shade, term);
+                return;
+            }
 
-        // If the material is reflective, calculate the reflection ray
-        if (material != NULL && material->Shininess() >= 90 && recurse <= 2)
+            bool blocked = m_renderer->Occluded(shadow, maxt, m_primitive);
+            if (state != NULL)
+                *state = blocked ? CRayVisibilityCache::SHADOW_BLOCKED : CRayVisibilityCache::SHADOW_CLEAR;
+            if (blocked)
+                return;
+        }
+        else if (*state == CRayVisibilityCache::SHADOW_BLOCKED)
         {
-            // Compute reflection direction
-            CGrPoint reflectionDir = Reflect(ray.Direction(), N);
-            CRay reflectionRay(intersect + N * 0.001, reflectionDir); // Offset to avoid self-intersection
+            return;
+        }
+    }
+
+    RayShadeApply<Multiply>(shade, term);
+}
+
+template void CMyRaytraceRenderer::Cached::Light<true>(CRayShade&, const CRay&, double, const CGrPoint&, int, bool);
+template void CMyRaytraceRenderer::Cached::Light<false>(CRayShade&, const CRay&, double, const CGrPoint&, int, bool);
+
+//
+// Name : CMyRaytraceRenderer::Occluded()
+// Description : Is anything that casts shadows on a shadow ray closer
+// than maxt? The primitive ignore (-1 for none) is the surface the ray
+// leaves. Polygons with a material that does not cast shadows are
+// stepped over by tracing again from past them.
+//
+
+bool CMyRaytraceRenderer::Occluded(const CRay& ray, double maxt, int ignore)
+{
+    // Any hit will do, which the accelerator may find sooner
+    if (!m_scene.shadowless)
+    {
+        m_raystraced++;
+        bool blocked = m_accelerator->Occluded(ray, maxt, ignore, m_costs != NULL ? &m_accelwork : NULL);
+        if (m_recorder != NULL)
+            m_recorder->Add(CRayRecorder::SHADOW, true, ray, maxt, ignore, blocked, -1, 0);
+        return blocked;
+    }
+
+    CRay shadow = ray;
+    for (int i = 0; i < MaxRecursion; i++)
+    {
+        int primitive;
+        double t;
+        CGrPoint intersect;
+        if (!Intersect(shadow, maxt, ignore, primitive, t, intersect, CRayRecorder::SHADOW))
+            return false;
+
+        CGrMaterial* material = m_geometry->GetPolygon(primitive).material;
+        if (material == NULL || material->CastShadows())
+            return true;
+
+        shadow = CRay(intersect, shadow.Direction());
+        maxt -= t;
+        ignore = primitive;
+    }
+
+    return true;
+}
+
+//
+// Name : CMyRaytraceRenderer::ReflectionAllowed()
+// Description : Can a mirror hit at this recursion depth spawn
+// a reflection ray? The ray is only counted (SpendRay()) once
+// ContinuePath() has decided to trace it.
+//
+
+bool CMyRaytraceRenderer::ReflectionAllowed(int recurse)
+{
+    if (recurse >= MaxRecursion)
+        return false;
+
+    if (m_termination == FIXED_DEPTH && recurse > m_maxdepth)
+        return false;
+
+    return RayAvailable();
+}
+
+//
+// Name : CMyRaytraceRenderer::ContinuePath()
+// Description : Decide if a reflection path with the given throughput
+// continues. weight is the factor the continued path must be scaled by.
+//
+
+bool CMyRaytraceRenderer::ContinuePath(const CGrPoint& throughput, int recurse, double& weight)
+{
+    weight = 1;
+
+    double maxthroughput = max(throughput.X(), max(throughput.Y(), throughput.Z()));
+
+    switch (m_termination)
+    {
+    case THROUGHPUT:
+        return maxthroughput >= m_throughputthreshold;
+
+    case RUSSIAN_ROULETTE:
+    {
+        // Survive with a probability equal to the throughput and
+        // scale the survivors up so the estimate stays unbiased.
+        if (recurse < m_roulettedepth)
+            return maxthroughput > 0;
+
+        double survive = min(maxthroughput, 1.0);
+        if (survive <= 0 || Random() >= survive)
+            return false;
+
+        weight = 1 / survive;
+        return true;
+    }
+
+    default:
+        return true;
+    }
+}
+
+//
+// Name : CMyRaytraceRenderer::Intersect()
+// Description : Nearest hit along a ray from the accelerator, skipping
+// the primitive ignore (-1 for none).
+//
+
+bool CMyRaytraceRenderer::Intersect(const CRay& ray, double maxt, int ignore, int& primitive, double& t, CGrPoint& intersect, CRayRecorder::Type type)
+{
+    m_raystraced++;
+
+    bool hit = m_accelerator->Intersect(ray, maxt, ignore, primitive, t, m_costs != NULL ? &m_accelwork : NULL);
+    if (hit)
+    {
+        intersect = ray.PointOnRay(t);
+        intersect.W(1);
+    }
+
+    if (m_recorder != NULL)
+        m_recorder->Add(type, false, ray, maxt, ignore, hit, hit ? primitive : -1, t);
+
+    return hit;
+}
+
+//
+// Name : CMyRaytraceRenderer::CostBegin()
+// Description : Note the counters before a pixel sample is traced.
+// CostEnd() charges the difference to the pixel.
+//
+
+void CMyRaytraceRenderer::CostBegin(CRayCostBuffer::Counters& start) const
+{
+    start.rays = m_raystraced;
+    start.steps = m_accelwork.steps;
+    start.tests = m_accelwork.tests;
+    start.cycles = __rdtsc();
+}
+
+void CMyRaytraceRenderer::CostEnd(int r, int c, const CRayCostBuffer::Counters& start)
+{
+    CRayCostBuffer::Counters cost;
+    cost.cycles = __rdtsc() - start.cycles;
+    cost.rays = m_raystraced - start.rays;
+    cost.steps = m_accelwork.steps - start.steps;
+    cost.tests = m_accelwork.tests - start.tests;
+    m_costs->Add(r, c, cost);
+}
+
+//
+// Name : CMyRaytraceRenderer::SpendRay()
+// Description : Count a secondary ray against the ray budget of the
+// pixel samples so far (see AllowRays()). Returns false if it has been
+// used up.
+//
+
+bool CMyRaytraceRenderer::SpendRay()
+{
+    if (!RayAvailable())
+        return false;
+
+    m_raycount++;
+    return true;
+}
+
+// Uniform random number in [0, 1) (xorshift)
+double CMyRaytraceRenderer::Random()
+{
+    m_randomstate ^= m_randomstate << 13;
+    m_randomstate ^= m_randomstate >> 17;
+    m_randomstate ^= m_randomstate << 5;
+    return m_randomstate / 4294967296.0;
+}
+
+bool CMyRaytraceRenderer::RendererEnd()
+{
+    GR_PROFILE_ZONE("CMyRaytraceRenderer::RendererEnd");
+
+    m_ymin = -tan(ProjectionAngle() / 2 * GR_DTOR);
+    m_yhit = -m_ymin * 2;
+
+    m_xmin = m_ymin * ProjectionAspect();
+    m_xwid = -m_xmin * 2;
+
+    if (m_kdtuner != NULL)
+        TuneIntersection();
+
+    {
+        GR_PROFILE_ZONE("CRayAccelerator::Build");
+        m_accelerator->Build(*m_geometry);
+    }
+
+    if (m_validator != NULL)
+    {
+        std::vector<CRay> primary;
+        std::vector<CGrPoint> lights;
+        SampleRays(m_validator->GetSampleCount(), primary, lights);
+        m_validator->Run(*m_geometry, primary, lights);
+    }
+
+    if (m_recorder != NULL)
+        m_recorder->Scene(*m_geometry);
+
+    m_links->End(*this);
+    m_kernels.Select(LightCnt());
+    m_cachedkernels.Select(LightCnt());
+    m_wavefront.SelectKernels(LightCnt());
 
-            // Recursively trace the reflection ray
-            CGrPoint reflectionColor;
-            RayColor(reflectionRay, reflectionColor, recurse + 1, nearest);
+    m_framebuffer.SetSize(m_rayimagewidth, m_rayimageheight);
+    if (m_costs != NULL)
+        m_costs->SetSize(m_rayimagewidth, m_rayimageheight);
+    m_lastpresent = std::chrono::steady_clock::now();
 
-            // Set the color to the reflection color
-            color = reflectionColor;
+    const CGrPoint* jitter = m_progressive && m_progressivesamples > 0 && m_progressivesamples <= JITTERMAX ? JITTER[m_progressivesamples] : NULL;
+    bool reservoirs = m_reservoirs != NULL && LightCnt() > 0;
+
+    // Every pixel gets one sample per reservoir frame, or one from the
+    // coarse to fine levels and one per jittered sample. The ray budget
+    // is split evenly between them.
+    int samples = reservoirs ? (jitter != NULL ? m_progressivesamples : 1) : 1 + (jitter != NULL ? m_progressivesamples : 0);
+    double pixels = double(m_rayimagewidth) * m_rayimageheight;
+    m_raycount = 0;
+    m_raypersample = pixels > 0 ? m_raybudget / (pixels * samples) : 0;
+    m_rayallowance = 0;
+
+    // Reservoir lighting renders whole frames, each one reusing
+    // the reservoirs of the one before
+    if (reservoirs)
+    {
+        for (int f = 0; f < samples; f++)
+        {
+            if (!RenderReservoirFrame(jitter != NULL ? jitter[f] : CGrPoint(0.5, 0.5)))
+                return false;
         }
-        else // Handle non-reflective materials 
+
+        m_framebuffer.Resolve(m_rayimage);
+        return true;
+    }
+
+    // The cache holds the pixel centers and each jittered sample
+    bool cachevalid = false;
+    if (m_cache != NULL)
+    {
+        // The full resolution pass from the cache
+        cachevalid = m_cache->Begin(m_rayimagewidth, m_rayimageheight, samples, m_scene.scenehash, *this);
+        if (!RenderCached(CGrPoint(0.5, 0.5), 0, cachevalid, false))
+            return false;
+    }
+    else if (m_hybrid)
+    {
+        // The full resolution pass from the rasterized primary hits
+        if (!RenderHybrid(CGrPoint(0.5, 0.5), false))
+            return false;
+    }
+    else
+    {
+        // Coarse to fine. Each level only traces the pixels the
+        // previous (coarser) level did not already compute.
+        int startblock = m_progressive ? ProgressiveStartBlock : 1;
+        for (int block = startblock; block >= 1; block /= 2)
         {
-            if (texture != NULL)
+            if (!RenderLevel(block, block < startblock))
+                return false;
+        }
+    }
+
+    // Then keep adding jittered samples per pixel. Hybrid rendering
+    // rasterizes the jittered primary hits too.
+    for (int s = 0; jitter != NULL && s < m_progressivesamples; s++)
+    {
+        bool rendered;
+        if (m_cache != NULL)
+            rendered = RenderCached(jitter[s], s + 1, cachevalid, true);
+        else if (m_hybrid)
+            rendered = RenderHybrid(jitter[s], true);
+        else
+            rendered = RenderSample(jitter[s]);
+
+        if (!rendered)
+            return false;
+    }
+
+    m_framebuffer.Resolve(m_rayimage);
+    return true;
+}
+
+//
+// Name : CMyRaytraceRenderer::TuneIntersection()
+// Description : Set the build parameters of the kd-tree accelerator
+// for this scene, searching for them if it has not been seen before.
+// Other accelerators are left alone.
+//
+
+void CMyRaytraceRenderer::TuneIntersection()
+{
+    CRayKdAccelerator* kdtree = dynamic_cast<CRayKdAccelerator*>(m_accelerator);
+    if (kdtree == NULL || m_rayimagewidth <= 0 || m_rayimageheight <= 0)
+        return;
+
+    std::vector<CRay> primary;
+    std::vector<CGrPoint> lights;
+    if (!m_kdtuner->Known(m_scene.kdhash))
+        SampleRays(m_kdtuner->GetSampleCount(), primary, lights);
+
+    double scale = primary.empty() ? 1 : double(m_rayimagewidth) * m_rayimageheight / primary.size();
+    CRayKdTuner::Apply(kdtree->Intersection(), m_kdtuner->Tune(m_scene.kdhash, *m_geometry, primary, lights, scale));
+}
+
+//
+// Name : CMyRaytraceRenderer::SampleRays()
+// Description : About p_count primary rays on a grid over the image and
+// the light positions, for the tuner and the validator.
+//
+
+void CMyRaytraceRenderer::SampleRays(int p_count, std::vector<CRay>& p_primary, std::vector<CGrPoint>& p_lights) const
+{
+    if (m_rayimagewidth > 0 && m_rayimageheight > 0 && p_count > 0)
+    {
+        double step = sqrt(double(m_rayimagewidth) * m_rayimageheight / p_count);
+        for (double y = step / 2; y < m_rayimageheight; y += step)
+        {
+            for (double x = step / 2; x < m_rayimagewidth; x += step)
+                p_primary.push_back(PrimaryRay(x, y));
+        }
+    }
+
+    for (int i = 0; i < LightCnt(); i++)
+        p_lights.push_back(GetLight(i).m_pos);
+}
+
+//
+// Name : CMyRaytraceRenderer::PrimaryRay()
+// Description : The ray from the eye through image location x, y,
+// where x and y are in pixels from the lower left corner.
+//
+
+CRay CMyRaytraceRenderer::PrimaryRay(double x, double y) const
+{
+    double px = m_xmin + x / m_rayimagewidth * m_xwid;
+    double py = m_ymin + y / m_rayimageheight * m_yhit;
+
+    return CRay(CGrPoint(0, 0, 0), Normalize3(CGrPoint(px, py, -1)));
+}
+
+//
+// Name : CMyRaytraceRenderer::TraceSamples()
+// Description : Compute the color of each sample with the current engine.
+//
+
+void CMyRaytraceRenderer::TraceSamples(std::vector<CRayWavefront::Sample>& samples)
+{
+    if (m_engine == WAVEFRONT && m_costs == NULL)
+    {
+        AllowRays(samples.size());
+        m_wavefront.Trace(samples);
+        return;
+    }
+
+    for (size_t i = 0; i < samples.size(); i++)
+    {
+        CRayWavefront::Sample& sample = samples[i];
+        AllowRays(1);
+
+        CRayCostBuffer::Counters start;
+        if (m_costs != NULL)
+            CostBegin(start);
+
+        RayColor(PrimaryRay(sample.x, sample.y), sample.color, 0, -1);
+
+        if (m_costs != NULL)
+            CostEnd(sample.r, sample.c, start);
+    }
+}
+
+//
+// Name : CMyRaytraceRenderer::RenderLevel()
+// Description : Trace one ray per block x block pixels and fill the
+// block with the result. If refine is true, the pixels that are on the
+// grid of the next coarser level have already been traced and are skipped.
+// The image is processed a frame buffer tile at a time.
+//
+
+bool CMyRaytraceRenderer::RenderLevel(int block, bool refine)
+{
+    GR_PROFILE_ZONE("RenderLevel");
+
+    const int tile = CGrFrameBuffer::TileSize;
+
+    for (int r0 = 0; r0 < m_rayimageheight; r0 += tile)
+    {
+        for (int c0 = 0; c0 < m_rayimagewidth; c0 += tile)
+        {
+            m_tilesamples.clear();
+
+            int rend = min(r0 + tile, m_rayimageheight);
+            int cend = min(c0 + tile, m_rayimagewidth);
+            for (int r = r0; r < rend; r += block)
             {
-                // Use texture coordinates to sample the texture color
-                CGrPoint textureColor = texture->Sample(texcoord.X(), texcoord.Y());
-                color = textureColor; // Start with the texture color
+                for (int c = c0; c < cend; c += block)
+                {
+                    if (refine && (r % (block * 2)) == 0 && (c % (block * 2)) == 0)
+                        continue;
+
+                    CRayWavefront::Sample sample;
+                    sample.r = r;
+                    sample.c = c;
+                    sample.x = c + 0.5;
+                    sample.y = r + 0.5;
+                    m_tilesamples.push_back(sample);
+                }
             }
-            else
+
+            TraceSamples(m_tilesamples);
+
+            for (size_t i = 0; i < m_tilesamples.size(); i++)
             {
-                // Use the ambient color of the material if there's no texture
-                color = material->Ambient(); 
+                const CRayWavefront::Sample& sample = m_tilesamples[i];
+                m_framebuffer.Fill(sample.r, sample.c, block, block, sample.color);
             }
+
+            if (!Present())
+                return false;
         }
+    }
+
+    return true;
+}
 
-        // Apply lighting
-        for (int i = 0; i < LightCnt(); ++i)
+//
+// Name : CMyRaytraceRenderer::RenderSample()
+// Description : Add one more sample to every pixel at the
+// given subpixel offset.
+//
+
+bool CMyRaytraceRenderer::RenderSample(const CGrPoint& jitter)
+{
+    GR_PROFILE_ZONE("RenderSample");
+
+    const int tile = CGrFrameBuffer::TileSize;
+
+    for (int r0 = 0; r0 < m_rayimageheight; r0 += tile)
+    {
+        for (int c0 = 0; c0 < m_rayimagewidth; c0 += tile)
         {
-            const Light& light = GetLight(i);
-            CGrPoint lightDir = light.m_pos - intersect;
+            m_tilesamples.clear();
 
-            double length = sqrt(lightDir.X() * lightDir.X() + lightDir.Y() * lightDir.Y() + lightDir.Z() * lightDir.Z());
-            if (length != 0) // Avoid division by zero 
+            int rend = min(r0 + tile, m_rayimageheight);
+            int cend = min(c0 + tile, m_rayimagewidth);
+            for (int r = r0; r < rend; r++)
             {
-                lightDir = lightDir / length;
+                for (int c = c0; c < cend; c++)
+                {
+                    CRayWavefront::Sample sample;
+                    sample.r = r;
+                    sample.c = c;
+                    sample.x = c + jitter.X();
+                    sample.y = r + jitter.Y();
+                    m_tilesamples.push_back(sample);
+                }
             }
 
-            CRay shadowRay(intersect + N * 0.001, lightDir);
-            const CRayIntersection::Object* shadowNearest;
-            if (!m_intersection.Intersect(shadowRay, length, nearest, shadowNearest, t, intersect))
+            TraceSamples(m_tilesamples);
+
+            for (size_t i = 0; i < m_tilesamples.size(); i++)
             {
-                // If no intersection, the point is not in shadow for this light
-                color += CalculateLighting(N, material, light, lightDir, intersect, color);
+                const CRayWavefront::Sample& sample = m_tilesamples[i];
+                m_framebuffer.AddSample(sample.r, sample.c, sample.color);
             }
+
+            if (!Present())
+                return false;
         }
     }
-    else
+
+    return true;
+}
+
+//
+// Name : CMyRaytraceRenderer::RenderReservoirFrame()
+// Description : Add one sample to every pixel using reservoir direct
+// lighting (see CRayReservoirs). Primary hits are shaded without their
+// lights first, the reservoirs choose one light per pixel, and a single
+// shadow ray decides if it is added. Surfaces without a material multiply
+// their lighting, which here is approximated by 1 + the estimated sum.
+//
+
+bool CMyRaytraceRenderer::RenderReservoirFrame(const CGrPoint& jitter)
+{
+    GR_PROFILE_ZONE("RenderReservoirFrame");
+
+    CRayReservoirs& reservoirs = *m_reservoirs;
+    reservoirs.Begin(m_rayimagewidth, m_rayimageheight, LightCnt(), m_links);
+
+    // Primary visibility and the initial reservoirs
+    const CGrPoint one(1, 1, 1);
+    for (int r = 0; r < m_rayimageheight; r++)
     {
-        // No intersection: return background color
-        color = CGrPoint(0, 0, 0); 
+        for (int c = 0; c < m_rayimagewidth; c++)
+        {
+            CRayReservoirs::Surface& surface = reservoirs.At(r, c);
+            surface.valid = false;
+            AllowRays(1);
+
+            CRay ray = PrimaryRay(c + jitter.X(), r + jitter.Y());
+            int primitive;
+            double t;
+            CGrPoint intersect;
+            if (Intersect(ray, 1e20, -1, primitive, t, intersect, CRayRecorder::PRIMARY))
+            {
+                CRayHit hit;
+                hit.Set(m_geometry, primitive, t, intersect);
+
+                int features = (*m_features)[primitive];
+                Immediate visibility(this, primitive, 0, one);
+                visibility.SkipDirectLighting();
+                m_kernels[features](m_lights, hit, ray, visibility, surface.shade);
+
+                surface.valid = true;
+                surface.primitive = primitive;
+                surface.point = intersect;
+                surface.normal = hit.Normal();
+                surface.view = Normalize3(intersect - Eye());
+                surface.multiply = (features & RAYSHADE_MATERIAL) == 0;
+                surface.specular = (features & RAYSHADE_SPECULAR) != 0;
+                surface.material.Set(hit.Material());
+                surface.source = hit.Material();
+                surface.link = hit.Link();
+                surface.receives = hit.Material() == NULL || hit.Material()->ReceiveShadows();
+            }
+
+            reservoirs.Candidates(r, c, *this);
+        }
+
+        if (!Present())
+            return false;
+    }
+
+    reservoirs.Spatial(*this);
+
+    // One shadow ray per pixel
+    for (int r = 0; r < m_rayimageheight; r++)
+    {
+        for (int c = 0; c < m_rayimagewidth; c++)
+        {
+            const CRayReservoirs::Surface& surface = reservoirs.At(r, c);
+            if (!surface.valid)
+            {
+                m_framebuffer.AddSample(r, c, CGrPoint(0, 0, 0));
+                continue;
+            }
+
+            CRayShade shade = surface.shade;
+
+            int light;
+            CGrPoint lightDir;
+            double length;
+            CGrPoint term;
+            if (reservoirs.Selected(r, c, *this, light, lightDir, length, term))
+            {
+                bool shadowed = false;
+                if (surface.receives && m_lights.CastsShadows(light) && SpendRay())
+                {
+                    CRay shadowRay(surface.point + surface.normal * 0.001, lightDir);
+                    shadowed = Occluded(shadowRay, length, surface.primitive);
+                }
+
+                if (shadowed)
+                    reservoirs.Occluded(r, c);
+                else if (surface.multiply)
+                    RayShadeApply<true>(shade, one + term);
+                else
+                    RayShadeApply<false>(shade, term);
+            }
+
+            m_framebuffer.AddSample(r, c, shade.Color());
+        }
+
+        if (!Present())
+            return false;
     }
+
+    return true;
 }
 
-bool CMyRaytraceRenderer::RendererEnd()
-{
-    m_intersection.LoadingComplete();
+//
+// Name : CMyRaytraceRenderer::RenderCached()
+// Description : One sample at the given subpixel offset in each pixel,
+// added to the pixel or replacing it. The primary hits are sample layer
+// p_sample of the visibility cache, traced first if the cache is not
+// valid. Cached hits are reshaded with the current lights and materials.
+// Mirrors are traced again, since their reflections are not cached. This
+// always uses the depth first engine.
+//
 
-    double ymin = -tan(ProjectionAngle() / 2 * GR_DTOR);
-    double yhit = -ymin * 2;
+bool CMyRaytraceRenderer::RenderCached(const CGrPoint& jitter, int sample, bool valid, bool add)
+{
+    GR_PROFILE_ZONE("RenderCached");
 
-    double xmin = ymin * ProjectionAspect();
-    double xwid = -xmin * 2;
+    if (!valid && m_hybrid)
+        m_visibility.Build(*m_geometry, m_rayimagewidth, m_rayimageheight, m_xmin, m_xwid, m_ymin, m_yhit, jitter);
 
     for (int r = 0; r < m_rayimageheight; r++)
     {
         for (int c = 0; c < m_rayimagewidth; c++)
         {
-            double x = xmin + (c + 0.5) / m_rayimagewidth * xwid;
-            double y = ymin + (r + 0.5) / m_rayimageheight * yhit;
+            CRayCostBuffer::Counters start;
+            if (m_costs != NULL)
+                CostBegin(start);
+
+            CRayVisibilityCache::Pixel& pixel = m_cache->At(sample, r, c);
+            AllowRays(1);
+            CRay ray = PrimaryRay(c + jitter.X(), r + jitter.Y());
 
-            // Construct a Ray
-            CRay ray(CGrPoint(0, 0, 0), Normalize3(CGrPoint(x, y, -1)));
-            CGrPoint color;
+            if (!valid && m_hybrid)
+            {
+                const CRayVisibilityBuffer::Pixel& raster = m_visibility.At(r, c);
+                pixel.primitive = raster.primitive;
+                pixel.t = raster.t;
+                pixel.point = ray.PointOnRay(raster.t);
+                pixel.point.W(1);
+            }
+            else if (!valid)
+            {
+                int primitive;
+                double t;
+                CGrPoint intersect;
+                pixel.primitive = -1;
+                if (Intersect(ray, 1e20, -1, primitive, t, intersect, CRayRecorder::PRIMARY))
+                {
+                    pixel.primitive = primitive;
+                    pixel.t = t;
+                    pixel.point = intersect;
+                }
+            }
+
+            CGrPoint color(0, 0, 0);
+            if (pixel.primitive >= 0)
+            {
+                int features = (*m_features)[pixel.primitive];
+                if (features & RAYSHADE_REFLECTIVE)
+                {
+                    RayColor(ray, color, 0, -1);
+                }
+                else
+                {
+                    CRayHit hit;
+                    hit.Set(m_geometry, pixel.primitive, pixel.t, pixel.point);
 
-            // Compute the color for the ray
-            RayColor(ray, color, 0, NULL);
+                    Cached visibility(this, sample, r, c, pixel.primitive);
+                    CRayShade shade;
+                    m_cachedkernels[features](m_lights, hit, ray, visibility, shade);
+                    color = shade.Color();
+                }
+            }
+
+            if (m_costs != NULL)
+                CostEnd(r, c, start);
 
-            // Convert the color to bytes and write to the image buffer
-            float attentuator = 0.5; 
-            m_rayimage[r][c * 3] = static_cast<BYTE>(min(max(0, color.X() * 255 * attentuator), 255));
-            m_rayimage[r][c * 3 + 1] = static_cast<BYTE>(min(max(0, color.Y() * 255 * attentuator), 255));
-            m_rayimage[r][c * 3 + 2] = static_cast<BYTE>(min(max(0, color.Z() * 255 * attentuator), 255));
+            if (add)
+                m_framebuffer.AddSample(r, c, color);
+            else
+                m_framebuffer.Fill(r, c, 1, 1, color);
         }
 
-        // Refresh the window every 50 rows to show progress
-        if ((r % 50) == 0)
+        if (!Present())
+        {
+            // Primary hits the cache did not get to are not valid
+            if (!valid)
+                m_cache->Reset();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+//
+// Name : CMyRaytraceRenderer::RenderHybrid()
+// Description : One sample at the given subpixel offset in each pixel,
+// added to the pixel or replacing it. The primary hits come from
+// rasterizing the scene, so only shadow and reflection rays are traced.
+// This always uses the depth first engine.
+//
+
+bool CMyRaytraceRenderer::RenderHybrid(const CGrPoint& jitter, bool add)
+{
+    GR_PROFILE_ZONE("RenderHybrid");
+
+    m_visibility.Build(*m_geometry, m_rayimagewidth, m_rayimageheight, m_xmin, m_xwid, m_ymin, m_yhit, jitter);
+
+    const CGrPoint one(1, 1, 1);
+    for (int r = 0; r < m_rayimageheight; r++)
+    {
+        for (int c = 0; c < m_rayimagewidth; c++)
         {
-            m_window->Invalidate();
-            MSG msg;
-            while (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE))
+            const CRayVisibilityBuffer::Pixel& pixel = m_visibility.At(r, c);
+            AllowRays(1);
+
+            CRayCostBuffer::Counters start;
+            if (m_costs != NULL)
+                CostBegin(start);
+
+            CGrPoint color(0, 0, 0);
+            if (pixel.primitive >= 0)
             {
-                TranslateMessage(&msg);
-                DispatchMessage(&msg);
+                CRay ray = PrimaryRay(c + jitter.X(), r + jitter.Y());
+                CGrPoint point = ray.PointOnRay(pixel.t);
+                point.W(1);
+
+                CRayHit hit;
+                hit.Set(m_geometry, pixel.primitive, pixel.t, point);
+
+                Immediate visibility(this, pixel.primitive, 0, one);
+                CRayShade shade;
+                m_kernels[(*m_features)[pixel.primitive]](m_lights, hit, ray, visibility, shade);
+                color = shade.Color();
             }
+
+            if (m_costs != NULL)
+                CostEnd(r, c, start);
+
+            if (add)
+                m_framebuffer.AddSample(r, c, color);
+            else
+                m_framebuffer.Fill(r, c, 1, 1, color);
         }
+
+        if (!Present())
+            return false;
     }
 
     return true;
 }
 
+//
+// Name : CMyRaytraceRenderer::Present()
+// Description : Refresh the window to show progress. To keep the
+// application responsive, this happens whenever the frame budget has
+// elapsed since the last refresh. Returns false if the render has been
+// aborted while we were processing messages.
+//
+
+bool CMyRaytraceRenderer::Present()
+{
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double, std::milli>(now - m_lastpresent).count();
+    if (elapsed < m_framebudget)
+        return true;
+
+    m_lastpresent = now;
+
+    if (m_window != NULL)
+    {
+        GR_PROFILE_ZONE("Present");
+        m_framebuffer.Resolve(m_rayimage);
+        m_window->Invalidate();
+        MSG msg;
+        while (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE))
+        {
+            TranslateMessage(&msg);
+            DispatchMessage(&msg);
+        }
+    }
+
+    return m_abort == NULL || !*m_abort;
+}
+
 double* CMyRaytraceRenderer::blinnPhongDir(const CGrPoint& lightDir, const CGrPoint& normal, float lightInt, float Kd, float Ks, float shininess, const CGrPoint& intersectionPoint)
 {
 	// Calculate diffuse and specular components
@@ -294,7 +1241,7 @@ CGrPoint CMyRaytraceRenderer::CalculateIndirectSpecular(const CRay& ray, const C
 
         // Compute color recursively for reflected ray
         CGrPoint reflectedColor;
-        RayColor(reflectedRay, reflectedColor, recurse - 1, nullptr);
+        RayColor(reflectedRay, reflectedColor, recurse - 1, -1);
 
         // Calculate specular contribution from other surfaces
         specularother = reflectedColor;
@@ -1,12 +1,29 @@
 #pragma once
 #include "graphics/GrRenderer.h"
 #include "graphics/RayIntersection.h"
+#include "graphics/GrFrameBuffer.h"
+#include "RayGeometry.h"
+#include "RayShading.h"
+#include "RayReservoirs.h"
+#include "RayVisibilityCache.h"
+#include "RayAccelerator.h"
+#include "RayKdAccelerator.h"
+#include "RayVisibilityBuffer.h"
+#include "RayCostBuffer.h"
+#include "RayWavefront.h"
+#include "RayKdTuner.h"
+#include "RayValidator.h"
+#include "RayRecorder.h"
+#include "RaySceneCache.h"
+#include "RayLightLinks.h"
+#include <chrono>
+#include <vector>
 
 class CMyRaytraceRenderer :
 	public CGrRenderer
 {
 public:
-    CMyRaytraceRenderer() { m_window = NULL; }
+    CMyRaytraceRenderer();
     int     m_rayimagewidth;
     int     m_rayimageheight;
     BYTE** m_rayimage;
@@ -14,11 +31,113 @@ public:
 
     CWnd* m_window;
 
-    CRayIntersection m_intersection;
+    // The polygons and the shading kernel of each (RAYSHADE_ features).
+    // Our own, or those of the scene cache.
+    CRayGeometry* m_geometry;
+    std::vector<unsigned char>* m_features;
+
+    // Light linking groups, also ours or the scene cache's, and the
+    // group of the polygons being rendered
+    CRayLightLinks* m_links;
+    int m_link;
 
     std::list<CGrTransform> m_mstack;
     CGrMaterial* m_material;
 
+    // Progressive refinement. The image is first traced at 1/8 resolution,
+    // then refined to 1/4, 1/2 and full resolution and finally accumulates
+    // additional jittered samples per pixel. Rendering stops as soon as the
+    // abort flag is set (for example, by a camera change).
+    void SetProgressive(bool p) { m_progressive = p; }
+    bool GetProgressive() const { return m_progressive; }
+    void SetProgressiveSamples(int n) { m_progressivesamples = n; }
+    void SetFrameBudget(double ms) { m_framebudget = ms; }
+    void SetAbortFlag(const bool* p_abort) { m_abort = p_abort; }
+
+    // Radiance accumulates here. Configure exposure and tone mapping
+    // through this before rendering.
+    CGrFrameBuffer& FrameBuffer() { return m_framebuffer; }
+
+    // How reflection paths end. FIXED_DEPTH stops at a maximum recursion
+    // depth. THROUGHPUT stops when the path throughput falls below a
+    // threshold. RUSSIAN_ROULETTE randomly stops paths with a probability
+    // based on the throughput and reweights the survivors.
+    enum Termination { FIXED_DEPTH, THROUGHPUT, RUSSIAN_ROULETTE };
+    void SetTermination(Termination t) { m_termination = t; }
+    void SetMaxDepth(int d) { m_maxdepth = d; }
+    void SetThroughputThreshold(double t) { m_throughputthreshold = t; }
+    void SetRouletteDepth(int d) { m_roulettedepth = d; }
+
+    // Maximum secondary (reflection and shadow) rays per frame, 0 for no
+    // limit. The budget is spread evenly over the pixel samples of the
+    // frame, and what a sample does not use is left to the ones after it.
+    void SetRayBudget(long long b) { m_raybudget = b; }
+    long long RayCount() const { return m_raycount; }
+
+    // Hard limit on reflection recursion for all termination modes
+    static const int MaxRecursion = 32;
+
+    // DEPTH_FIRST traces each path recursively through RayColor().
+    // WAVEFRONT traces a tile at a time breadth first (see CRayWavefront).
+    enum Engine { DEPTH_FIRST, WAVEFRONT };
+    void SetEngine(Engine e) { m_engine = e; }
+    Engine GetEngine() const { return m_engine; }
+    CRayWavefront& Wavefront() { return m_wavefront; }
+
+    // Light table. Configure lightcuts for many lights through this.
+    CRayLights& Lights() { return m_lights; }
+
+    // Reservoir direct lighting. Primary hits trace one shadow ray to a
+    // light chosen by the reservoirs, which keep their state from frame
+    // to frame. NULL shades every light.
+    void SetReservoirs(CRayReservoirs* p_reservoirs) { m_reservoirs = p_reservoirs; }
+
+    // Primary visibility cache. The full resolution pass and the jittered
+    // samples reuse the primary hits and shadow results of the last render
+    // when only the lights or materials changed. NULL traces everything.
+    void SetVisibilityCache(CRayVisibilityCache* p_cache) { m_cache = p_cache; }
+
+    // Intersection accelerator (see CRayAccelerator). It is kept from
+    // render to render, so CRayBvh only refits where polygons moved.
+    // NULL uses a kd-tree of our own (CRayKdAccelerator).
+    void SetAccelerator(CRayAccelerator* p_accelerator) { m_accelerator = p_accelerator != NULL ? p_accelerator : &m_kdtree; }
+
+    // Hybrid primary visibility. The full resolution pass finds its
+    // primary hits by rasterizing the scene (see CRayVisibilityBuffer)
+    // and only shadow and reflection rays are traced. Progressive
+    // samples rasterize their jittered primary hits the same way.
+    void SetHybrid(bool h) { m_hybrid = h; }
+
+    // Per pixel cost accounting (see CRayCostBuffer). The buffer is sized
+    // and cleared for each render. Shading is not changed, but samples
+    // are traced depth first so their costs can be charged to pixels.
+    void SetCostBuffer(CRayCostBuffer* p_costs) { m_costs = p_costs; }
+
+    // Kd-tree parameter tuning (see CRayKdTuner). A CRayKdAccelerator
+    // is built with the parameters found for the scene. Not used with
+    // the other accelerators. NULL uses the library defaults.
+    void SetKdTuner(CRayKdTuner* p_tuner) { m_kdtuner = p_tuner; }
+
+    // Accelerator validation. Once the scene is loaded every accelerator
+    // is checked against brute force on a sample of rays from this view
+    // (see CRayValidator). The render then goes on as usual.
+    void SetValidator(CRayValidator* p_validator) { m_validator = p_validator; }
+
+    // Ray capture. Every intersection query is written to the recorder
+    // with its answer, after the scene (see CRayRecorder). NULL records
+    // nothing.
+    void SetRecorder(CRayRecorder* p_recorder) { m_recorder = p_recorder; }
+
+    // Scene cache. Children of composites that did not change since the
+    // last render are skipped and keep their polygons (see
+    // CRaySceneCache). NULL emits the whole scene every render.
+    void SetSceneCache(CRaySceneCache* p_scenecache) { m_scenecache = p_scenecache; }
+
+    // Every ray intersected (primary, reflection and shadow) so far
+    unsigned long long RaysTraced() const { return m_raystraced; }
+
+    static const int ProgressiveStartBlock = 8;
+
     void SetWindow(CWnd* p_window);
     bool RendererStart();
     bool RendererEnd();
@@ -29,15 +148,145 @@ public:
     virtual void RendererRotate(double a, double x, double y, double z);
     virtual void RendererTranslate(double x, double y, double z);
     void RendererEndPolygon();
+    virtual bool RendererVisible(CGrObject* p_object);
+    virtual bool RendererReplay(CGrObject* p_object);
 
     CGrPoint Reflect(const CGrPoint& incident, const CGrPoint& normal) const;
 
-    void RayColor(const CRay& p_ray, CGrPoint& p_color, int p_recurse, const CRayIntersection::Object* p_ignore);
+    void RayColor(const CRay& p_ray, CGrPoint& p_color, int p_recurse, int p_ignore, const CGrPoint& p_throughput = CGrPoint(1, 1, 1));
 
     CGrPoint CalculateLighting(const CGrPoint& N, CGrMaterial* material, const Light& light, const CGrPoint& lightDir, const CGrPoint& intersectionPoint, CGrPoint color);
 
     CGrPoint CalculateIndirectSpecular(const CRay& ray, const CGrPoint& N, const CGrPoint& intersectionPoint, int recurse);
 
     double* blinnPhongDir(const CGrPoint& lightDir, const CGrPoint& normal, float lightInt, float Kd, float Ks, float shininess, const CGrPoint& intersectionPoint);
-};
 
+private:
+    friend class CRayWavefront;
+
+    // Depth first visibility for the shading kernels: reflections
+    // recurse and shadow rays are traced right away
+    class Immediate
+    {
+    public:
+        Immediate(CMyRaytraceRenderer* p_renderer, int p_primitive, int p_recurse, const CGrPoint& p_throughput)
+            : m_renderer(p_renderer), m_primitive(p_primitive), m_recurse(p_recurse), m_throughput(p_throughput), m_direct(true) {}
+
+        void SkipDirectLighting() { m_direct = false; }
+        bool DirectLighting() const { return m_direct; }
+        bool Reflect(CRayHit& p_hit, const CRay& p_ray, CGrPoint& p_base);
+        template <bool Multiply> void Light(CRayShade& p_shade, const CRay& p_shadow, double p_maxt, const CGrPoint& p_term, int p_light, bool p_cast);
+
+    private:
+        CMyRaytraceRenderer* m_renderer;
+        int m_primitive;        // Hit primitive, ignored by the rays it spawns
+        int m_recurse;
+        const CGrPoint& m_throughput;
+        bool m_direct;
+    };
+
+    // Visibility for primary hits served from the visibility cache.
+    // Shadow results are looked up in the cache and traced (and stored)
+    // only when unknown. Mirrors are not shaded through this.
+    class Cached
+    {
+    public:
+        Cached(CMyRaytraceRenderer* p_renderer, int p_s, int p_r, int p_c, int p_primitive)
+            : m_renderer(p_renderer), m_s(p_s), m_r(p_r), m_c(p_c), m_primitive(p_primitive) {}
+
+        bool DirectLighting() const { return true; }
+        bool Reflect(CRayHit& p_hit, const CRay& p_ray, CGrPoint& p_base) { return false; }
+        template <bool Multiply> void Light(CRayShade& p_shade, const CRay& p_shadow, double p_maxt, const CGrPoint& p_term, int p_light, bool p_cast);
+
+    private:
+        CMyRaytraceRenderer* m_renderer;
+        int m_s, m_r, m_c;
+        int m_primitive;
+    };
+
+    CRay PrimaryRay(double x, double y) const;
+    void TuneIntersection();
+    void SampleRays(int p_count, std::vector<CRay>& p_primary, std::vector<CGrPoint>& p_lights) const;
+    void TraceSamples(std::vector<CRayWavefront::Sample>& samples);
+    bool RenderLevel(int block, bool refine);
+    bool RenderSample(const CGrPoint& jitter);
+    bool RenderReservoirFrame(const CGrPoint& jitter);
+    bool RenderCached(const CGrPoint& jitter, int sample, bool valid, bool add);
+    bool RenderHybrid(const CGrPoint& jitter, bool add);
+    bool Present();
+    bool ReflectionAllowed(int recurse);
+    bool ContinuePath(const CGrPoint& throughput, int recurse, double& weight);
+    bool RayAvailable() const { return m_raybudget <= 0 || m_raycount < m_rayallowance; }
+    bool SpendRay();
+    void AllowRays(size_t samples) { m_rayallowance += m_raypersample * samples; }
+    bool Intersect(const CRay& ray, double maxt, int ignore, int& primitive, double& t, CGrPoint& intersect, CRayRecorder::Type type);
+    bool Occluded(const CRay& ray, double maxt, int ignore);
+    void CostBegin(CRayCostBuffer::Counters& start) const;
+    void CostEnd(int r, int c, const CRayCostBuffer::Counters& start);
+    double Random();
+    void StartScene();
+
+    // Bounds of all of the polygons (eye coordinates), whether some
+    // material does not cast shadows and the hashes of the scene
+    CRaySceneCache::Summary m_scene;
+
+    // Image plane extents for primary rays
+    double  m_xmin, m_xwid;
+    double  m_ymin, m_yhit;
+
+    // Polygon data for m_geometry, reused for each polygon
+    std::vector<CGrPoint> m_polyvertices;
+    std::vector<CGrPoint> m_polynormals;
+    std::vector<CGrPoint> m_polytexcoords;
+
+    CGrFrameBuffer  m_framebuffer;
+
+    // The lights in SIMD form, built in RendererStart()
+    CRayLights m_lights;
+
+    CRayGeometry m_owngeometry;
+    std::vector<unsigned char> m_ownfeatures;
+    CRayLightLinks m_ownlinks;
+    CRaySceneCache* m_scenecache;
+
+    CRayShadingTable<Immediate> m_kernels;
+
+    CRayReservoirs* m_reservoirs;
+
+    CRayVisibilityCache* m_cache;
+    CRayShadingTable<Cached> m_cachedkernels;
+
+    CRayAccelerator* m_accelerator;
+    CRayKdAccelerator m_kdtree;         // The default accelerator
+    CRayValidator* m_validator;
+    CRayRecorder* m_recorder;
+
+    bool m_hybrid;
+    CRayVisibilityBuffer m_visibility;
+
+    CRayCostBuffer* m_costs;
+    unsigned long long m_raystraced;    // Every ray intersected, for m_costs
+    CRayAccelerator::Counters m_accelwork;  // Accelerator work, counted only for m_costs
+
+    CRayKdTuner* m_kdtuner;
+
+    Engine          m_engine;
+    CRayWavefront   m_wavefront;
+    std::vector<CRayWavefront::Sample> m_tilesamples;
+
+    bool    m_progressive;
+    int     m_progressivesamples;
+    double  m_framebudget;          // Milliseconds between screen updates
+    const bool* m_abort;
+    std::chrono::steady_clock::time_point m_lastpresent;
+
+    Termination m_termination;
+    int     m_maxdepth;
+    double  m_throughputthreshold;
+    int     m_roulettedepth;
+    long long m_raybudget;
+    long long m_raycount;
+    double  m_raypersample;         // Share of the budget of each pixel sample
+    double  m_rayallowance;         // Budget of the pixel samples so far
+    unsigned int m_randomstate;
+};
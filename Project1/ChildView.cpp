@@ -8,6 +8,12 @@
 #include "ChildView.h"
 #include "graphics/OpenGLRenderer.h"
 #include "CMyRaytraceRenderer.h"
+#include "CMyRasterRenderer.h"
+#include "graphics/GrProfiler.h"
+#include "MicroBenchmarks.h"
+#include "RayRegression.h"
+#include "RayReplay.h"
+#include <thread>
 
 #ifdef _DEBUG
 #define new DEBUG_NEW
@@ -23,7 +29,26 @@ CChildView::CChildView()
 
 	// Init raytracing values
 	m_raytrace = false;
+	m_rayprogressive = false;
+	m_raywavefront = false;
+	m_rayreservoir = false;
+	m_raycache = false;
+	m_rayscenecache = false;
+	m_raybvh = false;
+	m_raywidebvh = false;
+	m_raygrid = false;
+	m_raybruteforce = false;
+	m_raykdtune = false;
+	m_rayhybrid = false;
+	m_raycosts = false;
+	m_raycapture = false;
+	m_raster = false;
+	m_rasterimage = NULL;
+	m_rasterimagewidth = 0;
+	m_rasterimageheight = 0;
 	m_rayimage = NULL;
+	m_rayrendering = false;
+	m_rayabort = false;
 
 	//
 	// Compose the Scene
@@ -131,15 +156,29 @@ CChildView::CChildView()
 CChildView::~CChildView()
 {
 	// delete image allocation
-	if (m_raytrace)
-		DeleteRaytraceImage();
+	DeleteRaytraceImage();
+	DeleteRasterImage();
 }
 
 void CChildView::DeleteRaytraceImage()
 {
 	// deallocate memory
-	delete[] m_rayimage[0];
-	delete[] m_rayimage;
+	if (m_rayimage)
+	{
+		delete[] m_rayimage[0];
+		delete[] m_rayimage;
+		m_rayimage = NULL;
+	}
+}
+
+void CChildView::DeleteRasterImage()
+{
+	if (m_rasterimage)
+	{
+		delete[] m_rasterimage[0];
+		delete[] m_rasterimage;
+		m_rasterimage = NULL;
+	}
 }
 
 BEGIN_MESSAGE_MAP(CChildView, COpenGLWnd)
@@ -149,6 +188,51 @@ BEGIN_MESSAGE_MAP(CChildView, COpenGLWnd)
 	ON_WM_MOUSEMOVE()
 	ON_COMMAND(ID_RENDER_RAYTRACE, &CChildView::OnRenderRaytrace)
 	ON_UPDATE_COMMAND_UI(ID_RENDER_RAYTRACE, &CChildView::OnUpdateRenderRaytrace)
+	ON_COMMAND(ID_RENDER_PROGRESSIVE, &CChildView::OnRenderProgressive)
+	ON_UPDATE_COMMAND_UI(ID_RENDER_PROGRESSIVE, &CChildView::OnUpdateRenderProgressive)
+	ON_COMMAND(ID_RENDER_WAVEFRONT, &CChildView::OnRenderWavefront)
+	ON_UPDATE_COMMAND_UI(ID_RENDER_WAVEFRONT, &CChildView::OnUpdateRenderWavefront)
+	ON_COMMAND(ID_RENDER_RESERVOIRS, &CChildView::OnRenderReservoirs)
+	ON_UPDATE_COMMAND_UI(ID_RENDER_RESERVOIRS, &CChildView::OnUpdateRenderReservoirs)
+	ON_COMMAND(ID_RENDER_RELIGHTCACHE, &CChildView::OnRenderRelightCache)
+	ON_UPDATE_COMMAND_UI(ID_RENDER_RELIGHTCACHE, &CChildView::OnUpdateRenderRelightCache)
+	ON_COMMAND(ID_RENDER_SCENECACHE, &CChildView::OnRenderSceneCache)
+	ON_UPDATE_COMMAND_UI(ID_RENDER_SCENECACHE, &CChildView::OnUpdateRenderSceneCache)
+	ON_COMMAND(ID_RENDER_KDTREE, &CChildView::OnRenderKdTree)
+	ON_UPDATE_COMMAND_UI(ID_RENDER_KDTREE, &CChildView::OnUpdateRenderKdTree)
+	ON_COMMAND(ID_RENDER_BVH, &CChildView::OnRenderBvh)
+	ON_UPDATE_COMMAND_UI(ID_RENDER_BVH, &CChildView::OnUpdateRenderBvh)
+	ON_COMMAND(ID_RENDER_WIDEBVH, &CChildView::OnRenderWideBvh)
+	ON_UPDATE_COMMAND_UI(ID_RENDER_WIDEBVH, &CChildView::OnUpdateRenderWideBvh)
+	ON_COMMAND(ID_RENDER_GRID, &CChildView::OnRenderGrid)
+	ON_UPDATE_COMMAND_UI(ID_RENDER_GRID, &CChildView::OnUpdateRenderGrid)
+	ON_COMMAND(ID_RENDER_BRUTEFORCE, &CChildView::OnRenderBruteForce)
+	ON_UPDATE_COMMAND_UI(ID_RENDER_BRUTEFORCE, &CChildView::OnUpdateRenderBruteForce)
+	ON_COMMAND(ID_RENDER_VALIDATE, &CChildView::OnRenderValidate)
+	ON_UPDATE_COMMAND_UI(ID_RENDER_VALIDATE, &CChildView::OnUpdateRenderBenchmarks)
+	ON_COMMAND(ID_RENDER_CAPTURE, &CChildView::OnRenderCapture)
+	ON_UPDATE_COMMAND_UI(ID_RENDER_CAPTURE, &CChildView::OnUpdateRenderCapture)
+	ON_COMMAND(ID_RENDER_REPLAY, &CChildView::OnRenderReplay)
+	ON_UPDATE_COMMAND_UI(ID_RENDER_REPLAY, &CChildView::OnUpdateRenderBenchmarks)
+	ON_COMMAND(ID_RENDER_KDTUNE, &CChildView::OnRenderKdTune)
+	ON_UPDATE_COMMAND_UI(ID_RENDER_KDTUNE, &CChildView::OnUpdateRenderKdTune)
+	ON_COMMAND(ID_RENDER_RASTER, &CChildView::OnRenderRaster)
+	ON_UPDATE_COMMAND_UI(ID_RENDER_RASTER, &CChildView::OnUpdateRenderRaster)
+	ON_COMMAND(ID_RENDER_HYBRID, &CChildView::OnRenderHybrid)
+	ON_UPDATE_COMMAND_UI(ID_RENDER_HYBRID, &CChildView::OnUpdateRenderHybrid)
+	ON_COMMAND(ID_RENDER_PROFILE, &CChildView::OnRenderProfile)
+	ON_UPDATE_COMMAND_UI(ID_RENDER_PROFILE, &CChildView::OnUpdateRenderProfile)
+	ON_COMMAND(ID_RENDER_SAVEPROFILE, &CChildView::OnRenderSaveProfile)
+	ON_COMMAND(ID_RENDER_COSTS, &CChildView::OnRenderCosts)
+	ON_UPDATE_COMMAND_UI(ID_RENDER_COSTS, &CChildView::OnUpdateRenderCosts)
+	ON_COMMAND(ID_RENDER_SAVECOSTS, &CChildView::OnRenderSaveCosts)
+	ON_UPDATE_COMMAND_UI(ID_RENDER_SAVECOSTS, &CChildView::OnUpdateRenderSaveCosts)
+	ON_COMMAND(ID_RENDER_BENCHMARKS, &CChildView::OnRenderBenchmarks)
+	ON_UPDATE_COMMAND_UI(ID_RENDER_BENCHMARKS, &CChildView::OnUpdateRenderBenchmarks)
+	ON_COMMAND(ID_RENDER_REGRESSION, &CChildView::OnRenderRegression)
+	ON_UPDATE_COMMAND_UI(ID_RENDER_REGRESSION, &CChildView::OnUpdateRenderBenchmarks)
+	ON_COMMAND(ID_RENDER_RECORDREGRESSION, &CChildView::OnRenderRecordRegression)
+	ON_UPDATE_COMMAND_UI(ID_RENDER_RECORDREGRESSION, &CChildView::OnUpdateRenderBenchmarks)
 END_MESSAGE_MAP()
 
 
@@ -170,7 +254,10 @@ BOOL CChildView::PreCreateWindow(CREATESTRUCT& cs)
 
 void CChildView::OnGLDraw(CDC* pDC)
 {
-	if (m_raytrace)
+	if (m_raster && !m_raytrace)
+		RasterScene();
+
+	if (m_raytrace || m_raster)
 	{
 		// Clear the color buffer
 		glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
@@ -188,11 +275,13 @@ void CChildView::OnGLDraw(CDC* pDC)
 		glLoadIdentity();
 
 		// If we got it, draw it
-		if (m_rayimage)
+		BYTE** image = m_raytrace ? m_rayimage : m_rasterimage;
+		if (image)
 		{
 			glRasterPos3i(0, 0, 0);
-			glDrawPixels(m_rayimagewidth, m_rayimageheight,
-				GL_RGB, GL_UNSIGNED_BYTE, m_rayimage[0]);
+			glDrawPixels(m_raytrace ? m_rayimagewidth : m_rasterimagewidth,
+				m_raytrace ? m_rayimageheight : m_rasterimageheight,
+				GL_RGB, GL_UNSIGNED_BYTE, image[0]);
 		}
 
 		glFlush();
@@ -207,6 +296,7 @@ void CChildView::OnGLDraw(CDC* pDC)
 
 		// Configure the renderer
 		ConfigureRenderer(&renderer);
+		renderer.SetBatches(&m_glbatches);
 
 		//
 		// Render the scene
@@ -227,7 +317,13 @@ void CChildView::OnLButtonDown(UINT nFlags, CPoint point)
 void CChildView::OnMouseMove(UINT nFlags, CPoint point)
 {
 	if (m_camera.MouseMove(point.x, point.y, nFlags))
+	{
+		// In progressive mode we trace while the camera moves
+		if (m_raytrace && m_rayprogressive)
+			RaytraceScene();
+
 		Invalidate();
+	}
 
 	COpenGLWnd::OnMouseMove(nFlags, point);
 }
@@ -254,24 +350,36 @@ void CChildView::ConfigureRenderer(CGrRenderer* p_renderer)
 	GetSize(width, height);
 	double aspectratio = double(width) / double(height);
 
+	ConfigureRenderer(p_renderer, m_camera, aspectratio);
+}
+
+
+//
+// Name :         CChildView::ConfigureRenderer()
+// Description :  Configures a renderer for a given camera and aspect ratio
+//                rather than the view's.
+//
+
+void CChildView::ConfigureRenderer(CGrRenderer* p_renderer, const CGrCamera& p_camera, double aspectratio)
+{
 	//
 	// Set up the camera in the renderer
 	//
 
-	p_renderer->Perspective(m_camera.FieldOfView(),
+	p_renderer->Perspective(p_camera.FieldOfView(),
 		aspectratio, // The aspect ratio.
 		20., // Near clipping
 		1000.); // Far clipping
 
-	// m_camera.FieldOfView is the vertical field of view in degrees.
+	// p_camera.FieldOfView is the vertical field of view in degrees.
 
 	//
 	// Set the camera location
 	//
 
-	p_renderer->LookAt(m_camera.Eye()[0], m_camera.Eye()[1], m_camera.Eye()[2],
-		m_camera.Center()[0], m_camera.Center()[1], m_camera.Center()[2],
-		m_camera.Up()[0], m_camera.Up()[1], m_camera.Up()[2]);
+	p_renderer->LookAt(p_camera.Eye()[0], p_camera.Eye()[1], p_camera.Eye()[2],
+		p_camera.Center()[0], p_camera.Center()[1], p_camera.Center()[2],
+		p_camera.Up()[0], p_camera.Up()[1], p_camera.Up()[2]);
 
 	//
 	// Set the light locations and colors
@@ -295,10 +403,20 @@ void CChildView::OnRenderRaytrace()
 	Invalidate();
 	if (!m_raytrace)
 	{
-		DeleteRaytraceImage();
+		// If a trace is running, it deletes the image when it stops
+		if (m_rayrendering)
+			m_rayabort = true;
+		else
+			DeleteRaytraceImage();
 		return;
 	}
 
+	// Turned back on before the trace that was asked to stop noticed.
+	// It still has the image and starts over with it.
+	if (m_rayrendering)
+		return;
+
+	DeleteRaytraceImage();
 	GetSize(m_rayimagewidth, m_rayimageheight);
 
 	m_rayimage = new BYTE * [m_rayimageheight];
@@ -323,19 +441,69 @@ void CChildView::OnRenderRaytrace()
 			m_rayimage[i][j * 3 + 2] = BYTE(255);   // blue
 		}
 	}
-	
-	// Instantiate a raytrace object
-	CMyRaytraceRenderer raytrace;
 
-	// Generic configurations for all renderers
-	ConfigureRenderer(&raytrace);
+	RaytraceScene();
+}
+
+//
+// Name :         CChildView::RaytraceScene()
+// Description :  Ray trace the scene into m_rayimage. The ray tracer
+//                processes messages while it works, so this can be
+//                called again (from a camera move) while a trace is
+//                still running. In that case we just ask the running
+//                trace to stop and it starts over with the new camera.
+//
+
+void CChildView::RaytraceScene()
+{
+	if (m_rayrendering)
+	{
+		m_rayabort = true;
+		return;
+	}
+
+	m_rayrendering = true;
+	do
+	{
+		m_rayabort = false;
+
+		// Instantiate a raytrace object
+		CMyRaytraceRenderer raytrace;
+
+		// Generic configurations for all renderers
+		ConfigureRenderer(&raytrace);
+
+		//
+		// Render the Scene
+		//
+		raytrace.SetImage(m_rayimage, m_rayimagewidth, m_rayimageheight);
+		raytrace.SetWindow(this);
+		raytrace.SetProgressive(m_rayprogressive);
+		raytrace.SetEngine(m_raywavefront ? CMyRaytraceRenderer::WAVEFRONT : CMyRaytraceRenderer::DEPTH_FIRST);
+		raytrace.SetReservoirs(m_rayreservoir ? &m_rayreservoirs : NULL);
+		raytrace.SetVisibilityCache(m_raycache ? &m_rayvisibility : NULL);
+		raytrace.SetSceneCache(m_rayscenecache ? &m_rayscene : NULL);
+		raytrace.SetAccelerator(RayAccelerator());
+		raytrace.SetKdTuner(m_raykdtune ? &m_raykdtuner : NULL);
+		raytrace.SetHybrid(m_rayhybrid);
+		raytrace.SetCostBuffer(m_raycosts ? &m_raycostbuffer : NULL);
+		raytrace.SetRecorder(m_raycapture && m_rayrecorder.Open(m_raycapturefile) ? &m_rayrecorder : NULL);
+		raytrace.SetAbortFlag(&m_rayabort);
+		raytrace.Render(m_scene);
+	} while (m_rayabort && m_raytrace);
+	m_rayrendering = false;
+
+	// A capture is of one ray trace, the last one started
+	if (m_raycapture)
+	{
+		m_rayrecorder.Close();
+		m_raycapture = false;
+	}
+
+	// Ray tracing was turned off while we were busy
+	if (!m_raytrace)
+		DeleteRaytraceImage();
 
-	//
-	// Render the Scene
-	//
-	raytrace.SetImage(m_rayimage, m_rayimagewidth, m_rayimageheight);
-	raytrace.SetWindow(this);
-	raytrace.Render(m_scene);
 	Invalidate();
 }
 
@@ -344,3 +512,498 @@ void CChildView::OnUpdateRenderRaytrace(CCmdUI* pCmdUI)
 {
 	pCmdUI->SetCheck(m_raytrace);
 }
+
+
+void CChildView::OnRenderProgressive()
+{
+	m_rayprogressive = !m_rayprogressive;
+}
+
+
+void CChildView::OnUpdateRenderProgressive(CCmdUI* pCmdUI)
+{
+	pCmdUI->SetCheck(m_rayprogressive);
+}
+
+
+void CChildView::OnRenderWavefront()
+{
+	m_raywavefront = !m_raywavefront;
+}
+
+
+void CChildView::OnUpdateRenderWavefront(CCmdUI* pCmdUI)
+{
+	pCmdUI->SetCheck(m_raywavefront);
+}
+
+
+void CChildView::OnRenderReservoirs()
+{
+	m_rayreservoir = !m_rayreservoir;
+	m_rayreservoirs.Reset();
+}
+
+
+void CChildView::OnUpdateRenderReservoirs(CCmdUI* pCmdUI)
+{
+	pCmdUI->SetCheck(m_rayreservoir);
+}
+
+
+void CChildView::OnRenderRelightCache()
+{
+	m_raycache = !m_raycache;
+	m_rayvisibility.Reset();
+}
+
+
+void CChildView::OnUpdateRenderRelightCache(CCmdUI* pCmdUI)
+{
+	pCmdUI->SetCheck(m_raycache);
+}
+
+
+void CChildView::OnRenderSceneCache()
+{
+	m_rayscenecache = !m_rayscenecache;
+	m_rayscene.Clear();
+}
+
+
+void CChildView::OnUpdateRenderSceneCache(CCmdUI* pCmdUI)
+{
+	pCmdUI->SetCheck(m_rayscenecache);
+}
+
+
+//
+// Name :         CChildView::RayAccelerator()
+// Description :  The accelerator picked on the Render menu. At most one
+//                of the others is picked, otherwise it is the kd-tree.
+//
+
+CRayAccelerator* CChildView::RayAccelerator()
+{
+	if (m_raybvh)
+		return &m_rayaccel;
+	if (m_raywidebvh)
+		return &m_raywideaccel;
+	if (m_raygrid)
+		return &m_raygridaccel;
+	if (m_raybruteforce)
+		return &m_raybruteaccel;
+	return &m_raykdaccel;
+}
+
+
+void CChildView::OnRenderKdTree()
+{
+	m_raybvh = m_raywidebvh = m_raygrid = m_raybruteforce = false;
+}
+
+
+void CChildView::OnUpdateRenderKdTree(CCmdUI* pCmdUI)
+{
+	pCmdUI->SetCheck(RayAccelerator() == &m_raykdaccel);
+}
+
+
+void CChildView::OnRenderBvh()
+{
+	m_raybvh = !m_raybvh;
+	m_raywidebvh = m_raygrid = m_raybruteforce = false;
+	m_rayaccel.Clear();
+}
+
+
+void CChildView::OnUpdateRenderBvh(CCmdUI* pCmdUI)
+{
+	pCmdUI->SetCheck(m_raybvh);
+}
+
+
+void CChildView::OnRenderWideBvh()
+{
+	m_raywidebvh = !m_raywidebvh;
+	m_raybvh = m_raygrid = m_raybruteforce = false;
+}
+
+
+void CChildView::OnUpdateRenderWideBvh(CCmdUI* pCmdUI)
+{
+	pCmdUI->SetCheck(m_raywidebvh);
+}
+
+
+void CChildView::OnRenderGrid()
+{
+	m_raygrid = !m_raygrid;
+	m_raybvh = m_raywidebvh = m_raybruteforce = false;
+}
+
+
+void CChildView::OnUpdateRenderGrid(CCmdUI* pCmdUI)
+{
+	pCmdUI->SetCheck(m_raygrid);
+}
+
+
+void CChildView::OnRenderBruteForce()
+{
+	m_raybruteforce = !m_raybruteforce;
+	m_raybvh = m_raywidebvh = m_raygrid = false;
+}
+
+
+void CChildView::OnUpdateRenderBruteForce(CCmdUI* pCmdUI)
+{
+	pCmdUI->SetCheck(m_raybruteforce);
+}
+
+
+void CChildView::OnRenderKdTune()
+{
+	m_raykdtune = !m_raykdtune;
+}
+
+
+void CChildView::OnUpdateRenderKdTune(CCmdUI* pCmdUI)
+{
+	pCmdUI->SetCheck(m_raykdtune);
+	// Only the kd-tree is tuned
+	pCmdUI->Enable(RayAccelerator() == &m_raykdaccel);
+}
+
+
+void CChildView::OnRenderHybrid()
+{
+	m_rayhybrid = !m_rayhybrid;
+	m_rayvisibility.Reset();
+}
+
+
+void CChildView::OnUpdateRenderHybrid(CCmdUI* pCmdUI)
+{
+	pCmdUI->SetCheck(m_rayhybrid);
+}
+
+
+void CChildView::OnRenderCosts()
+{
+	m_raycosts = !m_raycosts;
+	m_raycostbuffer.SetSize(0, 0);
+}
+
+
+void CChildView::OnUpdateRenderCosts(CCmdUI* pCmdUI)
+{
+	pCmdUI->SetCheck(m_raycosts);
+}
+
+
+//
+// Name :         CChildView::OnRenderSaveCosts()
+// Description :  Save the ray traced image and the cost heatmaps and raw
+//                cost buffers of it. For image.ppm the costs go in
+//                image_cycles.ppm, image_cycles.pfm and so on.
+//
+
+void CChildView::OnRenderSaveCosts()
+{
+	static _TCHAR BASED_CODE szFilter[] = TEXT("Image Files (*.ppm)|*.ppm|All Files (*.*)|*.*||");
+
+	CFileDialog dlg(FALSE, TEXT(".ppm"), NULL, OFN_OVERWRITEPROMPT, szFilter, NULL);
+	if (dlg.DoModal() != IDOK)
+		return;
+
+	std::basic_string<_TCHAR> filename(dlg.GetPathName());
+	std::basic_string<_TCHAR> base = filename;
+	size_t dot = base.find_last_of(_T('.'));
+	if (dot != std::basic_string<_TCHAR>::npos && base.find_first_of(_T("\\/"), dot) == std::basic_string<_TCHAR>::npos)
+		base.erase(dot);
+
+	if (!CRayCostBuffer::WritePPM(filename.c_str(), m_rayimage, m_rayimagewidth, m_rayimageheight) ||
+		!m_raycostbuffer.Write(base))
+		AfxMessageBox(TEXT("Unable to write the cost images"));
+}
+
+
+void CChildView::OnUpdateRenderSaveCosts(CCmdUI* pCmdUI)
+{
+	// Only once a ray trace with costs has finished
+	pCmdUI->Enable(m_raycosts && m_raytrace && !m_rayrendering && m_rayimage != NULL &&
+		m_raycostbuffer.Width() == m_rayimagewidth && m_raycostbuffer.Height() == m_rayimageheight);
+}
+
+
+//
+// Name :         CChildView::RasterScene()
+// Description :  Draw the scene with the software rasterizer into
+//                m_rasterimage, reallocated when the window size changes.
+//
+
+void CChildView::RasterScene()
+{
+	int width, height;
+	GetSize(width, height);
+	if (width <= 0 || height <= 0)
+		return;
+
+	if (m_rasterimage == NULL || width != m_rasterimagewidth || height != m_rasterimageheight)
+	{
+		DeleteRasterImage();
+		m_rasterimagewidth = width;
+		m_rasterimageheight = height;
+
+		int rowwid = m_rasterimagewidth * 3;
+		while (rowwid % 4)
+			rowwid++;
+
+		m_rasterimage = new BYTE * [m_rasterimageheight];
+		m_rasterimage[0] = new BYTE[m_rasterimageheight * rowwid];
+		for (int i = 1; i < m_rasterimageheight; i++)
+		{
+			m_rasterimage[i] = m_rasterimage[0] + i * rowwid;
+		}
+	}
+
+	CMyRasterRenderer raster;
+	ConfigureRenderer(&raster);
+	raster.SetImage(m_rasterimage, m_rasterimagewidth, m_rasterimageheight);
+	raster.Render(m_scene);
+}
+
+
+void CChildView::OnRenderRaster()
+{
+	m_raster = !m_raster;
+	if (!m_raster)
+		DeleteRasterImage();
+	Invalidate();
+}
+
+
+void CChildView::OnUpdateRenderRaster(CCmdUI* pCmdUI)
+{
+	pCmdUI->SetCheck(m_raster);
+}
+
+
+//
+// Name :         CChildView::OnRenderProfile()
+// Description :  Start or stop recording profiler zones. Starting
+//                discards whatever was recorded before.
+//
+
+void CChildView::OnRenderProfile()
+{
+	if (!CGrProfiler::Enabled())
+	{
+		CGrProfiler::Clear();
+		GR_PROFILE_THREAD("User interface");
+	}
+
+	CGrProfiler::Enable(!CGrProfiler::Enabled());
+}
+
+
+void CChildView::OnUpdateRenderProfile(CCmdUI* pCmdUI)
+{
+	pCmdUI->SetCheck(CGrProfiler::Enabled());
+}
+
+
+//
+// Name :         CChildView::OnRenderSaveProfile()
+// Description :  Save the recorded zones as a Chrome trace, which
+//                chrome://tracing or ui.perfetto.dev can open.
+//
+
+void CChildView::OnRenderSaveProfile()
+{
+	// Events can't be read while a render is adding them
+	if (m_rayrendering)
+		return;
+
+	static _TCHAR BASED_CODE szFilter[] = TEXT("Trace Files (*.json)|*.json|All Files (*.*)|*.*||");
+
+	CFileDialog dlg(FALSE, TEXT(".json"), NULL, OFN_OVERWRITEPROMPT, szFilter, NULL);
+	if (dlg.DoModal() != IDOK)
+		return;
+
+	if (!CGrProfiler::Export(dlg.GetPathName()))
+		AfxMessageBox(TEXT("Unable to write the trace file"));
+}
+
+
+//
+// Name :         CChildView::OnRenderBenchmarks()
+// Description :  Time the math, texture and intersection primitives
+//                and show the results.
+//
+
+void CChildView::OnRenderBenchmarks()
+{
+	CMicroBenchmarks benchmarks;
+	{
+		CWaitCursor wait;
+		benchmarks.Run();
+	}
+
+	AfxMessageBox(CString(benchmarks.Report().c_str()), MB_ICONINFORMATION);
+}
+
+
+void CChildView::OnUpdateRenderBenchmarks(CCmdUI* pCmdUI)
+{
+	// The timings would include the ray trace
+	pCmdUI->Enable(!m_rayrendering);
+}
+
+
+//
+// Name :         CChildView::RunRegression()
+// Description :  Render the regression cases from a fixed camera (the one
+//                the view starts with) and either record them as the
+//                references and baseline or check them against those.
+//                The files are kept in the regression directory.
+//
+
+void CChildView::RunRegression(bool p_record)
+{
+	CGrCamera camera;
+	camera.Set(30., 15., 80., 0., 0., 0., 0., 1., 0.);
+
+	CRayRegression regression;
+	regression.SetDirectory(_T("regression\\"));
+	CreateDirectory(_T("regression"), NULL);
+
+	bool passed;
+	{
+		CWaitCursor wait;
+		CRayRegression::Configure configure = [this, &camera](CGrRenderer* p_renderer, int p_width, int p_height) {
+			ConfigureRenderer(p_renderer, camera, double(p_width) / double(p_height));
+		};
+
+		passed = p_record ? regression.Record(m_scene, configure) : regression.Check(m_scene, configure);
+	}
+
+	std::string report = regression.Report();
+	if (p_record)
+		report = (passed ? "Recorded the regression baseline\n\n" : "Unable to record the regression baseline\n\n") + report;
+	else
+		report = (passed ? "All regression cases passed\n\n" : "Regression cases failed\n\n") + report;
+
+	AfxMessageBox(CString(report.c_str()), passed ? MB_ICONINFORMATION : MB_ICONWARNING);
+}
+
+
+void CChildView::OnRenderRegression()
+{
+	RunRegression(false);
+}
+
+
+void CChildView::OnRenderRecordRegression()
+{
+	RunRegression(true);
+}
+
+
+//
+// Name :         CChildView::OnRenderValidate()
+// Description :  Check every accelerator against brute force on rays
+//                from the current view. The scene is loaded through a
+//                small ray trace that is not shown.
+//
+
+void CChildView::OnRenderValidate()
+{
+	const int width = 80, height = 60;
+	std::vector<BYTE> image(width * height * 3);
+	std::vector<BYTE*> rows(height);
+	for (int r = 0; r < height; r++)
+		rows[r] = &image[r * width * 3];
+
+	int viewwidth, viewheight;
+	GetSize(viewwidth, viewheight);
+
+	CRayValidator validator;
+	{
+		CWaitCursor wait;
+		CMyRaytraceRenderer raytrace;
+		ConfigureRenderer(&raytrace, m_camera, viewheight > 0 ? double(viewwidth) / double(viewheight) : 1.);
+		raytrace.SetImage(&rows[0], width, height);
+		raytrace.SetProgressive(false);
+		raytrace.SetValidator(&validator);
+		raytrace.Render(m_scene);
+	}
+
+	AfxMessageBox(CString(validator.Report().c_str()), validator.Passed() ? MB_ICONINFORMATION : MB_ICONWARNING);
+}
+
+
+//
+// Name :         CChildView::OnRenderCapture()
+// Description :  Capture the rays of the next ray trace to a file for
+//                CChildView::OnRenderReplay(). If ray tracing is on the
+//                trace starts over to be captured.
+//
+
+void CChildView::OnRenderCapture()
+{
+	if (m_raycapture)
+	{
+		m_raycapture = false;
+		return;
+	}
+
+	static _TCHAR BASED_CODE szFilter[] = TEXT("Ray Captures (*.rays)|*.rays|All Files (*.*)|*.*||");
+
+	CFileDialog dlg(FALSE, TEXT(".rays"), NULL, OFN_OVERWRITEPROMPT, szFilter, NULL);
+	if (dlg.DoModal() != IDOK)
+		return;
+
+	m_raycapturefile = dlg.GetPathName();
+	m_raycapture = true;
+
+	if (m_raytrace)
+		RaytraceScene();
+}
+
+
+void CChildView::OnUpdateRenderCapture(CCmdUI* pCmdUI)
+{
+	pCmdUI->SetCheck(m_raycapture);
+}
+
+
+//
+// Name :         CChildView::OnRenderReplay()
+// Description :  Replay a ray capture through each accelerator, on one
+//                thread and on all of them, and show the throughput.
+//
+
+void CChildView::OnRenderReplay()
+{
+	static _TCHAR BASED_CODE szFilter[] = TEXT("Ray Captures (*.rays)|*.rays|All Files (*.*)|*.*||");
+
+	CFileDialog dlg(TRUE, TEXT(".rays"), NULL, OFN_FILEMUSTEXIST, szFilter, NULL);
+	if (dlg.DoModal() != IDOK)
+		return;
+
+	CRayReplay replay;
+	{
+		CWaitCursor wait;
+		if (!replay.Load(std::basic_string<_TCHAR>(dlg.GetPathName())))
+		{
+			AfxMessageBox(TEXT("Unable to read the ray capture"));
+			return;
+		}
+
+		replay.RunAll(max(1, int(std::thread::hardware_concurrency())));
+	}
+
+	AfxMessageBox(CString(replay.Report().c_str()), MB_ICONINFORMATION);
+}
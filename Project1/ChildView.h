@@ -8,6 +8,18 @@
 #include "graphics/GrCamera.h"
 #include "graphics/GrObject.h"
 #include "graphics/GrTexture.h"
+#include "graphics/GrBatches.h"
+#include "RayReservoirs.h"
+#include "RayVisibilityCache.h"
+#include "RayBvh.h"
+#include "RayGrid.h"
+#include "RayWideBvh.h"
+#include "RayKdAccelerator.h"
+#include "RayKdTuner.h"
+#include "RayCostBuffer.h"
+#include "RayRecorder.h"
+#include "RaySceneCache.h"
+#include <string>
 
 // CChildView window
 
@@ -22,6 +34,19 @@ public:
 	CGrCamera m_camera;
 	CGrPtr<CGrObject> m_scene;
 	bool m_raytrace;
+	bool m_rayprogressive;
+	bool m_raywavefront;
+	bool m_rayreservoir;
+	bool m_raycache;
+	bool m_rayscenecache;
+	bool m_raybvh;
+	bool m_raywidebvh;
+	bool m_raygrid;
+	bool m_raybruteforce;
+	bool m_raykdtune;
+	bool m_rayhybrid;
+	bool m_raycosts;
+	bool m_raster;
 
 	// Textures for scene
 	CGrTexture m_worldtex;
@@ -33,12 +58,60 @@ private:
 	BYTE** m_rayimage;
 	int    m_rayimagewidth;
 	int    m_rayimageheight;
+	bool   m_rayrendering;	// A ray trace is in progress
+	bool   m_rayabort;		// Set to stop the ray trace in progress
+
+	// Reservoir lighting state carried from one ray trace to the next
+	CRayReservoirs m_rayreservoirs;
+
+	// Primary hits and shadows of the last ray trace, for fast relighting
+	CRayVisibilityCache m_rayvisibility;
+
+	// Polygons kept from one ray trace to the next, so only the parts
+	// of the scene graph that changed are emitted again
+	CRaySceneCache m_rayscene;
+
+	// Hierarchy refit from one ray trace to the next
+	CRayBvh m_rayaccel;
+
+	// The kd-tree, used unless another accelerator is picked
+	CRayKdAccelerator m_raykdaccel;
+
+	// The other accelerators that can be picked instead
+	CRayWideBvh m_raywideaccel;
+	CRayGrid m_raygridaccel;
+	CRayBruteForce m_raybruteaccel;
+
+	// Kd-tree parameters found for each scene
+	CRayKdTuner m_raykdtuner;
+
+	// What each pixel of the last ray trace cost
+	CRayCostBuffer m_raycostbuffer;
+
+	// Capture of the rays of the next ray trace
+	bool m_raycapture;
+	std::basic_string<_TCHAR> m_raycapturefile;
+	CRayRecorder m_rayrecorder;
+
+	// Polygon batches of the OpenGL preview, kept until the scene changes
+	CGrBatches m_glbatches;
+
+	// Image from the software rasterizer
+	BYTE** m_rasterimage;
+	int    m_rasterimagewidth;
+	int    m_rasterimageheight;
 
 // Operations
 public:
 	void OnGLDraw(CDC* pDC);
 	void ConfigureRenderer(CGrRenderer* p_renderer);
+	void ConfigureRenderer(CGrRenderer* p_renderer, const CGrCamera& p_camera, double aspectratio);
 	void DeleteRaytraceImage();
+	void RaytraceScene();
+	void RasterScene();
+	void DeleteRasterImage();
+	void RunRegression(bool p_record);
+	CRayAccelerator* RayAccelerator();
 	
 // Overrides
 	protected:
@@ -57,5 +130,46 @@ public:
 	afx_msg void OnMouseMove(UINT nFlags, CPoint point);
 	afx_msg void OnRenderRaytrace();
 	afx_msg void OnUpdateRenderRaytrace(CCmdUI* pCmdUI);
+	afx_msg void OnRenderProgressive();
+	afx_msg void OnUpdateRenderProgressive(CCmdUI* pCmdUI);
+	afx_msg void OnRenderWavefront();
+	afx_msg void OnUpdateRenderWavefront(CCmdUI* pCmdUI);
+	afx_msg void OnRenderReservoirs();
+	afx_msg void OnUpdateRenderReservoirs(CCmdUI* pCmdUI);
+	afx_msg void OnRenderRelightCache();
+	afx_msg void OnUpdateRenderRelightCache(CCmdUI* pCmdUI);
+	afx_msg void OnRenderSceneCache();
+	afx_msg void OnUpdateRenderSceneCache(CCmdUI* pCmdUI);
+	afx_msg void OnRenderKdTree();
+	afx_msg void OnUpdateRenderKdTree(CCmdUI* pCmdUI);
+	afx_msg void OnRenderBvh();
+	afx_msg void OnUpdateRenderBvh(CCmdUI* pCmdUI);
+	afx_msg void OnRenderWideBvh();
+	afx_msg void OnUpdateRenderWideBvh(CCmdUI* pCmdUI);
+	afx_msg void OnRenderGrid();
+	afx_msg void OnUpdateRenderGrid(CCmdUI* pCmdUI);
+	afx_msg void OnRenderBruteForce();
+	afx_msg void OnUpdateRenderBruteForce(CCmdUI* pCmdUI);
+	afx_msg void OnRenderValidate();
+	afx_msg void OnRenderKdTune();
+	afx_msg void OnUpdateRenderKdTune(CCmdUI* pCmdUI);
+	afx_msg void OnRenderRaster();
+	afx_msg void OnUpdateRenderRaster(CCmdUI* pCmdUI);
+	afx_msg void OnRenderHybrid();
+	afx_msg void OnUpdateRenderHybrid(CCmdUI* pCmdUI);
+	afx_msg void OnRenderProfile();
+	afx_msg void OnUpdateRenderProfile(CCmdUI* pCmdUI);
+	afx_msg void OnRenderSaveProfile();
+	afx_msg void OnRenderCosts();
+	afx_msg void OnUpdateRenderCosts(CCmdUI* pCmdUI);
+	afx_msg void OnRenderSaveCosts();
+	afx_msg void OnUpdateRenderSaveCosts(CCmdUI* pCmdUI);
+	afx_msg void OnRenderBenchmarks();
+	afx_msg void OnUpdateRenderBenchmarks(CCmdUI* pCmdUI);
+	afx_msg void OnRenderRegression();
+	afx_msg void OnRenderRecordRegression();
+	afx_msg void OnRenderCapture();
+	afx_msg void OnUpdateRenderCapture(CCmdUI* pCmdUI);
+	afx_msg void OnRenderReplay();
 };
 
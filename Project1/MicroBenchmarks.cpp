@@ -0,0 +1,440 @@
+//
+// Name :         MicroBenchmarks.cpp
+// Description :  Implementation of CMicroBenchmarks. Every operation is a
+//                lambda that performs n operations and returns a value
+//                that depends on all of them.
+//
+
+#include "pch.h"
+#include "MicroBenchmarks.h"
+#include "graphics/GrTransform.h"
+#include "graphics/GrTexture.h"
+#include "graphics/RayIntersection.h"
+#include "RayBvh.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <emmintrin.h>
+
+namespace
+{
+    double Median(std::vector<double> values)
+    {
+        size_t half = values.size() / 2;
+        std::nth_element(values.begin(), values.begin() + half, values.end());
+        double median = values[half];
+        if (values.size() % 2 == 0)
+            median = (median + *std::max_element(values.begin(), values.begin() + half)) / 2;
+        return median;
+    }
+}
+
+CMicroBenchmarks::CMicroBenchmarks()
+{
+    m_repetitions = 15;
+    m_mintime = 5;
+    m_sink = 0;
+}
+
+//
+// Name : CMicroBenchmarks::Run()
+// Description : Run every benchmark. Results of an earlier run are
+// discarded.
+//
+
+void CMicroBenchmarks::Run()
+{
+    m_results.clear();
+
+    PointBenchmarks();
+    TransformBenchmarks();
+    TextureBenchmarks();
+    IntersectionBenchmarks();
+}
+
+//
+// Name : CMicroBenchmarks::Report()
+// Description : A table of the results as text.
+//
+
+std::string CMicroBenchmarks::Report() const
+{
+    std::string report;
+    char line[160];
+    snprintf(line, sizeof(line), "%-36s %10s %9s %10s\n", "Benchmark", "ns/op", "MAD", "Mop/s");
+    report += line;
+
+    for (size_t i = 0; i < m_results.size(); i++)
+    {
+        const Result& result = m_results[i];
+        snprintf(line, sizeof(line), "%-36s %10.2f %9.2f %10.1f\n", result.name.c_str(),
+            result.median, result.mad, result.throughput);
+        report += line;
+    }
+
+    return report;
+}
+
+//
+// Name : CMicroBenchmarks::Time()
+// Description : Milliseconds to perform n operations.
+//
+
+template <class F> double CMicroBenchmarks::Time(F& p_operation, long long n)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    double result = p_operation(n);
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+    m_sink = m_sink + result;
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+//
+// Name : CMicroBenchmarks::Measure()
+// Description : Warm up until one repetition takes long enough to time,
+// then time the repetitions.
+//
+
+template <class F> void CMicroBenchmarks::Measure(const char* p_name, F p_operation)
+{
+    long long n = DataSize;
+    while (Time(p_operation, n) < m_mintime && n < (1LL << 40))
+        n *= 2;
+
+    std::vector<double> ns(max(m_repetitions, 1));
+    for (size_t r = 0; r < ns.size(); r++)
+        ns[r] = Time(p_operation, n) * 1e6 / n;
+
+    Result result;
+    result.name = p_name;
+    result.median = Median(ns);
+
+    std::vector<double> deviations(ns.size());
+    for (size_t r = 0; r < ns.size(); r++)
+        deviations[r] = fabs(ns[r] - result.median);
+    result.mad = Median(deviations);
+
+    result.throughput = result.median > 0 ? 1e3 / result.median : 0;
+    m_results.push_back(result);
+}
+
+//
+// Name : CMicroBenchmarks::PointBenchmarks()
+// Description : CGrPoint arithmetic, Dot3, Cross3 and Normalize3.
+//
+
+void CMicroBenchmarks::PointBenchmarks()
+{
+    std::mt19937 random(1);
+    std::uniform_real_distribution<double> uniform(-1, 1);
+
+    std::vector<CGrPoint> a(DataSize), b(DataSize);
+    std::vector<double> ax(DataSize), ay(DataSize), az(DataSize);
+    std::vector<double> bx(DataSize), by(DataSize), bz(DataSize);
+    for (int i = 0; i < DataSize; i++)
+    {
+        a[i].Set(uniform(random), uniform(random), uniform(random), 0);
+        b[i].Set(uniform(random), uniform(random), uniform(random), 0);
+        ax[i] = a[i].X();  ay[i] = a[i].Y();  az[i] = a[i].Z();
+        bx[i] = b[i].X();  by[i] = b[i].Y();  bz[i] = b[i].Z();
+    }
+
+    const int mask = DataSize - 1;
+
+    Measure("CGrPoint +", [&](long long n) {
+        CGrPoint sum(0, 0, 0, 0);
+        for (long long k = 0; k < n; k++)
+            sum += a[k & mask] + b[k & mask];
+        return sum.X() + sum.Y();
+    });
+
+    Measure("CGrPoint * double", [&](long long n) {
+        CGrPoint sum(0, 0, 0, 0);
+        for (long long k = 0; k < n; k++)
+            sum += a[k & mask] * 0.5;
+        return sum.X() + sum.Y();
+    });
+
+    Measure("Dot3", [&](long long n) {
+        double sum = 0;
+        for (long long k = 0; k < n; k++)
+            sum += Dot3(a[k & mask], b[k & mask]);
+        return sum;
+    });
+
+    Measure("Dot3 (SSE2, 2 wide)", [&](long long n) {
+        __m128d sum = _mm_setzero_pd();
+        for (long long k = 0; k < n; k += 2)
+        {
+            int i = int(k & mask);
+            __m128d d = _mm_mul_pd(_mm_loadu_pd(&ax[i]), _mm_loadu_pd(&bx[i]));
+            d = _mm_add_pd(d, _mm_mul_pd(_mm_loadu_pd(&ay[i]), _mm_loadu_pd(&by[i])));
+            d = _mm_add_pd(d, _mm_mul_pd(_mm_loadu_pd(&az[i]), _mm_loadu_pd(&bz[i])));
+            sum = _mm_add_pd(sum, d);
+        }
+        double s[2];
+        _mm_storeu_pd(s, sum);
+        return s[0] + s[1];
+    });
+
+    Measure("Cross3", [&](long long n) {
+        CGrPoint sum(0, 0, 0, 0);
+        for (long long k = 0; k < n; k++)
+            sum += Cross3(a[k & mask], b[k & mask]);
+        return sum.X() + sum.Y() + sum.Z();
+    });
+
+    Measure("Normalize3", [&](long long n) {
+        CGrPoint sum(0, 0, 0, 0);
+        for (long long k = 0; k < n; k++)
+            sum += Normalize3(a[k & mask]);
+        return sum.X() + sum.Y() + sum.Z();
+    });
+
+    // The unit vectors are summed by component, as the scalar version does
+    Measure("Normalize3 (SSE2, 2 wide)", [&](long long n) {
+        __m128d sumx = _mm_setzero_pd();
+        __m128d sumy = _mm_setzero_pd();
+        __m128d sumz = _mm_setzero_pd();
+        const __m128d one = _mm_set1_pd(1.);
+        for (long long k = 0; k < n; k += 2)
+        {
+            int i = int(k & mask);
+            __m128d x = _mm_loadu_pd(&ax[i]);
+            __m128d y = _mm_loadu_pd(&ay[i]);
+            __m128d z = _mm_loadu_pd(&az[i]);
+            __m128d l = _mm_add_pd(_mm_add_pd(_mm_mul_pd(x, x), _mm_mul_pd(y, y)), _mm_mul_pd(z, z));
+            __m128d inverse = _mm_div_pd(one, _mm_sqrt_pd(l));
+            sumx = _mm_add_pd(sumx, _mm_mul_pd(x, inverse));
+            sumy = _mm_add_pd(sumy, _mm_mul_pd(y, inverse));
+            sumz = _mm_add_pd(sumz, _mm_mul_pd(z, inverse));
+        }
+        double s[2];
+        _mm_storeu_pd(s, _mm_add_pd(_mm_add_pd(sumx, sumy), sumz));
+        return s[0] + s[1];
+    });
+}
+
+//
+// Name : CMicroBenchmarks::TransformBenchmarks()
+// Description : CGrTransform product, point transform and
+// SetAffineInverse.
+//
+
+void CMicroBenchmarks::TransformBenchmarks()
+{
+    std::mt19937 random(2);
+    std::uniform_real_distribution<double> uniform(-1, 1);
+
+    // Rigid transforms, so products stay well scaled
+    const int transforms = 16;
+    std::vector<CGrTransform> t(transforms);
+    for (int i = 0; i < transforms; i++)
+    {
+        CGrTransform r, s;
+        r.SetRotate(uniform(random) * 180, CGrPoint(uniform(random), uniform(random), 1, 0));
+        s.SetTranslate(uniform(random), uniform(random), uniform(random));
+        t[i] = s * r;
+    }
+
+    std::vector<CGrPoint> p(DataSize);
+    for (int i = 0; i < DataSize; i++)
+        p[i].Set(uniform(random), uniform(random), uniform(random), 1);
+
+    const int mask = DataSize - 1;
+    const int tmask = transforms - 1;
+
+    Measure("CGrTransform * CGrTransform", [&](long long n) {
+        double sum = 0;
+        for (long long k = 0; k < n; k++)
+        {
+            CGrTransform c = t[k & tmask] * t[(k + 1) & tmask];
+            sum += c[0][0] + c[2][3];
+        }
+        return sum;
+    });
+
+    Measure("CGrTransform * CGrTransform (SSE2)", [&](long long n) {
+        double sum = 0;
+        CGrTransform c;
+        for (long long k = 0; k < n; k++)
+        {
+            const CGrTransform& ta = t[k & tmask];
+            const CGrTransform& tb = t[(k + 1) & tmask];
+            for (int r = 0; r < 4; r++)
+            {
+                __m128d lo = _mm_setzero_pd();
+                __m128d hi = _mm_setzero_pd();
+                for (int j = 0; j < 4; j++)
+                {
+                    __m128d s = _mm_set1_pd(ta[r][j]);
+                    lo = _mm_add_pd(lo, _mm_mul_pd(s, _mm_loadu_pd(&tb[j][0])));
+                    hi = _mm_add_pd(hi, _mm_mul_pd(s, _mm_loadu_pd(&tb[j][2])));
+                }
+                _mm_storeu_pd(&c[r][0], lo);
+                _mm_storeu_pd(&c[r][2], hi);
+            }
+            sum += c[0][0] + c[2][3];
+        }
+        return sum;
+    });
+
+    Measure("CGrTransform * CGrPoint", [&](long long n) {
+        CGrPoint sum(0, 0, 0, 0);
+        for (long long k = 0; k < n; k++)
+            sum += t[k & tmask] * p[k & mask];
+        return sum.X() + sum.Y() + sum.Z();
+    });
+
+    // The columns of each transform, for the SSE2 point transform
+    std::vector<double> columns(transforms * 16);
+    for (int i = 0; i < transforms; i++)
+    {
+        for (int c = 0; c < 4; c++)
+        {
+            for (int r = 0; r < 4; r++)
+                columns[i * 16 + c * 4 + r] = t[i][r][c];
+        }
+    }
+
+    Measure("CGrTransform * CGrPoint (SSE2)", [&](long long n) {
+        __m128d lo = _mm_setzero_pd();
+        __m128d hi = _mm_setzero_pd();
+        for (long long k = 0; k < n; k++)
+        {
+            const double* m = &columns[(k & tmask) * 16];
+            const CGrPoint& v = p[k & mask];
+            for (int c = 0; c < 4; c++)
+            {
+                __m128d s = _mm_set1_pd(v[c]);
+                lo = _mm_add_pd(lo, _mm_mul_pd(s, _mm_loadu_pd(m + c * 4)));
+                hi = _mm_add_pd(hi, _mm_mul_pd(s, _mm_loadu_pd(m + c * 4 + 2)));
+            }
+        }
+        double s[4];
+        _mm_storeu_pd(s, lo);
+        _mm_storeu_pd(s + 2, hi);
+        return s[0] + s[1] + s[2];
+    });
+
+    Measure("CGrTransform::SetAffineInverse", [&](long long n) {
+        double sum = 0;
+        CGrTransform inverse;
+        for (long long k = 0; k < n; k++)
+        {
+            inverse.SetAffineInverse(t[k & tmask]);
+            sum += inverse[0][3];
+        }
+        return sum;
+    });
+}
+
+//
+// Name : CMicroBenchmarks::TextureBenchmarks()
+// Description : CGrTexture::Sample at random texture coordinates.
+//
+
+void CMicroBenchmarks::TextureBenchmarks()
+{
+    std::mt19937 random(3);
+    std::uniform_real_distribution<double> uniform(0, 1);
+
+    CGrTexture texture;
+    texture.SetSize(256, 256);
+    for (int y = 0; y < 256; y++)
+    {
+        for (int x = 0; x < 256; x++)
+            texture.Set(x, y, x, y, x ^ y);
+    }
+
+    std::vector<double> u(DataSize), v(DataSize);
+    for (int i = 0; i < DataSize; i++)
+    {
+        u[i] = uniform(random);
+        v[i] = uniform(random);
+    }
+
+    const int mask = DataSize - 1;
+
+    Measure("CGrTexture::Sample", [&](long long n) {
+        CGrPoint sum(0, 0, 0, 0);
+        for (long long k = 0; k < n; k++)
+            sum += texture.Sample(u[k & mask], v[k & mask]);
+        return sum.X() + sum.Y() + sum.Z();
+    });
+}
+
+//
+// Name : CMicroBenchmarks::IntersectionBenchmarks()
+// Description : Nearest hit queries on a cloud of small random triangles,
+// through the intersection system and through CRayBvh.
+//
+
+void CMicroBenchmarks::IntersectionBenchmarks()
+{
+    std::mt19937 random(4);
+    std::uniform_real_distribution<double> uniform(-1, 1);
+
+    const int triangles = 4096;
+    CRayIntersection intersection;
+    CRayGeometry geometry;
+    intersection.Initialize();
+
+    std::vector<CGrPoint> vertices(3), none;
+    for (int i = 0; i < triangles; i++)
+    {
+        CGrPoint center(uniform(random) * 50, uniform(random) * 50, uniform(random) * 50);
+        for (int v = 0; v < 3; v++)
+            vertices[v] = center + CGrPoint(uniform(random) * 2, uniform(random) * 2, uniform(random) * 2, 0);
+
+        geometry.AddPolygon(NULL, NULL, vertices, none, none);
+        intersection.PolygonBegin();
+        for (int v = 0; v < 3; v++)
+            intersection.Vertex(vertices[v]);
+        intersection.PolygonEnd();
+    }
+
+    intersection.LoadingComplete();
+
+    CRayBvh bvh;
+    bvh.Update(geometry);
+
+    // Rays from outside the cloud toward random points in it
+    std::vector<CRay> rays(DataSize);
+    for (int i = 0; i < DataSize; i++)
+    {
+        CGrPoint origin(uniform(random) * 100, uniform(random) * 100, 100);
+        CGrPoint target(uniform(random) * 40, uniform(random) * 40, uniform(random) * 40);
+        rays[i] = CRay(origin, Normalize3(target - origin));
+    }
+
+    const int mask = DataSize - 1;
+
+    Measure("CRayIntersection::Intersect", [&](long long n) {
+        double sum = 0;
+        for (long long k = 0; k < n; k++)
+        {
+            const CRayIntersection::Object* nearest;
+            double t;
+            CGrPoint intersect;
+            if (intersection.Intersect(rays[k & mask], 1e20, NULL, nearest, t, intersect))
+                sum += t;
+        }
+        return sum;
+    });
+
+    Measure("CRayBvh::Intersect", [&](long long n) {
+        double sum = 0;
+        for (long long k = 0; k < n; k++)
+        {
+            int primitive;
+            double t;
+            if (bvh.Intersect(rays[k & mask], 1e20, -1, primitive, t))
+                sum += t;
+        }
+        return sum;
+    });
+}
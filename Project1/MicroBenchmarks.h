@@ -0,0 +1,74 @@
+//
+// Name :         MicroBenchmarks.h
+// Description :  Header for CMicroBenchmarks, timing of the math, texture
+//                and intersection primitives the renderers are built on.
+//                See MicroBenchmarks.cpp
+//
+
+#pragma once
+#include <string>
+#include <vector>
+
+//
+// Each benchmark applies one operation to a table of DataSize random
+// inputs, so the compiler can not fold it away and the inputs stay in
+// the cache. It is first run with a doubling operation count until one
+// run takes at least the minimum time (which doubles as the warmup),
+// then timed for a number of repetitions. The median and the median
+// absolute deviation of the time per operation are reported, which a
+// stray interrupt or page fault does not move.
+//
+// Where it makes sense there is also an SSE2 variant that does the same
+// work two doubles at a time, to show what vectorizing the scalar
+// CGrPoint and CGrTransform code would be worth.
+//
+// It runs from the Render menu (see CChildView::OnRenderBenchmarks) and
+// is built with the application. The benchmarks themselves show no user
+// interface, but CGrTexture brings in MFC and the OpenGL headers, the
+// intersection benchmarks link the CRayIntersection DLL and max() is the
+// Windows macro from the precompiled header.
+//
+
+class CMicroBenchmarks
+{
+public:
+    CMicroBenchmarks();
+
+    static const int DataSize = 1024;       // Inputs per table, a power of 2
+
+    struct Result
+    {
+        std::string name;
+        double  median;         // Nanoseconds per operation
+        double  mad;            // Median absolute deviation, nanoseconds
+        double  throughput;     // Millions of operations per second
+    };
+
+    void SetRepetitions(int n) { m_repetitions = n; }
+    void SetMinTime(double ms) { m_mintime = ms; }
+
+    // Run every benchmark
+    void Run();
+
+    const std::vector<Result>& Results() const { return m_results; }
+
+    // One line per benchmark
+    std::string Report() const;
+
+private:
+    template <class F> void Measure(const char* p_name, F p_operation);
+    template <class F> double Time(F& p_operation, long long n);
+
+    void PointBenchmarks();
+    void TransformBenchmarks();
+    void TextureBenchmarks();
+    void IntersectionBenchmarks();
+
+    int     m_repetitions;
+    double  m_mintime;          // Milliseconds per repetition, at least
+
+    std::vector<Result> m_results;
+
+    // Results are added here so the work is not optimized away
+    volatile double m_sink;
+};
@@ -0,0 +1,74 @@
+//
+// Name :         RayAccelerator.cpp
+// Description :  Implementation of CRayAccelerator and CRayBruteForce.
+//
+
+#include "pch.h"
+#include "RayAccelerator.h"
+
+bool CRayAccelerator::Occluded(const CRay& p_ray, double p_maxt, int p_ignore, Counters* p_counters) const
+{
+    int primitive;
+    double t;
+    return Intersect(p_ray, p_maxt, p_ignore, primitive, t, p_counters);
+}
+
+void CRayAccelerator::HitInfo(const CRay& p_ray, int p_primitive, double p_t, CRayHit& p_hit) const
+{
+    CGrPoint point = p_ray.PointOnRay(p_t);
+    point.W(1);
+    p_hit.Set(m_geometry, p_primitive, p_t, point);
+}
+
+//
+// Name : CRayBruteForce::Intersect()
+// Description : Nearest hit of all of the polygons.
+//
+
+bool CRayBruteForce::Intersect(const CRay& p_ray, double p_maxt, int p_ignore, int& p_primitive, double& p_t, Counters* p_counters) const
+{
+    if (m_geometry == NULL)
+        return false;
+
+    double nearest = p_maxt;
+    p_primitive = -1;
+
+    int primitivecnt = m_geometry->PrimitiveCnt();
+    for (int p = 0; p < primitivecnt; p++)
+    {
+        double t;
+        if (p != p_ignore && m_geometry->IntersectPolygon(p_ray, p, nearest, t))
+        {
+            nearest = t;
+            p_primitive = p;
+        }
+    }
+
+    if (p_counters != NULL)
+        p_counters->tests += primitivecnt;
+
+    p_t = nearest;
+    return p_primitive >= 0;
+}
+
+bool CRayBruteForce::Occluded(const CRay& p_ray, double p_maxt, int p_ignore, Counters* p_counters) const
+{
+    if (m_geometry == NULL)
+        return false;
+
+    int primitivecnt = m_geometry->PrimitiveCnt();
+    for (int p = 0; p < primitivecnt; p++)
+    {
+        double t;
+        if (p != p_ignore && m_geometry->IntersectPolygon(p_ray, p, p_maxt, t))
+        {
+            if (p_counters != NULL)
+                p_counters->tests += p + 1;
+            return true;
+        }
+    }
+
+    if (p_counters != NULL)
+        p_counters->tests += primitivecnt;
+    return false;
+}
@@ -0,0 +1,86 @@
+//
+// Name :         RayAccelerator.h
+// Description :  Header for CRayAccelerator, the interface to the ray
+//                intersection accelerators the ray tracer can use, and
+//                CRayBruteForce, the reference they are checked against.
+//                See RayAccelerator.cpp
+//
+
+#pragma once
+#include "RayGeometry.h"
+
+//
+// An accelerator is built over the polygons of CRayGeometry and reports
+// hits by primitive id. Everything else about a hit (material, normal,
+// texture coordinate) comes from the geometry through CRayHit, so it does
+// not depend on which accelerator found it.
+//
+// The implementations are:
+//
+//     CRayBvh             Refittable bounding volume hierarchy
+//     CRayWideBvh         Four wide hierarchy with quantized bounds
+//     CRayKdAccelerator   The kd-tree of the CRayIntersection DLL, the default
+//     CRayGrid            Uniform grid
+//     CRayBruteForce      Every polygon tested against every ray
+//
+// The geometry must stay alive while the accelerator is used. Intersect()
+// and Occluded() add the nodes or cells visited and polygons tested to
+// the counters they are given, where the accelerator knows them, for cost
+// accounting. The counters belong to the caller, so threads tracing
+// through the same accelerator each count their own.
+//
+
+class CRayAccelerator
+{
+public:
+    CRayAccelerator() : m_geometry(NULL) {}
+    virtual ~CRayAccelerator() {}
+
+    struct Counters
+    {
+        Counters() : steps(0), tests(0) {}
+
+        unsigned long long steps;       // Nodes or cells visited
+        unsigned long long tests;       // Polygons tested
+    };
+
+    virtual const char* Name() const = 0;
+
+    // Bring the accelerator up to date with the geometry
+    virtual void Build(const CRayGeometry& p_geometry) = 0;
+
+    // Nearest polygon hit closer than maxt, skipping p_ignore. The
+    // work done is added to p_counters unless it is NULL.
+    virtual bool Intersect(const CRay& p_ray, double p_maxt, int p_ignore, int& p_primitive, double& p_t, Counters* p_counters = NULL) const = 0;
+
+    // Is any polygon other than p_ignore hit closer than maxt? The
+    // default finds the nearest hit, accelerators that can stop at
+    // the first hit override it.
+    virtual bool Occluded(const CRay& p_ray, double p_maxt, int p_ignore, Counters* p_counters = NULL) const;
+
+    // Can Intersect() and Occluded() be called from several threads at
+    // once?
+    virtual bool ThreadSafe() const { return true; }
+
+    // The hit record for a hit Intersect() found
+    void HitInfo(const CRay& p_ray, int p_primitive, double p_t, CRayHit& p_hit) const;
+
+    const CRayGeometry* Geometry() const { return m_geometry; }
+
+protected:
+    const CRayGeometry* m_geometry;
+};
+
+//
+// Tests every polygon. Slow, but simple enough to be trusted, so the
+// other accelerators are validated against it (see CRayValidator).
+//
+
+class CRayBruteForce : public CRayAccelerator
+{
+public:
+    virtual const char* Name() const { return "Brute force"; }
+    virtual void Build(const CRayGeometry& p_geometry) { m_geometry = &p_geometry; }
+    virtual bool Intersect(const CRay& p_ray, double p_maxt, int p_ignore, int& p_primitive, double& p_t, Counters* p_counters = NULL) const;
+    virtual bool Occluded(const CRay& p_ray, double p_maxt, int p_ignore, Counters* p_counters = NULL) const;
+};
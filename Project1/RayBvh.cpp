@@ -0,0 +1,432 @@
+//
+// Name :         RayBvh.cpp
+// Description :  Implementation of CRayBvh. Nodes are split at the median
+//                centroid on the longest axis, so the shape of a subtree
+//                depends only on how many polygons it holds. That lets a
+//                degraded subtree be rebuilt into the nodes it already has.
+//
+
+#include "pch.h"
+#include "RayBvh.h"
+#include <algorithm>
+#include <functional>
+
+const double CRayBvh::RebuildFactor = 2.0;
+
+CRayBvh::CRayBvh()
+{
+    m_moved = 0;
+    m_rebuilt = 0;
+    m_revision = 0;
+}
+
+void CRayBvh::Clear()
+{
+    m_nodes.clear();
+    m_primitives.clear();
+    m_leaf.clear();
+    m_centroids.clear();
+    m_counts.clear();
+    m_vertices.clear();
+}
+
+//
+// Name : CRayBvh::Update()
+// Description : Refit the hierarchy to the geometry, or build it if the
+// polygons are not the ones it was built from.
+//
+
+CRayBvh::UpdateKind CRayBvh::Update(const CRayGeometry& p_geometry)
+{
+    m_geometry = &p_geometry;
+    m_moved = 0;
+    m_rebuilt = 0;
+
+    // If the geometry lists what moved since the revision we were
+    // last brought up to date with, only those polygons are looked at
+    bool tracked = !m_nodes.empty() && p_geometry.MovedFrom() != 0 && p_geometry.MovedFrom() == m_revision;
+    m_revision = p_geometry.Revision();
+
+    int primitivecnt = p_geometry.PrimitiveCnt();
+    bool same = tracked || (!m_nodes.empty() && primitivecnt == int(m_counts.size()));
+    for (int p = 0; !tracked && same && p < primitivecnt; p++)
+    {
+        if (p_geometry.GetPolygon(p).count != m_counts[p])
+            same = false;
+    }
+
+    if (!same)
+    {
+        Build();
+        return BUILD;
+    }
+
+    // Find the polygons that moved. Their leaves and every
+    // ancestor of those leaves need new bounds.
+    std::vector<int> dirty;
+    if (tracked)
+    {
+        const std::vector<int>& moved = p_geometry.Moved();
+        for (size_t i = 0; i < moved.size(); i++)
+            Move(moved[i], dirty);
+    }
+    else
+    {
+        for (int p = 0; p < primitivecnt; p++)
+        {
+            const CRayGeometry::Polygon& polygon = p_geometry.GetPolygon(p);
+            for (int v = polygon.first; v < polygon.first + polygon.count; v++)
+            {
+                const CGrPoint& a = p_geometry.Vertex(v);
+                const CGrPoint& b = m_vertices[v];
+                if (a.X() != b.X() || a.Y() != b.Y() || a.Z() != b.Z())
+                {
+                    Move(p, dirty);
+                    break;
+                }
+            }
+        }
+    }
+
+    if (dirty.empty())
+        return UNCHANGED;
+
+    // Children always come after their parent, so the highest
+    // index first refits bottom up
+    std::sort(dirty.begin(), dirty.end(), std::greater<int>());
+    dirty.erase(std::unique(dirty.begin(), dirty.end()), dirty.end());
+    for (size_t i = 0; i < dirty.size(); i++)
+    {
+        if (m_nodes[dirty[i]].child < 0)
+            LeafBounds(dirty[i]);
+        else
+            ChildBounds(dirty[i]);
+    }
+
+    // Top down, rebuild subtrees that have grown too much. A rebuilt
+    // subtree holds the same polygons, so its own bounds do not change.
+    for (size_t i = dirty.size(); i-- > 0; )
+    {
+        Node& node = m_nodes[dirty[i]];
+        if (node.child >= 0 && Area(node) > RebuildFactor * node.area)
+        {
+            Partition(dirty[i], false);
+            m_rebuilt++;
+        }
+    }
+
+    return REFIT;
+}
+
+//
+// Name : CRayBvh::Move()
+// Description : Take the new vertices of a polygon that moved and
+// add its leaf and the leaf's ancestors to the nodes to refit.
+//
+
+void CRayBvh::Move(int p_primitive, std::vector<int>& p_dirty)
+{
+    const CRayGeometry::Polygon& polygon = m_geometry->GetPolygon(p_primitive);
+
+    CGrPoint centroid(0, 0, 0);
+    for (int v = polygon.first; v < polygon.first + polygon.count; v++)
+    {
+        m_vertices[v] = m_geometry->Vertex(v);
+        centroid += m_vertices[v];
+    }
+    m_centroids[p_primitive] = polygon.count > 0 ? centroid / polygon.count : centroid;
+    m_moved++;
+
+    for (int n = m_leaf[p_primitive]; n >= 0; n = m_nodes[n].parent)
+        p_dirty.push_back(n);
+}
+
+//
+// Name : CRayBvh::Build()
+// Description : Build the hierarchy from scratch.
+//
+
+void CRayBvh::Build()
+{
+    const CRayGeometry& geometry = *m_geometry;
+    int primitivecnt = geometry.PrimitiveCnt();
+
+    Clear();
+    m_counts.resize(primitivecnt);
+    m_centroids.resize(primitivecnt);
+    m_leaf.resize(primitivecnt);
+    m_primitives.resize(primitivecnt);
+
+    for (int p = 0; p < primitivecnt; p++)
+    {
+        const CRayGeometry::Polygon& polygon = geometry.GetPolygon(p);
+        m_counts[p] = polygon.count;
+        m_primitives[p] = p;
+
+        if (int(m_vertices.size()) < polygon.first + polygon.count)
+            m_vertices.resize(polygon.first + polygon.count);
+
+        CGrPoint centroid(0, 0, 0);
+        for (int v = polygon.first; v < polygon.first + polygon.count; v++)
+        {
+            m_vertices[v] = geometry.Vertex(v);
+            centroid += m_vertices[v];
+        }
+        m_centroids[p] = polygon.count > 0 ? centroid / polygon.count : centroid;
+    }
+
+    if (primitivecnt == 0)
+        return;
+
+    m_nodes.reserve(2 * (primitivecnt / LeafSize + 1));
+
+    Node root;
+    root.parent = -1;
+    root.child = -1;
+    root.first = 0;
+    root.count = primitivecnt;
+    m_nodes.push_back(root);
+
+    Partition(0, true);
+}
+
+//
+// Name : CRayBvh::Partition()
+// Description : Split the polygons of a node at the median centroid on
+// the longest axis and recurse. If allocate is false, the node already
+// has children, which are reused.
+//
+
+void CRayBvh::Partition(int p_node, bool p_allocate)
+{
+    int first = m_nodes[p_node].first;
+    int count = m_nodes[p_node].count;
+
+    if (count <= LeafSize)
+    {
+        m_nodes[p_node].child = -1;
+        for (int i = first; i < first + count; i++)
+            m_leaf[m_primitives[i]] = p_node;
+
+        LeafBounds(p_node);
+        m_nodes[p_node].area = Area(m_nodes[p_node]);
+        return;
+    }
+
+    CGrPoint cmin(1e30, 1e30, 1e30);
+    CGrPoint cmax(-1e30, -1e30, -1e30);
+    for (int i = first; i < first + count; i++)
+    {
+        cmin.Minimize(m_centroids[m_primitives[i]]);
+        cmax.Maximize(m_centroids[m_primitives[i]]);
+    }
+
+    CGrPoint extent = cmax - cmin;
+    int axis = 0;
+    if (extent.Y() > extent.X())
+        axis = 1;
+    if (extent.Z() > extent[axis])
+        axis = 2;
+
+    int half = count / 2;
+    std::vector<int>::iterator begin = m_primitives.begin() + first;
+    std::nth_element(begin, begin + half, begin + count, [this, axis](int a, int b) {
+        return m_centroids[a][axis] < m_centroids[b][axis];
+    });
+
+    int child;
+    if (p_allocate)
+    {
+        child = int(m_nodes.size());
+        m_nodes.resize(child + 2);
+        m_nodes[p_node].child = child;
+    }
+    else
+    {
+        child = m_nodes[p_node].child;
+    }
+
+    Node& left = m_nodes[child];
+    left.parent = p_node;
+    left.first = first;
+    left.count = half;
+
+    Node& right = m_nodes[child + 1];
+    right.parent = p_node;
+    right.first = first + half;
+    right.count = count - half;
+
+    if (p_allocate)
+        left.child = right.child = -1;
+
+    Partition(child, p_allocate);
+    Partition(child + 1, p_allocate);
+
+    ChildBounds(p_node);
+    m_nodes[p_node].area = Area(m_nodes[p_node]);
+}
+
+void CRayBvh::LeafBounds(int p_node)
+{
+    Node& node = m_nodes[p_node];
+    for (int d = 0; d < 3; d++)
+    {
+        node.min[d] = 1e30;
+        node.max[d] = -1e30;
+    }
+
+    for (int i = node.first; i < node.first + node.count; i++)
+    {
+        double pmin[3], pmax[3];
+        PolygonBounds(m_primitives[i], pmin, pmax);
+        for (int d = 0; d < 3; d++)
+        {
+            node.min[d] = min(node.min[d], pmin[d]);
+            node.max[d] = max(node.max[d], pmax[d]);
+        }
+    }
+}
+
+void CRayBvh::ChildBounds(int p_node)
+{
+    Node& node = m_nodes[p_node];
+    const Node& a = m_nodes[node.child];
+    const Node& b = m_nodes[node.child + 1];
+    for (int d = 0; d < 3; d++)
+    {
+        node.min[d] = min(a.min[d], b.min[d]);
+        node.max[d] = max(a.max[d], b.max[d]);
+    }
+}
+
+void CRayBvh::PolygonBounds(int p_primitive, double* p_min, double* p_max) const
+{
+    const CRayGeometry::Polygon& polygon = m_geometry->GetPolygon(p_primitive);
+    for (int d = 0; d < 3; d++)
+    {
+        p_min[d] = 1e30;
+        p_max[d] = -1e30;
+    }
+
+    for (int v = polygon.first; v < polygon.first + polygon.count; v++)
+    {
+        const CGrPoint& vertex = m_vertices[v];
+        for (int d = 0; d < 3; d++)
+        {
+            p_min[d] = min(p_min[d], vertex[d]);
+            p_max[d] = max(p_max[d], vertex[d]);
+        }
+    }
+}
+
+double CRayBvh::Area(const Node& p_node)
+{
+    double dx = p_node.max[0] - p_node.min[0];
+    double dy = p_node.max[1] - p_node.min[1];
+    double dz = p_node.max[2] - p_node.min[2];
+    if (dx < 0 || dy < 0 || dz < 0)
+        return 0;
+
+    return 2 * (dx * dy + dy * dz + dz * dx);
+}
+
+//
+// Name : CRayBvh::Intersect()
+// Description : Find the nearest polygon hit. The nearer child of each
+// node is visited first so farther subtrees are culled by the hit.
+//
+
+bool CRayBvh::Intersect(const CRay& p_ray, double p_maxt, int p_ignore, int& p_primitive, double& p_t, Counters* p_counters) const
+{
+    if (m_nodes.empty())
+        return false;
+
+    double origin[3] = {p_ray.Origin(0), p_ray.Origin(1), p_ray.Origin(2)};
+    double inverse[3];
+    for (int d = 0; d < 3; d++)
+        inverse[d] = 1. / p_ray.Direction(d);
+
+    // Entry distance into a node, or -1 for a miss
+    double nearest = p_maxt;
+    auto enter = [&](const Node& node) -> double {
+        double tmin = 0, tmax = nearest;
+        for (int d = 0; d < 3; d++)
+        {
+            double t0 = (node.min[d] - origin[d]) * inverse[d];
+            double t1 = (node.max[d] - origin[d]) * inverse[d];
+            if (t0 > t1)
+                std::swap(t0, t1);
+            tmin = t0 > tmin ? t0 : tmin;
+            tmax = t1 < tmax ? t1 : tmax;
+            if (tmin > tmax)
+                return -1;
+        }
+        return tmin;
+    };
+
+    p_primitive = -1;
+
+    int stack[64];
+    int top = 0;
+    if (enter(m_nodes[0]) >= 0)
+        stack[top++] = 0;
+
+    unsigned steps = 0, tests = 0;
+    while (top > 0)
+    {
+        const Node& node = m_nodes[stack[--top]];
+        steps++;
+        if (node.child < 0)
+        {
+            for (int i = node.first; i < node.first + node.count; i++)
+            {
+                int primitive = m_primitives[i];
+                double t;
+                if (primitive == p_ignore)
+                    continue;
+
+                tests++;
+                if (m_geometry->IntersectPolygon(p_ray, primitive, nearest, t))
+                {
+                    nearest = t;
+                    p_primitive = primitive;
+                }
+            }
+            continue;
+        }
+
+        double ta = enter(m_nodes[node.child]);
+        double tb = enter(m_nodes[node.child + 1]);
+        if (ta >= 0 && tb >= 0)
+        {
+            // Push the farther child first
+            if (ta <= tb)
+            {
+                stack[top++] = node.child + 1;
+                stack[top++] = node.child;
+            }
+            else
+            {
+                stack[top++] = node.child;
+                stack[top++] = node.child + 1;
+            }
+        }
+        else if (ta >= 0)
+        {
+            stack[top++] = node.child;
+        }
+        else if (tb >= 0)
+        {
+            stack[top++] = node.child + 1;
+        }
+    }
+
+    if (p_counters != NULL)
+    {
+        p_counters->steps += steps;
+        p_counters->tests += tests;
+    }
+
+    p_t = nearest;
+    return p_primitive >= 0;
+}
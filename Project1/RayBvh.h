@@ -0,0 +1,90 @@
+//
+// Name :         RayBvh.h
+// Description :  Header for CRayBvh, a bounding volume hierarchy over the
+//                polygons of CRayGeometry that can be refit in place when
+//                the polygons move, instead of being rebuilt.
+//                See RayBvh.cpp
+//
+
+#pragma once
+#include "RayAccelerator.h"
+#include <vector>
+
+//
+// CRayIntersection has to be rebuilt from scratch for every change to the
+// scene. CRayBvh keeps a copy of the vertices it was built from, so on the
+// next render Update() can tell which polygons moved:
+//
+// -   If the polygons are the same ones (same count, same vertex counts),
+//     only the leaves of the polygons that moved and their ancestors get
+//     new bounds (a refit). A refit subtree whose surface area has grown
+//     past RebuildFactor times what it was when built is rebuilt in place.
+// -   Otherwise the whole hierarchy is built again.
+//
+// Comparing the vertices still visits every polygon. A geometry kept
+// from frame to frame (see CRaySceneCache) lists the polygons it moved
+// since the revision the hierarchy was last updated to, and then only
+// those are looked at.
+//
+// The cost of a frame then depends on how much of the scene moved.
+// Like CRayReservoirs, the object should live as long as the view (see
+// CMyRaytraceRenderer::SetAccelerator).
+//
+
+class CRayBvh : public CRayAccelerator
+{
+public:
+    CRayBvh();
+
+    virtual const char* Name() const { return "BVH"; }
+    virtual void Build(const CRayGeometry& p_geometry) { Update(p_geometry); }
+
+    static const int LeafSize = 4;
+    static const double RebuildFactor;
+
+    // What the last Update() did
+    enum UpdateKind { UNCHANGED, REFIT, BUILD };
+
+    // Bring the hierarchy up to date with the geometry. The geometry
+    // must stay alive while Intersect() is used.
+    UpdateKind Update(const CRayGeometry& p_geometry);
+    void Clear();
+
+    virtual bool Intersect(const CRay& p_ray, double p_maxt, int p_ignore, int& p_primitive, double& p_t, Counters* p_counters = NULL) const;
+
+    int MovedCnt() const { return m_moved; }
+    int RebuiltCnt() const { return m_rebuilt; }
+
+private:
+    struct Node
+    {
+        double  min[3];
+        double  max[3];
+        int     parent;
+        int     child;      // Left child, the right child follows it. -1 for a leaf.
+        int     first;      // Range of m_primitives under this node
+        int     count;
+        double  area;       // Surface area when it was last built
+    };
+
+    void Build();
+    void Move(int p_primitive, std::vector<int>& p_dirty);
+    void Partition(int p_node, bool p_allocate);
+    void LeafBounds(int p_node);
+    void ChildBounds(int p_node);
+    void PolygonBounds(int p_primitive, double* p_min, double* p_max) const;
+    static double Area(const Node& p_node);
+
+    std::vector<Node>   m_nodes;
+    std::vector<int>    m_primitives;       // Primitive ids, in leaf order
+    std::vector<int>    m_leaf;             // Leaf of each primitive
+    std::vector<CGrPoint> m_centroids;
+
+    // The geometry the hierarchy describes
+    std::vector<int>        m_counts;       // Vertex count of each polygon
+    std::vector<CGrPoint>   m_vertices;
+    unsigned                m_revision;     // CRayGeometry::Revision() it is up to date with
+
+    int     m_moved;
+    int     m_rebuilt;
+};
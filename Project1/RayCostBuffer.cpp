@@ -0,0 +1,157 @@
+//
+// Name :         RayCostBuffer.cpp
+// Description :  Implementation of CRayCostBuffer. Heatmaps are scaled so
+//                the 99th percentile of the pixels that cost anything is
+//                the hottest color, so a few extreme pixels do not wash
+//                out the rest of the image.
+//
+
+#include "pch.h"
+#include "RayCostBuffer.h"
+#include <algorithm>
+#include <fstream>
+
+CRayCostBuffer::CRayCostBuffer()
+{
+    m_width = 0;
+    m_height = 0;
+}
+
+void CRayCostBuffer::SetSize(int p_width, int p_height)
+{
+    m_width = p_width;
+    m_height = p_height;
+    for (int m = 0; m < MEASURES; m++)
+        m_values[m].assign(size_t(p_width) * p_height, 0.f);
+}
+
+void CRayCostBuffer::Add(int r, int c, const Counters& p_counters)
+{
+    size_t i = size_t(r) * m_width + c;
+    m_values[CYCLES][i] += float(p_counters.cycles);
+    m_values[RAYS][i] += float(p_counters.rays);
+    m_values[STEPS][i] += float(p_counters.steps);
+    m_values[TESTS][i] += float(p_counters.tests);
+}
+
+const char* CRayCostBuffer::Name(Measure m)
+{
+    static const char* names[MEASURES] = { "_cycles", "_rays", "_steps", "_tests" };
+    return names[m];
+}
+
+//
+// Name : CRayCostBuffer::Write()
+// Description : Write the heatmap and the raw values of every measure.
+//
+
+bool CRayCostBuffer::Write(const std::basic_string<_TCHAR>& p_base) const
+{
+    for (int m = 0; m < MEASURES; m++)
+    {
+        std::basic_string<_TCHAR> filename = p_base;
+        for (const char* s = Name(Measure(m)); *s; s++)
+            filename += _TCHAR(*s);
+
+        if (!WriteHeatmap(Measure(m), (filename + _T(".ppm")).c_str()))
+            return false;
+
+        if (!WriteRaw(Measure(m), (filename + _T(".pfm")).c_str()))
+            return false;
+    }
+
+    return true;
+}
+
+//
+// Name : CRayCostBuffer::WriteHeatmap()
+// Description : Write one measure as a false color PPM image.
+//
+
+bool CRayCostBuffer::WriteHeatmap(Measure m, const _TCHAR* p_filename) const
+{
+    const std::vector<float>& values = m_values[m];
+
+    // The scale, from the pixels that cost something
+    std::vector<float> nonzero;
+    for (size_t i = 0; i < values.size(); i++)
+    {
+        if (values[i] > 0)
+            nonzero.push_back(values[i]);
+    }
+
+    double scale = 0;
+    if (!nonzero.empty())
+    {
+        std::vector<float>::iterator p = nonzero.begin() + (nonzero.size() - 1) * 99 / 100;
+        std::nth_element(nonzero.begin(), p, nonzero.end());
+        scale = *p > 0 ? 1. / *p : 0;
+    }
+
+    std::vector<BYTE> pixels(size_t(m_width) * m_height * 3);
+    std::vector<BYTE*> rows(m_height);
+    for (int r = 0; r < m_height; r++)
+    {
+        rows[r] = &pixels[size_t(r) * m_width * 3];
+        for (int c = 0; c < m_width; c++)
+            HeatColor(values[size_t(r) * m_width + c] * scale, rows[r] + c * 3);
+    }
+
+    return WritePPM(p_filename, m_height > 0 ? &rows[0] : NULL, m_width, m_height);
+}
+
+//
+// Name : CRayCostBuffer::WriteRaw()
+// Description : Write one measure as a grayscale PFM file, which keeps
+// the values exactly. PFM rows go from the bottom, as ours do, and a
+// negative scale means little endian.
+//
+
+bool CRayCostBuffer::WriteRaw(Measure m, const _TCHAR* p_filename) const
+{
+    std::ofstream file(p_filename, std::ios::binary);
+    if (!file)
+        return false;
+
+    file << "Pf\n" << m_width << " " << m_height << "\n-1.0\n";
+    if (!m_values[m].empty())
+        file.write((const char*)&m_values[m][0], m_values[m].size() * sizeof(float));
+
+    return bool(file);
+}
+
+//
+// Name : CRayCostBuffer::WritePPM()
+// Description : Write an RGB image with row 0 at the bottom.
+//
+
+bool CRayCostBuffer::WritePPM(const _TCHAR* p_filename, const BYTE* const* p_image, int p_width, int p_height)
+{
+    std::ofstream file(p_filename, std::ios::binary);
+    if (!file)
+        return false;
+
+    file << "P6\n" << p_width << " " << p_height << "\n255\n";
+    for (int r = p_height - 1; r >= 0; r--)
+        file.write((const char*)p_image[r], p_width * 3);
+
+    return bool(file);
+}
+
+//
+// Name : CRayCostBuffer::HeatColor()
+// Description : Black through blue, magenta and orange to pale yellow
+// for v from 0 to 1.
+//
+
+void CRayCostBuffer::HeatColor(double v, BYTE* rgb)
+{
+    static const double stops[5][3] = {
+        { 0, 0, 0 }, { 40, 0, 160 }, { 200, 30, 120 }, { 250, 140, 0 }, { 255, 255, 160 } };
+
+    v = min(max(v, 0.), 1.) * 4;
+    int i = min(int(v), 3);
+    double f = v - i;
+    for (int j = 0; j < 3; j++)
+        rgb[j] = BYTE(stops[i][j] + (stops[i + 1][j] - stops[i][j]) * f + 0.5);
+}
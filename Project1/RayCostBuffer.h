@@ -0,0 +1,74 @@
+//
+// Name :         RayCostBuffer.h
+// Description :  Header for CRayCostBuffer, what each pixel of a ray
+//                traced image cost to compute.
+//                See RayCostBuffer.cpp
+//
+
+#pragma once
+#include <string>
+#include <vector>
+
+//
+// The ray tracer adds to a pixel everything spent on the samples traced
+// through it: processor cycles (rdtsc), rays (primary, reflection and
+// shadow), hierarchy nodes visited and polygons tested. Node and polygon
+// counts are only known for our own accelerators, the kd-tree of the
+// intersection system does not report them.
+//
+// Each measure can be written as a false color heatmap (PPM) and as the
+// raw values (PFM, one float per pixel, rows from the bottom). Expensive
+// geometry, like a large polygon that overlaps much of the hierarchy,
+// stands out in the heatmaps.
+//
+// Like CRayReservoirs the object should live as long as the view, so the
+// costs of the last image can be written after it is done (see
+// CMyRaytraceRenderer::SetCostBuffer).
+//
+
+class CRayCostBuffer
+{
+public:
+    CRayCostBuffer();
+
+    enum Measure { CYCLES, RAYS, STEPS, TESTS, MEASURES };
+
+    // Costs of one sample
+    struct Counters
+    {
+        unsigned long long cycles;
+        unsigned long long rays;
+        unsigned long long steps;
+        unsigned long long tests;
+    };
+
+    // Allocate and zero the buffer
+    void SetSize(int p_width, int p_height);
+
+    int Width() const { return m_width; }
+    int Height() const { return m_height; }
+
+    void Add(int r, int c, const Counters& p_counters);
+    float Get(Measure m, int r, int c) const { return m_values[m][r * m_width + c]; }
+
+    // File name suffix for a measure, like "_cycles"
+    static const char* Name(Measure m);
+
+    // Write the heatmap and raw values of every measure. The files are
+    // named p_base with the measure name and .ppm or .pfm appended.
+    bool Write(const std::basic_string<_TCHAR>& p_base) const;
+
+    bool WriteHeatmap(Measure m, const _TCHAR* p_filename) const;
+    bool WriteRaw(Measure m, const _TCHAR* p_filename) const;
+
+    // Write an RGB image with row 0 at the bottom as a PPM file
+    static bool WritePPM(const _TCHAR* p_filename, const BYTE* const* p_image, int p_width, int p_height);
+
+private:
+    static void HeatColor(double v, BYTE* rgb);
+
+    int     m_width;
+    int     m_height;
+
+    std::vector<float> m_values[MEASURES];
+};
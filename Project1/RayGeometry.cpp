@@ -0,0 +1,316 @@
+//
+// Name :         RayGeometry.cpp
+// Description :  Implementation of CRayGeometry and CRayHit. Polygons are
+//                stored as vertex fans so a hit can be located by the fan
+//                triangle it is in and its barycentric coordinates.
+//
+
+#include "pch.h"
+#include "RayGeometry.h"
+
+unsigned CRayGeometry::m_revisions = 0;
+
+CRayGeometry::CRayGeometry()
+{
+    m_movedfrom = 0;
+    NewRevision();
+}
+
+void CRayGeometry::NewRevision()
+{
+    m_revision = ++m_revisions;
+    m_movedfrom = 0;
+    m_moved.clear();
+}
+
+void CRayGeometry::Clear()
+{
+    m_polygons.clear();
+    m_vertices.clear();
+    m_normals.clear();
+    m_texcoords.clear();
+    NewRevision();
+}
+
+//
+// Name : CRayGeometry::AddPolygon()
+// Description : Add a polygon (eye coordinates). The normals and
+// texture coordinates may be empty.
+//
+
+void CRayGeometry::AddPolygon(CGrMaterial* p_material, CGrTexture* p_texture,
+    const std::vector<CGrPoint>& p_vertices, const std::vector<CGrPoint>& p_normals,
+    const std::vector<CGrPoint>& p_texcoords, int p_link)
+{
+    NewRevision();
+
+    Polygon polygon;
+    polygon.first = int(m_vertices.size());
+    polygon.count = int(p_vertices.size());
+
+    m_vertices.resize(m_vertices.size() + polygon.count);
+    m_normals.resize(m_vertices.size());
+    m_texcoords.resize(m_vertices.size());
+
+    SetPolygon(polygon, p_material, p_texture, p_vertices, p_normals, p_texcoords, p_link);
+    m_polygons.push_back(polygon);
+}
+
+void CRayGeometry::BeginMoves()
+{
+    unsigned from = m_revision;
+    NewRevision();
+    m_movedfrom = from;
+}
+
+//
+// Name : CRayGeometry::ReplacePolygon()
+// Description : Put a polygon in place of another one with as many
+// vertices. It is listed in Moved() if any vertex is different.
+//
+
+bool CRayGeometry::ReplacePolygon(int p_primitive, CGrMaterial* p_material, CGrTexture* p_texture,
+    const std::vector<CGrPoint>& p_vertices, const std::vector<CGrPoint>& p_normals,
+    const std::vector<CGrPoint>& p_texcoords, int p_link)
+{
+    Polygon& polygon = m_polygons[p_primitive];
+    if (polygon.count != int(p_vertices.size()))
+        return false;
+
+    bool moved = false;
+    for (int i = 0; i < polygon.count && !moved; i++)
+    {
+        const CGrPoint& a = m_vertices[polygon.first + i];
+        const CGrPoint& b = p_vertices[i];
+        moved = a.X() != b.X() || a.Y() != b.Y() || a.Z() != b.Z();
+    }
+
+    if (moved)
+        m_moved.push_back(p_primitive);
+
+    SetPolygon(polygon, p_material, p_texture, p_vertices, p_normals, p_texcoords, p_link);
+    return true;
+}
+
+//
+// Name : CRayGeometry::SetPolygon()
+// Description : Fill in a polygon whose vertices have been allocated.
+//
+
+void CRayGeometry::SetPolygon(Polygon& polygon, CGrMaterial* p_material, CGrTexture* p_texture,
+    const std::vector<CGrPoint>& p_vertices, const std::vector<CGrPoint>& p_normals,
+    const std::vector<CGrPoint>& p_texcoords, int p_link)
+{
+    polygon.material = p_material;
+    polygon.texture = p_texture;
+    polygon.link = p_link;
+    polygon.hasnormals = p_normals.size() == p_vertices.size();
+    polygon.hastexcoords = p_texcoords.size() == p_vertices.size();
+
+    // Newell's method, good for any planar polygon
+    CGrPoint normal(0, 0, 0, 0);
+    for (int i = 0; i < polygon.count; i++)
+    {
+        const CGrPoint& a = p_vertices[i];
+        const CGrPoint& b = p_vertices[(i + 1) % polygon.count];
+        normal.X() += (a.Y() - b.Y()) * (a.Z() + b.Z());
+        normal.Y() += (a.Z() - b.Z()) * (a.X() + b.X());
+        normal.Z() += (a.X() - b.X()) * (a.Y() + b.Y());
+    }
+
+    if (normal.Length3() > 0)
+        normal.Normalize3();
+    polygon.normal = normal;
+
+    for (int i = 0; i < polygon.count; i++)
+    {
+        m_vertices[polygon.first + i] = p_vertices[i];
+        m_normals[polygon.first + i] = polygon.hasnormals ? p_normals[i] : normal;
+        m_texcoords[polygon.first + i] = polygon.hastexcoords ? p_texcoords[i] : CGrPoint(0, 0, 0);
+    }
+}
+
+//
+// Name : CRayGeometry::IntersectPolygon()
+// Description : Ray/polygon test on the fan triangles of the polygon
+// (Moller-Trumbore). Only hits closer than maxt count.
+//
+
+bool CRayGeometry::IntersectPolygon(const CRay& p_ray, int p_primitive, double p_maxt, double& p_t) const
+{
+    const Polygon& polygon = m_polygons[p_primitive];
+    const CGrPoint& dir = p_ray.Direction();
+    const CGrPoint& a = m_vertices[polygon.first];
+
+    // Polygons are usually planar, but a bent one could be hit twice
+    bool hit = false;
+    for (int v = polygon.first + 1; v + 1 < polygon.first + polygon.count; v++)
+    {
+        CGrPoint e1 = m_vertices[v] - a;
+        CGrPoint e2 = m_vertices[v + 1] - a;
+        CGrPoint p = Cross3(dir, e2);
+        double det = Dot3(e1, p);
+        if (det > -1e-12 && det < 1e-12)
+            continue;
+
+        double inv = 1. / det;
+        CGrPoint s = p_ray.Origin() - a;
+        double u = Dot3(s, p) * inv;
+        if (u < 0 || u > 1)
+            continue;
+
+        CGrPoint q = Cross3(s, e1);
+        double w = Dot3(dir, q) * inv;
+        if (w < 0 || u + w > 1)
+            continue;
+
+        double t = Dot3(e2, q) * inv;
+        if (t > 1e-9 && t < p_maxt)
+        {
+            p_maxt = t;
+            hit = true;
+        }
+    }
+
+    p_t = p_maxt;
+    return hit;
+}
+
+//
+// Name : CRayHit::Barycentrics()
+// Description : Find the fan triangle that contains the hit point and
+// its barycentric coordinates in that triangle.
+//
+
+void CRayHit::Barycentrics()
+{
+    const CRayGeometry::Polygon& polygon = m_geometry->GetPolygon(m_primitive);
+    const CGrPoint& v0 = m_geometry->Vertex(polygon.first);
+    CGrPoint p = m_point - v0;
+
+    // If the point is not inside any triangle (round off at an edge),
+    // use the one it is closest to being inside of.
+    double bestout = 1e20;
+    for (int i = 1; i + 1 < polygon.count; i++)
+    {
+        CGrPoint e1 = m_geometry->Vertex(polygon.first + i) - v0;
+        CGrPoint e2 = m_geometry->Vertex(polygon.first + i + 1) - v0;
+
+        double d11 = Dot3(e1, e1);
+        double d12 = Dot3(e1, e2);
+        double d22 = Dot3(e2, e2);
+        double dp1 = Dot3(p, e1);
+        double dp2 = Dot3(p, e2);
+        double denom = d11 * d22 - d12 * d12;
+        if (denom == 0)
+            continue;
+
+        double b1 = (d22 * dp1 - d12 * dp2) / denom;
+        double b2 = (d11 * dp2 - d12 * dp1) / denom;
+        double b0 = 1 - b1 - b2;
+
+        double out = 0;
+        if (b0 < 0) out -= b0;
+        if (b1 < 0) out -= b1;
+        if (b2 < 0) out -= b2;
+
+        if (out < bestout)
+        {
+            bestout = out;
+            m_tri = i;
+            m_b1 = float(b1);
+            m_b2 = float(b2);
+            if (out == 0)
+                break;
+        }
+    }
+
+    if (bestout == 1e20)
+    {
+        // Degenerate polygon (or fewer than three vertices), use the
+        // first vertex. m_tri = 0 tells Normal() and TexCoord() not to
+        // look at the others, which may belong to the next polygon.
+        m_tri = 0;
+        m_b1 = m_b2 = 0;
+    }
+
+    m_flags |= HAVE_BARYCENTRICS;
+}
+
+//
+// Name : CRayHit::Normal()
+// Description : The shading normal. Interpolated from the vertex
+// normals if the polygon has them, otherwise the face normal.
+//
+
+const CGrPoint& CRayHit::Normal()
+{
+    if (m_flags & HAVE_NORMAL)
+        return m_normal;
+
+    const CRayGeometry::Polygon& polygon = m_geometry->GetPolygon(m_primitive);
+    if (!polygon.hasnormals)
+    {
+        m_normal = polygon.normal;
+    }
+    else
+    {
+        if (!(m_flags & HAVE_BARYCENTRICS))
+            Barycentrics();
+
+        int v = polygon.first;
+        if (m_tri == 0)
+        {
+            m_normal = m_geometry->Normal(v);
+        }
+        else
+        {
+            m_normal = m_geometry->Normal(v) * (1 - m_b1 - m_b2);
+            m_normal.WeightedAdd3(m_geometry->Normal(v + m_tri), m_b1);
+            m_normal.WeightedAdd3(m_geometry->Normal(v + m_tri + 1), m_b2);
+        }
+
+        m_normal.W(0);
+        m_normal.Normalize3();
+    }
+
+    m_flags |= HAVE_NORMAL;
+    return m_normal;
+}
+
+//
+// Name : CRayHit::TexCoord()
+// Description : The interpolated texture coordinate.
+//
+
+const CGrPoint& CRayHit::TexCoord()
+{
+    if (m_flags & HAVE_TEXCOORD)
+        return m_texcoord;
+
+    const CRayGeometry::Polygon& polygon = m_geometry->GetPolygon(m_primitive);
+    if (!polygon.hastexcoords)
+    {
+        m_texcoord = CGrPoint(0, 0, 0);
+    }
+    else
+    {
+        if (!(m_flags & HAVE_BARYCENTRICS))
+            Barycentrics();
+
+        int v = polygon.first;
+        if (m_tri == 0)
+        {
+            m_texcoord = m_geometry->TexCoord(v);
+        }
+        else
+        {
+            m_texcoord = m_geometry->TexCoord(v) * (1 - m_b1 - m_b2);
+            m_texcoord.WeightedAdd3(m_geometry->TexCoord(v + m_tri), m_b1);
+            m_texcoord.WeightedAdd3(m_geometry->TexCoord(v + m_tri + 1), m_b2);
+        }
+    }
+
+    m_flags |= HAVE_TEXCOORD;
+    return m_texcoord;
+}
@@ -0,0 +1,153 @@
+//
+// Name :         RayGeometry.h
+// Description :  Header for CRayGeometry, the polygon table the ray tracer
+//                builds its accelerators over, and CRayHit, a hit record
+//                that computes surface attributes on demand.
+//                See RayGeometry.cpp
+//
+
+#pragma once
+#include "graphics/RayIntersection.h"
+#include <vector>
+
+class CGrMaterial;
+class CGrTexture;
+
+//
+// CRayIntersection::IntersectInfo() computes everything about a hit
+// (interpolated normal, material, texture and texture coordinate) every
+// time it is called. CRayGeometry keeps its own copy of each polygon so a
+// hit can be reduced to a primitive id and the attributes computed only
+// when the shader asks for them.
+//
+// To use:
+//
+// 1.  Call Clear() at the start of the scene
+// 2.  Call AddPolygon() for each polygon. Primitive ids are given out
+//     in order from 0.
+// 3.  Build an accelerator over the geometry (see CRayAccelerator),
+//     which reports hits by primitive id
+//
+// A geometry that is kept from frame to frame (see CRaySceneCache) can
+// instead call BeginMoves() and ReplacePolygon() for the polygons that
+// were emitted again. The ones whose vertices changed are listed by
+// Moved(). An accelerator that was built over Revision() as it was
+// before BeginMoves() (MovedFrom()) only has to look at those.
+//
+
+class CRayGeometry
+{
+public:
+    CRayGeometry();
+
+    struct Polygon
+    {
+        CGrMaterial*    material;
+        CGrTexture*     texture;
+        int             first;          // First vertex in the vertex arrays
+        int             count;          // Number of vertices
+        bool            hasnormals;
+        bool            hastexcoords;
+        CGrPoint        normal;         // Geometric (face) normal
+        int             link;           // Light linking group (see CRayLightLinks)
+    };
+
+    void Clear();
+
+    void AddPolygon(CGrMaterial* p_material, CGrTexture* p_texture,
+        const std::vector<CGrPoint>& p_vertices, const std::vector<CGrPoint>& p_normals,
+        const std::vector<CGrPoint>& p_texcoords, int p_link = 0);
+
+    // Start a new list of moved polygons
+    void BeginMoves();
+
+    // Replace a polygon by one with the same number of vertices.
+    // Returns false, changing nothing, if the count is different.
+    bool ReplacePolygon(int p_primitive, CGrMaterial* p_material, CGrTexture* p_texture,
+        const std::vector<CGrPoint>& p_vertices, const std::vector<CGrPoint>& p_normals,
+        const std::vector<CGrPoint>& p_texcoords, int p_link = 0);
+
+    // Every change gives the geometry a new revision, unique over all
+    // CRayGeometry objects. MovedFrom() is 0 if anything other than
+    // ReplacePolygon() changed it since BeginMoves().
+    unsigned Revision() const { return m_revision; }
+    unsigned MovedFrom() const { return m_movedfrom; }
+    const std::vector<int>& Moved() const { return m_moved; }
+
+    int PrimitiveCnt() const { return int(m_polygons.size()); }
+    const Polygon& GetPolygon(int p) const { return m_polygons[p]; }
+
+    // Ray/polygon test for accelerators of our own. Only hits closer
+    // than p_maxt count.
+    bool IntersectPolygon(const CRay& p_ray, int p_primitive, double p_maxt, double& p_t) const;
+
+    const CGrPoint& Vertex(int i) const { return m_vertices[i]; }
+    const CGrPoint& Normal(int i) const { return m_normals[i]; }
+    const CGrPoint& TexCoord(int i) const { return m_texcoords[i]; }
+
+private:
+    void SetPolygon(Polygon& p_polygon, CGrMaterial* p_material, CGrTexture* p_texture,
+        const std::vector<CGrPoint>& p_vertices, const std::vector<CGrPoint>& p_normals,
+        const std::vector<CGrPoint>& p_texcoords, int p_link);
+    void NewRevision();
+
+    static unsigned m_revisions;
+
+    std::vector<Polygon>    m_polygons;
+    std::vector<CGrPoint>   m_vertices;
+    std::vector<CGrPoint>   m_normals;
+    std::vector<CGrPoint>   m_texcoords;
+
+    unsigned                m_revision;
+    unsigned                m_movedfrom;
+    std::vector<int>        m_moved;        // Primitives that moved since BeginMoves()
+};
+
+//
+// A ray hit. Intersection fills in the primitive id, distance and point.
+// Barycentric coordinates, the shading normal and the texture coordinate
+// are computed the first time they are asked for, so a mirror or an
+// untextured surface never interpolates texture coordinates.
+//
+
+class CRayHit
+{
+public:
+    CRayHit() : m_geometry(NULL), m_primitive(-1), m_t(0), m_flags(0) {}
+
+    void Set(const CRayGeometry* p_geometry, int p_primitive, double p_t, const CGrPoint& p_point)
+    {
+        m_geometry = p_geometry;  m_primitive = p_primitive;  m_t = p_t;  m_point = p_point;  m_flags = 0;
+    }
+
+    int Primitive() const { return m_primitive; }
+    double T() const { return m_t; }
+    const CGrPoint& Point() const { return m_point; }
+
+    CGrMaterial* Material() const { return m_geometry->GetPolygon(m_primitive).material; }
+    CGrTexture* Texture() const { return m_geometry->GetPolygon(m_primitive).texture; }
+    int Link() const { return m_geometry->GetPolygon(m_primitive).link; }
+
+    const CGrPoint& GeometricNormal() const { return m_geometry->GetPolygon(m_primitive).normal; }
+    const CGrPoint& Normal();
+    const CGrPoint& TexCoord();
+
+private:
+    void Barycentrics();
+
+    enum { HAVE_BARYCENTRICS = 1, HAVE_NORMAL = 2, HAVE_TEXCOORD = 4 };
+
+    const CRayGeometry* m_geometry;
+    int         m_primitive;
+    double      m_t;
+    CGrPoint    m_point;
+    int         m_flags;
+
+    // Fan triangle (0, m_tri, m_tri+1) of the polygon and the
+    // barycentric weights of its last two vertices
+    int         m_tri;
+    float       m_b1, m_b2;
+
+    CGrPoint    m_normal;
+    CGrPoint    m_texcoord;
+};
@@ -0,0 +1,248 @@
+//
+// Name :         RayGrid.cpp
+// Description :  Implementation of CRayGrid. A polygon that spans several
+//                cells may be tested once in each of them. A hit beyond
+//                the cell being walked does not end the walk, since a
+//                nearer polygon could still be in the cells before it.
+//
+
+#include "pch.h"
+#include "RayGrid.h"
+#include <algorithm>
+#include <cmath>
+
+const double CRayGrid::Density = 4.0;
+
+CRayGrid::CRayGrid()
+{
+    for (int d = 0; d < 3; d++)
+    {
+        m_min[d] = m_max[d] = 0;
+        m_cellsize[d] = 1;
+        m_resolution[d] = 0;
+    }
+}
+
+//
+// Name : CRayGrid::Build()
+// Description : Size the grid for the polygons and list them in their
+// cells: one pass to count the polygons of each cell, one to fill them in.
+//
+
+void CRayGrid::Build(const CRayGeometry& p_geometry)
+{
+    m_geometry = &p_geometry;
+    m_cellstart.clear();
+    m_cellprimitives.clear();
+
+    int primitivecnt = p_geometry.PrimitiveCnt();
+    for (int d = 0; d < 3; d++)
+    {
+        m_min[d] = 1e20;
+        m_max[d] = -1e20;
+        m_resolution[d] = 0;
+    }
+
+    // Bounds of each polygon and the scene
+    std::vector<double> bounds(size_t(primitivecnt) * 6);
+    for (int p = 0; p < primitivecnt; p++)
+    {
+        const CRayGeometry::Polygon& polygon = p_geometry.GetPolygon(p);
+        double* b = &bounds[size_t(p) * 6];
+        b[0] = b[1] = b[2] = 1e20;
+        b[3] = b[4] = b[5] = -1e20;
+        for (int v = polygon.first; v < polygon.first + polygon.count; v++)
+        {
+            const CGrPoint& vertex = p_geometry.Vertex(v);
+            for (int d = 0; d < 3; d++)
+            {
+                b[d] = min(b[d], vertex[d]);
+                b[d + 3] = max(b[d + 3], vertex[d]);
+            }
+        }
+
+        for (int d = 0; d < 3; d++)
+        {
+            m_min[d] = min(m_min[d], b[d]);
+            m_max[d] = max(m_max[d], b[d + 3]);
+        }
+    }
+
+    if (primitivecnt == 0 || m_min[0] > m_max[0])
+        return;
+
+    // Pad the bounds so a flat scene still has volume and polygons
+    // on the boundary are inside
+    double largest = max(max(m_max[0] - m_min[0], m_max[1] - m_min[1]), m_max[2] - m_min[2]);
+    double pad = max(largest * 1e-6, 1e-9);
+    double volume = 1;
+    for (int d = 0; d < 3; d++)
+    {
+        m_min[d] -= pad;
+        m_max[d] += pad;
+        volume *= m_max[d] - m_min[d];
+    }
+
+    double cellsper = std::cbrt(Density * primitivecnt / volume);
+    int cellcnt = 1;
+    for (int d = 0; d < 3; d++)
+    {
+        m_resolution[d] = min(max(int((m_max[d] - m_min[d]) * cellsper), 1), int(MaxResolution));
+        m_cellsize[d] = (m_max[d] - m_min[d]) / m_resolution[d];
+        cellcnt *= m_resolution[d];
+    }
+
+    // The range of cells a polygon overlaps
+    auto range = [&](int p, int* lo, int* hi) {
+        const double* b = &bounds[size_t(p) * 6];
+        for (int d = 0; d < 3; d++)
+        {
+            lo[d] = min(max(int((b[d] - m_min[d]) / m_cellsize[d]), 0), m_resolution[d] - 1);
+            hi[d] = min(max(int((b[d + 3] - m_min[d]) / m_cellsize[d]), 0), m_resolution[d] - 1);
+        }
+    };
+
+    m_cellstart.assign(cellcnt + 1, 0);
+    int lo[3], hi[3];
+    for (int p = 0; p < primitivecnt; p++)
+    {
+        range(p, lo, hi);
+        for (int z = lo[2]; z <= hi[2]; z++)
+            for (int y = lo[1]; y <= hi[1]; y++)
+                for (int x = lo[0]; x <= hi[0]; x++)
+                    m_cellstart[(z * m_resolution[1] + y) * m_resolution[0] + x + 1]++;
+    }
+
+    for (int i = 0; i < cellcnt; i++)
+        m_cellstart[i + 1] += m_cellstart[i];
+
+    std::vector<int> fill(m_cellstart.begin(), m_cellstart.end() - 1);
+    m_cellprimitives.resize(m_cellstart[cellcnt]);
+    for (int p = 0; p < primitivecnt; p++)
+    {
+        range(p, lo, hi);
+        for (int z = lo[2]; z <= hi[2]; z++)
+            for (int y = lo[1]; y <= hi[1]; y++)
+                for (int x = lo[0]; x <= hi[0]; x++)
+                    m_cellprimitives[fill[(z * m_resolution[1] + y) * m_resolution[0] + x]++] = p;
+    }
+}
+
+bool CRayGrid::Intersect(const CRay& p_ray, double p_maxt, int p_ignore, int& p_primitive, double& p_t, Counters* p_counters) const
+{
+    return Traverse<false>(p_ray, p_maxt, p_ignore, p_primitive, p_t, p_counters);
+}
+
+bool CRayGrid::Occluded(const CRay& p_ray, double p_maxt, int p_ignore, Counters* p_counters) const
+{
+    int primitive;
+    double t;
+    return Traverse<true>(p_ray, p_maxt, p_ignore, primitive, t, p_counters);
+}
+
+//
+// Name : CRayGrid::Traverse()
+// Description : Walk the cells along the ray from where it enters the
+// grid. With AnyHit the first hit closer than maxt ends the walk.
+//
+
+template <bool AnyHit> bool CRayGrid::Traverse(const CRay& p_ray, double p_maxt, int p_ignore, int& p_primitive, double& p_t, Counters* p_counters) const
+{
+    p_primitive = -1;
+    if (m_cellstart.empty())
+        return false;
+
+    // Clip the ray to the grid bounds
+    double origin[3], dir[3];
+    double tmin = 0, tmax = p_maxt;
+    for (int d = 0; d < 3; d++)
+    {
+        origin[d] = p_ray.Origin(d);
+        dir[d] = p_ray.Direction(d);
+        if (dir[d] == 0)
+        {
+            if (origin[d] < m_min[d] || origin[d] > m_max[d])
+                return false;
+            continue;
+        }
+
+        double t0 = (m_min[d] - origin[d]) / dir[d];
+        double t1 = (m_max[d] - origin[d]) / dir[d];
+        if (t0 > t1)
+            std::swap(t0, t1);
+        tmin = max(tmin, t0);
+        tmax = min(tmax, t1);
+        if (tmin > tmax)
+            return false;
+    }
+
+    // The starting cell and the distances to its boundaries
+    int cell[3], step[3];
+    double next[3], delta[3];
+    for (int d = 0; d < 3; d++)
+    {
+        double p = origin[d] + dir[d] * tmin;
+        cell[d] = min(max(int((p - m_min[d]) / m_cellsize[d]), 0), m_resolution[d] - 1);
+        if (dir[d] > 0)
+        {
+            step[d] = 1;
+            next[d] = (m_min[d] + (cell[d] + 1) * m_cellsize[d] - origin[d]) / dir[d];
+            delta[d] = m_cellsize[d] / dir[d];
+        }
+        else if (dir[d] < 0)
+        {
+            step[d] = -1;
+            next[d] = (m_min[d] + cell[d] * m_cellsize[d] - origin[d]) / dir[d];
+            delta[d] = -m_cellsize[d] / dir[d];
+        }
+        else
+        {
+            step[d] = 0;
+            next[d] = 1e300;
+            delta[d] = 0;
+        }
+    }
+
+    double nearest = p_maxt;
+    unsigned steps = 0, tests = 0;
+    bool done = false;
+    while (!done)
+    {
+        steps++;
+        int c = (cell[2] * m_resolution[1] + cell[1]) * m_resolution[0] + cell[0];
+        for (int i = m_cellstart[c]; i < m_cellstart[c + 1]; i++)
+        {
+            int primitive = m_cellprimitives[i];
+            if (primitive == p_ignore || primitive == p_primitive)
+                continue;
+
+            tests++;
+            double t;
+            if (m_geometry->IntersectPolygon(p_ray, primitive, nearest, t))
+            {
+                nearest = t;
+                p_primitive = primitive;
+                if (AnyHit)
+                    break;
+            }
+        }
+
+        // Done once a hit is inside this cell, or the ray leaves the grid
+        int axis = next[0] < next[1] ? (next[0] < next[2] ? 0 : 2) : (next[1] < next[2] ? 1 : 2);
+        if ((AnyHit && p_primitive >= 0) || (p_primitive >= 0 && nearest <= next[axis]) || next[axis] > tmax)
+            break;
+
+        cell[axis] += step[axis];
+        next[axis] += delta[axis];
+        done = cell[axis] < 0 || cell[axis] >= m_resolution[axis];
+    }
+
+    if (p_counters != NULL)
+    {
+        p_counters->steps += steps;
+        p_counters->tests += tests;
+    }
+
+    p_t = nearest;
+    return p_primitive >= 0;
+}
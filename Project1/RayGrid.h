@@ -0,0 +1,49 @@
+//
+// Name :         RayGrid.h
+// Description :  Header for CRayGrid, a uniform grid ray intersection
+//                accelerator.
+//                See RayGrid.cpp
+//
+
+#pragma once
+#include "RayAccelerator.h"
+#include <vector>
+
+//
+// The bounds of the scene are divided into cells of equal size, about
+// Density polygons' worth per cell, and each polygon is listed in every
+// cell its bounding box overlaps. A ray walks the cells it passes through
+// in order (3D DDA) and stops in the first cell where it hits something
+// within the cell. Building is a single pass over the polygons, so the
+// grid is cheap to rebuild every frame, but cells fill up where polygons
+// crowd together.
+//
+
+class CRayGrid : public CRayAccelerator
+{
+public:
+    CRayGrid();
+
+    static const double Density;
+    static const int MaxResolution = 128;   // Cells along one axis, at most
+
+    virtual const char* Name() const { return "Uniform grid"; }
+    virtual void Build(const CRayGeometry& p_geometry);
+    virtual bool Intersect(const CRay& p_ray, double p_maxt, int p_ignore, int& p_primitive, double& p_t, Counters* p_counters = NULL) const;
+    virtual bool Occluded(const CRay& p_ray, double p_maxt, int p_ignore, Counters* p_counters = NULL) const;
+
+    const int* Resolution() const { return m_resolution; }
+
+private:
+    template <bool AnyHit> bool Traverse(const CRay& p_ray, double p_maxt, int p_ignore, int& p_primitive, double& p_t, Counters* p_counters) const;
+
+    double  m_min[3];
+    double  m_max[3];
+    double  m_cellsize[3];
+    int     m_resolution[3];
+
+    // The polygons of cell i are m_cellprimitives[m_cellstart[i]] up to
+    // m_cellprimitives[m_cellstart[i + 1]]
+    std::vector<int>    m_cellstart;
+    std::vector<int>    m_cellprimitives;
+};
@@ -0,0 +1,101 @@
+//
+// Name :         RayKdAccelerator.cpp
+// Description :  Implementation of CRayKdAccelerator.
+//
+
+#include "pch.h"
+#include "RayKdAccelerator.h"
+
+//
+// Name : CRayKdAccelerator::Build()
+// Description : Load every polygon into the intersection system, tagged
+// with its primitive id, and build the tree. Vertex normals and texture
+// coordinates are loaded too, so IntersectInfo() has them.
+//
+
+void CRayKdAccelerator::Build(const CRayGeometry& p_geometry)
+{
+    m_geometry = &p_geometry;
+    m_primitives.clear();
+    m_objects.assign(p_geometry.PrimitiveCnt(), NULL);
+
+    m_intersection.Initialize();
+    for (int p = 0; p < p_geometry.PrimitiveCnt(); p++)
+    {
+        const CRayGeometry::Polygon& polygon = p_geometry.GetPolygon(p);
+
+        m_intersection.PolygonBegin();
+        m_intersection.Material(reinterpret_cast<CGrMaterial*>(size_t(p + 1)));
+        for (int v = polygon.first; v < polygon.first + polygon.count; v++)
+        {
+            if (polygon.hasnormals)
+                m_intersection.Normal(p_geometry.Normal(v));
+            if (polygon.hastexcoords)
+                m_intersection.TexVertex(p_geometry.TexCoord(v));
+            m_intersection.Vertex(p_geometry.Vertex(v));
+        }
+        m_intersection.PolygonEnd();
+    }
+
+    m_intersection.LoadingComplete();
+}
+
+bool CRayKdAccelerator::Intersect(const CRay& p_ray, double p_maxt, int p_ignore, int& p_primitive, double& p_t, Counters* p_counters) const
+{
+    const CRayIntersection::Object* ignore = p_ignore >= 0 && p_ignore < int(m_objects.size()) ? m_objects[p_ignore] : NULL;
+
+    const CRayIntersection::Object* nearest;
+    CGrPoint intersect;
+    if (!m_intersection.Intersect(p_ray, p_maxt, ignore, nearest, p_t, intersect))
+        return false;
+
+    p_primitive = Primitive(p_ray, nearest, p_t);
+    if (p_primitive != p_ignore || ignore != NULL)
+        return true;
+
+    // The ignored polygon was hit before its object was known. It is now.
+    ignore = nearest;
+    if (!m_intersection.Intersect(p_ray, p_maxt, ignore, nearest, p_t, intersect))
+        return false;
+
+    p_primitive = Primitive(p_ray, nearest, p_t);
+    return true;
+}
+
+int CRayKdAccelerator::Primitive(const CRay& p_ray, const CRayIntersection::Object* p_object, double p_t) const
+{
+    std::unordered_map<const CRayIntersection::Object*, int>::const_iterator f = m_primitives.find(p_object);
+    if (f != m_primitives.end())
+        return f->second;
+
+    CGrPoint normal;
+    CGrMaterial* tag;
+    CGrTexture* texture;
+    CGrPoint texcoord;
+    m_intersection.IntersectInfo(p_ray, p_object, p_t, normal, tag, texture, texcoord);
+
+    int primitive = int(reinterpret_cast<size_t>(tag)) - 1;
+    m_primitives[p_object] = primitive;
+    if (primitive >= 0 && primitive < int(m_objects.size()))
+        m_objects[primitive] = p_object;
+
+    return primitive;
+}
+
+//
+// Name : CRayKdAccelerator::IntersectInfo()
+// Description : The DLL's own shading normal and texture coordinate for a
+// hit Intersect() has just reported. Returns false if the polygon's
+// object is not known.
+//
+
+bool CRayKdAccelerator::IntersectInfo(const CRay& p_ray, int p_primitive, double p_t, CGrPoint& p_normal, CGrPoint& p_texcoord) const
+{
+    if (p_primitive < 0 || p_primitive >= int(m_objects.size()) || m_objects[p_primitive] == NULL)
+        return false;
+
+    CGrMaterial* tag;
+    CGrTexture* texture;
+    m_intersection.IntersectInfo(p_ray, m_objects[p_primitive], p_t, p_normal, tag, texture, p_texcoord);
+    return true;
+}
@@ -0,0 +1,48 @@
+//
+// Name :         RayKdAccelerator.h
+// Description :  Header for CRayKdAccelerator, the kd-tree of the
+//                CRayIntersection DLL behind the CRayAccelerator interface.
+//                See RayKdAccelerator.cpp
+//
+
+#pragma once
+#include "RayAccelerator.h"
+#include <unordered_map>
+#include <vector>
+
+//
+// This is the ray tracer's default accelerator. The DLL reports hits as
+// its own objects. Each polygon is loaded with its primitive id + 1 as
+// the material tag, which the DLL treats as an anonymous pointer, so an
+// object is mapped to a primitive through IntersectInfo() the first time
+// it is hit, and the mapping is remembered both ways. A primitive to ignore is passed to
+// the DLL as its object once that is known.
+//
+// The DLL does not report nodes visited or polygons tested. The tree is
+// built from scratch by every Build(). The object maps are filled in as
+// rays are traced, so it is not thread safe.
+//
+
+class CRayKdAccelerator : public CRayAccelerator
+{
+public:
+    virtual const char* Name() const { return "Kd-tree"; }
+    virtual void Build(const CRayGeometry& p_geometry);
+    virtual bool Intersect(const CRay& p_ray, double p_maxt, int p_ignore, int& p_primitive, double& p_t, Counters* p_counters = NULL) const;
+    virtual bool ThreadSafe() const { return false; }
+
+    // Set the build parameters through this before Build()
+    CRayIntersection& Intersection() { return m_intersection; }
+
+    // The DLL's shading attributes for the hit Intersect() just reported
+    bool IntersectInfo(const CRay& p_ray, int p_primitive, double p_t, CGrPoint& p_normal, CGrPoint& p_texcoord) const;
+
+private:
+    int Primitive(const CRay& p_ray, const CRayIntersection::Object* p_object, double p_t) const;
+
+    // Intersect() and IntersectInfo() are not const in the DLL
+    mutable CRayIntersection m_intersection;
+
+    mutable std::unordered_map<const CRayIntersection::Object*, int> m_primitives;
+    mutable std::vector<const CRayIntersection::Object*> m_objects;     // By primitive, NULL until hit
+};
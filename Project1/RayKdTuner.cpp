@@ -0,0 +1,231 @@
+//
+// Name :         RayKdTuner.cpp
+// Description :  Implementation of CRayKdTuner. Candidates are built from
+//                the CRayGeometry copy of the scene into trees of their
+//                own, so the accelerator's CRayIntersection is only touched
+//                to set the winning parameters.
+//
+
+#include "pch.h"
+#include "RayKdTuner.h"
+#include "graphics/GrProfiler.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <sstream>
+
+// A candidate has to beat the best by this much, so timing noise
+// does not move the parameters back and forth
+const double NoiseMargin = 0.97;
+
+CRayKdTuner::CRayKdTuner()
+{
+    m_samples = 4096;
+}
+
+void CRayKdTuner::Apply(CRayIntersection& p_intersection, const Parameters& p_parameters)
+{
+    p_intersection.SetIntersectionCost(p_parameters.intersectioncost);
+    p_intersection.SetTraverseCost(p_parameters.traversecost);
+    p_intersection.SetMaxDepth(p_parameters.maxdepth);
+    p_intersection.SetMinLeaf(p_parameters.minleaf);
+}
+
+//
+// Name : CRayKdTuner::Tune()
+// Description : Search for the parameters with the lowest estimated
+// render cost, unless the scene has been tuned before.
+//
+
+const CRayKdTuner::Parameters& CRayKdTuner::Tune(unsigned long long p_scenehash, const CRayGeometry& p_geometry,
+    const std::vector<CRay>& p_primary, const std::vector<CGrPoint>& p_lights, double p_scale)
+{
+    std::map<unsigned long long, Parameters>::const_iterator known = m_cache.find(p_scenehash);
+    if (known != m_cache.end())
+        return known->second;
+
+    GR_PROFILE_ZONE("CRayKdTuner::Tune");
+
+    // The library defaults and a tree built with them
+    CRayIntersection reference;
+    Parameters best;
+    best.intersectioncost = reference.GetIntersectionCost();
+    best.traversecost = reference.GetTraverseCost();
+    best.maxdepth = reference.GetMaxDepth();
+    best.minleaf = reference.GetMinLeaf();
+
+    Load(reference, p_geometry);
+    reference.LoadingComplete();
+
+    // The sample: primary rays and shadow rays from where they hit.
+    // Shadow rays start just off the surface, since the hit object
+    // is a different object in each candidate tree.
+    std::vector<Sample> rays;
+    for (size_t i = 0; i < p_primary.size(); i++)
+    {
+        Sample primary = { p_primary[i], 1e20 };
+        rays.push_back(primary);
+
+        const CRayIntersection::Object* nearest;
+        double t;
+        CGrPoint intersect;
+        if (!reference.Intersect(p_primary[i], 1e20, NULL, nearest, t, intersect))
+            continue;
+
+        for (size_t l = 0; l < p_lights.size(); l++)
+        {
+            CGrPoint dir = p_lights[l] - intersect;
+            dir.W(0);
+            double length = dir.Length3();
+            if (length <= 1e-6)
+                continue;
+
+            dir = dir / length;
+            CGrPoint origin = intersect + dir * 1e-4;
+            origin.W(1);
+
+            Sample shadow = { CRay(origin, dir), length };
+            rays.push_back(shadow);
+        }
+    }
+
+    std::ostringstream report;
+    report.setf(std::ios::fixed);
+    report.precision(2);
+
+    std::vector<Parameters> tried;
+    double bestcost = Evaluate(best, p_geometry, rays, p_scale);
+    tried.push_back(best);
+    report << bestcost * 1000 << " ms  " << best.intersectioncost << " " << best.traversecost << " "
+        << best.maxdepth << " " << best.minleaf << " (defaults)\n";
+
+    for (int pass = 0; pass < Passes; pass++)
+    {
+        bool changed = false;
+        for (int p = 0; p < 4; p++)
+        {
+            // Values to try for parameter p around the best so far
+            Parameters candidates[2] = { best, best };
+            switch (p)
+            {
+            case 0:
+                candidates[0].intersectioncost = best.intersectioncost * 0.5;
+                candidates[1].intersectioncost = best.intersectioncost * 2;
+                break;
+
+            case 1:
+                candidates[0].traversecost = best.traversecost * 0.5;
+                candidates[1].traversecost = best.traversecost * 2;
+                break;
+
+            case 2:
+                candidates[0].maxdepth = max(best.maxdepth - 4, 1);
+                candidates[1].maxdepth = best.maxdepth + 4;
+                break;
+
+            case 3:
+                candidates[0].minleaf = max(best.minleaf / 2, 1);
+                candidates[1].minleaf = best.minleaf * 2;
+                break;
+            }
+
+            Parameters winner = best;
+            double winnercost = bestcost;
+            for (int c = 0; c < 2; c++)
+            {
+                const Parameters& candidate = candidates[c];
+
+                bool seen = false;
+                for (size_t i = 0; i < tried.size() && !seen; i++)
+                {
+                    seen = tried[i].intersectioncost == candidate.intersectioncost && tried[i].traversecost == candidate.traversecost &&
+                        tried[i].maxdepth == candidate.maxdepth && tried[i].minleaf == candidate.minleaf;
+                }
+                if (seen)
+                    continue;
+
+                tried.push_back(candidate);
+                double cost = Evaluate(candidate, p_geometry, rays, p_scale);
+                report << cost * 1000 << " ms  " << candidate.intersectioncost << " " << candidate.traversecost << " "
+                    << candidate.maxdepth << " " << candidate.minleaf << "\n";
+
+                if (cost < winnercost * NoiseMargin)
+                {
+                    winner = candidate;
+                    winnercost = cost;
+                }
+            }
+
+            if (winnercost < bestcost)
+            {
+                best = winner;
+                bestcost = winnercost;
+                changed = true;
+            }
+        }
+
+        if (!changed)
+            break;
+    }
+
+    report << bestcost * 1000 << " ms  " << best.intersectioncost << " " << best.traversecost << " "
+        << best.maxdepth << " " << best.minleaf << " (chosen)\n";
+    m_report = report.str();
+
+    return m_cache[p_scenehash] = best;
+}
+
+//
+// Name : CRayKdTuner::Load()
+// Description : Add the polygons of the scene to an intersection
+// system. Only the vertices matter for timing the tree.
+//
+
+void CRayKdTuner::Load(CRayIntersection& p_intersection, const CRayGeometry& p_geometry)
+{
+    p_intersection.Initialize();
+    p_intersection.Material(NULL);
+    for (int p = 0; p < p_geometry.PrimitiveCnt(); p++)
+    {
+        const CRayGeometry::Polygon& polygon = p_geometry.GetPolygon(p);
+
+        p_intersection.PolygonBegin();
+        for (int v = 0; v < polygon.count; v++)
+            p_intersection.Vertex(p_geometry.Vertex(polygon.first + v));
+        p_intersection.PolygonEnd();
+    }
+}
+
+//
+// Name : CRayKdTuner::Evaluate()
+// Description : Estimated render cost in seconds of a tree built with
+// these parameters: the build plus the sample traced p_scale times.
+//
+
+double CRayKdTuner::Evaluate(const Parameters& p_parameters, const CRayGeometry& p_geometry,
+    const std::vector<Sample>& p_rays, double p_scale)
+{
+    CRayIntersection intersection;
+    Load(intersection, p_geometry);
+    Apply(intersection, p_parameters);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    intersection.LoadingComplete();
+    double build = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    double trace = 1e20;
+    for (int r = 0; r < Repetitions; r++)
+    {
+        start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < p_rays.size(); i++)
+        {
+            const CRayIntersection::Object* nearest;
+            double t;
+            CGrPoint intersect;
+            intersection.Intersect(p_rays[i].ray, p_rays[i].maxt, NULL, nearest, t, intersect);
+        }
+        trace = min(trace, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+
+    return build + trace * p_scale;
+}
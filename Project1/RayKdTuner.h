@@ -0,0 +1,86 @@
+//
+// Name :         RayKdTuner.h
+// Description :  Header for CRayKdTuner, which picks the kd-tree build
+//                parameters of CRayIntersection for each scene.
+//                See RayKdTuner.cpp
+//
+
+#pragma once
+#include "graphics/RayIntersection.h"
+#include "RayGeometry.h"
+#include <map>
+#include <string>
+#include <vector>
+
+//
+// CRayIntersection builds its kd-tree with a surface area heuristic
+// controlled by the intersection and traversal costs, a maximum depth
+// and a minimum leaf size. The library defaults are not right for every
+// scene, so the tuner tries others on a copy of the scene:
+//
+// 1.  A tree with the defaults traces a sample of primary rays and the
+//     shadow rays from their hits to each light.
+// 2.  Each parameter in turn is set to each of a few values around the
+//     current best, with the others held, and a tree is built and the
+//     sample traced. The estimated cost of a render is the build time
+//     plus the trace time scaled up to the whole image. Anything that
+//     beats the best by more than the noise margin becomes the best.
+// 3.  Step 2 repeats until nothing changes or Passes is reached.
+//
+// The winner is kept by scene hash (see CRayVisibilityCache::Hash), so
+// only the first render of a scene pays for the search. Like the other
+// persistent ray tracer state the object should live as long as the
+// view (see CMyRaytraceRenderer::SetKdTuner).
+//
+
+class CRayKdTuner
+{
+public:
+    CRayKdTuner();
+
+    struct Parameters
+    {
+        double  intersectioncost;
+        double  traversecost;
+        int     maxdepth;
+        int     minleaf;
+    };
+
+    static const int Passes = 2;
+    static const int Repetitions = 3;     // Timings per candidate, fastest kept
+
+    // Primary rays are sampled on a grid of about this many
+    void SetSampleCount(int n) { m_samples = n; }
+    int GetSampleCount() const { return m_samples; }
+
+    // Find (or look up) the parameters for a scene. p_primary is the
+    // sample of primary rays, p_lights the light positions and p_scale
+    // how many rays the full render traces for each one in the sample.
+    const Parameters& Tune(unsigned long long p_scenehash, const CRayGeometry& p_geometry,
+        const std::vector<CRay>& p_primary, const std::vector<CGrPoint>& p_lights, double p_scale);
+
+    // Set the parameters before CRayIntersection::LoadingComplete()
+    static void Apply(CRayIntersection& p_intersection, const Parameters& p_parameters);
+
+    bool Known(unsigned long long p_scenehash) const { return m_cache.find(p_scenehash) != m_cache.end(); }
+    void Clear() { m_cache.clear(); }
+
+    // The search for the most recent scene tuned, one line per candidate
+    const std::string& Report() const { return m_report; }
+
+private:
+    struct Sample
+    {
+        CRay    ray;
+        double  maxt;
+    };
+
+    static void Load(CRayIntersection& p_intersection, const CRayGeometry& p_geometry);
+    double Evaluate(const Parameters& p_parameters, const CRayGeometry& p_geometry,
+        const std::vector<Sample>& p_rays, double p_scale);
+
+    int     m_samples;
+
+    std::map<unsigned long long, Parameters> m_cache;
+    std::string m_report;
+};
@@ -0,0 +1,100 @@
+//
+// Name :         RayLightLinks.cpp
+// Description :  Implementation of CRayLightLinks.
+//
+
+#include "pch.h"
+#include "RayLightLinks.h"
+#include <algorithm>
+
+CRayLightLinks::CRayLightLinks()
+{
+    m_groups.resize(1);
+    m_lightcnt = 0;
+}
+
+bool CRayLightLinks::Begin(const CGrRenderer& p_renderer)
+{
+    std::vector<const CGrObject*> objects;
+    for (int i = 0; i < p_renderer.LightCnt(); i++)
+    {
+        const CGrRenderer::Light& light = p_renderer.GetLight(i);
+        objects.insert(objects.end(), light.m_includeobjects.begin(), light.m_includeobjects.end());
+        objects.insert(objects.end(), light.m_excludeobjects.begin(), light.m_excludeobjects.end());
+    }
+
+    std::sort(objects.begin(), objects.end());
+    objects.erase(std::unique(objects.begin(), objects.end()), objects.end());
+
+    if (objects == m_objects)
+        return true;
+
+    m_objects.swap(objects);
+    m_groups.resize(1);
+    return false;
+}
+
+bool CRayLightLinks::Linked(const CGrObject* p_object) const
+{
+    return !m_objects.empty() && std::binary_search(m_objects.begin(), m_objects.end(), p_object);
+}
+
+//
+// Name : CRayLightLinks::Enter()
+// Description : Find the group that is the objects of p_group and
+// p_object, adding it if it is new. There are few, so they are
+// searched in order.
+//
+
+int CRayLightLinks::Enter(int p_group, const CGrObject* p_object)
+{
+    std::vector<const CGrObject*> objects = m_groups[p_group];
+    if (std::find(objects.begin(), objects.end(), p_object) != objects.end())
+        return p_group;
+
+    objects.push_back(p_object);
+    std::sort(objects.begin(), objects.end());
+
+    for (size_t g = 0; g < m_groups.size(); g++)
+    {
+        if (m_groups[g] == objects)
+            return int(g);
+    }
+
+    m_groups.push_back(objects);
+    return int(m_groups.size()) - 1;
+}
+
+//
+// Name : CRayLightLinks::End()
+// Description : A light reaches a group if it has no include objects or
+// the group is below one of them, and the group is below none of its
+// exclude objects.
+//
+
+void CRayLightLinks::End(const CGrRenderer& p_renderer)
+{
+    m_lightcnt = p_renderer.LightCnt();
+    m_table.assign(m_groups.size() * m_lightcnt, 1);
+
+    for (int i = 0; i < m_lightcnt; i++)
+    {
+        const CGrRenderer::Light& light = p_renderer.GetLight(i);
+        for (size_t g = 0; g < m_groups.size(); g++)
+        {
+            bool included = light.m_includeobjects.empty() || Contains(light.m_includeobjects, m_groups[g]);
+            m_table[g * m_lightcnt + i] = included && !Contains(light.m_excludeobjects, m_groups[g]);
+        }
+    }
+}
+
+bool CRayLightLinks::Contains(const std::vector<CGrObject*>& p_list, const std::vector<const CGrObject*>& p_group)
+{
+    for (size_t i = 0; i < p_list.size(); i++)
+    {
+        if (std::binary_search(p_group.begin(), p_group.end(), (const CGrObject*)p_list[i]))
+            return true;
+    }
+
+    return false;
+}
@@ -0,0 +1,65 @@
+//
+// Name :         RayLightLinks.h
+// Description :  Header for CRayLightLinks, which sorts the polygons of the
+//                ray tracer into groups by the scene graph objects the
+//                lights are linked to.
+//                See RayLightLinks.cpp
+//
+
+#pragma once
+#include "graphics/GrRenderer.h"
+#include <vector>
+
+class CGrObject;
+
+//
+// A light can be linked to scene graph objects as well as to materials
+// (see CGrRenderer::Light). The lists name objects, but the shading
+// kernels only see polygons, so each polygon carries a group
+// (CRayGeometry::Polygon::link). A group is the set of linked objects the
+// polygon is below. Group 0 is below none of them.
+//
+// To use:
+//
+// 1.  Call Begin() before the scene graph is rendered
+// 2.  For each child of a composite that is Linked(), render the child
+//     with the group Enter() returns and go back to the outer group
+//     afterwards
+// 3.  Call End() once the scene is complete, then ask Illuminates()
+//
+// Only objects that are children of a composite are seen (see
+// CGrRenderer::RendererVisible()), so the root object can't be linked.
+//
+// Groups are kept from render to render while the lights link the same
+// objects, so polygons kept by a CRaySceneCache keep their groups.
+//
+
+class CRayLightLinks
+{
+public:
+    CRayLightLinks();
+
+    // Collect the objects the lights are linked to. Returns false if
+    // they are not the ones of the last render, and the groups of
+    // earlier polygons are no longer valid.
+    bool Begin(const CGrRenderer& p_renderer);
+
+    // Does some light name this object?
+    bool Linked(const CGrObject* p_object) const;
+
+    // The group of what is below p_object, in group p_group
+    int Enter(int p_group, const CGrObject* p_object);
+
+    // Decide which lights reach each group
+    void End(const CGrRenderer& p_renderer);
+
+    bool Illuminates(int p_light, int p_group) const { return m_table[size_t(p_group) * m_lightcnt + p_light] != 0; }
+
+private:
+    static bool Contains(const std::vector<CGrObject*>& p_list, const std::vector<const CGrObject*>& p_group);
+
+    std::vector<const CGrObject*>               m_objects;  // Sorted
+    std::vector<std::vector<const CGrObject*> > m_groups;   // Objects each group is below
+    std::vector<unsigned char>                  m_table;    // Group by light
+    int                                         m_lightcnt;
+};
@@ -0,0 +1,223 @@
+//
+// Name :         RayLightTree.cpp
+// Description :  Implementation of CRayLightTree. The tree is built top
+//                down by splitting the lights at the median of the longest
+//                axis of their bounds.
+//
+
+#include "pch.h"
+#include "RayLightTree.h"
+#include <algorithm>
+#include <cmath>
+
+CRayLightTree::CRayLightTree()
+{
+    m_maxerror = 0.02;
+    m_maxcut = 32;
+}
+
+//
+// Name : CRayLightTree::Build()
+// Description : Build the tree over the given lights of the renderer.
+//
+
+void CRayLightTree::Build(const CGrRenderer& p_renderer, const std::vector<int>& p_lights)
+{
+    m_nodes.clear();
+    m_positions.clear();
+
+    int lightcnt = int(p_lights.size());
+    if (lightcnt == 0)
+        return;
+
+    // Positions and intensities are indexed by renderer light
+    std::vector<int> lights(p_lights);
+    std::vector<double> intensity(p_renderer.LightCnt(), 0.);
+    m_positions.resize(p_renderer.LightCnt());
+    for (int j = 0; j < lightcnt; j++)
+    {
+        int i = lights[j];
+        const CGrRenderer::Light& light = p_renderer.GetLight(i);
+        m_positions[i] = light.m_pos;
+
+        // Luminance of the diffuse color picks the representatives
+        double lum = 0.2126 * light.m_diffuse[0] + 0.7152 * light.m_diffuse[1] + 0.0722 * light.m_diffuse[2];
+        intensity[i] = lum > 1e-6 ? lum : 1e-6;
+    }
+
+    m_nodes.reserve(lightcnt * 2);
+    BuildNode(lights, 0, lightcnt, intensity);
+}
+
+int CRayLightTree::BuildNode(std::vector<int>& p_lights, int p_first, int p_last, const std::vector<double>& p_intensity)
+{
+    int index = int(m_nodes.size());
+    m_nodes.push_back(Node());
+
+    Node node;
+    node.min = node.max = m_positions[p_lights[p_first]];
+    node.intensity = 0;
+    node.count = p_last - p_first;
+    node.child[0] = node.child[1] = -1;
+    node.light = p_lights[p_first];
+
+    for (int i = p_first; i < p_last; i++)
+    {
+        node.min.Minimize(m_positions[p_lights[i]]);
+        node.max.Maximize(m_positions[p_lights[i]]);
+        node.intensity += p_intensity[p_lights[i]];
+    }
+
+    if (node.count > 1)
+    {
+        int axis = 0;
+        CGrPoint extent = node.max - node.min;
+        if (extent.Y() > extent[axis])
+            axis = 1;
+        if (extent.Z() > extent[axis])
+            axis = 2;
+
+        int mid = (p_first + p_last) / 2;
+        const std::vector<CGrPoint>& positions = m_positions;
+        std::nth_element(p_lights.begin() + p_first, p_lights.begin() + mid, p_lights.begin() + p_last,
+            [&positions, axis](int a, int b) { return positions[a][axis] < positions[b][axis]; });
+
+        node.child[0] = BuildNode(p_lights, p_first, mid, p_intensity);
+        node.child[1] = BuildNode(p_lights, mid, p_last, p_intensity);
+
+        // The brighter child supplies the representative
+        const Node& a = m_nodes[node.child[0]];
+        const Node& b = m_nodes[node.child[1]];
+        node.light = a.intensity >= b.intensity ? a.light : b.light;
+    }
+
+    m_nodes[index] = node;
+    return index;
+}
+
+//
+// Name : CRayLightTree::CosineBound()
+// Description : An upper bound on N.L for any light in the node.
+// The node bounds are transformed into a frame with N as the z axis.
+//
+
+double CRayLightTree::CosineBound(const Node& p_node, const CGrPoint& p_point, const CGrPoint& p_normal) const
+{
+    CGrPoint axis = fabs(p_normal.X()) < 0.9 ? CGrPoint(1, 0, 0, 0) : CGrPoint(0, 1, 0, 0);
+    CGrPoint t = Normalize3(Cross3(p_normal, axis));
+    CGrPoint b = Cross3(p_normal, t);
+
+    double lo[3] = {1e30, 1e30, 1e30};
+    double hi[3] = {-1e30, -1e30, -1e30};
+    for (int c = 0; c < 8; c++)
+    {
+        CGrPoint corner((c & 1) ? p_node.max.X() : p_node.min.X(),
+            (c & 2) ? p_node.max.Y() : p_node.min.Y(),
+            (c & 4) ? p_node.max.Z() : p_node.min.Z());
+        corner -= p_point;
+
+        double v[3] = {Dot3(corner, t), Dot3(corner, b), Dot3(corner, p_normal)};
+        for (int d = 0; d < 3; d++)
+        {
+            lo[d] = v[d] < lo[d] ? v[d] : lo[d];
+            hi[d] = v[d] > hi[d] ? v[d] : hi[d];
+        }
+    }
+
+    if (hi[2] <= 0)
+        return 0;
+
+    double dx = lo[0] > 0 ? lo[0] : (hi[0] < 0 ? -hi[0] : 0);
+    double dy = lo[1] > 0 ? lo[1] : (hi[1] < 0 ? -hi[1] : 0);
+    return hi[2] / sqrt(dx * dx + dy * dy + hi[2] * hi[2]);
+}
+
+//
+// Name : CRayLightTree::Evaluate()
+// Description : The lighting terms of the representative of a node.
+//
+
+void CRayLightTree::Evaluate(int p_node, const CGrPoint& p_point, const CGrPoint& p_normal, const CGrPoint& p_view,
+    float p_kd, float p_ks, float p_shininess, bool p_specular, CutLight& p_cut) const
+{
+    const Node& node = m_nodes[p_node];
+    CGrPoint lightDir = m_positions[node.light] - p_point;
+
+    double length = lightDir.Length3();
+    if (length != 0)
+    {
+        lightDir = lightDir / length;
+    }
+
+    p_cut.count = node.count;
+    p_cut.light = node.light;
+    p_cut.dx = lightDir.X();
+    p_cut.dy = lightDir.Y();
+    p_cut.dz = lightDir.Z();
+    p_cut.length = length;
+
+    double ndotl = Dot3(lightDir, p_normal);
+    p_cut.diffuse = p_kd * float(ndotl > 0 ? ndotl : 0);
+    p_cut.specular = 0;
+    if (p_specular)
+    {
+        double ndoth = Dot3(Normalize3(lightDir + p_view), p_normal);
+        p_cut.specular = p_ks * float(pow(ndoth > 0 ? ndoth : 0, p_shininess));
+    }
+}
+
+//
+// Name : CRayLightTree::SelectCut()
+// Description : Choose the clusters that shade a point. The estimate of a
+// cluster is the term of its representative times the number of lights.
+// The error bound of a cluster is the largest term any of its lights
+// could have times the number of lights. Single lights are exact.
+//
+
+int CRayLightTree::SelectCut(const CGrPoint& p_point, const CGrPoint& p_normal, const CGrPoint& p_view,
+    float p_kd, float p_ks, float p_shininess, bool p_specular, CutLight* p_cut) const
+{
+    if (m_nodes.empty())
+        return 0;
+
+    int nodes[MaxCut];
+    double estimate[MaxCut];
+    double error[MaxCut];
+
+    double specularBound = p_specular ? p_ks : 0;
+
+    // Add node n to the cut as entry i
+    auto place = [&](int i, int n) {
+        const Node& node = m_nodes[n];
+        nodes[i] = n;
+        Evaluate(n, p_point, p_normal, p_view, p_kd, p_ks, p_shininess, p_specular, p_cut[i]);
+        estimate[i] = node.count * (p_cut[i].diffuse + p_cut[i].specular);
+        error[i] = node.child[0] < 0 ? 0 : node.count * (p_kd * CosineBound(node, p_point, p_normal) + specularBound);
+    };
+
+    int cnt = 1;
+    place(0, 0);
+
+    while (cnt < m_maxcut)
+    {
+        double total = 0;
+        int worst = -1;
+        for (int i = 0; i < cnt; i++)
+        {
+            total += estimate[i];
+            if (error[i] > 0 && (worst < 0 || error[i] > error[worst]))
+                worst = i;
+        }
+
+        if (worst < 0 || error[worst] <= m_maxerror * total)
+            break;
+
+        // Refine the worst cluster into its children
+        const Node& node = m_nodes[nodes[worst]];
+        int second = node.child[1];
+        place(worst, node.child[0]);
+        place(cnt++, second);
+    }
+
+    return cnt;
+}
@@ -0,0 +1,72 @@
+//
+// Name :         RayLightTree.h
+// Description :  Header for CRayLightTree, a light hierarchy for shading
+//                scenes with hundreds of lights (lightcuts).
+//                See RayLightTree.cpp
+//
+
+#pragma once
+#include "graphics/GrRenderer.h"
+#include <vector>
+
+//
+// The lights are clustered by position into a binary tree. Each cluster
+// has a representative light, chosen by intensity. To shade a point, a cut
+// through the tree is selected: a set of clusters that covers every light
+// once. The cut starts at the root, and the cluster with the largest error
+// bound is replaced by its children until every bound is under the allowed
+// relative error or the cut reaches its maximum size. Only the
+// representatives of the cut get shadow rays. Each one stands in for all
+// of the lights of its cluster, so only lights that differ in nothing but
+// position and color should be put in the tree.
+//
+
+class CRayLightTree
+{
+public:
+    CRayLightTree();
+
+    static const int MaxCut = 64;
+
+    // One cluster of the cut. The terms are those of the representative.
+    struct CutLight
+    {
+        int     count;          // Lights the representative stands for
+        int     light;          // The representative light
+        double  dx, dy, dz;     // Unit direction to the representative
+        double  length;         // Distance to the representative
+        float   diffuse;        // Kd * N.L
+        float   specular;       // Ks * (N.H)^shininess
+    };
+
+    // p_lights are the indices of the renderer lights to cluster
+    void Build(const CGrRenderer& p_renderer, const std::vector<int>& p_lights);
+    bool Empty() const { return m_nodes.empty(); }
+
+    void SetMaxError(double e) { m_maxerror = e; }
+    void SetMaxCut(int c) { m_maxcut = c < MaxCut ? c : MaxCut; }
+
+    // Select the cut for a point. Returns the number of clusters in p_cut.
+    int SelectCut(const CGrPoint& p_point, const CGrPoint& p_normal, const CGrPoint& p_view,
+        float p_kd, float p_ks, float p_shininess, bool p_specular, CutLight* p_cut) const;
+
+private:
+    struct Node
+    {
+        CGrPoint    min, max;       // Bounds of the light positions
+        double      intensity;      // Sum of the light intensities
+        int         count;
+        int         light;          // Representative light
+        int         child[2];       // -1 for a leaf
+    };
+
+    int BuildNode(std::vector<int>& p_lights, int p_first, int p_last, const std::vector<double>& p_intensity);
+    double CosineBound(const Node& p_node, const CGrPoint& p_point, const CGrPoint& p_normal) const;
+    void Evaluate(int p_node, const CGrPoint& p_point, const CGrPoint& p_normal, const CGrPoint& p_view,
+        float p_kd, float p_ks, float p_shininess, bool p_specular, CutLight& p_cut) const;
+
+    std::vector<Node>       m_nodes;        // m_nodes[0] is the root
+    std::vector<CGrPoint>   m_positions;
+    double                  m_maxerror;
+    int                     m_maxcut;
+};
@@ -0,0 +1,308 @@
+//
+// Name :         RayLights.cpp
+// Description :  Implementation of CRayLights. The same lighting code is
+//                compiled for SSE2 (4 lights) or AVX2 (8 lights) through a
+//                small set of vector operations. pow() is replaced by a fast
+//                exp2(shininess * log2(x)) approximation.
+//
+
+#include "pch.h"
+#include "RayLights.h"
+#include "RayLightLinks.h"
+#include <immintrin.h>
+#include <cfloat>
+
+namespace
+{
+    //
+    // Vector operations. Each wrapper supplies the same functions
+    // for its register width.
+    //
+
+    struct Sse
+    {
+        typedef __m128 F;
+        typedef __m128i I;
+
+        static F Set(float a) { return _mm_set1_ps(a); }
+        static F Load(const float* p) { return _mm_load_ps(p); }
+        static void Store(float* p, F a) { _mm_store_ps(p, a); }
+        static F Add(F a, F b) { return _mm_add_ps(a, b); }
+        static F Sub(F a, F b) { return _mm_sub_ps(a, b); }
+        static F Mul(F a, F b) { return _mm_mul_ps(a, b); }
+        static F Div(F a, F b) { return _mm_div_ps(a, b); }
+        static F Max(F a, F b) { return _mm_max_ps(a, b); }
+        static F Min(F a, F b) { return _mm_min_ps(a, b); }
+        static F Sqrt(F a) { return _mm_sqrt_ps(a); }
+        static F Greater(F a, F b) { return _mm_cmpgt_ps(a, b); }
+        static F And(F a, F b) { return _mm_and_ps(a, b); }
+        static F Or(F a, F b) { return _mm_or_ps(a, b); }
+        static F ToFloat(I a) { return _mm_cvtepi32_ps(a); }
+        static I ToInt(F a) { return _mm_cvtps_epi32(a); }
+        static I Bits(F a) { return _mm_castps_si128(a); }
+        static F Float(I a) { return _mm_castsi128_ps(a); }
+        static I SetI(int a) { return _mm_set1_epi32(a); }
+        static I AndI(I a, I b) { return _mm_and_si128(a, b); }
+        static I AddI(I a, I b) { return _mm_add_epi32(a, b); }
+        static I SubI(I a, I b) { return _mm_sub_epi32(a, b); }
+        static I ShiftLeft(I a, int n) { return _mm_slli_epi32(a, n); }
+        static I ShiftRight(I a, int n) { return _mm_srli_epi32(a, n); }
+    };
+
+#ifdef __AVX2__
+    struct Avx
+    {
+        typedef __m256 F;
+        typedef __m256i I;
+
+        static F Set(float a) { return _mm256_set1_ps(a); }
+        static F Load(const float* p) { return _mm256_load_ps(p); }
+        static void Store(float* p, F a) { _mm256_store_ps(p, a); }
+        static F Add(F a, F b) { return _mm256_add_ps(a, b); }
+        static F Sub(F a, F b) { return _mm256_sub_ps(a, b); }
+        static F Mul(F a, F b) { return _mm256_mul_ps(a, b); }
+        static F Div(F a, F b) { return _mm256_div_ps(a, b); }
+        static F Max(F a, F b) { return _mm256_max_ps(a, b); }
+        static F Min(F a, F b) { return _mm256_min_ps(a, b); }
+        static F Sqrt(F a) { return _mm256_sqrt_ps(a); }
+        static F Greater(F a, F b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+        static F And(F a, F b) { return _mm256_and_ps(a, b); }
+        static F Or(F a, F b) { return _mm256_or_ps(a, b); }
+        static F ToFloat(I a) { return _mm256_cvtepi32_ps(a); }
+        static I ToInt(F a) { return _mm256_cvtps_epi32(a); }
+        static I Bits(F a) { return _mm256_castps_si256(a); }
+        static F Float(I a) { return _mm256_castsi256_ps(a); }
+        static I SetI(int a) { return _mm256_set1_epi32(a); }
+        static I AndI(I a, I b) { return _mm256_and_si256(a, b); }
+        static I AddI(I a, I b) { return _mm256_add_epi32(a, b); }
+        static I SubI(I a, I b) { return _mm256_sub_epi32(a, b); }
+        static I ShiftLeft(I a, int n) { return _mm256_slli_epi32(a, n); }
+        static I ShiftRight(I a, int n) { return _mm256_srli_epi32(a, n); }
+    };
+
+    typedef Avx Simd;
+#else
+    typedef Sse Simd;
+#endif
+
+    typedef Simd::F F;
+    typedef Simd::I I;
+
+    // log2(x) for x > 0. Minimax polynomial for log2(m)/(m-1) on the
+    // mantissa m in [1, 2), plus the exponent.
+    inline F Log2(F x)
+    {
+        I bits = Simd::Bits(x);
+        F e = Simd::ToFloat(Simd::SubI(Simd::ShiftRight(Simd::AndI(bits, Simd::SetI(0x7f800000)), 23), Simd::SetI(127)));
+        F one = Simd::Set(1.f);
+        F m = Simd::Or(Simd::Float(Simd::AndI(bits, Simd::SetI(0x007fffff))), one);
+
+        F p = Simd::Set(0.0596515482674574969533f);
+        p = Simd::Add(Simd::Mul(p, m), Simd::Set(-0.465725644288844778798f));
+        p = Simd::Add(Simd::Mul(p, m), Simd::Set(1.48116647521213171641f));
+        p = Simd::Add(Simd::Mul(p, m), Simd::Set(-2.52074962577807006663f));
+        p = Simd::Add(Simd::Mul(p, m), Simd::Set(2.8882704548164776201f));
+
+        return Simd::Add(Simd::Mul(p, Simd::Sub(m, one)), e);
+    }
+
+    // 2^x. Minimax polynomial on the fraction in [0, 1] (x - 0.5 is
+    // rounded to the nearest integer, so the fraction reaches 1 where x
+    // is an odd integer), scaled by the integer part built directly as
+    // an exponent. The polynomial is within 1.6e-7 relative of 2^f on
+    // that range, about one float ulp.
+    inline F Exp2(F x)
+    {
+        x = Simd::Min(x, Simd::Set(129.f));
+        x = Simd::Max(x, Simd::Set(-126.99999f));
+
+        I ipart = Simd::ToInt(Simd::Sub(x, Simd::Set(0.5f)));
+        F fpart = Simd::Sub(x, Simd::ToFloat(ipart));
+        F expipart = Simd::Float(Simd::ShiftLeft(Simd::AddI(ipart, Simd::SetI(127)), 23));
+
+        F p = Simd::Set(1.8775767e-3f);
+        p = Simd::Add(Simd::Mul(p, fpart), Simd::Set(8.9893397e-3f));
+        p = Simd::Add(Simd::Mul(p, fpart), Simd::Set(5.5826318e-2f));
+        p = Simd::Add(Simd::Mul(p, fpart), Simd::Set(2.4015361e-1f));
+        p = Simd::Add(Simd::Mul(p, fpart), Simd::Set(6.9315308e-1f));
+        p = Simd::Add(Simd::Mul(p, fpart), Simd::Set(9.9999994e-1f));
+
+        return Simd::Mul(expipart, p);
+    }
+
+    // 1 / sqrt(x), or 0 where x is 0
+    inline F InverseLength(F lengthSquared, F& length)
+    {
+        F zero = Simd::Set(0.f);
+        length = Simd::Sqrt(lengthSquared);
+        F nonzero = Simd::Greater(length, zero);
+        return Simd::And(Simd::Div(Simd::Set(1.f), Simd::Max(length, Simd::Set(1e-30f))), nonzero);
+    }
+}
+
+CRayLights::CRayLights()
+{
+    m_count = 0;
+    m_capacity = 0;
+    m_x = m_y = m_z = m_valid = m_range = NULL;
+    m_renderer = NULL;
+    m_links = NULL;
+    m_linked = false;
+    m_cutthreshold = 64;
+    m_usecuts = false;
+}
+
+CRayLights::~CRayLights()
+{
+    _mm_free(m_x);
+    _mm_free(m_y);
+    _mm_free(m_z);
+    _mm_free(m_valid);
+    _mm_free(m_range);
+}
+
+//
+// Name : CRayLights::Build()
+// Description : Copy the lights of the renderer into the table.
+//
+
+void CRayLights::Build(const CGrRenderer& p_renderer, const CRayLightLinks* p_links)
+{
+    m_eye = p_renderer.Eye();
+    m_count = p_renderer.LightCnt();
+
+    int capacity = (m_count + Width - 1) / Width * Width;
+    if (capacity == 0)
+        capacity = Width;
+
+    if (capacity > m_capacity)
+    {
+        _mm_free(m_x);
+        _mm_free(m_y);
+        _mm_free(m_z);
+        _mm_free(m_valid);
+        _mm_free(m_range);
+
+        m_capacity = capacity;
+        m_x = (float*)_mm_malloc(m_capacity * sizeof(float), 32);
+        m_y = (float*)_mm_malloc(m_capacity * sizeof(float), 32);
+        m_z = (float*)_mm_malloc(m_capacity * sizeof(float), 32);
+        m_valid = (float*)_mm_malloc(m_capacity * sizeof(float), 32);
+        m_range = (float*)_mm_malloc(m_capacity * sizeof(float), 32);
+    }
+
+    m_renderer = &p_renderer;
+    m_links = p_links;
+    m_castshadows.assign(m_count, 1);
+    m_linked = false;
+
+    std::vector<int> cut;
+    m_uncut.clear();
+
+    for (int i = 0; i < m_capacity; i++)
+    {
+        if (i < m_count)
+        {
+            const CGrRenderer::Light& light = p_renderer.GetLight(i);
+            m_x[i] = float(light.m_pos.X());
+            m_y[i] = float(light.m_pos.Y());
+            m_z[i] = float(light.m_pos.Z());
+            m_valid[i] = 1.f;
+            m_range[i] = light.m_range > 0 ? float(light.m_range) : FLT_MAX;
+            m_castshadows[i] = light.m_castshadows;
+
+            bool linked = !light.m_include.empty() || !light.m_exclude.empty() ||
+                !light.m_includeobjects.empty() || !light.m_excludeobjects.empty();
+            if (linked)
+                m_linked = true;
+
+            if (linked || light.m_range > 0 || !light.m_castshadows)
+                m_uncut.push_back(i);
+            else
+                cut.push_back(i);
+        }
+        else
+        {
+            m_x[i] = m_y[i] = m_z[i] = 0.f;
+            m_valid[i] = 0.f;
+            m_range[i] = 0.f;
+        }
+    }
+
+    m_usecuts = m_cutthreshold > 0 && m_count >= m_cutthreshold;
+    if (m_usecuts)
+        m_tree.Build(p_renderer, cut);
+}
+
+//
+// Name : CRayLights::Illuminates()
+// Description : Light linking test for a polygon with this material
+// and light linking group.
+//
+
+bool CRayLights::Illuminates(int i, const CGrMaterial* p_material, int p_link) const
+{
+    return m_renderer->GetLight(i).Illuminates(p_material) && (m_links == NULL || m_links->Illuminates(i, p_link));
+}
+
+//
+// Name : CRayLights::Evaluate()
+// Description : Blinn-Phong diffuse and specular terms for a group of
+// lights at a point. p_view is the unit vector from the eye to the point.
+// Lights out of range give zero terms.
+//
+
+void CRayLights::Evaluate(int p_first, const CGrPoint& p_point, const CGrPoint& p_normal, const CGrPoint& p_view,
+    float p_kd, float p_ks, float p_shininess, bool p_specular, Terms& p_terms) const
+{
+    F zero = Simd::Set(0.f);
+    F valid = Simd::Greater(Simd::Load(m_valid + p_first), zero);
+
+    F nx = Simd::Set(float(p_normal.X()));
+    F ny = Simd::Set(float(p_normal.Y()));
+    F nz = Simd::Set(float(p_normal.Z()));
+
+    // Direction to each light
+    F lx = Simd::Sub(Simd::Load(m_x + p_first), Simd::Set(float(p_point.X())));
+    F ly = Simd::Sub(Simd::Load(m_y + p_first), Simd::Set(float(p_point.Y())));
+    F lz = Simd::Sub(Simd::Load(m_z + p_first), Simd::Set(float(p_point.Z())));
+
+    F length;
+    F inv = InverseLength(Simd::Add(Simd::Add(Simd::Mul(lx, lx), Simd::Mul(ly, ly)), Simd::Mul(lz, lz)), length);
+    lx = Simd::Mul(lx, inv);
+    ly = Simd::Mul(ly, inv);
+    lz = Simd::Mul(lz, inv);
+
+    Simd::Store(p_terms.dx, lx);
+    Simd::Store(p_terms.dy, ly);
+    Simd::Store(p_terms.dz, lz);
+    Simd::Store(p_terms.length, length);
+
+    valid = Simd::And(valid, Simd::Greater(Simd::Load(m_range + p_first), length));
+
+    F ndotl = Simd::Add(Simd::Add(Simd::Mul(nx, lx), Simd::Mul(ny, ly)), Simd::Mul(nz, lz));
+    F diffuse = Simd::Mul(Simd::Set(p_kd), Simd::Max(ndotl, zero));
+    Simd::Store(p_terms.diffuse, Simd::And(diffuse, valid));
+
+    if (!p_specular)
+    {
+        Simd::Store(p_terms.specular, zero);
+        return;
+    }
+
+    // Halfway vector
+    F hx = Simd::Add(lx, Simd::Set(float(p_view.X())));
+    F hy = Simd::Add(ly, Simd::Set(float(p_view.Y())));
+    F hz = Simd::Add(lz, Simd::Set(float(p_view.Z())));
+
+    F hlength;
+    F hinv = InverseLength(Simd::Add(Simd::Add(Simd::Mul(hx, hx), Simd::Mul(hy, hy)), Simd::Mul(hz, hz)), hlength);
+
+    F ndoth = Simd::Mul(Simd::Add(Simd::Add(Simd::Mul(nx, hx), Simd::Mul(ny, hy)), Simd::Mul(nz, hz)), hinv);
+
+    // pow(ndoth, shininess), 0 where ndoth <= 0
+    F positive = Simd::Greater(ndoth, zero);
+    F power = Exp2(Simd::Mul(Simd::Set(p_shininess), Log2(Simd::Max(ndoth, Simd::Set(1e-30f)))));
+    F specular = Simd::Mul(Simd::Set(p_ks), Simd::And(power, positive));
+    Simd::Store(p_terms.specular, Simd::And(specular, valid));
+}
@@ -0,0 +1,112 @@
+//
+// Name :         RayLights.h
+// Description :  Header for CRayLights, the renderer lights stored as a
+//                structure of arrays so the lighting terms for several
+//                lights are computed with each SIMD instruction.
+//                See RayLights.cpp
+//
+
+#pragma once
+#include "graphics/GrRenderer.h"
+#include "RayLightTree.h"
+#include <vector>
+
+class CRayLightLinks;
+
+//
+// To use:
+//
+// 1.  Call Build() in RendererStart(), once the lights and the camera are set
+// 2.  For each hit, call Evaluate() for each group of Width lights
+//
+// Width is 8 when compiled for AVX2, otherwise 4 (SSE2).
+//
+// When there are at least CutThreshold lights, Build() also builds a
+// light tree and the shading kernels shade a lightcut instead of
+// every light (see CRayLightTree). Lights with a range, with links or
+// that cast no shadows are left out of the tree and shaded one at a
+// time (see Uncut()), since a representative can't decide those for
+// the other lights of its cluster.
+//
+// Lights with a range give zero terms past it. Whether a light casts
+// shadows and which materials it is linked to come from the renderer
+// lights (see CGrRenderer::Light). Which objects it is linked to come
+// from the CRayLightLinks given to Build().
+//
+
+class CRayLights
+{
+public:
+    CRayLights();
+    ~CRayLights();
+
+#ifdef __AVX2__
+    static const int Width = 8;
+#else
+    static const int Width = 4;
+#endif
+
+    // The lighting terms for one group of lights
+    struct Terms
+    {
+        alignas(32) float dx[Width];        // Unit direction to the light
+        alignas(32) float dy[Width];
+        alignas(32) float dz[Width];
+        alignas(32) float length[Width];    // Distance to the light
+        alignas(32) float diffuse[Width];   // Kd * N.L
+        alignas(32) float specular[Width];  // Ks * (N.H)^shininess
+    };
+
+    void Build(const CGrRenderer& p_renderer, const CRayLightLinks* p_links);
+
+    // Light count at which lightcuts are used, 0 to never use them
+    void SetCutThreshold(int n) { m_cutthreshold = n; }
+    int GetCutThreshold() const { return m_cutthreshold; }
+
+    bool UseCuts() const { return m_usecuts; }
+    CRayLightTree& Tree() { return m_tree; }
+    const CRayLightTree& Tree() const { return m_tree; }
+
+    // Lights not in the tree, in increasing order
+    const std::vector<int>& Uncut() const { return m_uncut; }
+
+    int Count() const { return m_count; }
+    const CGrPoint& Eye() const { return m_eye; }
+
+    float Range(int i) const { return m_range[i]; }
+    bool CastsShadows(int i) const { return m_castshadows[i] != 0; }
+
+    // True if any light has include or exclude lists. p_link is the
+    // light linking group of the polygon (CRayHit::Link()).
+    bool Linked() const { return m_linked; }
+    bool Illuminates(int i, const CGrMaterial* p_material, int p_link) const;
+
+    // Terms for lights first to first + Width - 1. Lights past Count() give zero terms.
+    void Evaluate(int p_first, const CGrPoint& p_point, const CGrPoint& p_normal, const CGrPoint& p_view,
+        float p_kd, float p_ks, float p_shininess, bool p_specular, Terms& p_terms) const;
+
+private:
+    CRayLights(const CRayLights&);
+    CRayLights& operator=(const CRayLights&);
+
+    int         m_count;
+    int         m_capacity;
+    CGrPoint    m_eye;
+
+    // Aligned, padded to a multiple of Width
+    float*      m_x;
+    float*      m_y;
+    float*      m_z;
+    float*      m_valid;        // 1 for a light, 0 for padding
+    float*      m_range;        // FLT_MAX for no limit
+
+    const CGrRenderer*          m_renderer;
+    const CRayLightLinks*       m_links;
+    std::vector<unsigned char>  m_castshadows;
+    bool                        m_linked;
+
+    int             m_cutthreshold;
+    bool            m_usecuts;
+    CRayLightTree   m_tree;
+    std::vector<int> m_uncut;
+};
@@ -0,0 +1,148 @@
+//
+// Name :         RayRecorder.cpp
+// Description :  Implementation of CRayRecorder.
+//
+
+#include "pch.h"
+#include "RayRecorder.h"
+
+static const char Magic[4] = { 'R', 'A', 'Y', 'S' };
+
+CRayRecorder::CRayRecorder()
+{
+    m_scene = false;
+    m_count = 0;
+}
+
+CRayRecorder::~CRayRecorder()
+{
+    Close();
+}
+
+bool CRayRecorder::Open(const std::basic_string<_TCHAR>& p_filename)
+{
+    Close();
+
+    m_file.open(p_filename.c_str(), std::ios::binary | std::ios::trunc);
+    m_scene = false;
+    m_count = 0;
+    m_buffer.clear();
+    m_buffer.reserve(BufferSize);
+
+    return m_file.is_open();
+}
+
+void CRayRecorder::Close()
+{
+    if (!m_file.is_open())
+        return;
+
+    Flush();
+    m_file.close();
+}
+
+//
+// Name : CRayRecorder::Scene()
+// Description : Write the header and the polygons.
+//
+
+void CRayRecorder::Scene(const CRayGeometry& p_geometry)
+{
+    if (!m_file.is_open() || m_scene)
+        return;
+
+    m_scene = true;
+
+    unsigned int header[3] = { Version, sizeof(Record), unsigned(p_geometry.PrimitiveCnt()) };
+    m_file.write(Magic, sizeof(Magic));
+    m_file.write((const char*)header, sizeof(header));
+
+    for (int p = 0; p < p_geometry.PrimitiveCnt(); p++)
+    {
+        const CRayGeometry::Polygon& polygon = p_geometry.GetPolygon(p);
+        m_file.write((const char*)&polygon.count, sizeof(polygon.count));
+        for (int v = polygon.first; v < polygon.first + polygon.count; v++)
+        {
+            const CGrPoint& vertex = p_geometry.Vertex(v);
+            double xyz[3] = { vertex.X(), vertex.Y(), vertex.Z() };
+            m_file.write((const char*)xyz, sizeof(xyz));
+        }
+    }
+}
+
+void CRayRecorder::Add(Type p_type, bool p_anyhit, const CRay& p_ray, double p_maxt, int p_ignore, bool p_hit, int p_primitive, double p_t)
+{
+    // Rays without a scene could not be replayed
+    if (!m_scene)
+        return;
+
+    Record record;
+    for (int d = 0; d < 3; d++)
+    {
+        record.origin[d] = p_ray.Origin(d);
+        record.direction[d] = p_ray.Direction(d);
+    }
+
+    record.maxt = p_maxt;
+    record.t = p_hit && !p_anyhit ? float(p_t) : 0.f;
+    record.ignore = p_ignore;
+    record.primitive = p_hit && !p_anyhit ? p_primitive : -1;
+    record.type = (unsigned char)p_type;
+    record.flags = (p_anyhit ? ANYHIT : 0) | (p_hit ? HIT : 0);
+    record.reserved = 0;
+
+    m_buffer.push_back(record);
+    m_count++;
+    if (int(m_buffer.size()) >= BufferSize)
+        Flush();
+}
+
+void CRayRecorder::Flush()
+{
+    if (!m_buffer.empty())
+        m_file.write((const char*)&m_buffer[0], m_buffer.size() * sizeof(Record));
+    m_buffer.clear();
+}
+
+//
+// Name : CRayRecorder::Read()
+// Description : Read a capture written by this version.
+//
+
+bool CRayRecorder::Read(const std::basic_string<_TCHAR>& p_filename, CRayGeometry& p_geometry, std::vector<Record>& p_records)
+{
+    std::ifstream file(p_filename.c_str(), std::ios::binary);
+
+    char magic[sizeof(Magic)];
+    unsigned int header[3];
+    if (!file.read(magic, sizeof(magic)) || !file.read((char*)header, sizeof(header)) ||
+        !std::equal(magic, magic + sizeof(Magic), Magic) || header[0] != Version || header[1] != sizeof(Record))
+        return false;
+
+    p_geometry.Clear();
+    std::vector<CGrPoint> vertices, normals, texcoords;
+    for (unsigned int p = 0; p < header[2]; p++)
+    {
+        int count;
+        if (!file.read((char*)&count, sizeof(count)) || count < 0)
+            return false;
+
+        vertices.clear();
+        for (int v = 0; v < count; v++)
+        {
+            double xyz[3];
+            if (!file.read((char*)xyz, sizeof(xyz)))
+                return false;
+            vertices.push_back(CGrPoint(xyz[0], xyz[1], xyz[2]));
+        }
+
+        p_geometry.AddPolygon(NULL, NULL, vertices, normals, texcoords);
+    }
+
+    p_records.clear();
+    Record record;
+    while (file.read((char*)&record, sizeof(record)))
+        p_records.push_back(record);
+
+    return true;
+}
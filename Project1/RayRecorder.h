@@ -0,0 +1,81 @@
+//
+// Name :         RayRecorder.h
+// Description :  Header for CRayRecorder, capture of every ray the ray
+//                tracer intersects to a binary file for replay.
+//                See RayRecorder.cpp
+//
+
+#pragma once
+#include "RayGeometry.h"
+#include <fstream>
+#include <string>
+#include <vector>
+
+//
+// A capture holds the polygons of the scene followed by one fixed size
+// record per intersection query: the ray, how far it may go, what kind
+// of ray it is, the polygon it ignores and what it hit. That is enough to
+// replay the render's ray distribution against any accelerator without
+// the shading code (see CRayReplay).
+//
+// File layout (little endian):
+//
+//     Header      "RAYS", version, record size, polygon count
+//     Polygons    for each: vertex count, then x, y, z of each vertex (double)
+//     Records     Record, until the end of the file
+//
+// The rays are in eye coordinates, as the ray tracer traces them. Records
+// are buffered and written BufferSize at a time. The recorder is not
+// thread safe, the ray tracer calls it from one thread.
+//
+
+class CRayRecorder
+{
+public:
+    CRayRecorder();
+    ~CRayRecorder();
+
+    enum Type { PRIMARY, REFLECTION, SHADOW };
+    enum Flags { ANYHIT = 1, HIT = 2 };
+
+    static const unsigned int Version = 1;
+    static const int BufferSize = 65536;
+
+    struct Record
+    {
+        double          origin[3];
+        double          direction[3];
+        double          maxt;
+        float           t;              // Distance to the nearest hit, if there was one
+        int             ignore;         // Primitive skipped, -1 for none
+        int             primitive;      // Primitive hit, -1 for a miss or an occlusion test
+        unsigned char   type;
+        unsigned char   flags;          // ANYHIT for an occlusion test, HIT if something was hit
+        unsigned short  reserved;
+    };
+
+    // Start a capture, replacing the file. The scene comes first.
+    bool Open(const std::basic_string<_TCHAR>& p_filename);
+    void Close();
+    bool IsOpen() const { return m_file.is_open(); }
+
+    // Write the polygons the rays are traced against. Only the first
+    // call for a capture writes anything.
+    void Scene(const CRayGeometry& p_geometry);
+
+    void Add(Type p_type, bool p_anyhit, const CRay& p_ray, double p_maxt, int p_ignore, bool p_hit, int p_primitive, double p_t);
+
+    long long RecordCnt() const { return m_count; }
+
+    // Read a capture. The polygons are added to p_geometry with no
+    // material or texture.
+    static bool Read(const std::basic_string<_TCHAR>& p_filename, CRayGeometry& p_geometry, std::vector<Record>& p_records);
+
+private:
+    void Flush();
+
+    std::ofstream       m_file;
+    bool                m_scene;        // The scene has been written
+    std::vector<Record> m_buffer;
+    long long           m_count;
+};
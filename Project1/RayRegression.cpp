@@ -0,0 +1,314 @@
+//
+// Name :         RayRegression.cpp
+// Description :  Implementation of CRayRegression. The reservoir engine is
+//                not one of the cases, it picks lights at random and keeps
+//                state from frame to frame, so its image is not repeatable.
+//
+
+#include "pch.h"
+#include "RayRegression.h"
+#include "RayBvh.h"
+#include "RayCostBuffer.h"
+#include "RaySceneCache.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <map>
+#include <sstream>
+
+CRayRegression::CRayRegression()
+{
+    m_psnrthreshold = 40;
+    m_timetolerance = 10;
+    m_raytolerance = 0;
+
+    static const Case cases[] = {
+        { "depthfirst_160x120", 160, 120, CMyRaytraceRenderer::DEPTH_FIRST, false, false, false },
+        { "depthfirst_320x240", 320, 240, CMyRaytraceRenderer::DEPTH_FIRST, false, false, false },
+        { "wavefront_320x240", 320, 240, CMyRaytraceRenderer::WAVEFRONT, false, false, false },
+        { "bvh_320x240", 320, 240, CMyRaytraceRenderer::DEPTH_FIRST, true, false, false },
+        { "hybrid_320x240", 320, 240, CMyRaytraceRenderer::DEPTH_FIRST, true, true, false },
+        { "scenecache_320x240", 320, 240, CMyRaytraceRenderer::DEPTH_FIRST, true, false, true } };
+
+    m_cases.assign(cases, cases + sizeof(cases) / sizeof(cases[0]));
+}
+
+//
+// Name : CRayRegression::Render()
+// Description : Render one case Repetitions times. The image is from the
+// last render, the time the fastest and the rays those of one render.
+// A scene cache case first renders once to fill the cache. That image
+// goes in p_first if it is not NULL.
+//
+
+void CRayRegression::Render(const Case& p_case, CGrPtr<CGrObject>& p_scene, const Configure& p_configure,
+    std::vector<BYTE>& p_image, double& p_seconds, long long& p_rays, std::vector<BYTE>* p_first)
+{
+    p_image.assign(size_t(p_case.width) * p_case.height * 3, 0);
+    std::vector<BYTE*> rows(p_case.height);
+    for (int r = 0; r < p_case.height; r++)
+        rows[r] = &p_image[size_t(r) * p_case.width * 3];
+
+    // The cache and its BVH last from one render to the next, as they
+    // do in the view
+    CRaySceneCache scenecache;
+    CRayBvh cachedbvh;
+
+    for (int i = p_case.scenecache ? -1 : 0; i < Repetitions; i++)
+    {
+        // Otherwise a new BVH each time, so every render builds it from scratch
+        CRayBvh bvh;
+
+        CMyRaytraceRenderer raytrace;
+        p_configure(&raytrace, p_case.width, p_case.height);
+        raytrace.SetImage(&rows[0], p_case.width, p_case.height);
+        raytrace.SetProgressive(false);
+        raytrace.SetEngine(p_case.engine);
+        raytrace.SetAccelerator(p_case.scenecache ? &cachedbvh : p_case.bvh ? &bvh : NULL);
+        raytrace.SetHybrid(p_case.hybrid);
+        raytrace.SetSceneCache(p_case.scenecache ? &scenecache : NULL);
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        raytrace.Render(p_scene);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        // The render that filled the cache is not timed
+        if (i < 0)
+        {
+            if (p_first != NULL)
+                *p_first = p_image;
+            p_seconds = 1e20;
+            continue;
+        }
+
+        p_seconds = i == 0 ? seconds : min(p_seconds, seconds);
+        p_rays = (long long)raytrace.RaysTraced();
+    }
+}
+
+//
+// Name : CRayRegression::Record()
+// Description : Render every case and write the reference images and
+// the baseline, replacing any that are there.
+//
+
+bool CRayRegression::Record(CGrPtr<CGrObject>& p_scene, const Configure& p_configure)
+{
+    m_results.clear();
+
+    std::ostringstream baseline;
+    bool ok = true;
+    for (size_t i = 0; i < m_cases.size(); i++)
+    {
+        const Case& c = m_cases[i];
+
+        Result result;
+        result.name = c.name;
+        result.psnr = 0;
+        result.baselineseconds = 0;
+        result.baselinerays = 0;
+
+        // The reference of a scene cache case is the render that filled it
+        std::vector<BYTE> image, first;
+        Render(c, p_scene, p_configure, image, result.seconds, result.rays, &first);
+
+        result.passed = WriteImage(Filename(c.name, ".ppm"), c.scenecache ? first : image, c.width, c.height);
+        if (!result.passed)
+            result.message = "unable to write the reference";
+
+        ok = ok && result.passed;
+        m_results.push_back(result);
+
+        baseline << c.name << " " << result.seconds << " " << result.rays << "\n";
+    }
+
+    std::ofstream file(Filename("baseline", ".txt").c_str());
+    file << baseline.str();
+    return ok && bool(file);
+}
+
+//
+// Name : CRayRegression::Check()
+// Description : Render every case and compare it to the references and
+// the baseline. A case with no reference or baseline fails.
+//
+
+bool CRayRegression::Check(CGrPtr<CGrObject>& p_scene, const Configure& p_configure)
+{
+    m_results.clear();
+
+    // name -> (seconds, rays)
+    std::map<std::string, std::pair<double, long long>> baseline;
+    std::ifstream file(Filename("baseline", ".txt").c_str());
+    std::string name;
+    double seconds;
+    long long rays;
+    while (file >> name >> seconds >> rays)
+        baseline[name] = std::make_pair(seconds, rays);
+
+    bool ok = true;
+    for (size_t i = 0; i < m_cases.size(); i++)
+    {
+        const Case& c = m_cases[i];
+
+        Result result;
+        result.name = c.name;
+        result.passed = true;
+        result.psnr = 0;
+        result.baselineseconds = 0;
+        result.baselinerays = 0;
+
+        std::vector<BYTE> image;
+        Render(c, p_scene, p_configure, image, result.seconds, result.rays);
+
+        std::ostringstream message;
+
+        std::vector<BYTE> reference;
+        if (!ReadImage(Filename(c.name, ".ppm"), reference, c.width, c.height))
+        {
+            result.passed = false;
+            message << "no reference; ";
+        }
+        else
+        {
+            result.psnr = Psnr(image, reference);
+            if (result.psnr < m_psnrthreshold)
+            {
+                result.passed = false;
+                message << "image differs; ";
+            }
+        }
+
+        std::map<std::string, std::pair<double, long long>>::const_iterator b = baseline.find(c.name);
+        if (b == baseline.end())
+        {
+            result.passed = false;
+            message << "no baseline; ";
+        }
+        else
+        {
+            result.baselineseconds = b->second.first;
+            result.baselinerays = b->second.second;
+
+            if (result.seconds > result.baselineseconds * (1 + m_timetolerance / 100))
+            {
+                result.passed = false;
+                message << "slower; ";
+            }
+
+            if (std::abs(double(result.rays - result.baselinerays)) > result.baselinerays * m_raytolerance / 100)
+            {
+                result.passed = false;
+                message << "ray count changed; ";
+            }
+        }
+
+        // Keep what we rendered so it can be compared to the reference
+        if (!result.passed)
+            WriteImage(Filename(c.name, "_current.ppm"), image, c.width, c.height);
+
+        result.message = message.str();
+        if (!result.message.empty())
+            result.message.erase(result.message.size() - 2);
+
+        ok = ok && result.passed;
+        m_results.push_back(result);
+    }
+
+    return ok;
+}
+
+std::string CRayRegression::Report() const
+{
+    std::ostringstream str;
+    str.setf(std::ios::fixed);
+
+    for (size_t i = 0; i < m_results.size(); i++)
+    {
+        const Result& r = m_results[i];
+        str << (r.passed ? "PASS " : "FAIL ") << r.name;
+        str.precision(1);
+        str << "  " << r.psnr << " dB";
+        str.precision(3);
+        str << "  " << r.seconds << " s (" << r.baselineseconds << ")";
+        str << "  " << r.rays << " rays (" << r.baselinerays << ")";
+        if (!r.message.empty())
+            str << "  " << r.message;
+        str << "\n";
+    }
+
+    return str.str();
+}
+
+//
+// Name : CRayRegression::Psnr()
+// Description : Peak signal to noise ratio of two 8 bit images in dB.
+// Identical images are given 100 dB.
+//
+
+double CRayRegression::Psnr(const std::vector<BYTE>& a, const std::vector<BYTE>& b)
+{
+    if (a.size() != b.size() || a.empty())
+        return 0;
+
+    double sum = 0;
+    for (size_t i = 0; i < a.size(); i++)
+    {
+        double d = double(a[i]) - double(b[i]);
+        sum += d * d;
+    }
+
+    if (sum == 0)
+        return 100;
+
+    double mse = sum / a.size();
+    return 10 * std::log10(255. * 255. / mse);
+}
+
+std::basic_string<_TCHAR> CRayRegression::Filename(const std::string& p_name, const char* p_suffix) const
+{
+    std::basic_string<_TCHAR> filename = m_directory;
+    for (size_t i = 0; i < p_name.size(); i++)
+        filename += _TCHAR(p_name[i]);
+    for (const char* s = p_suffix; *s; s++)
+        filename += _TCHAR(*s);
+    return filename;
+}
+
+bool CRayRegression::WriteImage(const std::basic_string<_TCHAR>& p_filename, std::vector<BYTE>& p_image, int p_width, int p_height) const
+{
+    std::vector<BYTE*> rows(p_height);
+    for (int r = 0; r < p_height; r++)
+        rows[r] = &p_image[size_t(r) * p_width * 3];
+
+    return CRayCostBuffer::WritePPM(p_filename.c_str(), p_height > 0 ? &rows[0] : NULL, p_width, p_height);
+}
+
+//
+// Name : CRayRegression::ReadImage()
+// Description : Read a binary PPM as written by CRayCostBuffer::WritePPM()
+// into rows from the bottom. Fails if it is not the expected size.
+//
+
+bool CRayRegression::ReadImage(const std::basic_string<_TCHAR>& p_filename, std::vector<BYTE>& p_image, int p_width, int p_height)
+{
+    std::ifstream file(p_filename.c_str(), std::ios::binary);
+    std::string magic;
+    int width, height, maxval;
+    if (!(file >> magic >> width >> height >> maxval) || magic != "P6" ||
+        width != p_width || height != p_height || maxval != 255)
+        return false;
+
+    file.get();     // The one whitespace character after the header
+
+    int rowwid = p_width * 3;
+    p_image.resize(size_t(rowwid) * p_height);
+    for (int r = p_height - 1; r >= 0; r--)
+    {
+        if (!file.read((char*)&p_image[size_t(r) * rowwid], rowwid))
+            return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,113 @@
+//
+// Name :         RayRegression.h
+// Description :  Header for CRayRegression, golden image and performance
+//                regression checks for CMyRaytraceRenderer.
+//                See RayRegression.cpp
+//
+
+#pragma once
+#include "graphics/GrObject.h"
+#include "CMyRaytraceRenderer.h"
+#include <functional>
+#include <string>
+#include <vector>
+
+//
+// A fixed set of cases (engine, acceleration structure and resolution)
+// is rendered from a fixed camera. Each image is compared against a
+// reference image and each render time and ray count against a baseline.
+// A case fails if:
+//
+// -   the PSNR of the image against the reference is below the threshold
+// -   the render time is more than the time tolerance over the baseline
+// -   the ray count differs from the baseline by more than the ray
+//     tolerance (the renderer is deterministic, so any change means
+//     the tracing changed)
+//
+// To use:
+//
+// 1.  Call SetDirectory() for where the references are kept. The images
+//     are <case>.ppm and the baseline is baseline.txt.
+// 2.  Call Record() once to write the references and the baseline.
+// 3.  Call Check() after each change. For a failed case the image that
+//     was rendered is written as <case>_current.ppm.
+//
+// The time of a case is the fastest of Repetitions renders, which is
+// less noisy than the average. Progressive rendering is off, so every
+// case traces one sample through each pixel.
+//
+// A scene cache case renders once to fill a CRaySceneCache, then times
+// renders that reuse it. Its reference is that first, full render, so
+// Check() compares what the cache reproduced against a render that
+// emitted the whole scene.
+////
+
+class CRayRegression
+{
+public:
+    CRayRegression();
+
+    // Sets up the camera and lights for an image of the given size
+    typedef std::function<void(CGrRenderer* p_renderer, int p_width, int p_height)> Configure;
+
+    struct Case
+    {
+        std::string name;
+        int     width;
+        int     height;
+        CMyRaytraceRenderer::Engine engine;
+        bool    bvh;
+        bool    hybrid;
+        bool    scenecache;
+    };
+
+    struct Result
+    {
+        std::string name;
+        bool    passed;
+        double  psnr;           // dB, 0 if there is no reference
+        double  seconds;
+        double  baselineseconds;    // 0 if there is no baseline
+        long long rays;
+        long long baselinerays;
+        std::string message;    // Why it failed
+    };
+
+    static const int Repetitions = 3;
+
+    void SetDirectory(const std::basic_string<_TCHAR>& p_directory) { m_directory = p_directory; }
+    void SetPsnrThreshold(double db) { m_psnrthreshold = db; }
+    void SetTimeTolerance(double percent) { m_timetolerance = percent; }
+    void SetRayTolerance(double percent) { m_raytolerance = percent; }
+
+    const std::vector<Case>& Cases() const { return m_cases; }
+
+    // Render every case and write the references and the baseline
+    bool Record(CGrPtr<CGrObject>& p_scene, const Configure& p_configure);
+
+    // Render every case and compare. Returns true if all of them passed.
+    bool Check(CGrPtr<CGrObject>& p_scene, const Configure& p_configure);
+
+    const std::vector<Result>& Results() const { return m_results; }
+
+    // One line per case
+    std::string Report() const;
+
+    static double Psnr(const std::vector<BYTE>& a, const std::vector<BYTE>& b);
+
+private:
+    void Render(const Case& p_case, CGrPtr<CGrObject>& p_scene, const Configure& p_configure,
+        std::vector<BYTE>& p_image, double& p_seconds, long long& p_rays, std::vector<BYTE>* p_first = NULL);
+
+    std::basic_string<_TCHAR> Filename(const std::string& p_name, const char* p_suffix) const;
+    bool WriteImage(const std::basic_string<_TCHAR>& p_filename, std::vector<BYTE>& p_image, int p_width, int p_height) const;
+    static bool ReadImage(const std::basic_string<_TCHAR>& p_filename, std::vector<BYTE>& p_image, int p_width, int p_height);
+
+    std::vector<Case> m_cases;
+    std::vector<Result> m_results;
+
+    std::basic_string<_TCHAR> m_directory;
+    double  m_psnrthreshold;
+    double  m_timetolerance;
+    double  m_raytolerance;
+};
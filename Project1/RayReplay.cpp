@@ -0,0 +1,162 @@
+//
+// Name :         RayReplay.cpp
+// Description :  Implementation of CRayReplay.
+//
+
+#include "pch.h"
+#include "RayReplay.h"
+#include "RayBvh.h"
+#include "RayGrid.h"
+#include "RayKdAccelerator.h"
+#include "RayWideBvh.h"
+#include <chrono>
+#include <cmath>
+#include <sstream>
+#include <thread>
+
+const double CRayReplay::Tolerance = 1e-5;
+
+CRayReplay::CRayReplay()
+{
+}
+
+bool CRayReplay::Load(const std::basic_string<_TCHAR>& p_filename)
+{
+    m_results.clear();
+    return CRayRecorder::Read(p_filename, m_geometry, m_records);
+}
+
+long long CRayReplay::RayCnt(CRayRecorder::Type p_type) const
+{
+    long long count = 0;
+    for (size_t i = 0; i < m_records.size(); i++)
+    {
+        if (m_records[i].type == p_type)
+            count++;
+    }
+
+    return count;
+}
+
+//
+// Name : CRayReplay::Replay()
+// Description : Trace a range of records and count the mismatches.
+//
+
+long long CRayReplay::Replay(const CRayAccelerator& p_accelerator, const CRayRecorder::Record* p_begin, const CRayRecorder::Record* p_end)
+{
+    long long mismatches = 0;
+    for (const CRayRecorder::Record* record = p_begin; record < p_end; record++)
+    {
+        CRay ray(CGrPoint(record->origin[0], record->origin[1], record->origin[2]),
+            CGrPoint(record->direction[0], record->direction[1], record->direction[2], 0));
+
+        bool expected = (record->flags & CRayRecorder::HIT) != 0;
+        if (record->flags & CRayRecorder::ANYHIT)
+        {
+            if (p_accelerator.Occluded(ray, record->maxt, record->ignore) != expected)
+                mismatches++;
+            continue;
+        }
+
+        int primitive;
+        double t;
+        bool hit = p_accelerator.Intersect(ray, record->maxt, record->ignore, primitive, t);
+        if (hit != expected || (hit && fabs(t - record->t) > Tolerance * max(1., fabs(t))))
+            mismatches++;
+    }
+
+    return mismatches;
+}
+
+//
+// Name : CRayReplay::Run()
+// Description : Replay every record, timing only the tracing.
+//
+
+const CRayReplay::Result& CRayReplay::Run(const CRayAccelerator& p_accelerator, int p_threads)
+{
+    int threads = p_accelerator.ThreadSafe() ? max(1, p_threads) : 1;
+    size_t count = m_records.size();
+    const CRayRecorder::Record* records = count > 0 ? &m_records[0] : NULL;
+
+    Result result;
+    result.name = p_accelerator.Name();
+    result.threads = threads;
+    result.rays = (long long)count;
+    result.mismatches = 0;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if (threads == 1)
+    {
+        result.mismatches = Replay(p_accelerator, records, records + count);
+    }
+    else
+    {
+        std::vector<long long> mismatches(threads, 0);
+        std::vector<std::thread> workers;
+        for (int i = 0; i < threads; i++)
+        {
+            const CRayRecorder::Record* begin = records + count * i / threads;
+            const CRayRecorder::Record* end = records + count * (i + 1) / threads;
+            workers.push_back(std::thread([&p_accelerator, &mismatches, i, begin, end]() {
+                mismatches[i] = Replay(p_accelerator, begin, end);
+            }));
+        }
+
+        for (int i = 0; i < threads; i++)
+        {
+            workers[i].join();
+            result.mismatches += mismatches[i];
+        }
+    }
+
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    m_results.push_back(result);
+    return m_results.back();
+}
+
+void CRayReplay::RunAll(int p_threads)
+{
+    CRayBvh bvh;
+    bvh.Build(m_geometry);
+    Run(bvh, 1);
+    Run(bvh, p_threads);
+
+    CRayWideBvh widebvh;
+    widebvh.Build(m_geometry);
+    Run(widebvh, 1);
+    Run(widebvh, p_threads);
+
+    CRayGrid grid;
+    grid.Build(m_geometry);
+    Run(grid, 1);
+    Run(grid, p_threads);
+
+    CRayKdAccelerator kdtree;
+    kdtree.Build(m_geometry);
+    Run(kdtree, 1);
+}
+
+std::string CRayReplay::Report() const
+{
+    std::ostringstream str;
+    str << m_geometry.PrimitiveCnt() << " polygons, " << RayCnt() << " rays ("
+        << RayCnt(CRayRecorder::PRIMARY) << " primary, " << RayCnt(CRayRecorder::REFLECTION) << " reflection, "
+        << RayCnt(CRayRecorder::SHADOW) << " shadow)\n";
+
+    str.setf(std::ios::fixed);
+    for (size_t i = 0; i < m_results.size(); i++)
+    {
+        const Result& r = m_results[i];
+        str.precision(3);
+        str << r.name << "  " << r.threads << (r.threads == 1 ? " thread  " : " threads  ")
+            << r.seconds << " s  ";
+        str.precision(2);
+        str << (r.seconds > 0 ? r.rays / r.seconds / 1e6 : 0.) << " Mrays/s  "
+            << r.mismatches << " mismatches\n";
+    }
+
+    return str.str();
+}
@@ -0,0 +1,73 @@
+//
+// Name :         RayReplay.h
+// Description :  Header for CRayReplay, which traces the rays of a capture
+//                through the accelerators to measure them.
+//                See RayReplay.cpp
+//
+
+#pragma once
+#include "RayAccelerator.h"
+#include "RayRecorder.h"
+#include <string>
+#include <vector>
+
+//
+// A capture (see CRayRecorder) is the ray distribution of a real render:
+// coherent primary rays, scattered reflections and short shadow rays, in
+// the proportions the scene produces. Replaying it traces just those rays
+// through an accelerator, with nothing else in the loop, so throughput
+// can be compared between accelerators, or before and after a change,
+// on exactly the same work.
+//
+// Each ray's answer is compared to the one recorded. A nearest hit agrees
+// if both miss, or both hit at the same distance (to a relative
+// tolerance, the distance is recorded as a float). An occlusion test
+// agrees if both give the same answer. The recorded answer came from the
+// accelerator the render used, so mismatches are differences between two
+// accelerators, not necessarily errors (see CRayValidator for that).
+//
+// Run() splits the rays into equal contiguous ranges over the threads.
+// Accelerators that are not thread safe are always replayed on one.
+//
+
+class CRayReplay
+{
+public:
+    CRayReplay();
+
+    static const double Tolerance;
+
+    struct Result
+    {
+        std::string name;
+        int         threads;
+        long long   rays;
+        long long   mismatches;
+        double      seconds;
+    };
+
+    bool Load(const std::basic_string<_TCHAR>& p_filename);
+
+    const CRayGeometry& Geometry() const { return m_geometry; }
+    long long RayCnt() const { return (long long)m_records.size(); }
+    long long RayCnt(CRayRecorder::Type p_type) const;
+
+    // Replay every ray through an accelerator already built over Geometry()
+    const Result& Run(const CRayAccelerator& p_accelerator, int p_threads);
+
+    // Build the BVH, wide BVH, grid and kd-tree and replay through each
+    // of them on one thread and on p_threads
+    void RunAll(int p_threads);
+
+    const std::vector<Result>& Results() const { return m_results; }
+
+    // The capture, then one line per run
+    std::string Report() const;
+
+private:
+    static long long Replay(const CRayAccelerator& p_accelerator, const CRayRecorder::Record* p_begin, const CRayRecorder::Record* p_end);
+
+    CRayGeometry    m_geometry;
+    std::vector<CRayRecorder::Record> m_records;
+    std::vector<Result> m_results;
+};
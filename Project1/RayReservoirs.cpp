@@ -0,0 +1,284 @@
+//
+// Name :         RayReservoirs.cpp
+// Description :  Implementation of CRayReservoirs. The target function is
+//                the unshadowed Blinn-Phong term of a light (Kd N.L plus
+//                Ks (N.H)^shininess), the same term the shading kernels use.
+//
+
+#include "pch.h"
+#include "RayReservoirs.h"
+#include "RayLightLinks.h"
+#include <cmath>
+
+CRayReservoirs::CRayReservoirs()
+{
+    m_candidates = 16;
+    m_spatialsamples = 4;
+    m_spatialradius = 16;
+    m_temporal = true;
+    m_maxhistory = 20;
+
+    m_width = 0;
+    m_height = 0;
+    m_lightcnt = 0;
+    m_links = NULL;
+    m_hashistory = false;
+    m_reset = false;
+
+    m_randomstate = 2463534242u;
+}
+
+//
+// Name : CRayReservoirs::Begin()
+// Description : Start a frame. History is dropped if the image size or
+// the lights changed, or Reset() was called.
+//
+
+void CRayReservoirs::Begin(int p_width, int p_height, int p_lightcnt, const CRayLightLinks* p_links)
+{
+    m_links = p_links;
+    if (p_width != m_width || p_height != m_height || p_lightcnt != m_lightcnt)
+    {
+        m_width = p_width;
+        m_height = p_height;
+        m_lightcnt = p_lightcnt;
+        m_hashistory = false;
+
+        size_t size = size_t(m_width) * m_height;
+        m_surfaces.assign(size, Surface());
+        m_prevsurfaces.assign(size, Surface());
+        m_current.resize(size);
+        m_previous.resize(size);
+        m_spatial.resize(size);
+    }
+    else
+    {
+        m_hashistory = !m_current.empty() && !m_reset;
+    }
+
+    m_reset = false;
+
+    m_surfaces.swap(m_prevsurfaces);
+    m_current.swap(m_previous);
+}
+
+//
+// Name : CRayReservoirs::Target()
+// Description : The target function for a light at a surface. It is
+// zero if the light is out of range or not linked to the material or
+// object.
+//
+
+double CRayReservoirs::Target(const Surface& p_surface, const CGrRenderer& p_renderer, int p_light, double* p_diffuse, double* p_specular) const
+{
+    const CGrRenderer::Light& light = p_renderer.GetLight(p_light);
+    CGrPoint lightDir = light.m_pos - p_surface.point;
+    double length = lightDir.Length3();
+
+    double diffuse = 0;
+    double specular = 0;
+    bool linked = light.Illuminates(p_surface.source) && (m_links == NULL || m_links->Illuminates(p_light, p_surface.link));
+    if ((light.m_range <= 0 || length < light.m_range) && linked)
+    {
+        lightDir = Normalize3(lightDir);
+
+        double ndotl = Dot3(lightDir, p_surface.normal);
+        diffuse = p_surface.material.kd * (ndotl > 0 ? ndotl : 0);
+        if (p_surface.specular)
+        {
+            double ndoth = Dot3(Normalize3(lightDir + p_surface.view), p_surface.normal);
+            specular = p_surface.material.ks * pow(ndoth > 0 ? ndoth : 0, p_surface.material.shininess);
+        }
+    }
+
+    if (p_diffuse != NULL)
+        *p_diffuse = diffuse;
+    if (p_specular != NULL)
+        *p_specular = specular;
+
+    return diffuse + specular;
+}
+
+// Stream one candidate into a reservoir. Returns true if it was selected.
+bool CRayReservoirs::Update(Reservoir& p_reservoir, int p_light, double p_weight, float p_m)
+{
+    p_reservoir.wsum += float(p_weight);
+    p_reservoir.m += p_m;
+    if (p_weight > 0 && Random() * p_reservoir.wsum < p_weight)
+    {
+        p_reservoir.light = p_light;
+        return true;
+    }
+
+    return false;
+}
+
+// Merge another reservoir, reweighted by the target at this surface
+void CRayReservoirs::Merge(Reservoir& p_reservoir, const Reservoir& p_other, const Surface& p_surface, const CGrRenderer& p_renderer, float p_maxm)
+{
+    if (p_other.light < 0 || p_other.light >= m_lightcnt)
+        return;
+
+    float m = p_other.m < p_maxm ? p_other.m : p_maxm;
+    double target = Target(p_surface, p_renderer, p_other.light);
+    Update(p_reservoir, p_other.light, target * p_other.w * m, m);
+}
+
+// Compute the contribution weight W = wsum / (M * target(selected))
+void CRayReservoirs::Finish(Reservoir& p_reservoir, const Surface& p_surface, const CGrRenderer& p_renderer) const
+{
+    p_reservoir.w = 0;
+    if (p_reservoir.light < 0 || p_reservoir.m <= 0)
+        return;
+
+    double target = Target(p_surface, p_renderer, p_reservoir.light);
+    if (target > 0)
+        p_reservoir.w = float(p_reservoir.wsum / (p_reservoir.m * target));
+}
+
+// Can two pixels share reservoirs?
+bool CRayReservoirs::Similar(const Surface& a, const Surface& b) const
+{
+    if (!a.valid || !b.valid || a.primitive != b.primitive)
+        return false;
+
+    if (Dot3(a.normal, b.normal) < 0.9)
+        return false;
+
+    double da = Distance(a.point, CGrPoint(0, 0, 0));
+    double db = Distance(b.point, CGrPoint(0, 0, 0));
+    return fabs(da - db) <= 0.1 * da;
+}
+
+//
+// Name : CRayReservoirs::Candidates()
+// Description : Build the initial reservoir of a pixel from uniformly
+// drawn lights, then merge in the reservoir it had last frame.
+//
+
+void CRayReservoirs::Candidates(int r, int c, const CGrRenderer& p_renderer)
+{
+    const Surface& surface = At(r, c);
+    Reservoir& reservoir = m_current[r * m_width + c];
+    reservoir.light = -1;
+    reservoir.wsum = 0;
+    reservoir.m = 0;
+    reservoir.w = 0;
+
+    if (!surface.valid || m_lightcnt == 0)
+        return;
+
+    // With few lights, every light is a candidate
+    int candidates = m_candidates < m_lightcnt ? m_candidates : m_lightcnt;
+    for (int i = 0; i < candidates; i++)
+    {
+        int light = candidates == m_lightcnt ? i : int(Random() * m_lightcnt);
+        if (light >= m_lightcnt)
+            light = m_lightcnt - 1;
+
+        // Weight is target / source pdf, the pdf being 1 / lightcnt
+        Update(reservoir, light, Target(surface, p_renderer, light) * m_lightcnt, 1);
+    }
+
+    Finish(reservoir, surface, p_renderer);
+
+    if (m_temporal && m_hashistory)
+    {
+        const Surface& prev = m_prevsurfaces[r * m_width + c];
+        if (Similar(surface, prev))
+        {
+            Merge(reservoir, m_previous[r * m_width + c], surface, p_renderer, float(m_maxhistory * candidates));
+            Finish(reservoir, surface, p_renderer);
+        }
+    }
+}
+
+//
+// Name : CRayReservoirs::Spatial()
+// Description : Merge the reservoirs of random nearby pixels that
+// see the same surface.
+//
+
+void CRayReservoirs::Spatial(const CGrRenderer& p_renderer)
+{
+    for (int r = 0; r < m_height; r++)
+    {
+        for (int c = 0; c < m_width; c++)
+        {
+            const Surface& surface = At(r, c);
+            Reservoir& reservoir = m_spatial[r * m_width + c];
+            reservoir = m_current[r * m_width + c];
+            if (!surface.valid)
+                continue;
+
+            // Merging starts over with this pixel's reservoir as a candidate
+            Reservoir own = reservoir;
+            reservoir.wsum = 0;
+            reservoir.m = 0;
+            Merge(reservoir, own, surface, p_renderer, own.m);
+
+            for (int i = 0; i < m_spatialsamples; i++)
+            {
+                int nr = r + int((Random() * 2 - 1) * m_spatialradius);
+                int nc = c + int((Random() * 2 - 1) * m_spatialradius);
+                if (nr < 0 || nr >= m_height || nc < 0 || nc >= m_width)
+                    continue;
+
+                if (!Similar(surface, At(nr, nc)))
+                    continue;
+
+                const Reservoir& other = m_current[nr * m_width + nc];
+                Merge(reservoir, other, surface, p_renderer, other.m);
+            }
+
+            Finish(reservoir, surface, p_renderer);
+        }
+    }
+
+    m_current.swap(m_spatial);
+}
+
+//
+// Name : CRayReservoirs::Selected()
+// Description : The light a pixel should trace a shadow ray to, and
+// its term weighted by the reservoir.
+//
+
+bool CRayReservoirs::Selected(int r, int c, const CGrRenderer& p_renderer, int& p_light, CGrPoint& p_lightDir, double& p_length, CGrPoint& p_term)
+{
+    const Surface& surface = At(r, c);
+    const Reservoir& reservoir = m_current[r * m_width + c];
+    if (!surface.valid || reservoir.light < 0 || reservoir.w <= 0)
+        return false;
+
+    p_light = reservoir.light;
+    p_lightDir = p_renderer.GetLight(p_light).m_pos - surface.point;
+    p_length = p_lightDir.Length3();
+    if (p_length != 0)
+        p_lightDir = p_lightDir / p_length;
+    p_lightDir.W(0);
+
+    double diffuse, specular;
+    Target(surface, p_renderer, p_light, &diffuse, &specular);
+
+    if (surface.multiply)
+    {
+        double t = (diffuse + specular) * reservoir.w;
+        p_term = CGrPoint(t, t, t);
+    }
+    else
+    {
+        p_term = (surface.material.diffuse * diffuse + surface.material.specular * specular) * reservoir.w;
+    }
+
+    return true;
+}
+
+// Uniform random number in [0, 1) (xorshift)
+double CRayReservoirs::Random()
+{
+    m_randomstate ^= m_randomstate << 13;
+    m_randomstate ^= m_randomstate >> 17;
+    m_randomstate ^= m_randomstate << 5;
+    return m_randomstate / 4294967296.0;
+}
@@ -0,0 +1,117 @@
+//
+// Name :         RayReservoirs.h
+// Description :  Header for CRayReservoirs, per pixel light reservoirs for
+//                reservoir based direct lighting (ReSTIR).
+//                See RayReservoirs.cpp
+//
+
+#pragma once
+#include "graphics/GrRenderer.h"
+#include "graphics/RayIntersection.h"
+#include "RayShading.h"
+#include <vector>
+
+class CRayLightLinks;
+
+//
+// Instead of a shadow ray for every light, each pixel picks one light by
+// resampled importance sampling and traces a single shadow ray to it:
+//
+// 1.  Candidates: a few lights are drawn at random and streamed through a
+//     weighted reservoir, weighted by their unshadowed contribution.
+//     The reservoir the pixel had in the previous frame is merged in.
+// 2.  Spatial reuse: reservoirs of nearby pixels on the same surface
+//     are merged in.
+// 3.  Shading: one shadow ray to the light the reservoir selected.
+//
+// The object keeps the reservoirs of the previous frame, so it should
+// live as long as the view (see CMyRaytraceRenderer::SetReservoirs).
+//
+
+class CRayReservoirs
+{
+public:
+    CRayReservoirs();
+
+    // The surface seen through a pixel
+    struct Surface
+    {
+        bool        valid;
+        int         primitive;
+        CGrPoint    point;
+        CGrPoint    normal;
+        CGrPoint    view;           // Unit vector from the eye to the point
+        bool        multiply;       // Lighting scales the color (no material)
+        bool        specular;
+        CRayShadeMaterial material;
+        CGrMaterial* source;        // For light linking
+        int         link;           // Light linking group (see CRayLightLinks)
+        bool        receives;       // Material receives shadows
+        CRayShade   shade;          // Shading without direct light
+    };
+
+    struct Reservoir
+    {
+        int         light;          // Selected light, -1 for none
+        float       wsum;           // Sum of the candidate weights
+        float       m;              // Number of candidates seen
+        float       w;              // Contribution weight of the selected light
+    };
+
+    void SetCandidates(int n) { m_candidates = n; }
+    void SetSpatialSamples(int n) { m_spatialsamples = n; }
+    void SetSpatialRadius(int r) { m_spatialradius = r; }
+    void SetTemporal(bool t) { m_temporal = t; }
+    void SetMaxHistory(int h) { m_maxhistory = h; }
+
+    // Drop the history at the next Begin()
+    void Reset() { m_reset = true; }
+
+    // Start a frame. The reservoirs of the last frame become the history.
+    // p_links decides which lights reach which objects, NULL for all.
+    void Begin(int p_width, int p_height, int p_lightcnt, const CRayLightLinks* p_links);
+
+    Surface& At(int r, int c) { return m_surfaces[r * m_width + c]; }
+
+    // Pass 1 for one pixel: initial candidates and temporal reuse
+    void Candidates(int r, int c, const CGrRenderer& p_renderer);
+
+    // Pass 2 for every pixel
+    void Spatial(const CGrRenderer& p_renderer);
+
+    // The light selected for a pixel and its unshadowed contribution
+    // times the reservoir weight. Returns false if there is none.
+    bool Selected(int r, int c, const CGrRenderer& p_renderer, int& p_light, CGrPoint& p_lightDir, double& p_length, CGrPoint& p_term);
+
+    // The shadow ray to the selected light was blocked
+    void Occluded(int r, int c) { m_current[r * m_width + c].w = 0; }
+
+private:
+    double Target(const Surface& p_surface, const CGrRenderer& p_renderer, int p_light, double* p_diffuse = NULL, double* p_specular = NULL) const;
+    bool Update(Reservoir& p_reservoir, int p_light, double p_weight, float p_m);
+    void Merge(Reservoir& p_reservoir, const Reservoir& p_other, const Surface& p_surface, const CGrRenderer& p_renderer, float p_maxm);
+    void Finish(Reservoir& p_reservoir, const Surface& p_surface, const CGrRenderer& p_renderer) const;
+    bool Similar(const Surface& a, const Surface& b) const;
+    double Random();
+
+    int     m_candidates;
+    int     m_spatialsamples;
+    int     m_spatialradius;
+    bool    m_temporal;
+    int     m_maxhistory;
+
+    int     m_width;
+    int     m_height;
+    int     m_lightcnt;
+    const CRayLightLinks* m_links;
+    bool    m_hashistory;
+    bool    m_reset;            // Reset() was called since the last Begin()
+
+    std::vector<Surface>    m_surfaces;
+    std::vector<Surface>    m_prevsurfaces;
+    std::vector<Reservoir>  m_current;
+    std::vector<Reservoir>  m_previous;
+    std::vector<Reservoir>  m_spatial;
+
+    unsigned int m_randomstate;
+};
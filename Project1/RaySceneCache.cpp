@@ -0,0 +1,199 @@
+//
+// Name :         RaySceneCache.cpp
+// Description :  Implementation of CRaySceneCache.
+//
+
+#include "pch.h"
+#include "RaySceneCache.h"
+#include "RayVisibilityCache.h"
+#include "graphics/GrObject.h"
+
+CRaySceneCache::Summary::Summary()
+{
+    min.Set(1e20, 1e20, 1e20);
+    max.Set(-1e20, -1e20, -1e20);
+    shadowless = false;
+    scenehash = CRayVisibilityCache::HashStart;
+    kdhash = CRayVisibilityCache::HashStart;
+}
+
+//
+// Name : CRaySceneCache::Summary::Add()
+// Description : Add a subtree to this one. The hashes take the
+// subtree's hash as one value, whether it was rendered or skipped.
+//
+
+void CRaySceneCache::Summary::Add(const Summary& p_other)
+{
+    min.Minimize(p_other.min);
+    max.Maximize(p_other.max);
+    shadowless = shadowless || p_other.shadowless;
+    scenehash = CRayVisibilityCache::Hash(scenehash, &p_other.scenehash, sizeof(p_other.scenehash));
+    kdhash = CRayVisibilityCache::Hash(kdhash, &p_other.kdhash, sizeof(p_other.kdhash));
+}
+
+CRaySceneCache::CRaySceneCache()
+{
+    m_replace = false;
+    m_valid = true;
+    m_entry = 0;
+    m_primitive = 0;
+    m_reused = 0;
+}
+
+void CRaySceneCache::Clear()
+{
+    m_geometry.Clear();
+    m_features.clear();
+    m_entries.clear();
+}
+
+void CRaySceneCache::Begin()
+{
+    m_replace = !m_entries.empty() || m_geometry.PrimitiveCnt() > 0;
+    m_valid = true;
+    m_entry = 0;
+    m_primitive = 0;
+    m_reused = 0;
+
+    if (m_replace)
+        m_geometry.BeginMoves();
+}
+
+bool CRaySceneCache::End()
+{
+    if (m_replace && (m_entry != int(m_entries.size()) || m_primitive != m_geometry.PrimitiveCnt()))
+        m_valid = false;
+
+    return m_valid;
+}
+
+//
+// Name : CRaySceneCache::Reuse()
+// Description : Skip a child if it, its place in the scene graph and
+// what is above it are all the same as in the last render.
+//
+
+const CRaySceneCache::Summary* CRaySceneCache::Reuse(CGrObject* p_object, const CGrTransform& p_matrix, CGrMaterial*& p_material, int p_link)
+{
+    if (!m_replace || !m_valid || m_entry >= int(m_entries.size()))
+        return NULL;
+
+    const Entry& entry = m_entries[m_entry];
+    if (entry.object != p_object || entry.revision != p_object->SubtreeRevision() ||
+        entry.material != p_material || entry.materialrevision != MaterialRevision(p_material) || entry.link != p_link || entry.first != m_primitive || !Same(entry.matrix, p_matrix))
+        return NULL;
+
+    m_entry += 1 + entry.entries;
+    m_primitive += entry.count;
+    m_reused++;
+
+    p_material = entry.after;
+    return &entry.summary;
+}
+
+//
+// Name : CRaySceneCache::Open()
+// Description : Start the entry of a child that is rendered. Returns
+// the entry for Close(), or -1 if the scene no longer lines up.
+//
+
+int CRaySceneCache::Open(CGrObject* p_object, const CGrTransform& p_matrix, CGrMaterial* p_material, int p_link)
+{
+    if (!m_valid)
+        return -1;
+
+    if (!m_replace)
+    {
+        Entry entry;
+        entry.count = 0;
+        entry.entries = 0;
+        m_entries.push_back(entry);
+    }
+    else if (m_entry >= int(m_entries.size()) || m_entries[m_entry].object != p_object)
+    {
+        m_valid = false;
+        return -1;
+    }
+
+    Entry& entry = m_entries[m_entry];
+    entry.object = p_object;
+    entry.revision = p_object->SubtreeRevision();
+    entry.matrix = p_matrix;
+    entry.material = p_material;
+    entry.materialrevision = MaterialRevision(p_material);
+    entry.link = p_link;
+    entry.first = m_primitive;
+    return m_entry++;
+}
+
+//
+// Name : CRaySceneCache::Close()
+// Description : End the entry of a rendered child. When replacing, it
+// must have added as many polygons and entries as the last time.
+//
+
+void CRaySceneCache::Close(int p_entry, const Summary& p_summary, CGrMaterial* p_material)
+{
+    if (p_entry < 0 || !m_valid)
+        return;
+
+    Entry& entry = m_entries[p_entry];
+    int count = m_primitive - entry.first;
+    int entries = m_entry - p_entry - 1;
+    if (m_replace && (count != entry.count || entries != entry.entries))
+    {
+        m_valid = false;
+        return;
+    }
+
+    entry.count = count;
+    entry.entries = entries;
+    entry.summary = p_summary;
+    entry.after = p_material;
+}
+
+void CRaySceneCache::AddPolygon(CGrMaterial* p_material, CGrTexture* p_texture,
+    const std::vector<CGrPoint>& p_vertices, const std::vector<CGrPoint>& p_normals,
+    const std::vector<CGrPoint>& p_texcoords, unsigned char p_features, int p_link)
+{
+    if (!m_valid)
+        return;
+
+    if (!m_replace)
+    {
+        m_geometry.AddPolygon(p_material, p_texture, p_vertices, p_normals, p_texcoords, p_link);
+        m_features.push_back(p_features);
+    }
+    else if (m_primitive >= m_geometry.PrimitiveCnt() ||
+        !m_geometry.ReplacePolygon(m_primitive, p_material, p_texture, p_vertices, p_normals, p_texcoords, p_link))
+    {
+        m_valid = false;
+        return;
+    }
+    else
+    {
+        m_features[m_primitive] = p_features;
+    }
+
+    m_primitive++;
+}
+
+unsigned CRaySceneCache::MaterialRevision(const CGrMaterial* p_material)
+{
+    return p_material != NULL ? p_material->LastChanged() : 0;
+}
+
+bool CRaySceneCache::Same(const CGrTransform& a, const CGrTransform& b)
+{
+    for (int r = 0; r < 4; r++)
+    {
+        for (int c = 0; c < 4; c++)
+        {
+            if (a[r][c] != b[r][c])
+                return false;
+        }
+    }
+
+    return true;
+}
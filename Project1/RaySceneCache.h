@@ -0,0 +1,125 @@
+//
+// Name :         RaySceneCache.h
+// Description :  Header for CRaySceneCache, which keeps the polygons of the
+//                ray tracer from one render to the next so that scene graph
+//                subtrees that did not change are not emitted again.
+//                See RaySceneCache.cpp
+//
+
+#pragma once
+#include "RayGeometry.h"
+#include "RayLightLinks.h"
+#include "graphics/GrTransform.h"
+#include <vector>
+
+class CGrObject;
+
+//
+// Every render walks the whole scene graph, takes every vertex to eye
+// coordinates and adds it to a new CRayGeometry, then CRayBvh compares
+// every vertex to find the ones that moved. When one node of a large
+// scene is animated, nearly all of that work reproduces the last frame.
+//
+// The cache keeps the geometry, and an entry for each child of a
+// composite (CGrComposite asks the renderer about each child, see
+// CGrRenderer::RendererVisible()). An entry holds the child's
+// CGrObject::SubtreeRevision(), the matrix and material it was rendered
+// with, the material's own revision (it is above the child, so edits to
+// it are not in the child's subtree revision) and the range of polygons
+// it added. On the next render a child
+// whose entry still matches is skipped and its polygons stay where they
+// are. A child that changed is rendered again and its polygons replace
+// the old ones in place (CRayGeometry::ReplacePolygon()), which lists
+// the ones that moved for CRayBvh::Update(). The work of a frame is then
+// the scene graph nodes above what changed, the polygons of the subtrees
+// that changed and the BVH nodes above those polygons.
+//
+// The polygons are in eye coordinates, so moving the camera changes the
+// matrix of every entry and everything is emitted again, as it is without
+// the cache. If a changed subtree adds a different number of polygons or
+// vertices, the scene no longer lines up with the cache. End() returns
+// false and the renderer starts over with an empty cache.
+//
+// The light linking groups of the polygons (see CRayLightLinks) are kept
+// here too. The renderer clears the cache when the lights are linked to
+// different objects.
+//
+// Like CRayBvh, the object should live as long as the view (see
+// CMyRaytraceRenderer::SetSceneCache).
+//
+
+class CRaySceneCache
+{
+public:
+    CRaySceneCache();
+
+    // What a subtree adds to the renderer's state for the whole scene.
+    // A skipped subtree adds what it did when it was rendered.
+    struct Summary
+    {
+        Summary();
+        void Add(const Summary& p_other);
+
+        CGrPoint    min;                    // Bounds of the vertices
+        CGrPoint    max;
+        bool        shadowless;             // Some material does not cast shadows
+        unsigned long long scenehash;       // Geometry, for the visibility cache
+        unsigned long long kdhash;          // Structure, for the kd-tree tuner
+    };
+
+    CRayGeometry& Geometry() { return m_geometry; }
+    std::vector<unsigned char>& Features() { return m_features; }
+    CRayLightLinks& Links() { return m_links; }
+
+    // A render is Begin(), the scene graph, then End(). End() is
+    // false if the scene did not line up with the last render.
+    void Begin();
+    bool End();
+    void Clear();
+
+    // A child of a composite, in light linking group p_link. If Reuse()
+    // returns the child's summary the child is skipped, and p_material
+    // becomes the material in effect after it. Otherwise Open() it,
+    // render it and Close() it.
+    const Summary* Reuse(CGrObject* p_object, const CGrTransform& p_matrix, CGrMaterial*& p_material, int p_link);
+    int Open(CGrObject* p_object, const CGrTransform& p_matrix, CGrMaterial* p_material, int p_link);
+    void Close(int p_entry, const Summary& p_summary, CGrMaterial* p_material);
+
+    // The next polygon of the scene, with its shading kernel
+    void AddPolygon(CGrMaterial* p_material, CGrTexture* p_texture,
+        const std::vector<CGrPoint>& p_vertices, const std::vector<CGrPoint>& p_normals,
+        const std::vector<CGrPoint>& p_texcoords, unsigned char p_features, int p_link);
+
+    // Children skipped by the last render
+    int ReusedCnt() const { return m_reused; }
+
+private:
+    struct Entry
+    {
+        CGrObject*      object;
+        unsigned        revision;       // Its SubtreeRevision() when rendered
+        CGrTransform    matrix;         // Modelview it was rendered with
+        CGrMaterial*    material;       // Material in effect before it
+        unsigned        materialrevision;   // Its LastChanged() when rendered
+        CGrMaterial*    after;          // and after it
+        int             link;           // Light linking group it is in
+        int             first;          // Its polygons
+        int             count;
+        int             entries;        // Entries of its own children, which follow it
+        Summary         summary;
+    };
+
+    static bool Same(const CGrTransform& a, const CGrTransform& b);
+    static unsigned MaterialRevision(const CGrMaterial* p_material);
+
+    CRayGeometry                m_geometry;
+    std::vector<unsigned char>  m_features;     // Shading kernel of each polygon
+    std::vector<Entry>          m_entries;      // In the order the scene graph visits them
+    CRayLightLinks              m_links;
+
+    bool    m_replace;          // Polygons replace those of the last render
+    bool    m_valid;            // The render has lined up with the last one so far
+    int     m_entry;            // Next entry
+    int     m_primitive;        // Next polygon
+    int     m_reused;
+};
@@ -0,0 +1,329 @@
+//
+// Name :         RayShading.h
+// Description :  Shading kernels for the ray tracer. Each kernel is compiled
+//                for one combination of material features and light count,
+//                so shading a hit runs without testing for features the
+//                material does not have.
+//
+
+#pragma once
+#include "graphics/GrRenderer.h"
+#include "graphics/GrTexture.h"
+#include "RayGeometry.h"
+#include "RayLights.h"
+
+//
+// The result of shading a hit: color = base * mul + add. Materials add
+// their lighting, surfaces without a material scale the base color.
+//
+
+struct CRayShade
+{
+    CGrPoint    base;
+    CGrPoint    mul;
+    CGrPoint    add;
+
+    CGrPoint Color() const { CGrPoint c = base; c.MemberMultiply3(mul); return c + add; }
+};
+
+// Material feature flags, selected once per polygon
+enum
+{
+    RAYSHADE_TEXTURED = 1,
+    RAYSHADE_REFLECTIVE = 2,
+    RAYSHADE_SPECULAR = 4,
+    RAYSHADE_MATERIAL = 8,
+    RAYSHADE_FEATURES = 16
+};
+
+inline int RayShadeFeatures(CGrMaterial* p_material, CGrTexture* p_texture)
+{
+    int features = 0;
+    if (p_texture != NULL)
+        features |= RAYSHADE_TEXTURED;
+
+    if (p_material == NULL)
+    {
+        // The default material has a specular term
+        features |= RAYSHADE_SPECULAR;
+    }
+    else
+    {
+        features |= RAYSHADE_MATERIAL;
+        if (p_material->Shininess() >= 90)
+            features |= RAYSHADE_REFLECTIVE;
+        if (p_material->Specular(0) != 0)
+            features |= RAYSHADE_SPECULAR;
+    }
+
+    return features;
+}
+
+//
+// Blinn-Phong parameters of a material. Kd and Ks are the first channel
+// of the diffuse and specular colors. Without a material there are
+// defaults (see CMyRaytraceRenderer::CalculateLighting).
+//
+
+struct CRayShadeMaterial
+{
+    float       kd;
+    float       ks;
+    float       shininess;
+    CGrPoint    diffuse;
+    CGrPoint    specular;
+
+    void Set(CGrMaterial* p_material)
+    {
+        if (p_material != NULL)
+        {
+            kd = p_material->Diffuse(0);
+            ks = p_material->Specular(0);
+            shininess = p_material->Shininess();
+            diffuse = CGrPoint(p_material->Diffuse(0), p_material->Diffuse(1), p_material->Diffuse(2));
+            specular = CGrPoint(p_material->Specular(0), p_material->Specular(1), p_material->Specular(2));
+        }
+        else
+        {
+            kd = 0.7f;
+            ks = 0.3f;
+            shininess = 50.f;
+            diffuse = specular = CGrPoint(1, 1, 1);
+        }
+    }
+};
+
+// Light terms below this can't change an 8 bit pixel
+const float RayShadeMinTerm = 1.f / 4096;
+
+// Apply the term for one light
+template <bool Multiply> inline void RayShadeApply(CRayShade& p_shade, const CGrPoint& p_term)
+{
+    if (Multiply)
+        p_shade.mul.MemberMultiply3(p_term);
+    else
+        p_shade.add += p_term;
+}
+
+//
+// Name : RayShadeKernel()
+// Description : Shade one hit. Features is a set of RAYSHADE_ flags and
+// Lights is the number of lights, or 0 for any number. The lighting terms
+// are computed CRayLights::Width lights at a time. Lights that contribute
+// less than RayShadeMinTerm (facing away, no highlight) do not get a
+// shadow ray.
+//
+// Visibility decides how reflections and shadows are traced. It supplies:
+//
+//   bool Reflect(CRayHit& hit, const CRay& ray, CGrPoint& base)
+//      Handle a mirror reflection. Returns false if the reflection
+//      is not allowed, in which case the surface is shaded normally.
+//
+//   bool DirectLighting() const
+//      False if the kernel should skip the lights.
+//
+//   template <bool Multiply> void Light(CRayShade& shade, const CRay& shadow,
+//      double maxt, const CGrPoint& term, int light, bool cast)
+//      Apply the term for light number light (with RayShadeApply()) if
+//      the shadow ray is not blocked. If cast is false there is no
+//      shadow ray and the term is always applied.
+//
+// Lights not linked to the material or object are skipped, and there are no shadow
+// rays for lights that don't cast shadows or materials that don't
+// receive them.
+//
+
+template <int Features, int Lights, class Visibility>
+void RayShadeKernel(const CRayLights& p_lights, CRayHit& p_hit, const CRay& p_ray, Visibility& p_visibility, CRayShade& p_shade)
+{
+    const bool textured = (Features & RAYSHADE_TEXTURED) != 0;
+    const bool reflective = (Features & RAYSHADE_REFLECTIVE) != 0;
+    const bool specular = (Features & RAYSHADE_SPECULAR) != 0;
+    const bool hasmaterial = (Features & RAYSHADE_MATERIAL) != 0;
+
+    CGrMaterial* material = p_hit.Material();
+    const CGrPoint& P = p_hit.Point();
+    const CGrPoint& N = p_hit.Normal();
+
+    p_shade.base = CGrPoint(0, 0, 0);
+    p_shade.mul = CGrPoint(1, 1, 1);
+    p_shade.add = CGrPoint(0, 0, 0);
+
+    if (!reflective || !p_visibility.Reflect(p_hit, p_ray, p_shade.base))
+    {
+        if (textured)
+        {
+            const CGrPoint& texcoord = p_hit.TexCoord();
+            p_shade.base = p_hit.Texture()->Sample(texcoord.X(), texcoord.Y());
+        }
+        else if (hasmaterial)
+        {
+            p_shade.base = material->Ambient();
+        }
+    }
+
+    // Direct lighting may be handled elsewhere (see CRayReservoirs)
+    if (!p_visibility.DirectLighting())
+        return;
+
+    // Blinn-Phong
+    CRayShadeMaterial params;
+    params.Set(hasmaterial ? material : NULL);
+
+    const float Kd = params.kd;
+    const float Ks = params.ks;
+    const float shininess = params.shininess;
+    const CGrPoint& diffuseColor = params.diffuse;
+    const CGrPoint& specularColor = params.specular;
+
+    CGrPoint viewDir;
+    if (specular)
+        viewDir = Normalize3(P - p_lights.Eye());
+
+    CGrPoint origin = P + N * 0.001;
+    const bool receives = !hasmaterial || material->ReceiveShadows();
+    const bool linked = p_lights.Linked();
+
+    // Many lights: shade the representatives of a lightcut. Each one stands
+    // for count lights, so an added term is scaled by the count and a
+    // multiplied term is raised to that power. The lights in the tree have
+    // no range or links and all cast shadows; the others are shaded one
+    // at a time after the cut.
+    if (Lights == 0 && p_lights.UseCuts())
+    {
+        CRayLightTree::CutLight cut[CRayLightTree::MaxCut];
+        int cutcnt = p_lights.Tree().SelectCut(P, N, viewDir, Kd, Ks, shininess, specular, cut);
+        for (int i = 0; i < cutcnt; i++)
+        {
+            float diffuse = cut[i].diffuse;
+            float spec = cut[i].specular;
+            if (diffuse + spec < RayShadeMinTerm)
+                continue;
+
+            int light = cut[i].light;
+            CGrPoint term;
+            if (hasmaterial)
+            {
+                term = (diffuseColor * diffuse + specularColor * spec) * cut[i].count;
+            }
+            else
+            {
+                double scale = pow(1. + diffuse + spec, cut[i].count);
+                term = CGrPoint(scale, scale, scale);
+            }
+
+            CGrPoint lightDir(cut[i].dx, cut[i].dy, cut[i].dz, 0);
+            p_visibility.template Light<!hasmaterial>(p_shade, CRay(origin, lightDir), cut[i].length, term, light, receives);
+        }
+
+        // The uncut lights are in increasing order, so each group is
+        // evaluated once
+        const std::vector<int>& uncut = p_lights.Uncut();
+        CRayLights::Terms terms;
+        int group = -1;
+        for (size_t u = 0; u < uncut.size(); u++)
+        {
+            int i = uncut[u];
+            int first = i - i % CRayLights::Width;
+            if (first != group)
+            {
+                p_lights.Evaluate(first, P, N, viewDir, Kd, Ks, shininess, specular, terms);
+                group = first;
+            }
+
+            int j = i - first;
+            float diffuse = terms.diffuse[j];
+            float spec = terms.specular[j];
+            if (diffuse + spec < RayShadeMinTerm)
+                continue;
+            if (linked && !p_lights.Illuminates(i, hasmaterial ? material : NULL, p_hit.Link()))
+                continue;
+
+            CGrPoint term;
+            if (hasmaterial)
+                term = diffuseColor * diffuse + specularColor * spec;
+            else
+                term = CGrPoint(1 + diffuse + spec, 1 + diffuse + spec, 1 + diffuse + spec);
+
+            CGrPoint lightDir(terms.dx[j], terms.dy[j], terms.dz[j], 0);
+            p_visibility.template Light<!hasmaterial>(p_shade, CRay(origin, lightDir), terms.length[j], term, i, receives && p_lights.CastsShadows(i));
+        }
+
+        return;
+    }
+
+    const int lightcnt = Lights > 0 ? Lights : p_lights.Count();
+    for (int first = 0; first < lightcnt; first += CRayLights::Width)
+    {
+        CRayLights::Terms terms;
+        p_lights.Evaluate(first, P, N, viewDir, Kd, Ks, shininess, specular, terms);
+
+        int last = first + CRayLights::Width < lightcnt ? first + CRayLights::Width : lightcnt;
+        for (int i = first; i < last; i++)
+        {
+            int j = i - first;
+            float diffuse = terms.diffuse[j];
+            float spec = terms.specular[j];
+            if (diffuse + spec < RayShadeMinTerm)
+                continue;
+            if (linked && !p_lights.Illuminates(i, hasmaterial ? material : NULL, p_hit.Link()))
+                continue;
+
+            CGrPoint term;
+            if (hasmaterial)
+                term = diffuseColor * diffuse + specularColor * spec;
+            else
+                term = CGrPoint(1 + diffuse + spec, 1 + diffuse + spec, 1 + diffuse + spec);
+
+            CGrPoint lightDir(terms.dx[j], terms.dy[j], terms.dz[j], 0);
+            p_visibility.template Light<!hasmaterial>(p_shade, CRay(origin, lightDir), terms.length[j], term, i, receives && p_lights.CastsShadows(i));
+        }
+    }
+}
+
+//
+// Name : CRayShadingTable
+// Description : The kernels for one visibility policy, indexed by
+// RAYSHADE_ feature flags. Call Select() with the light count once the
+// scene is loaded.
+//
+
+template <class Visibility> class CRayShadingTable
+{
+public:
+    typedef void (*Kernel)(const CRayLights&, CRayHit&, const CRay&, Visibility&, CRayShade&);
+
+    CRayShadingTable() { Select(0); }
+
+    // Up to 4 lights get kernels with the light loop unrolled
+    void Select(int p_lightcnt)
+    {
+        switch (p_lightcnt)
+        {
+        case 1: Fill<1, RAYSHADE_FEATURES - 1>::Do(m_kernels); break;
+        case 2: Fill<2, RAYSHADE_FEATURES - 1>::Do(m_kernels); break;
+        case 3: Fill<3, RAYSHADE_FEATURES - 1>::Do(m_kernels); break;
+        case 4: Fill<4, RAYSHADE_FEATURES - 1>::Do(m_kernels); break;
+        default: Fill<0, RAYSHADE_FEATURES - 1>::Do(m_kernels); break;
+        }
+    }
+
+    Kernel operator[](int p_features) const { return m_kernels[p_features]; }
+
+private:
+    template <int Lights, int Features> struct Fill
+    {
+        static void Do(Kernel* p_kernels)
+        {
+            p_kernels[Features] = &RayShadeKernel<Features, Lights, Visibility>;
+            Fill<Lights, Features - 1>::Do(p_kernels);
+        }
+    };
+
+    template <int Lights> struct Fill<Lights, -1>
+    {
+        static void Do(Kernel*) {}
+    };
+
+    Kernel m_kernels[RAYSHADE_FEATURES];
+};
@@ -0,0 +1,291 @@
+//
+// Name :         RayValidator.cpp
+// Description :  Implementation of CRayValidator.
+//
+
+#include "pch.h"
+#include "RayValidator.h"
+#include "graphics/GrTransform.h"
+#include <chrono>
+#include <cmath>
+#include <sstream>
+
+const double CRayValidator::Tolerance = 1e-6;
+const double CRayValidator::ShadingTolerance = 1e-4;
+
+CRayValidator::CRayValidator()
+{
+    m_samples = 4096;
+    m_randomrays = 4096;
+    m_randomstate = 2463534242u;
+}
+
+// Uniform random number in [0, 1) (xorshift)
+double CRayValidator::Random()
+{
+    m_randomstate ^= m_randomstate << 13;
+    m_randomstate ^= m_randomstate >> 17;
+    m_randomstate ^= m_randomstate << 5;
+    return m_randomstate / 4294967296.0;
+}
+
+//
+// Name : CRayValidator::Run()
+// Description : Make the sample with brute force and check each of the
+// accelerators against it.
+//
+
+bool CRayValidator::Run(const CRayGeometry& p_geometry, const std::vector<CRay>& p_primary, const std::vector<CGrPoint>& p_lights)
+{
+    m_results.clear();
+    m_reference.Build(p_geometry);
+
+    std::vector<Sample> samples;
+    auto add = [&](const CRay& ray, double maxt, int ignore, bool occlusion) {
+        Sample sample = { ray, maxt, ignore, occlusion, false, maxt };
+        int primitive = -1;
+        if (occlusion)
+            sample.hit = m_reference.Occluded(ray, maxt, ignore);
+        else
+            sample.hit = m_reference.Intersect(ray, maxt, ignore, primitive, sample.t);
+        samples.push_back(sample);
+        return primitive;
+    };
+
+    for (size_t i = 0; i < p_primary.size(); i++)
+    {
+        const CRay& ray = p_primary[i];
+        int primitive = add(ray, 1e20, -1, false);
+        if (!samples.back().hit)
+            continue;
+
+        CGrPoint point = ray.PointOnRay(samples.back().t);
+        point.W(1);
+
+        const CGrPoint& normal = p_geometry.GetPolygon(primitive).normal;
+        CGrPoint reflect = ray.Direction() - normal * (2 * Dot3(ray.Direction(), normal));
+        reflect.W(0);
+        add(CRay(point, reflect), 1e20, primitive, false);
+
+        for (size_t l = 0; l < p_lights.size(); l++)
+        {
+            CGrPoint dir = p_lights[l] - point;
+            dir.W(0);
+            double length = dir.Length3();
+            if (length > 1e-6)
+                add(CRay(point, dir / length), length, primitive, true);
+        }
+    }
+
+    // Random rays through the scene bounds
+    CGrPoint smin(1e20, 1e20, 1e20), smax(-1e20, -1e20, -1e20);
+    for (int p = 0; p < p_geometry.PrimitiveCnt(); p++)
+    {
+        const CRayGeometry::Polygon& polygon = p_geometry.GetPolygon(p);
+        for (int v = polygon.first; v < polygon.first + polygon.count; v++)
+        {
+            smin.Minimize(p_geometry.Vertex(v));
+            smax.Maximize(p_geometry.Vertex(v));
+        }
+    }
+
+    for (int i = 0; i < m_randomrays && p_geometry.PrimitiveCnt() > 0; i++)
+    {
+        CGrPoint origin(smin.X() + Random() * (smax.X() - smin.X()),
+            smin.Y() + Random() * (smax.Y() - smin.Y()),
+            smin.Z() + Random() * (smax.Z() - smin.Z()));
+
+        // Uniform on the sphere
+        double z = 1 - 2 * Random();
+        double r = sqrt(max(0., 1 - z * z));
+        double phi = GR_PI2 * Random();
+        CGrPoint dir(r * cos(phi), r * sin(phi), z, 0);
+
+        add(CRay(origin, dir), 1e20, -1, false);
+    }
+
+    Check(m_reference, samples);
+
+    m_bvh.Clear();
+    m_bvh.Build(p_geometry);
+    Check(m_bvh, samples);
+
+    m_widebvh.Build(p_geometry);
+    Check(m_widebvh, samples);
+
+    m_kdtree.Build(p_geometry);
+    Check(m_kdtree, samples);
+    CheckShading(p_geometry, samples);
+
+    m_grid.Build(p_geometry);
+    Check(m_grid, samples);
+
+    return Passed();
+}
+
+//
+// Name : CRayValidator::Check()
+// Description : Trace the sample with one accelerator and count where it
+// disagrees with brute force.
+//
+
+void CRayValidator::Check(CRayAccelerator& p_accelerator, const std::vector<Sample>& p_samples)
+{
+    Result result;
+    result.name = p_accelerator.Name();
+    result.rays = int(p_samples.size());
+    result.mismatches = 0;
+
+    std::ostringstream examples;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < p_samples.size(); i++)
+    {
+        const Sample& sample = p_samples[i];
+
+        bool hit;
+        int primitive = -1;
+        double t = sample.maxt;
+        if (sample.occlusion)
+            hit = p_accelerator.Occluded(sample.ray, sample.maxt, sample.ignore);
+        else
+            hit = p_accelerator.Intersect(sample.ray, sample.maxt, sample.ignore, primitive, t);
+
+        bool agree = hit == sample.hit;
+        if (agree && hit && !sample.occlusion)
+            agree = fabs(t - sample.t) <= Tolerance * max(1., fabs(sample.t));
+
+        if (agree)
+            continue;
+
+        if (result.mismatches < MaxExamples)
+        {
+            const CGrPoint& o = sample.ray.Origin();
+            const CGrPoint& d = sample.ray.Direction();
+            examples << "    " << (sample.occlusion ? "shadow" : "ray") << " (" << o.X() << ", " << o.Y() << ", " << o.Z()
+                << ") dir (" << d.X() << ", " << d.Y() << ", " << d.Z() << "): expected "
+                << (sample.hit ? "hit" : "miss");
+            if (sample.hit && !sample.occlusion)
+                examples << " at " << sample.t;
+            examples << ", got " << (hit ? "hit" : "miss");
+            if (hit && !sample.occlusion)
+                examples << " at " << t << " (polygon " << primitive << ")";
+            examples << "\n";
+        }
+
+        result.mismatches++;
+    }
+
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    result.examples = examples.str();
+    m_results.push_back(result);
+}
+
+//
+// Name : CRayValidator::CheckShading()
+// Description : Compare the normal and texture coordinate of CRayHit with
+// those of the DLL (through the kd-tree, which must be built) at each
+// nearest hit where the polygon has them. Normals agree if they are
+// within ShadingTolerance of parallel, texture coordinates if they are
+// within ShadingTolerance of each other.
+//
+
+void CRayValidator::CheckShading(const CRayGeometry& p_geometry, const std::vector<Sample>& p_samples)
+{
+    Result result;
+    result.name = "Shading vs IntersectInfo";
+    result.rays = 0;
+    result.mismatches = 0;
+
+    std::ostringstream examples;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < p_samples.size(); i++)
+    {
+        const Sample& sample = p_samples[i];
+        if (sample.occlusion || !sample.hit)
+            continue;
+
+        int primitive;
+        double t;
+        if (!m_kdtree.Intersect(sample.ray, sample.maxt, sample.ignore, primitive, t))
+            continue;
+
+        const CRayGeometry::Polygon& polygon = p_geometry.GetPolygon(primitive);
+        if (!polygon.hasnormals && !polygon.hastexcoords)
+            continue;
+
+        CGrPoint normal, texcoord;
+        if (!m_kdtree.IntersectInfo(sample.ray, primitive, t, normal, texcoord))
+            continue;
+
+        CGrPoint point = sample.ray.PointOnRay(t);
+        point.W(1);
+
+        CRayHit hit;
+        hit.Set(&p_geometry, primitive, t, point);
+
+        bool agree = true;
+        if (polygon.hasnormals)
+        {
+            normal.W(0);
+            if (normal.Length3() > 0)
+                normal.Normalize3();
+            agree = Dot3(normal, hit.Normal()) >= 1 - ShadingTolerance;
+        }
+
+        if (agree && polygon.hastexcoords)
+        {
+            CGrPoint d = texcoord - hit.TexCoord();
+            agree = fabs(d.X()) <= ShadingTolerance && fabs(d.Y()) <= ShadingTolerance;
+        }
+
+        result.rays++;
+        if (agree)
+            continue;
+
+        if (result.mismatches < MaxExamples)
+        {
+            const CGrPoint& n = hit.Normal();
+            const CGrPoint& c = hit.TexCoord();
+            examples << "    polygon " << primitive << " at (" << point.X() << ", " << point.Y() << ", " << point.Z()
+                << "): normal (" << n.X() << ", " << n.Y() << ", " << n.Z() << ") texcoord (" << c.X() << ", " << c.Y()
+                << "), IntersectInfo normal (" << normal.X() << ", " << normal.Y() << ", " << normal.Z()
+                << ") texcoord (" << texcoord.X() << ", " << texcoord.Y() << ")\n";
+        }
+
+        result.mismatches++;
+    }
+
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    result.examples = examples.str();
+    m_results.push_back(result);
+}
+
+bool CRayValidator::Passed() const
+{
+    for (size_t i = 0; i < m_results.size(); i++)
+    {
+        if (m_results[i].mismatches > 0)
+            return false;
+    }
+
+    return true;
+}
+
+std::string CRayValidator::Report() const
+{
+    std::ostringstream str;
+
+    for (size_t i = 0; i < m_results.size(); i++)
+    {
+        const Result& r = m_results[i];
+        str.setf(std::ios::fixed);
+        str.precision(2);
+        str << (r.mismatches == 0 ? "PASS " : "FAIL ") << r.name << "  " << r.rays << " rays  "
+            << r.mismatches << " mismatches  " << r.seconds * 1000 << " ms\n";
+        str.unsetf(std::ios::fixed);
+        str.precision(6);
+        str << r.examples;
+    }
+
+    return str.str();
+}
@@ -0,0 +1,98 @@
+//
+// Name :         RayValidator.h
+// Description :  Header for CRayValidator, which checks the hits of every
+//                ray intersection accelerator against brute force.
+//                See RayValidator.cpp
+//
+
+#pragma once
+#include "RayAccelerator.h"
+#include "RayBvh.h"
+#include "RayGrid.h"
+#include "RayKdAccelerator.h"
+#include "RayWideBvh.h"
+#include <string>
+#include <vector>
+
+//
+// Each accelerator is built over the scene and traces the same sample of
+// rays as CRayBruteForce:
+//
+// -   the primary rays the renderer supplies
+// -   from each primary hit, the reflection about the face normal and the
+//     shadow ray to each light (an occlusion test)
+// -   RandomRays rays from random points in the scene bounds in random
+//     directions, which reach the parts of the scene the camera doesn't
+//
+// A nearest hit agrees if both miss, or both hit at the same distance
+// (to a relative tolerance). Which polygon was hit is not compared, two
+// polygons that meet at an edge are hit at the same distance. An occlusion
+// test agrees if both give the same answer.
+//
+// The shading normals and texture coordinates CRayHit interpolates are
+// checked against the DLL's IntersectInfo() too, at every nearest hit in
+// the sample both agree on. This is reported as one more line.
+//
+// The time each accelerator took to trace the sample is reported too, so
+// this doubles as an A/B comparison on the scene (see
+// CMyRaytraceRenderer::SetValidator).
+//
+
+class CRayValidator
+{
+public:
+    CRayValidator();
+
+    static const double Tolerance;
+    static const double ShadingTolerance;
+    static const int MaxExamples = 3;       // Mismatches described per accelerator
+
+    struct Result
+    {
+        std::string name;
+        int     rays;
+        int     mismatches;
+        double  seconds;                // Time to trace the sample
+        std::string examples;           // The first few mismatches
+    };
+
+    void SetSampleCount(int n) { m_samples = n; }
+    int GetSampleCount() const { return m_samples; }
+    void SetRandomRays(int n) { m_randomrays = n; }
+
+    // Check every accelerator. Returns true if all of them agree.
+    bool Run(const CRayGeometry& p_geometry, const std::vector<CRay>& p_primary, const std::vector<CGrPoint>& p_lights);
+
+    const std::vector<Result>& Results() const { return m_results; }
+    bool Passed() const;
+
+    // One line per accelerator, brute force first
+    std::string Report() const;
+
+private:
+    struct Sample
+    {
+        CRay    ray;
+        double  maxt;
+        int     ignore;
+        bool    occlusion;      // Occluded() rather than Intersect()
+        bool    hit;            // The brute force answer
+        double  t;
+    };
+
+    void Check(CRayAccelerator& p_accelerator, const std::vector<Sample>& p_samples);
+    void CheckShading(const CRayGeometry& p_geometry, const std::vector<Sample>& p_samples);
+    double Random();
+
+    int     m_samples;
+    int     m_randomrays;
+    unsigned int m_randomstate;
+
+    CRayBruteForce      m_reference;
+    CRayBvh             m_bvh;
+    CRayWideBvh         m_widebvh;
+    CRayKdAccelerator   m_kdtree;
+    CRayGrid            m_grid;
+
+    std::vector<Result> m_results;
+};
@@ -0,0 +1,217 @@
+//
+// Name :         RayVisibilityBuffer.cpp
+// Description :  Implementation of CRayVisibilityBuffer. Polygons are
+//                clipped to the near plane, projected onto the image
+//                plane and scan converted as triangle fans with a depth
+//                test on 1/z, which is linear in screen space.
+//
+
+#include "pch.h"
+#include "RayVisibilityBuffer.h"
+#include <algorithm>
+#include <cmath>
+
+const double CRayVisibilityBuffer::NearPlane = 1e-5;
+
+CRayVisibilityBuffer::CRayVisibilityBuffer()
+{
+    m_width = 0;
+    m_height = 0;
+    m_xmin = m_ymin = -1;
+    m_xwid = m_yhit = 2;
+    m_offsetx = m_offsety = 0.5;
+}
+
+//
+// Name : CRayVisibilityBuffer::Build()
+// Description : Rasterize all of the polygons, then find the distance
+// to the nearest one along the ray through each pixel's sample point.
+//
+
+void CRayVisibilityBuffer::Build(const CRayGeometry& geometry, int width, int height,
+    double xmin, double xwid, double ymin, double yhit, const CGrPoint& offset)
+{
+    m_width = width;
+    m_height = height;
+    m_xmin = xmin;
+    m_xwid = xwid;
+    m_ymin = ymin;
+    m_yhit = yhit;
+    m_offsetx = offset.X();
+    m_offsety = offset.Y();
+
+    Pixel empty;
+    empty.primitive = -1;
+    empty.t = 0;
+    m_pixels.assign(size_t(width) * height, empty);
+    m_depth.assign(size_t(width) * height, 0);
+
+    for (int p = 0; p < geometry.PrimitiveCnt(); p++)
+    {
+        const CRayGeometry::Polygon& poly = geometry.GetPolygon(p);
+
+        // Clip to z <= -NearPlane
+        m_polygon.clear();
+        for (int i = 0; i < poly.count; i++)
+            m_polygon.push_back(geometry.Vertex(poly.first + i));
+
+        m_clipped.clear();
+        int cnt = int(m_polygon.size());
+        for (int i = 0; i < cnt; i++)
+        {
+            const CGrPoint& a = m_polygon[i];
+            const CGrPoint& b = m_polygon[(i + 1) % cnt];
+            double da = -NearPlane - a.Z();
+            double db = -NearPlane - b.Z();
+
+            if (da >= 0)
+                m_clipped.push_back(a);
+
+            if ((da >= 0) != (db >= 0))
+            {
+                double f = da / (da - db);
+                m_clipped.push_back(a + (b - a) * f);
+            }
+        }
+
+        for (int i = 1; i + 1 < int(m_clipped.size()); i++)
+            Triangle(p, m_clipped[0], m_clipped[i], m_clipped[i + 1]);
+    }
+
+    // Exact distances along the primary rays
+    for (int r = 0; r < m_height; r++)
+    {
+        for (int c = 0; c < m_width; c++)
+        {
+            Pixel& pixel = m_pixels[r * m_width + c];
+            if (pixel.primitive < 0)
+                continue;
+
+            CGrPoint d = Normalize3(CGrPoint(m_xmin + (c + m_offsetx) / m_width * m_xwid,
+                m_ymin + (r + m_offsety) / m_height * m_yhit, -1, 0));
+
+            double t = Distance(geometry, pixel.primitive, d);
+
+            // Edge on polygons, fall back to the interpolated depth
+            if (!(t > 0))
+                t = 1. / (m_depth[r * m_width + c] * -d.Z());
+
+            pixel.t = t;
+        }
+    }
+}
+
+//
+// Name : CRayVisibilityBuffer::Distance()
+// Description : Distance along the ray from the eye in direction d to
+// the polygon. Polygons need not be planar, so each triangle of the fan
+// is intersected and the nearest hit is used. Rasterization may cover a
+// pixel the ray just misses, in which case the triangle it misses by
+// the least is used. Returns 0 if the ray is parallel to every triangle.
+//
+
+double CRayVisibilityBuffer::Distance(const CRayGeometry& geometry, int primitive, const CGrPoint& d)
+{
+    const CRayGeometry::Polygon& poly = geometry.GetPolygon(primitive);
+    const CGrPoint& a = geometry.Vertex(poly.first);
+
+    double nearest = 0;     // Nearest triangle the ray hits
+    double best = -1e30;    // Otherwise the one it misses by the least
+    double t = 0;
+    for (int i = poly.first + 1; i + 1 < poly.first + poly.count; i++)
+    {
+        CGrPoint e1 = geometry.Vertex(i) - a;
+        CGrPoint e2 = geometry.Vertex(i + 1) - a;
+        CGrPoint p = Cross3(d, e2);
+        double det = Dot3(e1, p);
+        if (det == 0)
+            continue;
+
+        CGrPoint s(-a.X(), -a.Y(), -a.Z(), 0);
+        CGrPoint q = Cross3(s, e1);
+        double u = Dot3(s, p) / det;
+        double v = Dot3(d, q) / det;
+
+        // Smallest barycentric, negative outside the triangle
+        double inside = min(min(u, v), 1 - u - v);
+        double ti = Dot3(e2, q) / det;
+        if (inside >= 0 && ti > 0)
+        {
+            if (nearest == 0 || ti < nearest)
+                nearest = ti;
+        }
+        else if (inside > best)
+        {
+            best = inside;
+            t = ti;
+        }
+    }
+
+    return nearest > 0 ? nearest : t;
+}
+
+//
+// Name : CRayVisibilityBuffer::Triangle()
+// Description : Scan convert one triangle in eye coordinates. A pixel
+// is covered if its sample point is inside or on an edge.
+//
+
+void CRayVisibilityBuffer::Triangle(int primitive, const CGrPoint& a, const CGrPoint& b, const CGrPoint& c)
+{
+    const CGrPoint* v[3] = { &a, &b, &c };
+    double sx[3], sy[3], iz[3];
+    for (int i = 0; i < 3; i++)
+    {
+        iz[i] = -1. / v[i]->Z();
+        sx[i] = (v[i]->X() * iz[i] - m_xmin) / m_xwid * m_width;
+        sy[i] = (v[i]->Y() * iz[i] - m_ymin) / m_yhit * m_height;
+    }
+
+    double area = (sx[1] - sx[0]) * (sy[2] - sy[0]) - (sx[2] - sx[0]) * (sy[1] - sy[0]);
+    if (area == 0)
+        return;
+
+    // Sample points inside the bounds of the triangle
+    int cmin = max(0, int(ceil(min(sx[0], min(sx[1], sx[2])) - m_offsetx)));
+    int cmax = min(m_width - 1, int(floor(max(sx[0], max(sx[1], sx[2])) - m_offsetx)));
+    int rmin = max(0, int(ceil(min(sy[0], min(sy[1], sy[2])) - m_offsety)));
+    int rmax = min(m_height - 1, int(floor(max(sy[0], max(sy[1], sy[2])) - m_offsety)));
+    if (cmin > cmax || rmin > rmax)
+        return;
+
+    // Edge i is opposite vertex i. Scaled by 1 / area, the edge
+    // functions are the barycentric weights for either winding.
+    double ea[3], eb[3], ec[3];
+    for (int i = 0; i < 3; i++)
+    {
+        int j = (i + 1) % 3;
+        int k = (i + 2) % 3;
+        ea[i] = (sy[j] - sy[k]) / area;
+        eb[i] = (sx[k] - sx[j]) / area;
+        ec[i] = (sx[j] * sy[k] - sx[k] * sy[j]) / area;
+    }
+
+    for (int r = rmin; r <= rmax; r++)
+    {
+        double y = r + m_offsety;
+        Pixel* pixels = &m_pixels[r * m_width];
+        double* depth = &m_depth[r * m_width];
+
+        for (int c = cmin; c <= cmax; c++)
+        {
+            double x = c + m_offsetx;
+            double l0 = ea[0] * x + eb[0] * y + ec[0];
+            double l1 = ea[1] * x + eb[1] * y + ec[1];
+            double l2 = ea[2] * x + eb[2] * y + ec[2];
+            if (l0 < 0 || l1 < 0 || l2 < 0)
+                continue;
+
+            double z = l0 * iz[0] + l1 * iz[1] + l2 * iz[2];
+            if (z > depth[c])
+            {
+                depth[c] = z;
+                pixels[c].primitive = primitive;
+            }
+        }
+    }
+}
@@ -0,0 +1,65 @@
+//
+// Name :         RayVisibilityBuffer.h
+// Description :  Header for CRayVisibilityBuffer, the primary hits of a
+//                frame found by rasterizing CRayGeometry instead of
+//                tracing primary rays.
+//                See RayVisibilityBuffer.cpp
+//
+
+#pragma once
+#include "RayGeometry.h"
+#include <vector>
+
+//
+// Build() rasterizes every polygon, in eye coordinates, with the same
+// image plane as the primary rays (see CMyRaytraceRenderer::PrimaryRay)
+// and samples each pixel at one point, the center unless a subpixel
+// offset is given (to add jittered samples). Each pixel keeps the nearest
+// primitive and the distance along the primary ray through that point,
+// found by intersecting that ray with the polygon's triangles, so the hit
+// point matches what the ray tracer would find. Barycentrics are not
+// kept since CRayHit computes them from the hit point when asked.
+//
+// Polygons are not back face culled, as the ray tracer sees both sides.
+//
+
+class CRayVisibilityBuffer
+{
+public:
+    CRayVisibilityBuffer();
+
+    struct Pixel
+    {
+        int     primitive;          // -1 if nothing covers the pixel
+        double  t;
+    };
+
+    // The image plane at distance 1 spans xmin to xmin + xwid
+    // and ymin to ymin + yhit. Pixel (r, c) is sampled at
+    // (c + offset.X(), r + offset.Y()).
+    void Build(const CRayGeometry& p_geometry, int p_width, int p_height,
+        double p_xmin, double p_xwid, double p_ymin, double p_yhit,
+        const CGrPoint& p_offset = CGrPoint(0.5, 0.5));
+
+    const Pixel& At(int r, int c) const { return m_pixels[r * m_width + c]; }
+
+    // Polygons closer than this to the eye plane are clipped
+    static const double NearPlane;
+
+private:
+    void Triangle(int p_primitive, const CGrPoint& a, const CGrPoint& b, const CGrPoint& c);
+    static double Distance(const CRayGeometry& p_geometry, int p_primitive, const CGrPoint& d);
+
+    int     m_width;
+    int     m_height;
+    double  m_xmin, m_xwid;
+    double  m_ymin, m_yhit;
+    double  m_offsetx, m_offsety;
+
+    std::vector<Pixel>  m_pixels;
+    std::vector<double> m_depth;    // 1 / distance in front of the eye
+
+    // Reused for each polygon
+    std::vector<CGrPoint> m_polygon;
+    std::vector<CGrPoint> m_clipped;
+};
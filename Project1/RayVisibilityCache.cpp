@@ -0,0 +1,86 @@
+//
+// Name :         RayVisibilityCache.cpp
+// Description :  Implementation of CRayVisibilityCache.
+//
+
+#include "pch.h"
+#include "RayVisibilityCache.h"
+
+CRayVisibilityCache::CRayVisibilityCache()
+{
+    m_width = 0;
+    m_height = 0;
+    m_samples = 0;
+    m_key = 0;
+    m_shadowlights = 0;
+}
+
+//
+// Name : CRayVisibilityCache::Begin()
+// Description : Start a frame. The key of a frame is the image size,
+// the number of samples, the camera and the scene hash. If it is the
+// same as last time, only the shadow results of lights that changed are
+// dropped.
+//
+
+bool CRayVisibilityCache::Begin(int p_width, int p_height, int p_samples, unsigned long long p_scene, const CGrRenderer& p_renderer)
+{
+    unsigned long long key = Hash(p_scene, &p_width, sizeof(p_width));
+    key = Hash(key, &p_height, sizeof(p_height));
+
+    const CGrPoint* camera[] = {&p_renderer.Eye(), &p_renderer.Center(), &p_renderer.Up()};
+    for (int i = 0; i < 3; i++)
+    {
+        double xyz[3] = {camera[i]->X(), camera[i]->Y(), camera[i]->Z()};
+        key = Hash(key, xyz, sizeof(xyz));
+    }
+
+    double projection[2] = {p_renderer.ProjectionAngle(), p_renderer.ProjectionAspect()};
+    key = Hash(key, projection, sizeof(projection));
+
+    int lightcnt = p_renderer.LightCnt();
+    int shadowlights = lightcnt <= MaxLights ? lightcnt : 0;
+
+    bool valid = m_width == p_width && m_height == p_height && m_samples == p_samples && m_key == key;
+    if (!valid)
+    {
+        m_width = p_width;
+        m_height = p_height;
+        m_samples = p_samples;
+        m_key = key;
+
+        Pixel miss;
+        miss.primitive = -1;
+        miss.t = 0;
+        m_pixels.assign(size_t(m_samples) * m_width * m_height, miss);
+    }
+
+    if (!valid || shadowlights != m_shadowlights)
+    {
+        m_shadowlights = shadowlights;
+        m_shadows.assign(m_pixels.size() * m_shadowlights, (unsigned char)SHADOW_UNKNOWN);
+        m_lights.clear();
+    }
+
+    // Drop the shadow results of lights that changed
+    LightKey unset;
+    unset.set = false;
+    unset.castshadows = true;
+    m_lights.resize(m_shadowlights, unset);
+    for (int l = 0; l < m_shadowlights; l++)
+    {
+        const CGrRenderer::Light& light = p_renderer.GetLight(l);
+        LightKey& lightkey = m_lights[l];
+        if (lightkey.set && lightkey.pos.X() == light.m_pos.X() && lightkey.pos.Y() == light.m_pos.Y() &&
+            lightkey.pos.Z() == light.m_pos.Z() && lightkey.castshadows == light.m_castshadows)
+            continue;
+
+        lightkey.set = true;
+        lightkey.pos = light.m_pos;
+        lightkey.castshadows = light.m_castshadows;
+        for (size_t i = l; i < m_shadows.size(); i += m_shadowlights)
+            m_shadows[i] = SHADOW_UNKNOWN;
+    }
+
+    return valid;
+}
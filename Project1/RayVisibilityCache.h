@@ -0,0 +1,101 @@
+//
+// Name :         RayVisibilityCache.h
+// Description :  Header for CRayVisibilityCache, the primary hits and
+//                shadow ray results of the last ray trace, kept so that
+//                light and material edits only have to reshade.
+//                See RayVisibilityCache.cpp
+//
+
+#pragma once
+#include "graphics/GrRenderer.h"
+#include <vector>
+
+//
+// The cache is a G-buffer of the primitive and hit point seen through each
+// sample position of each pixel, plus, for up to MaxLights lights, whether
+// the shadow ray from that hit to each light was blocked. Sample 0 is the
+// center of the pixel, the others are the jittered samples of progressive
+// rendering.
+//
+// Begin() compares the new frame with the one the cache holds:
+//
+// -   A different image size, number of samples, camera or scene
+//     geometry (see Hash()) drops everything, so the primary rays are
+//     traced again.
+// -   A light that moved or changed its shadow flag drops only the
+//     shadow results for that light.
+// -   Material colors are never cached, so edits to them only reshade.
+//
+// Like CRayReservoirs, the object should live as long as the view (see
+// CMyRaytraceRenderer::SetVisibilityCache).
+//
+
+class CRayVisibilityCache
+{
+public:
+    CRayVisibilityCache();
+
+    // Lights past this many always trace their shadow rays
+    static const int MaxLights = 16;
+
+    // The primary hit of a pixel
+    struct Pixel
+    {
+        int         primitive;      // -1 if the ray missed
+        double      t;
+        CGrPoint    point;
+    };
+
+    // Shadow ray results
+    enum { SHADOW_UNKNOWN, SHADOW_CLEAR, SHADOW_BLOCKED };
+
+    // Start a frame. p_scene is a hash of the scene geometry. Returns
+    // true if the primary hits of the last frame are still valid.
+    bool Begin(int p_width, int p_height, int p_samples, unsigned long long p_scene, const CGrRenderer& p_renderer);
+
+    void Reset() { m_width = m_height = 0; }
+
+    Pixel& At(int s, int r, int c) { return m_pixels[Index(s, r, c)]; }
+
+    // Shadow result for a light, NULL if the light is not cached
+    unsigned char* Shadow(int s, int r, int c, int p_light)
+    {
+        return p_light < m_shadowlights ? &m_shadows[Index(s, r, c) * m_shadowlights + p_light] : NULL;
+    }
+
+    // FNV-1a, to accumulate the scene hash
+    static unsigned long long Hash(unsigned long long p_hash, const void* p_data, size_t p_size)
+    {
+        const unsigned char* data = (const unsigned char*)p_data;
+        for (size_t i = 0; i < p_size; i++)
+        {
+            p_hash ^= data[i];
+            p_hash *= 1099511628211ull;
+        }
+
+        return p_hash;
+    }
+
+    static const unsigned long long HashStart = 14695981039346656037ull;
+
+private:
+    size_t Index(int s, int r, int c) const { return (size_t(s) * m_height + r) * m_width + c; }
+
+    // What the shadow results of a light depend on
+    struct LightKey
+    {
+        bool        set;            // False until the light has been seen
+        CGrPoint    pos;
+        bool        castshadows;
+    };
+
+    int     m_width;
+    int     m_height;
+    int     m_samples;
+    unsigned long long m_key;
+    int     m_shadowlights;
+
+    std::vector<Pixel>          m_pixels;
+    std::vector<unsigned char>  m_shadows;
+    std::vector<LightKey>       m_lights;
+};
@@ -0,0 +1,306 @@
+//
+// Name :         RayWavefront.cpp
+// Description :  Implementation of CRayWavefront. Each stage runs over a
+//                whole queue of rays, so the intersection code and the
+//                shading code each stay in cache for the length of a queue
+//                instead of alternating for every ray.
+//
+
+#include "pch.h"
+#include "RayWavefront.h"
+#include "CMyRaytraceRenderer.h"
+#include "graphics/GrTexture.h"
+#include "graphics/GrProfiler.h"
+#include <algorithm>
+
+CRayWavefront::CRayWavefront(CMyRaytraceRenderer* p_renderer)
+{
+    m_renderer = p_renderer;
+    m_coherencesort = true;
+}
+
+//
+// Name : CRayWavefront::Trace()
+// Description : Compute the color for every sample.
+//
+
+void CRayWavefront::Trace(std::vector<Sample>& p_samples)
+{
+    GR_PROFILE_ZONE("CRayWavefront::Trace");
+
+    // Generate the primary rays
+    m_rays.clear();
+    for (size_t i = 0; i < p_samples.size(); i++)
+    {
+        Sample& sample = p_samples[i];
+        sample.color = CGrPoint(0, 0, 0);
+
+        Ray ray;
+        ray.ray = m_renderer->PrimaryRay(sample.x, sample.y);
+        ray.sample = int(i);
+        ray.weight = CGrPoint(1, 1, 1);
+        ray.recurse = 0;
+        ray.ignore = -1;
+        m_rays.push_back(ray);
+    }
+
+    for (int wave = 0; !m_rays.empty(); wave++)
+    {
+        // The primary rays and the reflections are separate zones, each
+        // split into the phases below
+        GR_PROFILE_ZONE(wave == 0 ? "Primary wave" : "Reflection wave");
+
+        IntersectRays();
+        ShadeHits();
+
+        if (m_coherencesort)
+        {
+            GR_PROFILE_ZONE("CRayWavefront::CoherenceSort");
+            CoherenceSort(m_shadows, m_shadowscratch);
+            CoherenceSort(m_nextrays, m_rayscratch);
+        }
+
+        IntersectShadows();
+
+        // Everything that is known about each hit is in now
+        for (size_t i = 0; i < m_shades.size(); i++)
+        {
+            const Shade& shade = m_shades[i];
+            p_samples[shade.sample].color += shade.Color().MemberMultiply3(shade.weight);
+        }
+
+        // Reflections are the next wave
+        m_rays.swap(m_nextrays);
+    }
+}
+
+//
+// Name : CRayWavefront::IntersectRays()
+// Description : Intersect the ray queue. Rays that miss contribute the
+// black background, so only the hits are kept.
+//
+
+void CRayWavefront::IntersectRays()
+{
+    GR_PROFILE_ZONE("CRayWavefront::IntersectRays");
+
+    CRayGeometry& geometry = *m_renderer->m_geometry;
+
+    m_hits.clear();
+    for (size_t i = 0; i < m_rays.size(); i++)
+    {
+        const Ray& ray = m_rays[i];
+
+        Hit hit;
+        int primitive;
+        double t;
+        CGrPoint intersect;
+        if (m_renderer->Intersect(ray.ray, 1e20, ray.ignore, primitive, t, intersect,
+            ray.recurse == 0 ? CRayRecorder::PRIMARY : CRayRecorder::REFLECTION))
+        {
+            hit.ray = int(i);
+            hit.hit.Set(&geometry, primitive, t, intersect);
+            hit.features = (*m_renderer->m_features)[hit.hit.Primitive()];
+            hit.material = hit.hit.Material();
+            hit.texture = hit.hit.Texture();
+            m_hits.push_back(hit);
+        }
+    }
+
+    // Group the hits so shading runs one kernel and one material at a time
+    std::sort(m_hits.begin(), m_hits.end(), [](const Hit& a, const Hit& b) {
+        if (a.features != b.features)
+            return a.features < b.features;
+        return a.material != b.material ? a.material < b.material : a.texture < b.texture;
+    });
+}
+
+//
+// Name : CRayWavefront::ShadeHits()
+// Description : Shade every hit with the kernel for its material. This
+// creates a shade record for each hit, a shadow ray for each light and
+// a reflection ray for mirrors.
+//
+
+void CRayWavefront::ShadeHits()
+{
+    GR_PROFILE_ZONE("CRayWavefront::ShadeHits");
+
+    CMyRaytraceRenderer* renderer = m_renderer;
+
+    m_shades.clear();
+    m_shadows.clear();
+    m_nextrays.clear();
+
+    for (size_t h = 0; h < m_hits.size(); h++)
+    {
+        Hit& hit = m_hits[h];
+        const Ray& ray = m_rays[hit.ray];
+
+        Shade shade;
+        shade.sample = ray.sample;
+        shade.weight = ray.weight;
+
+        Deferred visibility(this, ray, hit.hit.Primitive(), int(m_shades.size()));
+        m_kernels[hit.features](renderer->m_lights, hit.hit, ray.ray, visibility, shade);
+
+        m_shades.push_back(shade);
+    }
+}
+
+//
+// Name : CRayWavefront::Deferred::Reflect()
+// Description : Queue the reflection of a mirror for the next wave. The
+// reflection is accumulated into the sample directly, so the base color
+// of the hit is black.
+//
+
+bool CRayWavefront::Deferred::Reflect(CRayHit& hit, const CRay& ray, CGrPoint& base)
+{
+    CMyRaytraceRenderer* renderer = m_wavefront->m_renderer;
+    if (!renderer->ReflectionAllowed(m_ray.recurse))
+        return false;
+
+    CGrMaterial* material = hit.Material();
+    CGrPoint reflectance(material->Specular(0), material->Specular(1), material->Specular(2));
+    CGrPoint reflectionThroughput = m_ray.weight;
+    reflectionThroughput.MemberMultiply3(reflectance);
+
+    double weight;
+    if (renderer->ContinuePath(reflectionThroughput, m_ray.recurse, weight) && renderer->SpendRay())
+    {
+        const CGrPoint& N = hit.Normal();
+
+        Ray reflection;
+        reflection.ray = CRay(hit.Point() + N * 0.001, renderer->Reflect(ray.Direction(), N));
+        reflection.sample = m_ray.sample;
+        reflection.weight = reflectionThroughput * weight;
+        reflection.recurse = m_ray.recurse + 1;
+        reflection.ignore = m_primitive;
+        m_wavefront->m_nextrays.push_back(reflection);
+    }
+
+    base = CGrPoint(0, 0, 0);
+    return true;
+}
+
+//
+// Name : CRayWavefront::Deferred::Light()
+// Description : Queue the shadow ray for a light. The light is applied
+// when the shadow ray is found to be clear.
+//
+
+template <bool Multiply> void CRayWavefront::Deferred::Light(CRayShade& shade, const CRay& shadowRay, double maxt, const CGrPoint& term, int light, bool cast)
+{
+    if (!cast || !m_wavefront->m_renderer->SpendRay())
+    {
+        // No shadow, or out of budget and the light is assumed unoccluded
+        RayShadeApply<Multiply>(shade, term);
+        return;
+    }
+
+    Shadow shadow;
+    shadow.ray = shadowRay;
+    shadow.maxt = maxt;
+    shadow.ignore = m_primitive;
+    shadow.shade = m_shade;
+    shadow.mul = CGrPoint(1, 1, 1);
+    shadow.add = CGrPoint(0, 0, 0);
+    if (Multiply)
+        shadow.mul = term;
+    else
+        shadow.add = term;
+    m_wavefront->m_shadows.push_back(shadow);
+}
+
+// SelectKernels() fills the kernel table wherever it is called, which
+// only sees the declaration
+template void CRayWavefront::Deferred::Light<true>(CRayShade&, const CRay&, double, const CGrPoint&, int, bool);
+template void CRayWavefront::Deferred::Light<false>(CRayShade&, const CRay&, double, const CGrPoint&, int, bool);
+
+//
+// Name : CRayWavefront::IntersectShadows()
+// Description : Intersect the shadow ray queue and apply each
+// light that is not blocked.
+//
+
+void CRayWavefront::IntersectShadows()
+{
+    GR_PROFILE_ZONE("CRayWavefront::IntersectShadows");
+
+    for (size_t i = 0; i < m_shadows.size(); i++)
+    {
+        const Shadow& shadow = m_shadows[i];
+
+        if (!m_renderer->Occluded(shadow.ray, shadow.maxt, shadow.ignore))
+        {
+            Shade& shade = m_shades[shadow.shade];
+            shade.mul.MemberMultiply3(shadow.mul);
+            shade.add += shadow.add;
+        }
+    }
+}
+
+//
+// Name : CRayWavefront::CoherenceKey()
+// Description : Sort key for a secondary ray. The top 3 bits are the
+// direction octant, the low 30 bits interleave 10 bits each of the origin
+// position within the scene bounds (Morton order).
+//
+
+// Spread the low 10 bits of v so there are two zero bits between each
+static unsigned long long MortonSpread(unsigned long long v)
+{
+    v &= 0x3ff;
+    v = (v | (v << 16)) & 0x30000ff;
+    v = (v | (v << 8)) & 0x300f00f;
+    v = (v | (v << 4)) & 0x30c30c3;
+    v = (v | (v << 2)) & 0x9249249;
+    return v;
+}
+
+unsigned long long CRayWavefront::CoherenceKey(const CRay& p_ray) const
+{
+    const CGrPoint& lo = m_renderer->m_scene.min;
+    const CGrPoint& hi = m_renderer->m_scene.max;
+
+    unsigned long long octant = 0;
+    unsigned long long morton = 0;
+    for (int d = 0; d < 3; d++)
+    {
+        if (p_ray.Direction(d) < 0)
+            octant |= 1ull << d;
+
+        double extent = hi[d] - lo[d];
+        double f = extent > 0 ? (p_ray.Origin(d) - lo[d]) / extent : 0;
+        f = f < 0 ? 0 : (f > 1 ? 1 : f);
+        morton |= MortonSpread((unsigned long long)(f * 1023)) << d;
+    }
+
+    return (octant << 30) | morton;
+}
+
+//
+// Name : CRayWavefront::CoherenceSort()
+// Description : Reorder a ray queue by CoherenceKey().
+//
+
+template <class T> void CRayWavefront::CoherenceSort(std::vector<T>& p_queue, std::vector<T>& p_scratch)
+{
+    m_keys.resize(p_queue.size());
+    for (size_t i = 0; i < p_queue.size(); i++)
+    {
+        m_keys[i].first = CoherenceKey(p_queue[i].ray);
+        m_keys[i].second = int(i);
+    }
+
+    std::sort(m_keys.begin(), m_keys.end());
+
+    p_scratch.resize(p_queue.size());
+    for (size_t i = 0; i < m_keys.size(); i++)
+    {
+        p_scratch[i] = p_queue[m_keys[i].second];
+    }
+
+    p_queue.swap(p_scratch);
+}
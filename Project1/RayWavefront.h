@@ -0,0 +1,136 @@
+//
+// Name :         RayWavefront.h
+// Description :  Header for CRayWavefront, a breadth first ray tracing
+//                engine for CMyRaytraceRenderer. See RayWavefront.cpp
+//
+
+#pragma once
+#include "graphics/RayIntersection.h"
+#include "RayGeometry.h"
+#include "RayShading.h"
+#include <vector>
+
+class CGrMaterial;
+class CGrTexture;
+class CMyRaytraceRenderer;
+
+//
+// Instead of following one path at a time, the wavefront engine moves
+// all of the rays of a tile through each stage together:
+//
+// 1.  Intersect the whole ray queue
+// 2.  Sort the hits by shading kernel and material
+// 3.  Shade the hits, which emits a shadow ray queue and
+//     a reflection ray queue
+// 4.  Intersect the shadow ray queue and apply the lights
+// 5.  Repeat with the reflection ray queue
+//
+// Before the shadow and reflection queues are intersected they are sorted
+// by direction octant and then by the Morton order of the ray origin, so
+// neighboring rays in the queue walk the same part of the kd-tree.
+//
+// The result matches the depth first CMyRaytraceRenderer::RayColor().
+//
+
+class CRayWavefront
+{
+public:
+    CRayWavefront(CMyRaytraceRenderer* p_renderer);
+
+    // One primary ray through the image
+    struct Sample
+    {
+        int         r, c;           // Pixel
+        double      x, y;           // Image location in pixels
+        CGrPoint    color;          // Result
+    };
+
+    void Trace(std::vector<Sample>& p_samples);
+
+    // Choose the shading kernels once the light count is known
+    void SelectKernels(int p_lightcnt) { m_kernels.Select(p_lightcnt); }
+
+    // Sort shadow and reflection queues for coherent traversal
+    void SetCoherenceSort(bool s) { m_coherencesort = s; }
+    bool GetCoherenceSort() const { return m_coherencesort; }
+
+private:
+    // A ray waiting to be intersected
+    struct Ray
+    {
+        CRay        ray;
+        int         sample;         // Sample this ray contributes to
+        CGrPoint    weight;         // Path throughput, the ray color is scaled by this
+        int         recurse;
+        int         ignore;         // Primitive the ray leaves, -1 for none
+    };
+
+    // A ray that hit something
+    struct Hit
+    {
+        int         ray;            // Index into m_rays
+        CRayHit     hit;
+        int         features;       // Shading kernel
+        CGrMaterial* material;
+        CGrTexture* texture;
+    };
+
+    // The shading result of a hit before shadows are known. The final
+    // contribution is weight * (base * mul + add).
+    struct Shade : public CRayShade
+    {
+        int         sample;
+        CGrPoint    weight;
+    };
+
+    // A light that applies to a shade record if the shadow ray is clear
+    struct Shadow
+    {
+        CRay        ray;
+        double      maxt;
+        int         ignore;
+        int         shade;          // Index into m_shades
+        CGrPoint    mul;
+        CGrPoint    add;
+    };
+
+    // Wavefront visibility for the shading kernels: reflection
+    // and shadow rays are queued for later
+    class Deferred
+    {
+    public:
+        Deferred(CRayWavefront* p_wavefront, const Ray& p_ray, int p_primitive, int p_shade)
+            : m_wavefront(p_wavefront), m_ray(p_ray), m_primitive(p_primitive), m_shade(p_shade) {}
+
+        bool DirectLighting() const { return true; }
+        bool Reflect(CRayHit& p_hit, const CRay& p_ray, CGrPoint& p_base);
+        template <bool Multiply> void Light(CRayShade& p_shade, const CRay& p_shadow, double p_maxt, const CGrPoint& p_term, int p_light, bool p_cast);
+
+    private:
+        CRayWavefront*  m_wavefront;
+        const Ray&      m_ray;
+        int             m_primitive;    // The hit, ignored by the rays it spawns
+        int             m_shade;
+    };
+
+    void IntersectRays();
+    void ShadeHits();
+    void IntersectShadows();
+
+    unsigned long long CoherenceKey(const CRay& p_ray) const;
+    template <class T> void CoherenceSort(std::vector<T>& p_queue, std::vector<T>& p_scratch);
+
+    CMyRaytraceRenderer*    m_renderer;
+    CRayShadingTable<Deferred> m_kernels;
+
+    std::vector<Ray>        m_rays;
+    std::vector<Ray>        m_nextrays;
+    std::vector<Hit>        m_hits;
+    std::vector<Shade>      m_shades;
+    std::vector<Shadow>     m_shadows;
+
+    bool                    m_coherencesort;
+    std::vector<std::pair<unsigned long long, int> > m_keys;
+    std::vector<Ray>        m_rayscratch;
+    std::vector<Shadow>     m_shadowscratch;
+};
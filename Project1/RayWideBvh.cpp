@@ -0,0 +1,426 @@
+//
+// Name :         RayWideBvh.cpp
+// Description :  Implementation of CRayWideBvh. A node's polygons are
+//                split into up to four children by splitting the largest
+//                range at the median centroid on its longest axis, as
+//                CRayBvh splits, until there are four or every range fits
+//                in a leaf.
+//
+
+#include "pch.h"
+#include "RayWideBvh.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <emmintrin.h>
+
+const double CRayWideBvh::Padding = 1e-5;
+
+static_assert(sizeof(CRayWideBvh::Node) == CRayWideBvh::CacheLine, "a node must fill one cache line");
+
+CRayWideBvh::CRayWideBvh()
+{
+    m_nodes = NULL;
+    m_nodecnt = 0;
+}
+
+//
+// Name : CRayWideBvh::Build()
+// Description : Build the hierarchy from scratch, then copy the nodes to
+// cache line aligned memory.
+//
+
+void CRayWideBvh::Build(const CRayGeometry& p_geometry)
+{
+    m_geometry = &p_geometry;
+    m_nodes = NULL;
+    m_nodecnt = 0;
+
+    int primitivecnt = p_geometry.PrimitiveCnt();
+    m_primitives.resize(primitivecnt);
+
+    // Only needed while building
+    std::vector<Bounds> primbounds(primitivecnt);
+    std::vector<CGrPoint> centroids(primitivecnt);
+
+    double largest = 1;
+    for (int p = 0; p < primitivecnt; p++)
+    {
+        const CRayGeometry::Polygon& polygon = p_geometry.GetPolygon(p);
+        Bounds& bounds = primbounds[p];
+        for (int d = 0; d < 3; d++)
+        {
+            bounds.min[d] = 1e30;
+            bounds.max[d] = -1e30;
+        }
+
+        CGrPoint centroid(0, 0, 0);
+        for (int v = polygon.first; v < polygon.first + polygon.count; v++)
+        {
+            const CGrPoint& vertex = p_geometry.Vertex(v);
+            for (int d = 0; d < 3; d++)
+            {
+                bounds.min[d] = min(bounds.min[d], vertex[d]);
+                bounds.max[d] = max(bounds.max[d], vertex[d]);
+                largest = max(largest, fabs(vertex[d]));
+            }
+            centroid += vertex;
+        }
+
+        centroids[p] = polygon.count > 0 ? centroid / polygon.count : centroid;
+        m_primitives[p] = p;
+    }
+
+    // The float rounding of the ray and of the bounds grows with the
+    // size of the coordinates
+    double padding = Padding * largest;
+    for (int p = 0; p < primitivecnt; p++)
+    {
+        for (int d = 0; d < 3; d++)
+        {
+            primbounds[p].min[d] -= padding;
+            primbounds[p].max[d] += padding;
+        }
+    }
+
+    if (primitivecnt == 0)
+        return;
+
+    std::vector<Node> nodes;
+    nodes.reserve(primitivecnt / (LeafSize * (Width - 1)) + 1);
+    Partition(nodes, primbounds, centroids, 0, primitivecnt);
+
+    m_memory.resize((nodes.size() + 1) * sizeof(Node));
+    char* base = &m_memory[0];
+    base += (CacheLine - size_t(base) % CacheLine) % CacheLine;
+    memcpy(base, &nodes[0], nodes.size() * sizeof(Node));
+
+    m_nodes = reinterpret_cast<const Node*>(base);
+    m_nodecnt = int(nodes.size());
+}
+
+//
+// Name : CRayWideBvh::Partition()
+// Description : Make the node for a range of polygons and recurse into
+// the children that are too big to be leaves. Returns the node index.
+//
+
+int CRayWideBvh::Partition(std::vector<Node>& p_nodes, const std::vector<Bounds>& p_bounds,
+    const std::vector<CGrPoint>& p_centroids, int p_first, int p_count)
+{
+    int index = int(p_nodes.size());
+    p_nodes.push_back(Node());
+
+    int first[Width], count[Width];
+    first[0] = p_first;
+    count[0] = p_count;
+
+    int n = 1;
+    while (n < Width)
+    {
+        int largest = 0;
+        for (int i = 1; i < n; i++)
+        {
+            if (count[i] > count[largest])
+                largest = i;
+        }
+
+        if (count[largest] <= LeafSize)
+            break;
+
+        int half = Split(p_centroids, first[largest], count[largest]);
+        first[n] = first[largest] + half;
+        count[n] = count[largest] - half;
+        count[largest] = half;
+        n++;
+    }
+
+    Node node;
+    memset(&node, 0, sizeof(node));
+
+    Bounds children[Width];
+    Bounds bounds = RangeBounds(p_bounds, p_first, p_count);
+    for (int i = 0; i < n; i++)
+    {
+        children[i] = RangeBounds(p_bounds, first[i], count[i]);
+        node.mask |= 1 << i;
+
+        if (count[i] <= LeafSize)
+        {
+            node.child[i] = first[i];
+            node.count[i] = (unsigned char)count[i];
+        }
+        else
+        {
+            node.child[i] = Partition(p_nodes, p_bounds, p_centroids, first[i], count[i]);
+        }
+    }
+
+    Quantize(node, bounds, children, n);
+
+    // The recursion may have moved the nodes
+    p_nodes[index] = node;
+    return index;
+}
+
+CRayWideBvh::Bounds CRayWideBvh::RangeBounds(const std::vector<Bounds>& p_bounds, int p_first, int p_count) const
+{
+    Bounds bounds;
+    for (int d = 0; d < 3; d++)
+    {
+        bounds.min[d] = 1e30;
+        bounds.max[d] = -1e30;
+    }
+
+    for (int i = p_first; i < p_first + p_count; i++)
+    {
+        const Bounds& b = p_bounds[m_primitives[i]];
+        for (int d = 0; d < 3; d++)
+        {
+            bounds.min[d] = min(bounds.min[d], b.min[d]);
+            bounds.max[d] = max(bounds.max[d], b.max[d]);
+        }
+    }
+
+    return bounds;
+}
+
+//
+// Name : CRayWideBvh::Split()
+// Description : Order a range so the first half has the smaller centroids
+// on the longest axis. Returns the size of the first half.
+//
+
+int CRayWideBvh::Split(const std::vector<CGrPoint>& p_centroids, int p_first, int p_count)
+{
+    CGrPoint cmin(1e30, 1e30, 1e30);
+    CGrPoint cmax(-1e30, -1e30, -1e30);
+    for (int i = p_first; i < p_first + p_count; i++)
+    {
+        cmin.Minimize(p_centroids[m_primitives[i]]);
+        cmax.Maximize(p_centroids[m_primitives[i]]);
+    }
+
+    CGrPoint extent = cmax - cmin;
+    int axis = 0;
+    if (extent.Y() > extent.X())
+        axis = 1;
+    if (extent.Z() > extent[axis])
+        axis = 2;
+
+    int half = p_count / 2;
+    std::vector<int>::iterator begin = m_primitives.begin() + p_first;
+    std::nth_element(begin, begin + half, begin + p_count, [&p_centroids, axis](int a, int b) {
+        return p_centroids[a][axis] < p_centroids[b][axis];
+    });
+
+    return half;
+}
+
+//
+// Name : CRayWideBvh::Scale()
+// Description : 2^exponent, built from the bits of the float.
+//
+
+float CRayWideBvh::Scale(int p_exponent)
+{
+    unsigned int bits = unsigned(p_exponent + 127) << 23;
+    float scale;
+    memcpy(&scale, &bits, sizeof(scale));
+    return scale;
+}
+
+//
+// Name : CRayWideBvh::Quantize()
+// Description : Fit the grid to the node's bounds and round each child's
+// bounds out to it. The rounding is checked with the same float
+// arithmetic the traversal decodes with, so no child box shrinks.
+//
+
+void CRayWideBvh::Quantize(Node& p_node, const Bounds& p_parent, const Bounds* p_children, int p_count)
+{
+    for (int d = 0; d < 3; d++)
+    {
+        float origin = float(p_parent.min[d]);
+        if (double(origin) > p_parent.min[d])
+            origin = nextafterf(origin, -FLT_MAX);
+
+        // The smallest cell size that spans the node in 255 cells
+        double extent = p_parent.max[d] - origin;
+        int exponent = -126;
+        if (extent > 0)
+            exponent = max(-126, int(ceil(log2(extent / 255))));
+        while (exponent < 127 && double(origin + 255.f * Scale(exponent)) < p_parent.max[d])
+            exponent++;
+
+        p_node.origin[d] = origin;
+        p_node.exponent[d] = (signed char)exponent;
+
+        float scale = Scale(exponent);
+        for (int i = 0; i < p_count; i++)
+        {
+            int lo = int(floor((p_children[i].min[d] - origin) / scale));
+            lo = min(max(lo, 0), 255);
+            while (lo > 0 && double(origin + float(lo) * scale) > p_children[i].min[d])
+                lo--;
+
+            int hi = int(ceil((p_children[i].max[d] - origin) / scale));
+            hi = min(max(hi, 0), 255);
+            while (hi < 255 && double(origin + float(hi) * scale) < p_children[i].max[d])
+                hi++;
+
+            p_node.lo[d][i] = (unsigned char)lo;
+            p_node.hi[d][i] = (unsigned char)hi;
+        }
+    }
+}
+
+// Four bytes as four floats
+static inline __m128 Widen(const unsigned char* p_bytes)
+{
+    int packed;
+    memcpy(&packed, p_bytes, sizeof(packed));
+
+    const __m128i zero = _mm_setzero_si128();
+    __m128i words = _mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero);
+    return _mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero));
+}
+
+bool CRayWideBvh::Intersect(const CRay& p_ray, double p_maxt, int p_ignore, int& p_primitive, double& p_t, Counters* p_counters) const
+{
+    return Traverse<false>(p_ray, p_maxt, p_ignore, p_primitive, p_t, p_counters);
+}
+
+bool CRayWideBvh::Occluded(const CRay& p_ray, double p_maxt, int p_ignore, Counters* p_counters) const
+{
+    int primitive;
+    double t;
+    return Traverse<true>(p_ray, p_maxt, p_ignore, primitive, t, p_counters);
+}
+
+//
+// Name : CRayWideBvh::Traverse()
+// Description : Walk the tree, testing the four children of a node at
+// once and visiting the ones hit nearest first. An entry on the stack
+// whose box is entered beyond the nearest hit so far is skipped when it
+// is popped. With AnyHit the first hit ends the walk.
+//
+
+template <bool AnyHit>
+bool CRayWideBvh::Traverse(const CRay& p_ray, double p_maxt, int p_ignore, int& p_primitive, double& p_t, Counters* p_counters) const
+{
+    p_primitive = -1;
+    if (m_nodecnt == 0)
+        return false;
+
+    // The ray in single precision. A zero direction component gets a
+    // large inverse rather than infinity, so 0 * inverse is never NaN.
+    __m128 origin[3], inverse[3];
+    for (int d = 0; d < 3; d++)
+    {
+        double dir = p_ray.Direction(d);
+        origin[d] = _mm_set1_ps(float(p_ray.Origin(d)));
+        inverse[d] = _mm_set1_ps(fabs(dir) > 1e-30 ? float(1 / dir) : 1e30f);
+    }
+
+    struct Entry
+    {
+        int     child;
+        int     count;      // Polygons for a leaf, 0 for a node
+        float   t;          // Where the ray enters its box
+    };
+
+    // Median splits keep the tree balanced, so the depth is about
+    // log4 of the leaf count and at most Width - 1 entries are left
+    // behind per level
+    Entry stack[64];
+    int top = 0;
+    Entry root = { 0, 0, 0.f };
+    stack[top++] = root;
+
+    double nearest = p_maxt;
+    unsigned steps = 0, tests = 0;
+    while (top > 0)
+    {
+        const Entry entry = stack[--top];
+        if (entry.t > nearest)
+            continue;
+
+        if (entry.count > 0)
+        {
+            for (int i = entry.child; i < entry.child + entry.count; i++)
+            {
+                int primitive = m_primitives[i];
+                if (primitive == p_ignore)
+                    continue;
+
+                tests++;
+                double t;
+                if (m_geometry->IntersectPolygon(p_ray, primitive, nearest, t))
+                {
+                    nearest = t;
+                    p_primitive = primitive;
+                    if (AnyHit)
+                        break;
+                }
+            }
+
+            if (AnyHit && p_primitive >= 0)
+                break;
+            continue;
+        }
+
+        const Node& node = m_nodes[entry.child];
+        steps++;
+
+        __m128 tnear = _mm_setzero_ps();
+        __m128 tfar = _mm_set1_ps(float(min(nearest, 1e30)));
+        for (int d = 0; d < 3; d++)
+        {
+            __m128 base = _mm_set1_ps(node.origin[d]);
+            __m128 scale = _mm_set1_ps(Scale(node.exponent[d]));
+            __m128 lo = _mm_add_ps(base, _mm_mul_ps(Widen(node.lo[d]), scale));
+            __m128 hi = _mm_add_ps(base, _mm_mul_ps(Widen(node.hi[d]), scale));
+
+            __m128 t0 = _mm_mul_ps(_mm_sub_ps(lo, origin[d]), inverse[d]);
+            __m128 t1 = _mm_mul_ps(_mm_sub_ps(hi, origin[d]), inverse[d]);
+            tnear = _mm_max_ps(tnear, _mm_min_ps(t0, t1));
+            tfar = _mm_min_ps(tfar, _mm_max_ps(t0, t1));
+        }
+
+        int hits = _mm_movemask_ps(_mm_cmple_ps(tnear, tfar)) & node.mask;
+        if (hits == 0)
+            continue;
+
+        float t[Width];
+        _mm_storeu_ps(t, tnear);
+
+        // Sort the children hit farthest first, so the nearest is popped next
+        Entry children[Width];
+        int n = 0;
+        for (int i = 0; i < Width; i++)
+        {
+            if (!(hits & (1 << i)))
+                continue;
+
+            Entry child = { node.child[i], node.count[i], t[i] };
+            int j = n++;
+            for (; j > 0 && children[j - 1].t < child.t; j--)
+                children[j] = children[j - 1];
+            children[j] = child;
+        }
+
+        for (int i = 0; i < n; i++)
+            stack[top++] = children[i];
+    }
+
+    if (p_counters != NULL)
+    {
+        p_counters->steps += steps;
+        p_counters->tests += tests;
+    }
+
+    p_t = nearest;
+    return p_primitive >= 0;
+}
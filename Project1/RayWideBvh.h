@@ -0,0 +1,89 @@
+//
+// Name :         RayWideBvh.h
+// Description :  Header for CRayWideBvh, a four wide bounding volume
+//                hierarchy with child bounds quantized to 8 bits.
+//                See RayWideBvh.cpp
+//
+
+#pragma once
+#include "RayAccelerator.h"
+#include <vector>
+
+//
+// A CRayBvh node holds its bounds as doubles and has two children, so a
+// ray loads 72 bytes to cull two boxes and most of the time goes to
+// waiting on memory. Here each node is one 64 byte cache line holding
+// the bounds of four children. The bounds are stored as 8 bit offsets
+// on a grid over the node's own box, whose corner and power of two cell
+// size are kept in the node:
+//
+//     child min = origin + lo * 2^exponent   (rounded down to the grid)
+//     child max = origin + hi * 2^exponent   (rounded up to the grid)
+//
+// Decoded boxes always enclose the polygons, so a quantized box can only
+// be hit more often than the exact one, never less. All four children are
+// tested with one SSE slab test in single precision. The boxes are padded
+// (Padding, relative to the scene's coordinates) to cover the rounding of
+// the ray to float. Polygons are still intersected in double precision,
+// so the hits are the ones CRayBruteForce finds, except that of two
+// polygons hit at exactly the same distance either may be reported.
+//
+// Leaves are not nodes. A child slot either points at a node or holds a
+// range of up to LeafSize polygons, so the tree has about a third as many
+// nodes as a binary one with the same leaves. Unlike CRayBvh it is rebuilt
+// from scratch by every Build().
+//
+
+class CRayWideBvh : public CRayAccelerator
+{
+public:
+    CRayWideBvh();
+
+    static const int Width = 4;
+    static const int LeafSize = 4;
+    static const int CacheLine = 64;
+    static const double Padding;
+
+    struct Node
+    {
+        float           origin[3];      // Min corner of the quantization grid
+        signed char     exponent[3];    // Grid cell size along each axis is 2^exponent
+        unsigned char   mask;           // Child slots in use
+        unsigned char   lo[3][Width];   // Child bounds on the grid, by axis
+        unsigned char   hi[3][Width];
+        int             child[Width];   // Node index, or first of m_primitives for a leaf
+        unsigned char   count[Width];   // Polygons in a leaf, 0 for a node
+        int             reserved;
+    };
+
+    virtual const char* Name() const { return "Wide BVH"; }
+    virtual void Build(const CRayGeometry& p_geometry);
+    virtual bool Intersect(const CRay& p_ray, double p_maxt, int p_ignore, int& p_primitive, double& p_t, Counters* p_counters = NULL) const;
+    virtual bool Occluded(const CRay& p_ray, double p_maxt, int p_ignore, Counters* p_counters = NULL) const;
+
+    int NodeCnt() const { return m_nodecnt; }
+    size_t NodeBytes() const { return m_nodecnt * sizeof(Node); }
+
+private:
+    struct Bounds
+    {
+        double  min[3];
+        double  max[3];
+    };
+
+    template <bool AnyHit> bool Traverse(const CRay& p_ray, double p_maxt, int p_ignore, int& p_primitive, double& p_t, Counters* p_counters) const;
+
+    int Partition(std::vector<Node>& p_nodes, const std::vector<Bounds>& p_bounds,
+        const std::vector<CGrPoint>& p_centroids, int p_first, int p_count);
+    Bounds RangeBounds(const std::vector<Bounds>& p_bounds, int p_first, int p_count) const;
+    int Split(const std::vector<CGrPoint>& p_centroids, int p_first, int p_count);
+    static void Quantize(Node& p_node, const Bounds& p_parent, const Bounds* p_children, int p_count);
+    static float Scale(int p_exponent);
+
+    std::vector<int>    m_primitives;       // Primitive ids, in leaf order
+
+    // The nodes, the root first, aligned to a cache line in m_memory
+    std::vector<char>   m_memory;
+    const Node*         m_nodes;
+    int                 m_nodecnt;
+};
@@ -0,0 +1,146 @@
+//
+// Name :         GrBatches.cpp
+// Description :  Implementation of CGrBatches. Polygons are split into
+//                triangle fans and appended to the open batch for their
+//                material and texture. Polygons without normals get the
+//                face normal.
+//
+
+#include "pch.h"
+#include "GrBatches.h"
+
+#ifdef _DEBUG
+#undef THIS_FILE
+static char THIS_FILE[]=__FILE__;
+#define new DEBUG_NEW
+#endif
+
+using namespace std;
+
+CGrBatches::CGrBatches()
+{
+    m_root = NULL;
+    m_revision = 0;
+    m_triangles = 0;
+}
+
+CGrBatches::~CGrBatches()
+{
+}
+
+
+//
+// Name :         CGrBatches::Clear()
+// Description :  Discard all of the batches.
+//
+
+void CGrBatches::Clear()
+{
+    m_batches.clear();
+    m_open.clear();
+    m_root = NULL;
+    m_revision = 0;
+    m_triangles = 0;
+}
+
+
+//
+// Name :         CGrBatches::Begin()
+// Description :  Start collecting the polygons of a scene graph.
+//
+
+void CGrBatches::Begin(const CGrObject *p_root)
+{
+    Clear();
+    m_root = p_root;
+    m_revision = CGrObject::Revision();
+}
+
+
+//
+// Name :         CGrBatches::AddPolygon()
+// Description :  Add a polygon as a fan of triangles.  Normals and
+//                texture coordinates are used if there are enough.
+//
+
+void CGrBatches::AddPolygon(CGrMaterial *p_material, CGrTexture *p_texture, const vector<CGrPoint> &p_vertices,
+                            const vector<CGrPoint> &p_normals, const vector<CGrPoint> &p_texcoords)
+{
+    int cnt = int(p_vertices.size());
+    if(cnt < 3)
+        return;
+
+    bool normals = p_normals.size() >= p_vertices.size();
+    bool texcoords = p_texture != NULL && p_texcoords.size() >= p_vertices.size();
+
+    // Face normal by Newell's method
+    CGrPoint face(0, 0, 0, 0);
+    if(!normals)
+    {
+        for(int i=0;  i<cnt;  i++)
+        {
+            const CGrPoint &a = p_vertices[i];
+            const CGrPoint &b = p_vertices[(i + 1) % cnt];
+            face.X() += (a.Y() - b.Y()) * (a.Z() + b.Z());
+            face.Y() += (a.Z() - b.Z()) * (a.X() + b.X());
+            face.Z() += (a.X() - b.X()) * (a.Y() + b.Y());
+        }
+
+        if(face.Length3() > 0)
+            face.Normalize3();
+    }
+
+    pair<CGrMaterial *, CGrTexture *> key(p_material, p_texture);
+    map<pair<CGrMaterial *, CGrTexture *>, int>::iterator open = m_open.find(key);
+    if(open == m_open.end() || m_batches[open->second].VertexCnt() + 3 * (cnt - 2) > MaxBatchVertices)
+    {
+        m_batches.push_back(Batch());
+        m_batches.back().m_material = p_material;
+        m_batches.back().m_texture = p_texture;
+        m_open[key] = int(m_batches.size()) - 1;
+        open = m_open.find(key);
+    }
+
+    Batch &batch = m_batches[open->second];
+    CGrPoint zero(0, 0, 0);
+
+    for(int i=1;  i<cnt-1;  i++)
+    {
+        int tri[3] = {0, i, i + 1};
+        for(int j=0;  j<3;  j++)
+        {
+            int v = tri[j];
+            AddVertex(batch, p_vertices[v], normals ? p_normals[v] : face,
+                p_texture == NULL ? NULL : (texcoords ? &p_texcoords[v] : &zero));
+        }
+
+        m_triangles++;
+    }
+}
+
+
+void CGrBatches::AddVertex(Batch &p_batch, const CGrPoint &v, const CGrPoint &n, const CGrPoint *t)
+{
+    if(p_batch.m_vertices.empty())
+    {
+        p_batch.m_min = p_batch.m_max = v;
+    }
+    else
+    {
+        p_batch.m_min.Minimize(v);
+        p_batch.m_max.Maximize(v);
+    }
+
+    p_batch.m_vertices.push_back(float(v.X()));
+    p_batch.m_vertices.push_back(float(v.Y()));
+    p_batch.m_vertices.push_back(float(v.Z()));
+    p_batch.m_normals.push_back(float(n.X()));
+    p_batch.m_normals.push_back(float(n.Y()));
+    p_batch.m_normals.push_back(float(n.Z()));
+
+    if(t)
+    {
+        p_batch.m_texcoords.push_back(float(t->X()));
+        p_batch.m_texcoords.push_back(float(t->Y()));
+    }
+}
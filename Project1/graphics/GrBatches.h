@@ -0,0 +1,82 @@
+//
+// Name :         GrBatches.h
+// Description :  Header for CGrBatches, the polygons of a scene graph
+//                collected into triangle batches by material and texture.
+//                See GrBatches.cpp
+//
+
+#if !defined(_GRBATCHES_H)
+#define _GRBATCHES_H
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+#include "GrObject.h"
+#include "GrTexture.h"
+#include <map>
+#include <utility>
+#include <vector>
+
+//
+// To use:
+//
+// 1.  Call Begin() with the scene graph root, then AddPolygon()
+//     for every polygon with its vertices in world coordinates
+// 2.  Valid() stays true for that root until the scene graph
+//     changes (see CGrObject::Changed()), so the batches can be
+//     drawn again without visiting the scene graph
+//
+// Each batch holds references to its material and texture, so
+// they stay alive as long as the batches do.
+//
+
+class CGrBatches
+{
+public:
+    CGrBatches();
+    ~CGrBatches();
+
+    // Triangles that share a material and texture
+    struct Batch
+    {
+        CGrPtr<CGrMaterial> m_material;
+        CGrPtr<CGrTexture>  m_texture;
+        std::vector<float>  m_vertices;     // x, y, z for each vertex
+        std::vector<float>  m_normals;      // x, y, z for each vertex
+        std::vector<float>  m_texcoords;    // s, t for each vertex, textured only
+        CGrPoint            m_min;          // World bounds of the vertices
+        CGrPoint            m_max;
+
+        int VertexCnt() const {return int(m_vertices.size() / 3);}
+    };
+
+    // Batches are split when they grow past this, so parts
+    // of a large object can still be culled
+    static const int MaxBatchVertices = 3 * 16384;
+
+    void Clear();
+    void Begin(const CGrObject *p_root);
+    bool Valid(const CGrObject *p_root) const {return m_root != NULL && m_root == p_root && m_revision == CGrObject::Revision();}
+
+    void AddPolygon(CGrMaterial *p_material, CGrTexture *p_texture, const std::vector<CGrPoint> &p_vertices,
+        const std::vector<CGrPoint> &p_normals, const std::vector<CGrPoint> &p_texcoords);
+
+    int BatchCnt() const {return int(m_batches.size());}
+    const Batch &GetBatch(int n) const {return m_batches[n];}
+    int TriangleCnt() const {return m_triangles;}
+
+private:
+    void AddVertex(Batch &p_batch, const CGrPoint &v, const CGrPoint &n, const CGrPoint *t);
+
+    std::vector<Batch>  m_batches;
+
+    // Batch currently filling for each material and texture
+    std::map<std::pair<CGrMaterial *, CGrTexture *>, int> m_open;
+
+    const CGrObject *m_root;
+    unsigned    m_revision;
+    int         m_triangles;
+};
+
+#endif
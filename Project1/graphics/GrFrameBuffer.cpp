@@ -0,0 +1,244 @@
+//
+// Name :         GrFrameBuffer.cpp
+// Description :  Implementation of CGrFrameBuffer. Pixels accumulate
+//                floating point RGBA and a sample count. A separate resolve
+//                pass averages the samples, applies exposure and tone mapping
+//                and writes an 8 bit image. Only tiles that changed since the
+//                last resolve are processed.
+//
+
+#include "pch.h"
+#include "GrFrameBuffer.h"
+#include "GrProfiler.h"
+#include <algorithm>
+#include <cmath>
+#include <emmintrin.h>
+
+#ifdef _DEBUG
+#undef THIS_FILE
+static char THIS_FILE[]=__FILE__;
+#define new DEBUG_NEW
+#endif
+
+CGrFrameBuffer::CGrFrameBuffer()
+{
+    m_width = 0;
+    m_height = 0;
+    m_tilescols = 0;
+    m_tilesrows = 0;
+
+    // The defaults reproduce the original fixed conversion
+    // of the ray tracer: scale by 0.5 and clamp.
+    m_exposure = 0.5f;
+    m_tonemap = CLAMP;
+    m_srgb = false;
+
+    for(int i=0;  i<4096;  i++)
+    {
+        double v = i / 4095.;
+        double s = v <= 0.0031308 ? v * 12.92 : 1.055 * pow(v, 1. / 2.4) - 0.055;
+        m_srgblut[i] = BYTE(s * 255. + 0.5);
+    }
+}
+
+CGrFrameBuffer::~CGrFrameBuffer()
+{
+}
+
+
+//
+// Name :         CGrFrameBuffer::SetSize()
+// Description :  Allocate the buffer. All pixels are cleared.
+//
+
+void CGrFrameBuffer::SetSize(int p_width, int p_height)
+{
+    m_width = p_width;
+    m_height = p_height;
+    m_tilescols = (m_width + TileSize - 1) / TileSize;
+    m_tilesrows = (m_height + TileSize - 1) / TileSize;
+
+    m_rgba.resize(size_t(m_width) * m_height * 4);
+    m_count.resize(size_t(m_width) * m_height);
+    m_dirty.resize(size_t(m_tilescols) * m_tilesrows);
+    Clear();
+}
+
+void CGrFrameBuffer::Clear()
+{
+    std::fill(m_rgba.begin(), m_rgba.end(), 0.f);
+    std::fill(m_count.begin(), m_count.end(), 0);
+    DirtyAll();
+}
+
+void CGrFrameBuffer::DirtyAll()
+{
+    std::fill(m_dirty.begin(), m_dirty.end(), true);
+}
+
+
+//
+// Name :         CGrFrameBuffer::AddSample()
+// Description :  Accumulate one more sample into a pixel.
+//
+
+void CGrFrameBuffer::AddSample(int r, int c, const CGrPoint &p_color, float p_alpha)
+{
+    float *p = &m_rgba[(size_t(r) * m_width + c) * 4];
+    p[0] += float(p_color.X());
+    p[1] += float(p_color.Y());
+    p[2] += float(p_color.Z());
+    p[3] += p_alpha;
+    m_count[r * m_width + c]++;
+    Dirty(r, c);
+}
+
+
+//
+// Name :         CGrFrameBuffer::Fill()
+// Description :  Replace a block of pixels with a single sample. This is
+//                used for the coarse passes of progressive rendering,
+//                where one sample stands in for a block of pixels.
+//
+
+void CGrFrameBuffer::Fill(int r, int c, int rows, int cols, const CGrPoint &p_color, float p_alpha)
+{
+    int rend = r + rows < m_height ? r + rows : m_height;
+    int cend = c + cols < m_width ? c + cols : m_width;
+
+    for(int rr=r;  rr<rend;  rr++)
+    {
+        for(int cc=c;  cc<cend;  cc++)
+        {
+            float *p = &m_rgba[(size_t(rr) * m_width + cc) * 4];
+            p[0] = float(p_color.X());
+            p[1] = float(p_color.Y());
+            p[2] = float(p_color.Z());
+            p[3] = p_alpha;
+            m_count[rr * m_width + cc] = 1;
+        }
+
+        for(int cc=c;  cc<cend;  cc+=TileSize)
+            Dirty(rr, cc);
+        Dirty(rr, cend - 1);
+    }
+}
+
+
+//
+// Name :         CGrFrameBuffer::Pixel()
+// Description :  The average (unresolved) color of a pixel.
+//
+
+CGrPoint CGrFrameBuffer::Pixel(int r, int c) const
+{
+    int n = m_count[r * m_width + c];
+    if(n == 0)
+        return CGrPoint(0, 0, 0);
+
+    const float *p = &m_rgba[(size_t(r) * m_width + c) * 4];
+    return CGrPoint(p[0] / n, p[1] / n, p[2] / n, p[3] / n);
+}
+
+
+//
+// Name :         CGrFrameBuffer::Resolve()
+// Description :  Tone map every dirty tile into p_image, which
+//                is RGB, 3 bytes per pixel.
+//
+
+void CGrFrameBuffer::Resolve(BYTE **p_image)
+{
+    GR_PROFILE_ZONE("CGrFrameBuffer::Resolve");
+
+    for(int tr=0;  tr<m_tilesrows;  tr++)
+    {
+        for(int tc=0;  tc<m_tilescols;  tc++)
+        {
+            if(m_dirty[tr * m_tilescols + tc])
+            {
+                ResolveTile(tr, tc, p_image);
+                m_dirty[tr * m_tilescols + tc] = false;
+            }
+        }
+    }
+}
+
+
+//
+// Name :         CGrFrameBuffer::ResolveTile()
+// Description :  Resolve one tile. Each pixel is processed as
+//                one SSE vector of RGBA.
+//
+
+void CGrFrameBuffer::ResolveTile(int tr, int tc, BYTE **p_image) const
+{
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.f);
+    const __m128 scale = _mm_set1_ps(m_srgb ? 4095.f : 255.f);
+
+    // ACES filmic fit constants (Narkowicz)
+    const __m128 a = _mm_set1_ps(2.51f);
+    const __m128 b = _mm_set1_ps(0.03f);
+    const __m128 c = _mm_set1_ps(2.43f);
+    const __m128 d = _mm_set1_ps(0.59f);
+    const __m128 e = _mm_set1_ps(0.14f);
+
+    int r0 = tr * TileSize;
+    int c0 = tc * TileSize;
+    int rend = r0 + TileSize < m_height ? r0 + TileSize : m_height;
+    int cend = c0 + TileSize < m_width ? c0 + TileSize : m_width;
+
+    for(int r=r0;  r<rend;  r++)
+    {
+        const float *src = &m_rgba[(size_t(r) * m_width + c0) * 4];
+        const int *cnt = &m_count[r * m_width + c0];
+        BYTE *dst = p_image[r] + c0 * 3;
+
+        for(int col=c0;  col<cend;  col++, src+=4, cnt++, dst+=3)
+        {
+            __m128 v = _mm_loadu_ps(src);
+            float w = *cnt > 0 ? m_exposure / *cnt : 0.f;
+            v = _mm_mul_ps(v, _mm_set1_ps(w));
+            v = _mm_max_ps(v, zero);
+
+            switch(m_tonemap)
+            {
+            case REINHARD:
+                v = _mm_div_ps(v, _mm_add_ps(one, v));
+                break;
+
+            case ACES:
+                v = _mm_div_ps(_mm_mul_ps(v, _mm_add_ps(_mm_mul_ps(a, v), b)),
+                    _mm_add_ps(_mm_mul_ps(v, _mm_add_ps(_mm_mul_ps(c, v), d)), e));
+                break;
+
+            default:
+                break;
+            }
+
+            v = _mm_min_ps(v, one);
+
+            // Truncating conversion to integer, as the original conversion did
+            __m128i iv = _mm_cvttps_epi32(_mm_mul_ps(v, scale));
+
+            if(m_srgb)
+            {
+                int idx[4];
+                _mm_storeu_si128((__m128i *)idx, iv);
+                dst[0] = m_srgblut[idx[0]];
+                dst[1] = m_srgblut[idx[1]];
+                dst[2] = m_srgblut[idx[2]];
+            }
+            else
+            {
+                iv = _mm_packs_epi32(iv, iv);
+                iv = _mm_packus_epi16(iv, iv);
+                int rgba = _mm_cvtsi128_si32(iv);
+                dst[0] = BYTE(rgba);
+                dst[1] = BYTE(rgba >> 8);
+                dst[2] = BYTE(rgba >> 16);
+            }
+        }
+    }
+}
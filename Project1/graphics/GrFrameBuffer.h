@@ -0,0 +1,82 @@
+//
+// Name :         GrFrameBuffer.h
+// Description :  Header for CGrFrameBuffer, a floating point accumulation
+//                frame buffer with a tone mapping resolve pass.
+//                See GrFrameBuffer.cpp
+//
+
+#if !defined(_GRFRAMEBUFFER_H)
+#define _GRFRAMEBUFFER_H
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+#include "GrPoint.h"
+#include <vector>
+
+//
+// To use:
+//
+// 1.  Call SetSize() to allocate and clear the buffer
+// 2.  Call AddSample() to accumulate radiance into a pixel, or
+//     Fill() to replace a block of pixels with a single sample
+// 3.  Call Resolve() to tone map the pixels that changed since
+//     the last resolve into an 8 bit RGB image
+//
+// Rows are numbered from the bottom, the same as glDrawPixels.
+//
+
+class CGrFrameBuffer
+{
+public:
+    CGrFrameBuffer();
+    virtual ~CGrFrameBuffer();
+
+    enum ToneMap {CLAMP, REINHARD, ACES};
+
+    static const int TileSize = 32;
+
+    void SetSize(int p_width, int p_height);
+    void Clear();
+
+    int Width() const {return m_width;}
+    int Height() const {return m_height;}
+
+    void AddSample(int r, int c, const CGrPoint &p_color, float p_alpha=1.f);
+    void Fill(int r, int c, int rows, int cols, const CGrPoint &p_color, float p_alpha=1.f);
+
+    int SampleCount(int r, int c) const {return m_count[r * m_width + c];}
+    CGrPoint Pixel(int r, int c) const;
+
+    // Resolve parameters
+    void SetExposure(float e) {m_exposure = e;  DirtyAll();}
+    float GetExposure() const {return m_exposure;}
+    void SetToneMap(ToneMap t) {m_tonemap = t;  DirtyAll();}
+    ToneMap GetToneMap() const {return m_tonemap;}
+    void SetSRGB(bool s) {m_srgb = s;  DirtyAll();}
+    bool GetSRGB() const {return m_srgb;}
+
+    void DirtyAll();
+    void Resolve(BYTE **p_image);
+
+private:
+    void Dirty(int r, int c) {m_dirty[(r / TileSize) * m_tilescols + c / TileSize] = true;}
+    void ResolveTile(int tr, int tc, BYTE **p_image) const;
+
+    int     m_width;
+    int     m_height;
+    int     m_tilescols;
+    int     m_tilesrows;
+
+    std::vector<float>  m_rgba;     // Accumulated RGBA, 4 floats per pixel
+    std::vector<int>    m_count;    // Samples per pixel
+    std::vector<bool>   m_dirty;    // Tiles changed since the last resolve
+
+    float   m_exposure;
+    ToneMap m_tonemap;
+    bool    m_srgb;
+    BYTE    m_srgblut[4096];        // Linear [0,1] to sRGB encoded byte
+};
+
+#endif
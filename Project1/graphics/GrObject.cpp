@@ -23,6 +23,168 @@ using namespace std;
 
 CGrObject::~CGrObject() {}
 
+unsigned CGrObject::m_revision = 1;
+
+//
+// Name :         CGrObject::Bounds()
+// Description :  Bounding box of the object, computed only when
+//                something in the scene graph changed since the
+//                last time we asked.
+//
+
+bool CGrObject::Bounds(CGrPoint &p_min, CGrPoint &p_max)
+{
+    if(m_boundsrevision != m_revision)
+    {
+        m_hasbounds = ComputeBounds(m_min, m_max);
+        m_boundsrevision = m_revision;
+    }
+
+    p_min = m_min;
+    p_max = m_max;
+    return m_hasbounds;
+}
+
+
+//
+// Name :         CGrObject::SubtreeRevision()
+// Description :  The newest revision of this object or any object
+//                below it, computed only when something in the scene
+//                graph changed since the last time we asked.
+//
+
+unsigned CGrObject::SubtreeRevision()
+{
+    if(m_subtreecheck != m_revision)
+    {
+        m_subtreerevision = ComputeSubtreeRevision();
+        m_subtreecheck = m_revision;
+    }
+
+    return m_subtreerevision;
+}
+
+
+//
+// Name :         CGrObject::TransformBounds()
+// Description :  Replace a box with the box around its eight 
+//                corners after transformation.
+//
+
+void CGrObject::TransformBounds(const CGrTransform &p_transform, CGrPoint &p_min, CGrPoint &p_max)
+{
+    CGrPoint bmin, bmax;
+    for(int i=0;  i<8;  i++)
+    {
+        CGrPoint corner(i & 1 ? p_max.X() : p_min.X(),
+                        i & 2 ? p_max.Y() : p_min.Y(),
+                        i & 4 ? p_max.Z() : p_min.Z());
+        CGrPoint t = p_transform * corner;
+
+        if(i == 0)
+        {
+            bmin = bmax = t;
+        }
+        else
+        {
+            bmin.Minimize(t);
+            bmax.Maximize(t);
+        }
+    }
+
+    p_min = bmin;
+    p_max = bmax;
+}
+
+
+//
+// class CGrBoundsRenderer
+// A renderer that draws nothing, it only collects the box
+// around every vertex it is given.  Used for objects that
+// don't know their own geometry, like VRML.
+//
+
+class CGrBoundsRenderer : public CGrRenderer
+{
+public:
+    CGrBoundsRenderer() {m_any = false;  m_mstack.push_back(CGrTransform());  m_mstack.back().SetIdentity();}
+
+    bool Result(CGrPoint &p_min, CGrPoint &p_max) const {p_min = m_min;  p_max = m_max;  return m_any;}
+
+    virtual void RendererEndPolygon()
+    {
+        for(list<CGrPoint>::const_iterator i=PolyVertices().begin();  i!=PolyVertices().end();  i++)
+            Include(*i);
+    }
+
+    // Every corner of the sphere's box, so the box still holds it
+    // after a rotation
+    virtual void RendererSphere(const CGrPoint &center, double radius)
+    {
+        for(int i=0;  i<8;  i++)
+        {
+            Include(CGrPoint(center.X() + (i & 1 ? radius : -radius),
+                             center.Y() + (i & 2 ? radius : -radius),
+                             center.Z() + (i & 4 ? radius : -radius)));
+        }
+    }
+
+    virtual void RendererPushMatrix() {m_mstack.push_back(m_mstack.back());}
+    virtual void RendererPopMatrix() {m_mstack.pop_back();}
+
+    virtual void RendererRotate(double a, double x, double y, double z)
+    {
+        CGrTransform r;
+        r.SetRotate(a, CGrPoint(x, y, z));
+        m_mstack.back() *= r;
+    }
+
+    virtual void RendererTranslate(double x, double y, double z)
+    {
+        CGrTransform t;
+        t.SetTranslate(x, y, z);
+        m_mstack.back() *= t;
+    }
+
+    virtual void RendererTransform(const CGrTransform *p_transform) {m_mstack.back() *= *p_transform;}
+
+private:
+    void Include(const CGrPoint &v)
+    {
+        CGrPoint t = m_mstack.back() * v;
+        if(m_any)
+        {
+            m_min.Minimize(t);
+            m_max.Maximize(t);
+        }
+        else
+        {
+            m_min = m_max = t;
+            m_any = true;
+        }
+    }
+
+    std::list<CGrTransform> m_mstack;
+    bool     m_any;
+    CGrPoint m_min;
+    CGrPoint m_max;
+};
+
+
+//
+// Name :         CGrObject::ComputeBounds()
+// Description :  Default bounds computation.  The object is rendered
+//                through CGrBoundsRenderer.  Subclasses that know
+//                their geometry override this.
+//
+
+bool CGrObject::ComputeBounds(CGrPoint &p_min, CGrPoint &p_max)
+{
+    CGrBoundsRenderer bounds;
+    Render(&bounds);
+    return bounds.Result(p_min, p_max);
+}
+
 //////////////////////////////////////////////////////////////////////
 // CGrPolygon:  Polygon class
 //////////////////////////////////////////////////////////////////////
@@ -35,6 +197,7 @@ CGrPolygon::CGrPolygon()
 void CGrPolygon::Texture(CGrTexture *p_texture)
 {
     m_texture = p_texture;
+    Changed();
 }
 
 CGrPolygon::CGrPolygon(double *a, double *b, double *c, double *d)
@@ -48,6 +211,21 @@ CGrPolygon::CGrPolygon(double *a, double *b, double *c, double *d)
 
 CGrPolygon::~CGrPolygon() {}
 
+bool CGrPolygon::ComputeBounds(CGrPoint &p_min, CGrPoint &p_max)
+{
+    if(m_vertices.empty())
+        return false;
+
+    p_min = p_max = m_vertices.front();
+    for(list<CGrPoint>::const_iterator i=m_vertices.begin();  i!=m_vertices.end();  i++)
+    {
+        p_min.Minimize(*i);
+        p_max.Maximize(*i);
+    }
+
+    return true;
+}
+
 void CGrPolygon::AddVertices3(const double *a, const double *b, const double *c, bool p_computenormal)
 {
     m_vertices.push_back(CGrPoint(a[0], a[1], a[2]));
@@ -55,6 +233,7 @@ void CGrPolygon::AddVertices3(const double *a, const double *b, const double *c,
     m_vertices.push_back(CGrPoint(c[0], c[1], c[2]));
     if(p_computenormal)
         ComputeNormal();
+    Changed();
 }
 
 void CGrPolygon::AddVertices4(const double *a, const double *b, const double *c, const double *d, bool p_computenormal)
@@ -65,6 +244,7 @@ void CGrPolygon::AddVertices4(const double *a, const double *b, const double *c,
     m_vertices.push_back(CGrPoint(d[0], d[1], d[2]));
     if(p_computenormal)
         ComputeNormal();
+    Changed();
 }
 
 
@@ -111,6 +291,7 @@ void CGrPolygon::ComputeNormal()
 
     // Put into the list of normals
     m_normals.push_back(normal);
+    Changed();
 }
 
 
@@ -123,18 +304,21 @@ void CGrPolygon::AddTexVertex3d(double x, double y, double z, double s, double t
 {
     m_vertices.push_back(CGrPoint(x, y, z));
     m_tvertices.push_back(CGrPoint(s, t, 0));
+    Changed();
 }
 
 void CGrPolygon::AddNormal3d(double x, double y, double z)
 {
     m_normals.push_back(CGrPoint(x, y, z, 0));
     m_normals.back().Normalize3();
+    Changed();
 }
 
 void CGrPolygon::AddNormal3dv(double *p)
 {
     m_normals.push_back(CGrPoint(p[0], p[1], p[2], 0));
     m_normals.back().Normalize3();
+    Changed();
 }
 
 
@@ -296,6 +480,19 @@ void CGrColor::Render(CGrRenderer *p_renderer)
         m_child->Render(p_renderer);
 }
 
+bool CGrColor::ComputeBounds(CGrPoint &p_min, CGrPoint &p_max)
+{
+    return m_child && m_child->Bounds(p_min, p_max);
+}
+
+unsigned CGrColor::ComputeSubtreeRevision()
+{
+    unsigned revision = CGrObject::ComputeSubtreeRevision();
+    if(m_child)
+        revision = max(revision, m_child->SubtreeRevision());
+    return revision;
+}
+
 
 //////////////////////////////////////////////////////////////////////
 // CGrComposite:  Composite object class.
@@ -310,10 +507,65 @@ void CGrComposite::glRender()
 }
 
 
+//
+// Name :         CGrComposite::Render()
+// Description :  Render the children, skipping any the renderer
+//                can tell are not visible.
+//
+
 void CGrComposite::Render(CGrRenderer *p_renderer)
 {
     for(list<CGrPtr<CGrObject> >::iterator i=m_children.begin();  i!=m_children.end();  i++)
-        (*i)->Render(p_renderer);
+    {
+        if(p_renderer->RendererVisible(*i))
+            (*i)->Render(p_renderer);
+    }
+}
+
+
+//
+// Name :         CGrComposite::ComputeBounds()
+// Description :  Union of the bounds of the children.
+//
+
+bool CGrComposite::ComputeBounds(CGrPoint &p_min, CGrPoint &p_max)
+{
+    bool any = false;
+    for(list<CGrPtr<CGrObject> >::iterator i=m_children.begin();  i!=m_children.end();  i++)
+    {
+        CGrPoint cmin, cmax;
+        if(!(*i)->Bounds(cmin, cmax))
+            continue;
+
+        if(any)
+        {
+            p_min.Minimize(cmin);
+            p_max.Maximize(cmax);
+        }
+        else
+        {
+            p_min = cmin;
+            p_max = cmax;
+            any = true;
+        }
+    }
+
+    return any;
+}
+
+
+//
+// Name :         CGrComposite::ComputeSubtreeRevision()
+// Description :  Newest revision of the composite and its children.
+//
+
+unsigned CGrComposite::ComputeSubtreeRevision()
+{
+    unsigned revision = CGrObject::ComputeSubtreeRevision();
+    for(list<CGrPtr<CGrObject> >::iterator i=m_children.begin();  i!=m_children.end();  i++)
+        revision = max(revision, (*i)->SubtreeRevision());
+
+    return revision;
 }
 
 
@@ -346,6 +598,25 @@ void CGrTranslate::Render(CGrRenderer *p_renderer)
     }
 }
 
+bool CGrTranslate::ComputeBounds(CGrPoint &p_min, CGrPoint &p_max)
+{
+    if(!m_child || !m_child->Bounds(p_min, p_max))
+        return false;
+
+    CGrPoint t(m_x, m_y, m_z, 0);
+    p_min += t;
+    p_max += t;
+    return true;
+}
+
+unsigned CGrTranslate::ComputeSubtreeRevision()
+{
+    unsigned revision = CGrObject::ComputeSubtreeRevision();
+    if(m_child)
+        revision = max(revision, m_child->SubtreeRevision());
+    return revision;
+}
+
 //////////////////////////////////////////////////////////////////////
 // CGrSgTransform  Generic transformations
 //////////////////////////////////////////////////////////////////////
@@ -375,6 +646,23 @@ void CGrSgTransform::Render(CGrRenderer *p_renderer)
     }
 }
 
+bool CGrSgTransform::ComputeBounds(CGrPoint &p_min, CGrPoint &p_max)
+{
+    if(!m_child || !m_child->Bounds(p_min, p_max))
+        return false;
+
+    TransformBounds(*this, p_min, p_max);
+    return true;
+}
+
+unsigned CGrSgTransform::ComputeSubtreeRevision()
+{
+    unsigned revision = CGrObject::ComputeSubtreeRevision();
+    if(m_child)
+        revision = max(revision, m_child->SubtreeRevision());
+    return revision;
+}
+
 
 
 //////////////////////////////////////////////////////////////////////
@@ -406,6 +694,25 @@ void CGrRotate::Render(CGrRenderer *p_renderer)
     }
 }
 
+bool CGrRotate::ComputeBounds(CGrPoint &p_min, CGrPoint &p_max)
+{
+    if(!m_child || !m_child->Bounds(p_min, p_max))
+        return false;
+
+    CGrTransform r;
+    r.SetRotate(m_angle, CGrPoint(m_x, m_y, m_z));
+    TransformBounds(r, p_min, p_max);
+    return true;
+}
+
+unsigned CGrRotate::ComputeSubtreeRevision()
+{
+    unsigned revision = CGrObject::ComputeSubtreeRevision();
+    if(m_child)
+        revision = max(revision, m_child->SubtreeRevision());
+    return revision;
+}
+
 
 //////////////////////////////////////////////////////////////////////
 // CGrMaterial:  Sets material properties.
@@ -413,18 +720,18 @@ void CGrRotate::Render(CGrRenderer *p_renderer)
 
 CGrMaterial::CGrMaterial()
 {
-    Clear();
+    Reset();
 }
 
 CGrMaterial::CGrMaterial(float dr, float dg, float db, float da)
 {
-    Clear();
+    Reset();
     m_diffuse[0] = dr;  m_diffuse[1] = dg;  m_diffuse[2] = db;  m_diffuse[3] = da;
 }
 
 CGrMaterial::CGrMaterial(float dr, float dg, float db, CGrObject *p_child)
 {
-    Clear();
+    Reset();
     m_diffuse[0] = dr;  m_diffuse[1] = dg;  m_diffuse[2] = db;  m_diffuse[3] = 1.f;
 
     Child(p_child);
@@ -432,7 +739,7 @@ CGrMaterial::CGrMaterial(float dr, float dg, float db, CGrObject *p_child)
 
 CGrMaterial::CGrMaterial(float dr, float dg, float db, float sr, float sg, float sb)
 {
-    Clear();
+    Reset();
 
     m_diffuse[0] = dr; m_diffuse[1] = dg; m_diffuse[2] = db; m_diffuse[3] = 1.f;
     m_specular[0] = sr; m_specular[1] = sg; m_specular[2] = sb; m_specular[3] = 1.f;
@@ -440,7 +747,7 @@ CGrMaterial::CGrMaterial(float dr, float dg, float db, float sr, float sg, float
 
 CGrMaterial::CGrMaterial(float dr, float dg, float db, float sr, float sg, float sb, CGrObject *p_child)
 {
-    Clear();
+    Reset();
 
     m_diffuse[0] = dr; m_diffuse[1] = dg; m_diffuse[2] = db; m_diffuse[3] = 1.f;
     m_specular[0] = sr; m_specular[1] = sg; m_specular[2] = sb; m_specular[3] = 1.f;
@@ -452,6 +759,12 @@ CGrMaterial::CGrMaterial(float dr, float dg, float db, float sr, float sg, float
 CGrMaterial::~CGrMaterial() {}
 
 void CGrMaterial::Clear()
+{
+    Reset();
+    Changed();
+}
+
+void CGrMaterial::Reset()
 {
 	for(int c=0;  c<4;  c++)
 	{
@@ -462,6 +775,8 @@ void CGrMaterial::Clear()
 		m_emission[c] = 0.f;
 	}
 	m_shininess = 1.f;
+	m_castshadows = true;
+	m_receiveshadows = true;
 }
 
 
@@ -475,6 +790,7 @@ void CGrMaterial::AmbientDiffuseSpecularShininess(const float *a, const float *d
     }
 
     m_shininess = sh;
+    Changed();
 }
 
 
@@ -482,6 +798,7 @@ void CGrMaterial::Emissive(const float *e)
 {
     for(int i=0;  i<4;  i++)
         m_emission[i] = e[i];
+    Changed();
 }
 
 void CGrMaterial::glRender()
@@ -522,6 +839,19 @@ void CGrMaterial::Render(CGrRenderer *p_renderer)
     }
 }
 
+bool CGrMaterial::ComputeBounds(CGrPoint &p_min, CGrPoint &p_max)
+{
+    return m_child && m_child->Bounds(p_min, p_max);
+}
+
+unsigned CGrMaterial::ComputeSubtreeRevision()
+{
+    unsigned revision = CGrObject::ComputeSubtreeRevision();
+    if(m_child)
+        revision = max(revision, m_child->SubtreeRevision());
+    return revision;
+}
+
 
 //
 // Name :         CGrMaterial::Standard()
@@ -531,9 +861,15 @@ void CGrMaterial::Render(CGrRenderer *p_renderer)
 //
 
 void CGrMaterial::Standard(enum Standards s)
+{
+    Reset(s);
+    Changed();
+}
+
+void CGrMaterial::Reset(enum Standards s)
 {
     int c;
-    Clear();
+    Reset();
 
     switch(s)
     {
@@ -26,7 +26,9 @@ class CGrRenderer;
 class CGrObject  
 {
 public:
-    CGrObject() {m_refs = 0;}
+    // Making an object is not an edit.  Child() marks the parent
+    // changed when the object is put into the scene graph.
+    CGrObject() {m_refs = 0;  m_boundsrevision = 0;  m_hasbounds = false;  m_changed = m_revision;  m_subtreecheck = 0;  m_subtreerevision = 0;}
     virtual ~CGrObject();
 
     virtual void glRender() = 0;
@@ -36,8 +38,47 @@ public:
     void DecRef() {m_refs--;  if(m_refs == 0) {delete this;}}
     int  RefCnt() const {return m_refs;}
 
+    // Bounding box in the coordinate system the object is rendered
+    // in, including any transform of its own.  Cached until the scene
+    // graph changes.  Returns false if the object has no geometry.
+    bool Bounds(CGrPoint &p_min, CGrPoint &p_max);
+
+    // Any edit to the scene graph must call this on the object
+    // edited so cached information is recomputed.  The setters 
+    // do it for you.
+    void Changed() {m_changed = ++m_revision;}
+    static unsigned Revision() {return m_revision;}
+
+    // The revision of the last edit to this object alone
+    unsigned LastChanged() const {return m_changed;}
+
+    // The last revision in which this object or anything below
+    // it changed.  Renderers that keep what a subtree produced
+    // can tell from this it is still good.  Cached like the bounds.
+    unsigned SubtreeRevision();
+
+protected:
+    // Default: render through a renderer that collects the vertices
+    virtual bool ComputeBounds(CGrPoint &p_min, CGrPoint &p_max);
+
+    // Default: the object's own revision.  Objects with
+    // children include theirs.
+    virtual unsigned ComputeSubtreeRevision() {return m_changed;}
+
+    static void TransformBounds(const CGrTransform &p_transform, CGrPoint &p_min, CGrPoint &p_max);
+
 private:
     int   m_refs;
+
+    static unsigned m_revision;
+    unsigned m_boundsrevision;      // m_revision when the bounds were cached
+    bool     m_hasbounds;
+    CGrPoint m_min;
+    CGrPoint m_max;
+
+    unsigned m_changed;             // m_revision when this object was made or last edited
+    unsigned m_subtreecheck;        // m_revision when m_subtreerevision was cached
+    unsigned m_subtreerevision;
 };
 
 // class CGrPtr
@@ -74,13 +115,13 @@ public:
     virtual void glRender();
     void Render(CGrRenderer *p_renderer);
 
-    void AddVertex3d(double x, double y, double z) {m_vertices.push_back(CGrPoint(x, y, z));}
-    void AddVertex3dv(double *p) {m_vertices.push_back(CGrPoint(p[0], p[1], p[2]));}
+    void AddVertex3d(double x, double y, double z) {m_vertices.push_back(CGrPoint(x, y, z));  Changed();}
+    void AddVertex3dv(double *p) {m_vertices.push_back(CGrPoint(p[0], p[1], p[2]));  Changed();}
     void AddNormal3d(double x, double y, double z);
     void AddNormal3dv(double *p);
     void AddTexVertex3d(double x, double y, double z, double s, double t);
 
-    void AddTex2d(double s, double t) {m_tvertices.push_back(CGrPoint(s, t, 0));}
+    void AddTex2d(double s, double t) {m_tvertices.push_back(CGrPoint(s, t, 0));  Changed();}
 
     void AddVertices3(const double *a, const double *b, const double *c, bool p_computenormal=false);
     void AddVertices4(const double *a, const double *b, const double *c, const double *d, bool p_computenormal=false);
@@ -92,11 +133,14 @@ public:
     void Texture(CGrTexture *p_texture);
 
     void ComputeNormal();
-    void ClearNormals() {m_normals.clear();}
+    void ClearNormals() {m_normals.clear();  Changed();}
 
     // Access functions
     const std::list<CGrPoint> Normals() const {return m_normals;}
 
+protected:
+    virtual bool ComputeBounds(CGrPoint &p_min, CGrPoint &p_max);
+
 private:
     // A polygon is a list of vertices
     std::list<CGrPoint> m_vertices;     // The polygon vertices
@@ -123,7 +167,11 @@ public:
     virtual void glRender();
     virtual void Render(CGrRenderer *p_renderer);
 
-    void Child(CGrObject *p_child) {m_child = p_child;}
+    void Child(CGrObject *p_child) {m_child = p_child;  Changed();}
+
+protected:
+    virtual bool ComputeBounds(CGrPoint &p_min, CGrPoint &p_max);
+    virtual unsigned ComputeSubtreeRevision();
 
 private:
     double c[4];
@@ -142,7 +190,7 @@ public:
     virtual void glRender();
     virtual void Render(CGrRenderer *p_renderer);
 
-    void Child(CGrObject *p_child) {m_children.push_back(p_child);}
+    void Child(CGrObject *p_child) {m_children.push_back(p_child);  Changed();}
 
     void AddMappedRect(CGrTexture *p_texture, double x1, double y1, double x2, double y2, 
         double xd, double yd, double so, double to);
@@ -153,6 +201,10 @@ public:
     void Poly3(const CGrPoint &a, const CGrPoint &b, const CGrPoint &c, CGrTexture *p_texture=NULL);
     void Poly4(const CGrPoint &a, const CGrPoint &b, const CGrPoint &c, const CGrPoint &d, CGrTexture *p_texture=NULL);
 
+protected:
+    virtual bool ComputeBounds(CGrPoint &p_min, CGrPoint &p_max);
+    virtual unsigned ComputeSubtreeRevision();
+
 private:
     std::list<CGrPtr<CGrObject> > m_children;
 };
@@ -168,16 +220,20 @@ public:
     CGrTranslate(double x, double y, double z, CGrObject *p_child) {m_x=x;  m_y=y;  m_z=z;  m_child=p_child;}
     ~CGrTranslate();
 
-    void X(double x) {m_x = x;}
-    void Y(double y) {m_y = y;}
-    void Z(double z) {m_z = z;}
-    void Translate(double x, double y, double z) {m_x = x; m_y = y; m_z = z;}
-    void Translate(const CGrPoint p) {m_x = p.X();  m_y = p.Y();  m_z = p.Z();}
+    void X(double x) {m_x = x;  Changed();}
+    void Y(double y) {m_y = y;  Changed();}
+    void Z(double z) {m_z = z;  Changed();}
+    void Translate(double x, double y, double z) {m_x = x; m_y = y; m_z = z;  Changed();}
+    void Translate(const CGrPoint p) {m_x = p.X();  m_y = p.Y();  m_z = p.Z();  Changed();}
 
     virtual void glRender();
     virtual void Render(CGrRenderer *p_renderer);
 
-    void Child(CGrObject *p_child) {m_child = p_child;}
+    void Child(CGrObject *p_child) {m_child = p_child;  Changed();}
+
+protected:
+    virtual bool ComputeBounds(CGrPoint &p_min, CGrPoint &p_max);
+    virtual unsigned ComputeSubtreeRevision();
 
 private:
     CGrPtr<CGrObject> m_child;
@@ -196,8 +252,12 @@ public:
     virtual void glRender();
     virtual void Render(CGrRenderer *p_renderer);
 
-    void Child(CGrObject *p_child) {m_child = p_child;}
-    void Transform(const CGrTransform &p_tran) {CGrTransform::operator=(p_tran);}
+    void Child(CGrObject *p_child) {m_child = p_child;  Changed();}
+    void Transform(const CGrTransform &p_tran) {CGrTransform::operator=(p_tran);  Changed();}
+
+protected:
+    virtual bool ComputeBounds(CGrPoint &p_min, CGrPoint &p_max);
+    virtual unsigned ComputeSubtreeRevision();
 
 private:
     CGrPtr<CGrObject> m_child;
@@ -214,11 +274,15 @@ public:
     CGrRotate(double a, double x, double y, double z, CGrObject *p_child) {m_angle=a; m_x=x;  m_y=y;  m_z=z;  m_child=p_child;}
     ~CGrRotate();
 
-    void Angle(double a) {m_angle = a;}
+    void Angle(double a) {m_angle = a;  Changed();}
 
     virtual void glRender();
     virtual void Render(CGrRenderer *p_renderer);
-    void Child(CGrObject *p_child) {m_child = p_child;}
+    void Child(CGrObject *p_child) {m_child = p_child;  Changed();}
+
+protected:
+    virtual bool ComputeBounds(CGrPoint &p_min, CGrPoint &p_max);
+    virtual unsigned ComputeSubtreeRevision();
 
 private:
     CGrPtr<CGrObject> m_child;
@@ -241,34 +305,34 @@ public:
     CGrMaterial(float dr, float dg, float db, CGrObject *p_child);
     CGrMaterial(float dr, float dg, float db, float sr, float sg, float sb);
     CGrMaterial(float dr, float dg, float db, float sr, float sg, float sb, CGrObject *p_child);
-    CGrMaterial(Standards s) {Standard(s);}
-    CGrMaterial(Standards s, CGrObject *p_child) {Standard(s);  m_child = p_child;}
+    CGrMaterial(Standards s) {Reset(s);}
+    CGrMaterial(Standards s, CGrObject *p_child) {Reset(s);  m_child = p_child;}
     ~CGrMaterial();
 
     void glMaterial();
 
     virtual void glRender();
     virtual void Render(CGrRenderer *p_renderer);
-    void Child(CGrObject *p_child) {m_child = p_child;}
+    void Child(CGrObject *p_child) {m_child = p_child;  Changed();}
 
     void Standard(Standards s);
     void AmbientDiffuseSpecularShininess(const float *a, const float *d, const float *s, float sh);
     void Emissive(const float *e);
     void Diffuse(float r, float g, float b, float a=1.f) 
-    {m_diffuse[0] = r;  m_diffuse[1] = g;  m_diffuse[2] = b;  m_diffuse[3] = a;}
+    {m_diffuse[0] = r;  m_diffuse[1] = g;  m_diffuse[2] = b;  m_diffuse[3] = a;  Changed();}
     void Specular(float r, float g, float b, float a=1.f) 
-    {m_specular[0] = r;  m_specular[1] = g;  m_specular[2] = b;  m_specular[3] = a;}
+    {m_specular[0] = r;  m_specular[1] = g;  m_specular[2] = b;  m_specular[3] = a;  Changed();}
     void SpecularOther(float r, float g, float b, float a=1.f) 
-    {m_specularother[0] = r;  m_specularother[1] = g;  m_specularother[2] = b;  m_specularother[3] = a;}
+    {m_specularother[0] = r;  m_specularother[1] = g;  m_specularother[2] = b;  m_specularother[3] = a;  Changed();}
     void Ambient(float r, float g, float b, float a=1.f) 
-    {m_ambient[0] = r;  m_ambient[1] = g;  m_ambient[2] = b;  m_ambient[3] = a;}
+    {m_ambient[0] = r;  m_ambient[1] = g;  m_ambient[2] = b;  m_ambient[3] = a;  Changed();}
     void Emission(float r, float g, float b, float a=1.f) 
-    {m_emission[0] = r;  m_emission[1] = g;  m_emission[2] = b;  m_emission[3] = a;}
+    {m_emission[0] = r;  m_emission[1] = g;  m_emission[2] = b;  m_emission[3] = a;  Changed();}
     void Shininess(float s) 
-    {m_shininess = s;}
+    {m_shininess = s;  Changed();}
     void AmbientAndDiffuse(float r, float g, float b, float a=1.f) 
     {m_diffuse[0] = r;  m_diffuse[1] = g;  m_diffuse[2] = b;  m_diffuse[3] = a;
-    for(int c=0;  c<4;  c++) {m_ambient[c] = m_diffuse[c];}}
+    for(int c=0;  c<4;  c++) {m_ambient[c] = m_diffuse[c];}  Changed();}
 
     float Ambient(int i) const {return m_ambient[i];}
     const float *Ambient() const {return m_ambient;}
@@ -278,8 +342,24 @@ public:
     const float *Specular() const {return m_specular;}
     float Shininess() const {return m_shininess;}
     float SpecularOther(int i) const {return m_specularother[i];}
+    const float *Emission() const {return m_emission;}
+
+    // Shadow flags for the ray tracer
+    void CastShadows(bool c) {m_castshadows = c;  Changed();}
+    bool CastShadows() const {return m_castshadows;}
+    void ReceiveShadows(bool r) {m_receiveshadows = r;  Changed();}
+    bool ReceiveShadows() const {return m_receiveshadows;}
+
+protected:
+    virtual bool ComputeBounds(CGrPoint &p_min, CGrPoint &p_max);
+    virtual unsigned ComputeSubtreeRevision();
 
 private:
+    // Clear() and Standard() without marking the material changed,
+    // for the constructors
+    void Reset();
+    void Reset(Standards s);
+
     CGrPtr<CGrObject> m_child;
 
     float m_diffuse[4];
@@ -288,6 +368,8 @@ private:
     float m_ambient[4];
     float m_emission[4];
     float m_shininess;
+    bool  m_castshadows;
+    bool  m_receiveshadows;
 };
 
 
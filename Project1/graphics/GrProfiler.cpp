@@ -0,0 +1,235 @@
+//
+// Name :         GrProfiler.cpp
+// Description :  Implementation of CGrProfiler. Each thread is given a
+//                ring of events the first time it records. Rings are
+//                never freed, only handed to a new thread when the one
+//                using them exits, so worker threads that come and go
+//                each render reuse the same few rings.
+//
+
+#include "pch.h"
+#include "GrProfiler.h"
+#include <chrono>
+#include <fstream>
+#include <list>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#ifdef _DEBUG
+#undef THIS_FILE
+static char THIS_FILE[]=__FILE__;
+#define new DEBUG_NEW
+#endif
+
+using namespace std;
+
+std::atomic<bool> CGrProfiler::m_enabled(false);
+
+namespace
+{
+    struct Event
+    {
+        const char *name;
+        long long   time;       // Nanoseconds
+        char        phase;      // 'B' or 'E'
+    };
+
+    // The events of one thread at a time. The thread id in the trace
+    // belongs to the ring, so a worker that replaces one that exited
+    // continues on the same timeline.
+    struct Ring
+    {
+        vector<Event> events;
+        int     next;
+        bool    wrapped;
+        bool    inuse;
+        int     thread;
+        string  name;
+    };
+
+    mutex g_lock;
+    list<Ring> g_rings;                     // A list, so a Ring never moves
+
+    // The ring of the calling thread, returned when the thread exits
+    struct ThreadRing
+    {
+        ThreadRing() : ring(NULL) {}
+        ~ThreadRing()
+        {
+            if(ring != NULL)
+            {
+                lock_guard<mutex> guard(g_lock);
+                ring->inuse = false;
+            }
+        }
+
+        Ring *ring;
+    };
+
+    thread_local ThreadRing t_ring;
+
+    Ring *AcquireRing()
+    {
+        lock_guard<mutex> guard(g_lock);
+        for(list<Ring>::iterator r=g_rings.begin();  r!=g_rings.end();  r++)
+        {
+            if(!r->inuse)
+            {
+                r->inuse = true;
+                r->name.clear();
+                return &*r;
+            }
+        }
+
+        g_rings.push_back(Ring());
+        Ring &ring = g_rings.back();
+        ring.events.resize(CGrProfiler::RingSize);
+        ring.next = 0;
+        ring.wrapped = false;
+        ring.inuse = true;
+        ring.thread = int(g_rings.size());
+        return &ring;
+    }
+
+    void WriteString(ostream &str, const char *s)
+    {
+        str << '"';
+        for(;  *s;  s++)
+        {
+            if(*s == '"' || *s == '\\')
+                str << '\\';
+            str << *s;
+        }
+        str << '"';
+    }
+}
+
+
+//
+// Name :         CGrProfiler::Record()
+// Description :  Add an event to the calling thread's ring.
+//
+
+void CGrProfiler::Record(const char *p_name, char p_phase)
+{
+    ThreadRing &t = t_ring;
+    if(t.ring == NULL)
+        t.ring = AcquireRing();
+
+    Ring &ring = *t.ring;
+    Event &event = ring.events[ring.next];
+    event.name = p_name;
+    event.time = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+    event.phase = p_phase;
+
+    if(++ring.next == RingSize)
+    {
+        ring.next = 0;
+        ring.wrapped = true;
+    }
+}
+
+
+//
+// Name :         CGrProfiler::ThreadName()
+// Description :  Name the calling thread in the exported trace.
+//
+
+void CGrProfiler::ThreadName(const char *p_name)
+{
+    ThreadRing &t = t_ring;
+    if(t.ring == NULL)
+        t.ring = AcquireRing();
+
+    lock_guard<mutex> guard(g_lock);
+    t.ring->name = p_name;
+}
+
+
+//
+// Name :         CGrProfiler::Clear()
+// Description :  Discard all recorded events.
+//
+
+void CGrProfiler::Clear()
+{
+    lock_guard<mutex> guard(g_lock);
+    for(list<Ring>::iterator r=g_rings.begin();  r!=g_rings.end();  r++)
+    {
+        r->next = 0;
+        r->wrapped = false;
+    }
+}
+
+
+//
+// Name :         CGrProfiler::Export()
+// Description :  Write the recorded events as Chrome trace_event JSON.
+//                Times are in microseconds from the earliest event. A
+//                ring that wrapped may start with the end of a zone
+//                whose beginning was overwritten, those are skipped.
+//
+
+bool CGrProfiler::Export(const _TCHAR *p_filename)
+{
+    lock_guard<mutex> guard(g_lock);
+
+    ofstream str(p_filename);
+    if(!str)
+        return false;
+
+    // Time of the oldest event
+    long long start = 0;
+    bool first = true;
+    for(list<Ring>::iterator r=g_rings.begin();  r!=g_rings.end();  r++)
+    {
+        int oldest = r->wrapped ? r->next : 0;
+        if((r->wrapped || r->next > 0) && (first || r->events[oldest].time < start))
+        {
+            start = r->events[oldest].time;
+            first = false;
+        }
+    }
+
+    str << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    str.setf(ios::fixed);
+    str.precision(3);
+
+    const char *separator = "\n";
+    for(list<Ring>::iterator r=g_rings.begin();  r!=g_rings.end();  r++)
+    {
+        if(!r->name.empty())
+        {
+            str << separator << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << r->thread << ",\"args\":{\"name\":";
+            WriteString(str, r->name.c_str());
+            str << "}}";
+            separator = ",\n";
+        }
+
+        // Oldest first
+        int cnt = r->wrapped ? RingSize : r->next;
+        int oldest = r->wrapped ? r->next : 0;
+        int depth = 0;
+        for(int i=0;  i<cnt;  i++)
+        {
+            const Event &event = r->events[(oldest + i) % RingSize];
+
+            if(event.phase == 'B')
+                depth++;
+            else if(depth > 0)
+                depth--;
+            else
+                continue;
+
+            str << separator << "{\"name\":";
+            WriteString(str, event.name);
+            str << ",\"ph\":\"" << event.phase << "\",\"pid\":1,\"tid\":" << r->thread
+                << ",\"ts\":" << (event.time - start) / 1000. << "}";
+            separator = ",\n";
+        }
+    }
+
+    str << "\n]}\n";
+    return bool(str);
+}
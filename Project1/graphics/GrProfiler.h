@@ -0,0 +1,91 @@
+//
+// Name :         GrProfiler.h
+// Description :  Header for CGrProfiler, a scoped zone profiler that
+//                records begin/end events per thread and exports them
+//                as Chrome trace_event JSON.
+//                See GrProfiler.cpp
+//
+
+#if !defined(_GRPROFILER_H)
+#define _GRPROFILER_H
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+#include <atomic>
+
+//
+// To use:
+//
+// 1.  Put GR_PROFILE_ZONE("name") at the top of a scope. The zone
+//     ends when the scope does. Names must be string literals (only
+//     the pointer is kept). A zone records two events, so zones
+//     belong around passes, tiles and loads, not around each ray.
+// 2.  Call CGrProfiler::Enable(true) to start recording. Zones cost
+//     one test of a flag while recording is off.
+// 3.  Call CGrProfiler::Export() to write the events to a file that
+//     chrome://tracing or Perfetto (ui.perfetto.dev) can open.
+//
+// Each thread records into a ring buffer of its own, so recording
+// takes no locks. When a ring fills the oldest events are overwritten.
+// Export() and Clear() must not be called while other threads are
+// recording.
+//
+// Define GR_PROFILING as 0 in the project settings to compile the
+// zones out entirely.
+//
+
+#ifndef GR_PROFILING
+#define GR_PROFILING 1
+#endif
+
+class CGrProfiler
+{
+public:
+    // Events kept per thread (24 bytes each). A progressive ray trace
+    // of a 4K image is 12 passes over about 8000 frame buffer tiles, and
+    // the zones of one of those have to fit.
+    static const int RingSize = 1 << 18;
+
+    // Recording may be turned on or off while other threads record
+    static void Enable(bool p_enable) { m_enabled.store(p_enable, std::memory_order_relaxed); }
+    static bool Enabled() { return m_enabled.load(std::memory_order_relaxed); }
+
+    static void Begin(const char *p_name) { Record(p_name, 'B'); }
+    static void End(const char *p_name) { Record(p_name, 'E'); }
+
+    // Name the calling thread in the exported trace
+    static void ThreadName(const char *p_name);
+
+    static void Clear();
+    static bool Export(const _TCHAR *p_filename);
+
+    // A zone that lasts for the scope it is declared in
+    class Zone
+    {
+    public:
+        Zone(const char *p_name) : m_name(NULL) {if(Enabled()) {m_name = p_name;  Begin(p_name);}}
+        ~Zone() {if(m_name != NULL) End(m_name);}
+
+    private:
+        const char *m_name;
+    };
+
+private:
+    static void Record(const char *p_name, char p_phase);
+
+    static std::atomic<bool> m_enabled;
+};
+
+#if GR_PROFILING
+#define GR_PROFILE_CONCAT2(a, b) a##b
+#define GR_PROFILE_CONCAT(a, b) GR_PROFILE_CONCAT2(a, b)
+#define GR_PROFILE_ZONE(name) CGrProfiler::Zone GR_PROFILE_CONCAT(grprofilezone, __LINE__)(name)
+#define GR_PROFILE_THREAD(name) CGrProfiler::ThreadName(name)
+#else
+#define GR_PROFILE_ZONE(name)
+#define GR_PROFILE_THREAD(name)
+#endif
+
+#endif
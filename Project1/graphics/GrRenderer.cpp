@@ -10,6 +10,7 @@
 #include "pch.h"
 #include "GrRenderer.h"
 #include "GrTexture.h"
+#include "GrProfiler.h"
 
 #ifdef _DEBUG
 #undef THIS_FILE
@@ -67,11 +68,18 @@ void CGrRenderer::LookAt(double ex, double ey, double ez,
 
 bool CGrRenderer::Render(CGrPtr<CGrObject> &p_object)
 {
+    GR_PROFILE_ZONE("CGrRenderer::Render");
+
     // Do anything we need to do before we render.
     RendererStart();
 
-    // Do the actual rendering
-    p_object->Render(this);
+    // Do the actual rendering, unless the renderer 
+    // still has the scene from the last time
+    if(!RendererReplay(p_object))
+    {
+        GR_PROFILE_ZONE("CGrObject::Render");
+        p_object->Render(this);
+    }
 
     // Any cleanup?
     RendererEnd();
@@ -105,6 +113,35 @@ CGrRenderer::Light::Light()
       m_specular[i] = 0.f;
    }
 
+   m_castshadows = true;
+   m_range = 0;
+}
+
+//
+// Name :         CGrRenderer::Light::Illuminates()
+// Description :  Light linking test for a material. Surfaces
+//                without a material are lit unless there is
+//                an include list.
+//
+
+bool CGrRenderer::Light::Illuminates(const CGrMaterial *p_material) const
+{
+   for(std::vector<CGrMaterial *>::const_iterator i=m_exclude.begin();  i!=m_exclude.end();  i++)
+   {
+      if(*i == p_material)
+         return false;
+   }
+
+   if(m_include.empty())
+      return true;
+
+   for(std::vector<CGrMaterial *>::const_iterator i=m_include.begin();  i!=m_include.end();  i++)
+   {
+      if(*i == p_material)
+         return true;
+   }
+
+   return false;
 }
 
 //
@@ -224,3 +261,13 @@ void CGrRenderer::RendererSphere(const CGrPoint &center, double radius)
 void CGrRenderer::RendererNormalize(bool)
 {
 }
+
+bool CGrRenderer::RendererVisible(CGrObject *p_object)
+{
+   return true;
+}
+
+bool CGrRenderer::RendererReplay(CGrObject *p_object)
+{
+   return false;
+}
@@ -55,15 +55,40 @@ public:
     virtual void RendererSphere(const CGrPoint &center, double radius);
     virtual void RendererNormalize(bool);
 
+    // Asked by composites before rendering a child.  Returning
+    // false skips the child.  The default renders everything.
+    virtual bool RendererVisible(CGrObject *p_object);
+
+    // Called after RendererStart().  A renderer that kept what it
+    // needs from an earlier frame draws it and returns true, and
+    // the scene graph is not visited.  The default returns false.
+    virtual bool RendererReplay(CGrObject *p_object);
+
     // Information necessary to describe a light
     struct Light
     {
         Light();
 
+        // Does this light reach surfaces with this material?
+        bool Illuminates(const CGrMaterial *p_material) const;
+
         CGrPoint m_pos;      // Where be the light?
         float    m_ambient[4];
         float    m_diffuse[4];
         float    m_specular[4];
+        bool     m_castshadows;     // False if nothing blocks this light
+        double   m_range;           // Nothing farther away is lit, 0 for no limit
+
+        // Light linking. If m_include is not empty, only those materials
+        // are lit. Materials in m_exclude are never lit.
+        std::vector<CGrMaterial *> m_include;
+        std::vector<CGrMaterial *> m_exclude;
+
+        // Object linking, the same for scene graph objects and all that
+        // is below them. The objects must be children of a composite.
+        // Not every renderer supports this.
+        std::vector<CGrObject *> m_includeobjects;
+        std::vector<CGrObject *> m_excludeobjects;
     };
 
     // Parameter access functions
@@ -76,6 +101,7 @@ public:
     const CGrPoint &Up() const {return m_up;}
     int LightCnt() const {return int(m_lights.size());}
     const Light &GetLight(int n) const {return m_lights[n];}
+    Light &GetLight(int n) {return m_lights[n];}
     CGrTexture *PolyTexture() {return m_texture;}
     const std::list<CGrPoint> &PolyVertices() const {return m_polyvertex;}
     const std::list<CGrPoint> &PolyNormals() const {return m_polynormal;}
@@ -19,6 +19,7 @@
 #include <gl/glu.h>
 
 #include "GrTexture.h"
+#include "GrProfiler.h"
 
 using namespace std;
 
@@ -261,6 +262,8 @@ bool CGrTexture::LoadMemory(const BYTE *image,
                             bool repeatS, bool repeatT, 
                             bool transparency)
 {
+    GR_PROFILE_ZONE("CGrTexture::LoadMemory");
+
     // Extract information from the header
     SetSize(width, height);
 
@@ -329,6 +332,8 @@ bool CGrTexture::LoadMemory(const BYTE *image,
 
 bool CGrTexture::LoadFile(const _TCHAR *pFilename)
 {
+    GR_PROFILE_ZONE("CGrTexture::LoadFile");
+
     string filename;
 
 #ifdef UNICODE
@@ -14,6 +14,7 @@
 #include "GrVRMLFactory.h"
 #include "GrRenderer.h"
 #include "GrTexture.h"
+#include "GrProfiler.h"
 
 using namespace std;
 
@@ -63,12 +64,18 @@ bool CGrVRMLFactory::Load(const char *p_file)
 CGrVRML::CGrVRML()
 {
     m_texture = -1;
+    m_material = 0;
 }
 
 CGrVRML::~CGrVRML() {}
 
 bool CGrVRML::Load(const char *p_file)
 {
+    GR_PROFILE_ZONE("CGrVRML::Load");
+
+    Changed();
+    m_textureCache.clear();
+    m_materials.clear();
     return m_vrml.FileLoad(p_file);
 }
 
@@ -90,12 +97,30 @@ void CGrVRML::Render(CGrRenderer *p_renderer)
                                     // callbacks from the VRML renderer.
     m_texture = -1;                 // No current texture
 
-    // Clear the list of materials
-    m_materials.clear();
+    // The materials are made on the first render and kept 
+    // until the next Load(), like the textures.
+    m_material = 0;
 
-    // Before we render, we create a texture cache that 
+    // The first time we render, we create a texture cache that 
     // makes a local texture object from those in the 
-    // VRML object.
+    // VRML object.  It is kept until the next Load(), so 
+    // the textures are not created again every frame.
+    if(int(m_textureCache.size()) != m_vrml.GetTextureCount())
+        BuildTextureCache();
+
+    m_vrml.Render(this);
+}
+
+
+//
+// Name :         CGrVRML::BuildTextureCache()
+// Description :  Make a CGrTexture for each texture of the VRML object.
+//
+
+void CGrVRML::BuildTextureCache()
+{
+    GR_PROFILE_ZONE("CGrVRML::BuildTextureCache");
+
     m_textureCache.clear();
     for(int i=0;  i<m_vrml.GetTextureCount();  i++)
     {
@@ -112,8 +137,6 @@ void CGrVRML::Render(CGrRenderer *p_renderer)
 
         m_textureCache.push_back(texture);
     }
-
-    m_vrml.Render(this);
 }
 
 
@@ -204,6 +227,13 @@ void CGrVRML::MultMatrix(const double *m)
 void CGrVRML::Material(const float *ambient, const float *diffuse, const float *specular, 
               const float *emissive, float shininess)
 {
+    // Same material as the last render?
+    if(m_material < int(m_materials.size()))
+    {
+        m_renderer->RendererMaterial(m_materials[m_material++]);
+        return;
+    }
+
     // Create a material node
     CGrPtr<CGrMaterial> mat = new CGrMaterial;
 
@@ -212,6 +242,7 @@ void CGrVRML::Material(const float *ambient, const float *diffuse, const float *
     // to what the material object actually contains.  So, we keep a pointer to it
     // in this scene graph node as well.
     m_materials.push_back(mat);
+    m_material++;
 
     mat->AmbientDiffuseSpecularShininess(ambient, diffuse, specular, shininess);
 
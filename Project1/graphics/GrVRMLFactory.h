@@ -3,6 +3,8 @@
 // Description :  Header for CGrVRMLFactory
 //                Object File Format (VRML) file loader.
 // Author :       Charles B. Owen
+// Note :         Not compiled into Project1.  It still includes 
+//                stdafx.h, and libvrml is only built for 32 bit.
 //
 
 #if !defined(GRVRMLFACTOR_H)
@@ -34,6 +36,8 @@ public:
     bool Load(const char *p_file);
 
 private:
+    void BuildTextureCache();
+
     // These are the renderer callback functions from the VRML library
     virtual void PolygonBegin();
     virtual void PolygonEnd();
@@ -52,6 +56,7 @@ private:
     CVRML        m_vrml;        // The underlying actual VRML object
     CGrRenderer *m_renderer;    // Current renderer
     int          m_texture;     // Current texture
+    int          m_material;    // Next material in m_materials
     std::vector<CGrPtr<CGrTexture> > m_textureCache;
     std::vector<CGrPtr<CGrMaterial> > m_materials;
 };
@@ -30,7 +30,12 @@ static char THIS_FILE[]=__FILE__;
 
 COpenGLRenderer::COpenGLRenderer()
 {
-
+   m_culling = true;
+   m_culled = 0;
+   m_batches = NULL;
+   m_capturing = false;
+   m_material = NULL;
+   m_normalvalid = false;
 }
 
 COpenGLRenderer::~COpenGLRenderer()
@@ -82,6 +87,17 @@ bool COpenGLRenderer::RendererStart()
              Center().X(), Center().Y(), Center().Z(), 
              Up().X(), Up().Y(), Up().Z());
 
+   m_view.SetLookAt(Eye().X(), Eye().Y(), Eye().Z(), 
+                    Center().X(), Center().Y(), Center().Z(), 
+                    Up().X(), Up().Y(), Up().Z());
+   m_mstack.clear();
+   m_mstack.push_back(CGrTransform());
+   m_mstack.back().SetIdentity();
+   m_normalvalid = false;
+   m_culled = 0;
+   m_capturing = false;
+   m_material = NULL;
+
    // Enable lighting
    glEnable(GL_LIGHTING);
 
@@ -111,11 +127,98 @@ bool COpenGLRenderer::RendererStart()
 
 bool COpenGLRenderer::RendererEnd()
 {
+   // Batches collected this frame are drawn now
+   if(m_capturing)
+   {
+      m_capturing = false;
+      DrawBatches();
+   }
+
    glFlush();
    return true;
 }
 
 
+//
+// Name :         COpenGLRenderer::RendererReplay()
+// Description :  Draw the batches if they are still good for this
+//                scene graph.  Otherwise start collecting new ones.
+//
+
+bool COpenGLRenderer::RendererReplay(CGrObject *p_object)
+{
+   if(m_batches == NULL)
+      return false;
+
+   if(m_batches->Valid(p_object))
+   {
+      DrawBatches();
+      return true;
+   }
+
+   m_batches->Begin(p_object);
+   m_capturing = true;
+   return false;
+}
+
+
+//
+// Name :         COpenGLRenderer::DrawBatches()
+// Description :  One glDrawArrays for each batch that is not 
+//                outside the view frustum.  The vertices are in
+//                world coordinates, so only the camera is on the
+//                modelview stack.
+//
+
+void COpenGLRenderer::DrawBatches()
+{
+   glEnableClientState(GL_VERTEX_ARRAY);
+   glEnableClientState(GL_NORMAL_ARRAY);
+
+   CGrMaterial *material = NULL;
+   for(int i=0;  i<m_batches->BatchCnt();  i++)
+   {
+      const CGrBatches::Batch &batch = m_batches->GetBatch(i);
+      if(batch.VertexCnt() == 0)
+         continue;
+
+      if(m_culling && Outside(m_view, batch.m_min, batch.m_max))
+      {
+         m_culled++;
+         continue;
+      }
+
+      if(batch.m_material != NULL && batch.m_material != material)
+      {
+         material = batch.m_material;
+         material->glMaterial();
+      }
+
+      if(batch.m_texture != NULL)
+      {
+         glEnable(GL_TEXTURE_2D);
+         glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+         glBindTexture(GL_TEXTURE_2D, batch.m_texture->TexName());
+         glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+         glTexCoordPointer(2, GL_FLOAT, 0, &batch.m_texcoords[0]);
+      }
+
+      glVertexPointer(3, GL_FLOAT, 0, &batch.m_vertices[0]);
+      glNormalPointer(GL_FLOAT, 0, &batch.m_normals[0]);
+      glDrawArrays(GL_TRIANGLES, 0, batch.VertexCnt());
+
+      if(batch.m_texture != NULL)
+      {
+         glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+         glDisable(GL_TEXTURE_2D);
+      }
+   }
+
+   glDisableClientState(GL_NORMAL_ARRAY);
+   glDisableClientState(GL_VERTEX_ARRAY);
+}
+
+
 //
 // Name :         COpenGLRenderer::RendererEndPolygon()
 // Description :  End definition of a polygon.  The superclass has
@@ -127,6 +230,30 @@ void COpenGLRenderer::RendererEndPolygon()
    const list<CGrPoint> &normals = PolyNormals();
    const list<CGrPoint> &tvertices = PolyTexVertices();
 
+   if(m_capturing)
+   {
+      const CGrTransform &model = m_mstack.back();
+
+      m_polyvertices.clear();
+      m_polynormals.clear();
+      m_polytexcoords.clear();
+
+      for(list<CGrPoint>::const_iterator i=vertices.begin();  i!=vertices.end();  i++)
+         m_polyvertices.push_back(model * *i);
+
+      for(list<CGrPoint>::const_iterator i=normals.begin();  i!=normals.end();  i++)
+      {
+         CGrPoint n = NormalMatrix() * *i;
+         n.Normalize3();
+         m_polynormals.push_back(n);
+      }
+
+      m_polytexcoords.assign(tvertices.begin(), tvertices.end());
+
+      m_batches->AddPolygon(m_material, PolyTexture(), m_polyvertices, m_polynormals, m_polytexcoords);
+      return;
+   }
+
    if(PolyTexture())
    {
       glEnable(GL_TEXTURE_2D);
@@ -169,34 +296,138 @@ void COpenGLRenderer::RendererEndPolygon()
 void COpenGLRenderer::RendererPushMatrix()
 {
    glPushMatrix();
+   m_mstack.push_back(m_mstack.back());
 }
 
 void COpenGLRenderer::RendererPopMatrix()
 {
    glPopMatrix();
+   m_mstack.pop_back();
+   m_normalvalid = false;
 }
 
 void COpenGLRenderer::RendererRotate(double a, double x, double y, double z)
 {
    glRotated(a, x, y, z);
+
+   CGrTransform r;
+   r.SetRotate(a, CGrPoint(x, y, z));
+   m_mstack.back() *= r;
+   m_normalvalid = false;
 }
 
 void COpenGLRenderer::RendererTranslate(double x, double y, double z)
 {
     glTranslated(x, y, z);
+
+    CGrTransform t;
+    t.SetTranslate(x, y, z);
+    m_mstack.back() *= t;
 }
 
 
 void COpenGLRenderer::RendererTransform(const CGrTransform *p_transform)
 {
    p_transform->glMultMatrix();
+   m_mstack.back() *= *p_transform;
+   m_normalvalid = false;
+}
+
+
+//
+// Name :         COpenGLRenderer::NormalMatrix()
+// Description :  The matrix that takes normals to world coordinates,
+//                the inverse transpose of the model matrix.
+//
+
+const CGrTransform &COpenGLRenderer::NormalMatrix()
+{
+   if(!m_normalvalid)
+   {
+      m_normalmatrix.SetAffineInverse(m_mstack.back());
+      m_normalmatrix.Transpose();
+      m_normalvalid = true;
+   }
+
+   return m_normalmatrix;
+}
+
+
+//
+// Name :         COpenGLRenderer::RendererVisible()
+// Description :  Test the bounds of an object against the view 
+//                frustum.  While batches are collected everything
+//                is visible, the batches are culled when drawn.
+//
+
+bool COpenGLRenderer::RendererVisible(CGrObject *p_object)
+{
+   CGrPoint bmin, bmax;
+   if(!m_culling || m_capturing || m_mstack.empty() || !p_object->Bounds(bmin, bmax))
+      return true;
+
+   if(Outside(m_view * m_mstack.back(), bmin, bmax))
+   {
+      m_culled++;
+      return false;
+   }
+
+   return true;
+}
+
+
+//
+// Name :         COpenGLRenderer::Outside()
+// Description :  The eight corners of a box are taken to eye 
+//                coordinates, where the camera looks down -z.  The
+//                box is outside only if all of the corners are
+//                outside the same plane, so this is conservative.
+//
+
+bool COpenGLRenderer::Outside(const CGrTransform &p_toeye, const CGrPoint &p_min, const CGrPoint &p_max) const
+{
+   double ty = tan(ProjectionAngle() / 2 * GR_DTOR);
+   double tx = ty * ProjectionAspect();
+
+   // Bit for each plane: near, far, left, right, bottom, top.
+   // Starts with all set and is cleared by any corner inside.
+   int outside = 0x3f;
+   for(int i=0;  i<8 && outside;  i++)
+   {
+      CGrPoint corner(i & 1 ? p_max.X() : p_min.X(),
+                      i & 2 ? p_max.Y() : p_min.Y(),
+                      i & 4 ? p_max.Z() : p_min.Z());
+      CGrPoint e = p_toeye * corner;
+      double d = -e.Z();      // Distance in front of the eye
+
+      int out = 0;
+      if(d < NearClip())
+         out |= 1;
+      if(d > FarClip())
+         out |= 2;
+      if(e.X() < -d * tx)
+         out |= 4;
+      if(e.X() > d * tx)
+         out |= 8;
+      if(e.Y() < -d * ty)
+         out |= 16;
+      if(e.Y() > d * ty)
+         out |= 32;
+
+      outside &= out;
+   }
+
+   return outside != 0;
 }
 
 void COpenGLRenderer::RendererMaterial(CGrMaterial *p_material)
 {
-   p_material->glMaterial();
+   m_material = p_material;
+   if(!m_capturing)
+      p_material->glMaterial();
 }
 
+// Colors only matter with lighting off, so batches don't keep them
 void COpenGLRenderer::RendererColor(double *c)
 {
    glColor4dv(c);
@@ -14,6 +14,9 @@
 #endif // _MSC_VER > 1000
 
 #include "GrRenderer.h"
+#include "GrBatches.h"
+#include <list>
+#include <vector>
 
 class COpenGLRenderer : public CGrRenderer  
 {
@@ -31,7 +34,47 @@ public:
     virtual void RendererRotate(double a, double x, double y, double z);
     virtual void RendererPopMatrix();
     virtual void RendererPushMatrix();
+    virtual bool RendererVisible(CGrObject *p_object);
+    virtual bool RendererReplay(CGrObject *p_object);
 
+    // View frustum culling of scene graph subtrees using
+    // the cached object bounds.  On by default.
+    void SetCulling(bool p_culling) {m_culling = p_culling;}
+    bool GetCulling() const {return m_culling;}
+
+    // Objects and batches culled during the last render
+    int CulledCnt() const {return m_culled;}
+
+    // Polygons are collected into triangle batches by material and
+    // texture and drawn with vertex arrays, one draw call a batch.
+    // The batches are kept until the scene graph changes, so later
+    // frames don't visit it at all.  NULL draws each polygon as 
+    // it is rendered.
+    void SetBatches(CGrBatches *p_batches) {m_batches = p_batches;}
+
+private:
+    bool Outside(const CGrTransform &p_toeye, const CGrPoint &p_min, const CGrPoint &p_max) const;
+    const CGrTransform &NormalMatrix();
+    void DrawBatches();
+
+    // Copy of the OpenGL modelview stack without the camera, so we
+    // can take bounds and vertices to world coordinates ourselves
+    std::list<CGrTransform> m_mstack;
+    CGrTransform m_view;            // The LookAt matrix
+
+    bool    m_culling;
+    int     m_culled;
+
+    CGrBatches  *m_batches;
+    bool        m_capturing;        // Polygons go to m_batches
+    CGrMaterial *m_material;        // Current material
+    CGrTransform m_normalmatrix;    // Inverse transpose of m_mstack.back()
+    bool        m_normalvalid;
+
+    // World coordinate polygon, reused for each polygon
+    std::vector<CGrPoint> m_polyvertices;
+    std::vector<CGrPoint> m_polynormals;
+    std::vector<CGrPoint> m_polytexcoords;
 };
 
 #endif // !defined(AFX_OPENGLRENDERER_H__96078397_F350_4485_A87E_94051B49266B__INCLUDED_)
@@ -7,13 +7,36 @@
 #define IDR_MAINFRAME                   128
 #define IDR_Project1TYPE                130
 #define ID_RENDER_RAYTRACE              32771
+#define ID_RENDER_PROGRESSIVE           32772
+#define ID_RENDER_WAVEFRONT             32773
+#define ID_RENDER_RESERVOIRS            32774
+#define ID_RENDER_RELIGHTCACHE          32775
+#define ID_RENDER_BVH                   32776
+#define ID_RENDER_RASTER                32777
+#define ID_RENDER_HYBRID                32778
+#define ID_RENDER_PROFILE               32779
+#define ID_RENDER_SAVEPROFILE           32780
+#define ID_RENDER_COSTS                 32781
+#define ID_RENDER_SAVECOSTS             32782
+#define ID_RENDER_BENCHMARKS            32783
+#define ID_RENDER_REGRESSION            32784
+#define ID_RENDER_RECORDREGRESSION      32785
+#define ID_RENDER_KDTUNE                32786
+#define ID_RENDER_GRID                  32787
+#define ID_RENDER_BRUTEFORCE            32788
+#define ID_RENDER_VALIDATE              32789
+#define ID_RENDER_CAPTURE               32790
+#define ID_RENDER_REPLAY                32791
+#define ID_RENDER_WIDEBVH               32792
+#define ID_RENDER_KDTREE                32793
+#define ID_RENDER_SCENECACHE            32794
 
 // Next default values for new objects
 // 
 #ifdef APSTUDIO_INVOKED
 #ifndef APSTUDIO_READONLY_SYMBOLS
 #define _APS_NEXT_RESOURCE_VALUE        310
-#define _APS_NEXT_COMMAND_VALUE         32772
+#define _APS_NEXT_COMMAND_VALUE         32795
 #define _APS_NEXT_CONTROL_VALUE         1000
 #define _APS_NEXT_SYMED_VALUE           310
 #endif